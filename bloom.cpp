@@ -0,0 +1,263 @@
+/*
+  bloom.cpp
+
+  Per-block Bloom filters.
+  A key is a 64-bit hash of a value (seeded with its column); the filter's bit positions
+  are derived from it by double hashing, so a value is only hashed once however many
+  positions the filter uses.
+
+*/
+
+#include "bloom.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include "hash.h"
+#include "transaction.h"
+
+static const uint MAX_HASHES = 16;
+static const uint MIN_FILTER_BYTES = 8;
+
+BloomFile::BloomFile(Identifier table_name)
+        : dbfilename(table_name + ".bloom.db"), db(nullptr), closed(true),
+          false_positive_rate(default_false_positive_rate()) {}
+
+BloomFile::~BloomFile() {
+    close();
+}
+
+void BloomFile::set_columns(const std::vector<size_t> &columns, double false_positive_rate) {
+    std::lock_guard<std::mutex> guard(mutex);
+    this->columns = columns;
+    this->false_positive_rate = false_positive_rate;
+}
+
+// Write the header: the false positive rate, then the number of columns and their indices
+void BloomFile::create() {
+    std::lock_guard<std::mutex> guard(mutex);
+    closed = false;
+    if (columns.empty())
+        return;
+    u_int32_t flags = DB_CREATE | DB_THREAD;
+    if (Transaction::enabled())
+        flags |= DB_AUTO_COMMIT;
+    db = new Db(_DB_ENV, 0);
+    db->set_message_stream(&std::cout);
+    db->set_error_stream(&std::cerr);
+    try {
+        db->open(nullptr, dbfilename.c_str(), nullptr, DB_RECNO, flags, 0);
+    } catch (...) {
+        delete db;
+        db = nullptr;
+        closed = true;
+        throw;
+    }
+    std::vector<char> header(sizeof(double) + sizeof(u_int16_t) * (1 + columns.size()));
+    memcpy(header.data(), &false_positive_rate, sizeof(double));
+    u_int16_t *fields = (u_int16_t *) (header.data() + sizeof(double));
+    fields[0] = (u_int16_t) columns.size();
+    for (size_t i = 0; i < columns.size(); i++)
+        fields[i + 1] = (u_int16_t) columns[i];
+    db_recno_t recno = 1;
+    Dbt key(&recno, sizeof(recno));
+    Dbt data(header.data(), (u_int32_t) header.size());
+    db->put(nullptr, &key, &data, 0);
+}
+
+// A table without a file has no filtered columns
+void BloomFile::open(BlockID last) {
+    std::lock_guard<std::mutex> guard(mutex);
+    if (!closed)
+        return;
+    closed = false;
+    if (!exists())
+        return;
+    u_int32_t flags = DB_CREATE | DB_THREAD;
+    if (Transaction::enabled())
+        flags |= DB_AUTO_COMMIT;
+    db = new Db(_DB_ENV, 0);
+    db->set_message_stream(&std::cout);
+    db->set_error_stream(&std::cerr);
+    try {
+        db->open(nullptr, dbfilename.c_str(), nullptr, DB_RECNO, flags, 0);
+    } catch (...) {
+        delete db;
+        db = nullptr;
+        closed = true;
+        throw;
+    }
+    columns.clear();
+    for (db_recno_t recno = 1; recno <= last + 1; recno++) {
+        Dbt key(&recno, sizeof(recno));
+        Dbt data;
+        data.set_flags(DB_DBT_MALLOC);
+        if (db->get(nullptr, &key, &data, 0) != 0)
+            continue;  // a block that never got a filter
+        const char *bytes = (const char *) data.get_data();
+        if (recno == 1 && data.get_size() >= sizeof(double) + sizeof(u_int16_t)) {
+            memcpy(&false_positive_rate, bytes, sizeof(double));
+            const u_int16_t *fields = (const u_int16_t *) (bytes + sizeof(double));
+            for (u_int16_t i = 0; i < fields[0] && sizeof(double) + sizeof(u_int16_t) * (i + 2) <= data.get_size(); i++)
+                columns.push_back(fields[i + 1]);
+        } else if (recno > 1) {
+            filters.resize(recno - 1);
+            filters[recno - 2].assign(bytes, data.get_size());
+        }
+        free(data.get_data());
+    }
+}
+
+void BloomFile::close() {
+    std::lock_guard<std::mutex> guard(mutex);
+    if (db != nullptr) {
+        db->close(0);
+        delete db;
+        db = nullptr;
+    }
+    filters.clear();
+    pending.clear();
+    closed = true;
+}
+
+// Delete the file, if there is one (in the current transaction, if there is one)
+void BloomFile::drop() {
+    close();
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        columns.clear();
+    }
+    if (!exists())
+        return;
+    int result;
+    if (Transaction::enabled()) {
+        DbTxn *txn = Transaction::current();
+        result = _DB_ENV->dbremove(txn, dbfilename.c_str(), nullptr, txn == nullptr ? DB_AUTO_COMMIT : 0);
+    } else {
+        Db db(_DB_ENV, 0);
+        result = db.remove(dbfilename.c_str(), nullptr, 0);
+    }
+    if (result != 0)
+        throw DbRelationError("failed to delete bloom filter file " + dbfilename);
+}
+
+// Seeded with the column, so equal values in different columns set different bits
+u_int64_t BloomFile::hash(size_t column, const std::string &value) {
+    return hash_bytes(value.data(), value.size(), (u_int64_t) column);
+}
+
+bool BloomFile::wants(BlockID block_id) {
+    std::lock_guard<std::mutex> guard(mutex);
+    return pending.count(block_id) > 0 || (block_id <= filters.size() && !filters[block_id - 1].empty());
+}
+
+void BloomFile::start(BlockID block_id) {
+    std::lock_guard<std::mutex> guard(mutex);
+    pending[block_id];
+}
+
+// The filter gets m = n ln(1/p) / ln(2)^2 bits and k = (m/n) ln(2) hash functions for n keys
+void BloomFile::finish(BlockID block_id, const std::vector<u_int64_t> &keys) {
+    std::lock_guard<std::mutex> guard(mutex);
+    std::vector<u_int64_t> &all = pending[block_id];
+    all.insert(all.end(), keys.begin(), keys.end());
+    const double ln2 = std::log(2.0);
+    double n = (double) std::max(all.size(), (size_t) 1);
+    double bits = std::ceil(-n * std::log(false_positive_rate) / (ln2 * ln2));
+    size_t bytes = std::max((size_t) MIN_FILTER_BYTES, (size_t) (bits + 7) / 8);
+    uint hashes = (uint) std::lround(bytes * 8 / n * ln2);
+    std::string filter(1 + bytes, '\0');
+    filter[0] = (char) std::max(1u, std::min(MAX_HASHES, hashes));
+    for (auto const &key: all)
+        insert(filter, key);
+    pending.erase(block_id);
+    if (filters.size() < block_id)
+        filters.resize(block_id);
+    filters[block_id - 1].swap(filter);
+    write(block_id);
+}
+
+void BloomFile::add(BlockID block_id, const std::vector<u_int64_t> &keys) {
+    std::lock_guard<std::mutex> guard(mutex);
+    auto building = pending.find(block_id);
+    if (building != pending.end()) {
+        building->second.insert(building->second.end(), keys.begin(), keys.end());
+        return;
+    }
+    if (block_id > filters.size() || filters[block_id - 1].empty())
+        return;
+    bool changed = false;
+    for (auto const &key: keys)
+        changed = insert(filters[block_id - 1], key) || changed;
+    if (changed)
+        write(block_id);
+}
+
+void BloomFile::reset(BlockID block_id) {
+    std::lock_guard<std::mutex> guard(mutex);
+    if (block_id > filters.size() || filters[block_id - 1].empty())
+        return;
+    std::string &filter = filters[block_id - 1];
+    std::fill(filter.begin() + 1, filter.end(), '\0');
+    write(block_id);
+}
+
+size_t BloomFile::prune(BlockIDs &block_ids, const std::vector<u_int64_t> &keys) {
+    if (keys.empty())
+        return 0;
+    std::lock_guard<std::mutex> guard(mutex);
+    size_t before = block_ids.size();
+    block_ids.erase(std::remove_if(block_ids.begin(), block_ids.end(), [this, &keys](BlockID block_id) {
+        if (block_id > filters.size() || filters[block_id - 1].empty())
+            return false;
+        for (auto const &key: keys)
+            if (!contains(filters[block_id - 1], key))
+                return true;
+        return false;
+    }), block_ids.end());
+    return before - block_ids.size();
+}
+
+// Check whether the file is already on disk (in the environment's home directory)
+bool BloomFile::exists() {
+    return env_file_exists(dbfilename);
+}
+
+// Write a block's filter to the file (mutex held)
+void BloomFile::write(BlockID block_id) {
+    if (db == nullptr)
+        return;
+    const std::string &filter = filters[block_id - 1];
+    db_recno_t recno = block_id + 1;
+    Dbt key(&recno, sizeof(recno));
+    Dbt data((void *) filter.data(), (u_int32_t) filter.size());
+    db->put(nullptr, &key, &data, 0);
+}
+
+// Whether every bit of the key is set (a key with no filter bits can't be ruled out)
+bool BloomFile::contains(const std::string &filter, u_int64_t key) {
+    uint hashes = (unsigned char) filter[0];
+    u_int64_t bits = (filter.size() - 1) * 8;
+    u_int64_t step = (key >> 32 | key << 32) | 1;
+    for (uint i = 0; i < hashes; i++) {
+        u_int64_t bit = (key + i * step) % bits;
+        if (!(filter[1 + bit / 8] & (1 << (bit % 8))))
+            return false;
+    }
+    return true;
+}
+
+// Set every bit of the key; returns whether any of them wasn't set yet
+bool BloomFile::insert(std::string &filter, u_int64_t key) {
+    uint hashes = (unsigned char) filter[0];
+    u_int64_t bits = (filter.size() - 1) * 8;
+    u_int64_t step = (key >> 32 | key << 32) | 1;
+    bool changed = false;
+    for (uint i = 0; i < hashes; i++) {
+        u_int64_t bit = (key + i * step) % bits;
+        char mask = (char) (1 << (bit % 8));
+        changed = changed || !(filter[1 + bit / 8] & mask);
+        filter[1 + bit / 8] |= mask;
+    }
+    return changed;
+}
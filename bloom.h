@@ -0,0 +1,125 @@
+/**
+ * @file bloom.h - Per-block Bloom filters over chosen TEXT columns, for skipping blocks in scans.
+ * BloomFile
+ *
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "db_cxx.h"
+#include "storage_engine.h"
+
+/**
+ * @class BloomFile - a Bloom filter for each full block of a table, over the values of its filtered columns
+ *
+ * A block gets its filter once it has filled up (start() and finish()), sized for the
+ * keys it holds at the given false positive rate; rows written into it after that add()
+ * their keys. A filter only ever gains keys until reset(), so a scan for a key the filter
+ * of a block rules out can skip the block without reading it. Blocks without a filter
+ * (the last one, still filling up) are always read.
+ *
+ * Filters are kept in memory and in the table's own Berkeley DB RecNo file
+ * (<table>.bloom.db): record 1 holds the false positive rate and the filtered columns,
+ * record n + 1 the filter of block n (its number of hash functions, then its bits). Like
+ * a dictionary, the file is written outside of any transaction: a key whose row is rolled
+ * back just stays in the filter.
+ */
+class BloomFile {
+public:
+    static double default_false_positive_rate() { return 0.01; }
+
+    BloomFile(Identifier table_name);
+
+    virtual ~BloomFile();
+
+    BloomFile(const BloomFile &other) = delete;
+
+    BloomFile &operator=(const BloomFile &other) = delete;
+
+    /**
+     * Have create() filter the given columns (by index), at false_positive_rate.
+     */
+    virtual void set_columns(const std::vector<size_t> &columns, double false_positive_rate);
+
+    /**
+     * Make the file, if set_columns() chose any columns.
+     */
+    virtual void create();
+
+    /**
+     * Read the filters of blocks 1 through last, if the table has a file.
+     */
+    virtual void open(BlockID last);
+
+    virtual void close();
+
+    virtual void drop();
+
+    /**
+     * Whether the table has any filtered columns.
+     */
+    virtual bool is_enabled() const { return !columns.empty(); }
+
+    virtual const std::vector<size_t> &get_columns() const { return columns; }
+
+    virtual double get_false_positive_rate() const { return false_positive_rate; }
+
+    /**
+     * The key of a value of a filtered column.
+     */
+    static u_int64_t hash(size_t column, const std::string &value);
+
+    /**
+     * Whether rows written into a block now need to add() their keys.
+     */
+    virtual bool wants(BlockID block_id);
+
+    /**
+     * Begin building a block's filter: keys added from now on go into it, along with
+     * those passed to finish(), so the caller should only read the block after this.
+     */
+    virtual void start(BlockID block_id);
+
+    /**
+     * Build a block's filter out of keys (those of every row the block holds) and write it.
+     */
+    virtual void finish(BlockID block_id, const std::vector<u_int64_t> &keys);
+
+    /**
+     * Add keys to a block's filter, if it has one (or is being built).
+     */
+    virtual void add(BlockID block_id, const std::vector<u_int64_t> &keys);
+
+    /**
+     * Empty a block's filter, once the block holds nothing anymore.
+     */
+    virtual void reset(BlockID block_id);
+
+    /**
+     * Remove the blocks whose filters rule out a row holding every key.
+     * @returns  the number of blocks removed
+     */
+    virtual size_t prune(BlockIDs &block_ids, const std::vector<u_int64_t> &keys);
+
+protected:
+    std::string dbfilename;
+    Db *db;  // nullptr unless open (and the table has a file)
+    bool closed;
+    std::vector<size_t> columns;
+    double false_positive_rate;
+    std::vector<std::string> filters;  // by block (from 1): hash count, then bits; empty if none
+    std::map<BlockID, std::vector<u_int64_t>> pending;  // keys added to filters being built
+    std::mutex mutex;  // guards all of the above
+
+    virtual bool exists();
+
+    virtual void write(BlockID block_id);
+
+    static bool contains(const std::string &filter, u_int64_t key);
+
+    static bool insert(std::string &filter, u_int64_t key);
+};
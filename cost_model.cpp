@@ -0,0 +1,78 @@
+/*
+  cost_model.cpp
+
+  Row and cost estimates from table statistics.
+  The unit costs are rough ratios for a warm Berkeley DB cache: a block read is
+  worth about fifty record tests, ten unmarshaled rows, or a twentieth of a thread start.
+
+*/
+
+#include "cost_model.h"
+#include <algorithm>
+#include <cmath>
+
+const double CostModel::BLOCK_COST = 1.0;
+const double CostModel::ROW_COST = 0.02;
+const double CostModel::OUTPUT_COST = 0.1;
+const double CostModel::WORKER_COST = 20.0;
+
+CostModel::CostModel(std::shared_ptr<const TableStatistics> statistics, const ColumnNames &column_names)
+        : statistics(statistics), column_names(column_names) {}
+
+double CostModel::selectivity(const ValueDict *where) const {
+    double selectivity = 1;
+    if (where == nullptr)
+        return selectivity;
+    for (auto const &condition: *where) {
+        const ColumnStatistics *stats = column(condition.first);
+        if (stats != nullptr)
+            selectivity *= stats->equal_selectivity(condition.second);
+    }
+    return selectivity;
+}
+
+double CostModel::rows(const ValueDict *where) const {
+    return statistics->rows * selectivity(where);
+}
+
+// A block of n rows holds none of the matching ones with probability (1 - selectivity)^n
+double CostModel::blocks(const ValueDict *where) const {
+    double blocks = statistics->blocks;
+    if (where == nullptr || blocks == 0)
+        return blocks;
+    double per_block = statistics->rows / blocks;
+    return blocks * (1 - std::pow(1 - selectivity(where), per_block));
+}
+
+double CostModel::groups(const ColumnNames &group_by, const ValueDict *where) const {
+    double matching = rows(where);
+    double groups = 1;
+    for (auto const &column_name: group_by) {
+        const ColumnStatistics *stats = column(column_name);
+        groups *= stats == nullptr ? matching : std::max(stats->distinct, 1.0);
+    }
+    return std::min(groups, std::max(matching, 1.0));
+}
+
+ScanPlan CostModel::scan(const ValueDict *where, unsigned int max_workers, double fraction) const {
+    ScanPlan plan;
+    plan.n_workers = 1;
+    plan.rows = rows(where) * fraction;
+    plan.blocks = blocks(where) * fraction;
+    double examined = statistics->blocks == 0 ? 0 : statistics->rows * plan.blocks / statistics->blocks;
+    plan.cost = 2 * plan.blocks * BLOCK_COST + examined * ROW_COST + plan.rows * OUTPUT_COST;
+    double shared = plan.blocks * BLOCK_COST + examined * ROW_COST + plan.rows * OUTPUT_COST;
+    for (unsigned int n = 2; n <= max_workers; n++) {
+        double cost = shared / n + n * WORKER_COST;
+        if (cost < plan.cost) {
+            plan.n_workers = n;
+            plan.cost = cost;
+        }
+    }
+    return plan;
+}
+
+const ColumnStatistics *CostModel::column(const Identifier &column_name) const {
+    size_t i = std::find(column_names.begin(), column_names.end(), column_name) - column_names.begin();
+    return i < statistics->columns.size() ? &statistics->columns[i] : nullptr;
+}
@@ -0,0 +1,80 @@
+/**
+ * @file cost_model.h - Estimated rows and costs of reading a table, from its statistics.
+ * ScanPlan
+ * CostModel
+ *
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#pragma once
+
+#include <memory>
+#include "statistics.h"
+
+/**
+ * @class ScanPlan - how to read the rows of one table that match a where clause
+ */
+struct ScanPlan {
+    unsigned int n_workers;  // 1: DbRelation::select() and then project() of the handles, on the calling thread
+    double rows;             // rows expected to match
+    double blocks;           // blocks expected to be read
+    double cost;             // in block reads
+};
+
+/**
+ * @class CostModel - what reading a table will take, going by its statistics
+ *
+ * Costs are counted in block reads. A serial select reads the blocks a scan can't skip,
+ * tests every row in them, then reads the blocks holding matching rows again to project
+ * them; a parallel scan unmarshals matching rows as it goes, but every worker costs a
+ * thread start. Blocks that can be skipped are estimated as if the matching rows were scattered
+ * over the table at random, which is the worst case for zone maps.
+ *
+ * Where equality conditions on several columns meet, they are taken to be independent.
+ */
+class CostModel {
+public:
+    static const double BLOCK_COST;   // reading a block
+    static const double ROW_COST;     // testing a record against the where clause
+    static const double OUTPUT_COST;  // unmarshaling a matching row
+    static const double WORKER_COST;  // starting a scan thread
+
+    /**
+     * @param statistics    the table's statistics (from DbRelation::get_statistics)
+     * @param column_names  the table's columns, in order
+     */
+    CostModel(std::shared_ptr<const TableStatistics> statistics, const ColumnNames &column_names);
+
+    virtual ~CostModel() {}
+
+    /**
+     * The estimated fraction of rows matching where (nullptr for all of them).
+     */
+    virtual double selectivity(const ValueDict *where) const;
+
+    /**
+     * The estimated number of rows matching where.
+     */
+    virtual double rows(const ValueDict *where) const;
+
+    /**
+     * The estimated number of blocks holding a row that matches where.
+     */
+    virtual double blocks(const ValueDict *where) const;
+
+    /**
+     * The estimated number of groups a GROUP BY on group_by makes of the rows matching where.
+     */
+    virtual double groups(const ColumnNames &group_by, const ValueDict *where) const;
+
+    /**
+     * The cheapest way to read the rows matching where with at most max_workers threads.
+     * @param fraction  of the table's blocks the scan reads (see BlockSample)
+     */
+    virtual ScanPlan scan(const ValueDict *where, unsigned int max_workers, double fraction = 1) const;
+
+protected:
+    std::shared_ptr<const TableStatistics> statistics;
+    ColumnNames column_names;
+
+    virtual const ColumnStatistics *column(const Identifier &column_name) const;
+};
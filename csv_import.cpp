@@ -0,0 +1,269 @@
+/*
+  csv_import.cpp
+
+  Parallel CSV bulk load.
+  Rows are packed directly into new SlottedPages instead of going through
+  HeapTable::insert(), which would fetch, modify and write back the last block
+  for every single row.
+
+*/
+
+#include "csv_import.h"
+#include "record_format.h"
+#include "transaction.h"
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+size_t CSVImport::load(const std::string &file_path, HeapFile &file, unsigned int n_workers) {
+    if (n_workers == 0)
+        n_workers = std::max(1U, std::thread::hardware_concurrency());
+    creator = Transaction::id();
+    block_size = file.get_block_size();
+
+    // map the whole file
+    int fd = ::open(file_path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw DbRelationError("cannot open " + file_path + ": " + strerror(errno));
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        ::close(fd);
+        throw DbRelationError("cannot stat " + file_path + ": " + strerror(errno));
+    }
+    size_t size = (size_t) info.st_size;
+    if (size == 0) {
+        ::close(fd);
+        return 0;
+    }
+    void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED)
+        throw DbRelationError("cannot map " + file_path + ": " + strerror(errno));
+    madvise(mapped, size, MADV_SEQUENTIAL);
+    const char *data = (const char *) mapped;
+
+    // cut it into chunks that start right after a newline
+    std::vector<Chunk> chunks;
+    const char *begin = data;
+    const char *end_of_file = data + size;
+    for (unsigned int i = 0; i < n_workers && begin < end_of_file; i++) {
+        const char *end = i == n_workers - 1 ? end_of_file : data + size / n_workers * (i + 1);
+        if (end < begin)
+            end = begin;
+        end = (const char *) memchr(end, '\n', end_of_file - end);
+        end = end == nullptr ? end_of_file : end + 1;
+        Chunk chunk;
+        chunk.begin = begin;
+        chunk.end = end;
+        chunk.offset = begin - data;
+        chunk.parsed = false;
+        chunk.rows = 0;
+        chunks.push_back(chunk);
+        begin = end;
+    }
+
+    // parse and pack the chunks concurrently, writing their pages out in file order as they come
+    abandoned = false;
+    std::exception_ptr failure;
+    std::vector<std::thread> threads;
+    for (auto &chunk: chunks) {
+        threads.push_back(std::thread([&]() {
+            try {
+                parse_chunk(chunk);
+            } catch (...) {
+                record_failure(failure);
+            }
+        }));
+    }
+    size_t rows = 0;
+    try {
+        for (auto &chunk: chunks) {
+            while (char *page = next_page(chunk)) {
+                try {
+                    file.put_new(page);
+                } catch (...) {
+                    delete[] page;
+                    throw;
+                }
+                delete[] page;
+            }
+        }
+    } catch (...) {
+        record_failure(failure);
+    }
+    for (auto &thread: threads)
+        thread.join();
+    munmap(mapped, size);
+    for (auto &chunk: chunks) {
+        for (auto page: chunk.pages)
+            delete[] page;
+        rows += chunk.rows;
+    }
+    if (failure)
+        std::rethrow_exception(failure);
+    return rows;
+}
+
+// Parse every line of a chunk into pages of marshaled rows, queueing each one once it is full
+void CSVImport::parse_chunk(Chunk &chunk) {
+    std::vector<char> row(block_size);
+    char *page_bytes = nullptr;
+    SlottedPage *page = nullptr;
+    const char *p = chunk.begin;
+    try {
+        while (p < chunk.end) {
+            size_t offset = chunk.offset + (p - chunk.begin);
+            uint size = marshal_line(p, chunk.end, row.data(), offset);
+            if (size == 0)
+                continue;  // blank line
+            Dbt data(row.data(), size);
+            bool added = false;
+            if (page != nullptr) {
+                try {
+                    page->add(&data);
+                    added = true;
+                } catch (DbBlockNoRoomError &e) {
+                    delete page;
+                    page = nullptr;
+                    char *full = page_bytes;
+                    page_bytes = nullptr;
+                    if (!queue_page(chunk, full))
+                        return;
+                }
+            }
+            if (!added) {
+                page_bytes = new char[block_size]();
+                Dbt block(page_bytes, block_size);
+                page = new SlottedPage(block, 0, true);
+                try {
+                    page->add(&data);
+                } catch (DbBlockNoRoomError &e) {
+                    throw DbRelationError("row near byte " + std::to_string(offset) + " does not fit in a block");
+                }
+            }
+            chunk.rows++;
+        }
+    } catch (...) {
+        delete page;
+        delete[] page_bytes;
+        throw;
+    }
+    delete page;
+    if (page_bytes != nullptr && !queue_page(chunk, page_bytes))
+        return;
+    std::lock_guard<std::mutex> guard(mutex);
+    chunk.parsed = true;
+    produced.notify_all();
+}
+
+// Hand a full page to the writer, waiting while the chunk already has MAX_QUEUED_PAGES queued
+// Returns false (having freed the page) if the load was abandoned.
+bool CSVImport::queue_page(Chunk &chunk, char *page) {
+    std::unique_lock<std::mutex> lock(mutex);
+    consumed.wait(lock, [this, &chunk]() { return abandoned || chunk.pages.size() < MAX_QUEUED_PAGES; });
+    if (abandoned) {
+        delete[] page;
+        return false;
+    }
+    chunk.pages.push_back(page);
+    produced.notify_all();
+    return true;
+}
+
+// The chunk's next page to write (freed by caller), waiting for it to be parsed
+// Returns nullptr once the chunk is done, or if the load was abandoned.
+char *CSVImport::next_page(Chunk &chunk) {
+    std::unique_lock<std::mutex> lock(mutex);
+    produced.wait(lock, [this, &chunk]() { return abandoned || chunk.parsed || !chunk.pages.empty(); });
+    if (abandoned || chunk.pages.empty())
+        return nullptr;
+    char *page = chunk.pages.front();
+    chunk.pages.pop_front();
+    consumed.notify_all();
+    return page;
+}
+
+// Keep the exception being handled (unless an earlier one was kept) and abandon the load:
+// the workers stop at their next full page, and the writer takes no more pages
+void CSVImport::record_failure(std::exception_ptr &failure) {
+    std::lock_guard<std::mutex> guard(mutex);
+    if (!failure)
+        failure = std::current_exception();
+    abandoned = true;
+    produced.notify_all();
+    consumed.notify_all();
+}
+
+// Marshal the line at p into row (advancing p past it); returns the row's size, or 0 for a blank line
+uint CSVImport::marshal_line(const char *&p, const char *end, char *row, size_t offset) {
+    const char *line = p;
+    const char *eol = (const char *) memchr(p, '\n', end - p);
+    eol = eol == nullptr ? end : eol;
+    p = eol < end ? eol + 1 : end;
+    const char *line_end = eol > line && eol[-1] == '\r' ? eol - 1 : eol;
+    if (line_end == line)
+        return 0;
+
+    std::string field;
+    RecordVersion(creator).write(row);
+    uint size = RecordVersion::SIZE;
+    const char *q = line;
+    for (size_t i = 0; i < column_names.size(); i++) {
+        // pull out the next field
+        field.clear();
+        if (q < line_end && *q == '"') {
+            for (q++; q < line_end; q++) {
+                if (*q == '"') {
+                    if (q + 1 < line_end && q[1] == '"')
+                        q++;
+                    else
+                        break;
+                }
+                field += *q;
+            }
+            if (q >= line_end)
+                throw DbRelationError("unterminated quote in line at byte " + std::to_string(offset));
+            q++;
+        } else {
+            const char *comma = (const char *) memchr(q, ',', line_end - q);
+            comma = comma == nullptr ? line_end : comma;
+            field.assign(q, comma - q);
+            q = comma;
+        }
+        if (i + 1 < column_names.size()) {
+            if (q >= line_end || *q != ',')
+                throw DbRelationError("too few fields in line at byte " + std::to_string(offset));
+            q++;
+        } else if (q != line_end) {
+            throw DbRelationError("too many fields in line at byte " + std::to_string(offset));
+        }
+
+        // and marshal it (see record_format.h)
+        Value value;
+        if (column_attributes[i].get_data_type() == ColumnAttribute::INT) {
+            char *rest;
+            errno = 0;
+            long n = strtol(field.c_str(), &rest, 10);
+            if (field.empty() || *rest != '\0' || errno != 0 || n < INT32_MIN || n > INT32_MAX)
+                throw DbRelationError("bad INT '" + field + "' for " + column_names[i] + " in line at byte "
+                                      + std::to_string(offset));
+            value = Value((int32_t) n);
+        } else {
+            value = Value(field);
+        }
+        if (!RecordFormat::put(row, size, block_size, column_attributes[i].get_data_type(), value, dictionaries[i],
+                               *overflow))
+            throw DbRelationError("row at byte " + std::to_string(offset) + " does not fit in a block");
+    }
+    return size;
+}
@@ -0,0 +1,89 @@
+/**
+ * @file csv_import.h - Parallel bulk load of CSV files into a HeapFile.
+ * CSVImport
+ *
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "heap_storage.h"
+
+/**
+ * @class CSVImport - load a CSV file straight into full SlottedPages
+ *
+ * The file is memory-mapped and cut into one chunk per worker at line boundaries.
+ * Each worker parses its chunk, marshals the rows the same way HeapTable does and
+ * packs them into SlottedPages of its own, queueing each page as it fills up. The
+ * calling thread appends the queued pages to the HeapFile while the workers go on
+ * parsing: all of chunk 0's, then chunk 1's, and so on, so the rows land in file order.
+ * A worker whose queue holds MAX_QUEUED_PAGES waits for the writer to catch up, so the
+ * load never holds more than about MAX_QUEUED_PAGES pages per worker, however big the file.
+ *
+ * One row per line, fields separated by commas, no header line. A field may be
+ * double-quoted (with "" for a quote inside it) but may not span lines.
+ *
+ * Large TEXT values go to overflow pages as the workers come across them, each page
+ * committed on its own: if the load fails, the pages it wrote are simply never used.
+ * Heap pages are written in the caller's transaction, whose abort takes them back.
+ */
+class CSVImport {
+public:
+    static const size_t MAX_QUEUED_PAGES = 16;  // per worker
+
+    /**
+     * @param dictionaries  by column, the dictionary of each dictionary encoded column (else nullptr)
+     * @param overflow      where TEXT values too large for a row go
+     */
+    CSVImport(const ColumnNames &column_names, const ColumnAttributes &column_attributes,
+              const std::vector<ColumnDictionary *> &dictionaries, OverflowFile *overflow)
+            : column_names(column_names), column_attributes(column_attributes), dictionaries(dictionaries),
+              overflow(overflow), creator(0), block_size(DbBlock::BLOCK_SZ), abandoned(false) {}
+
+    virtual ~CSVImport() {}
+
+    /**
+     * Load a CSV file into the end of a heap file.
+     * @param file_path  the CSV file
+     * @param file       the (open) heap file to append to
+     * @param n_workers  parsing threads (0 for one per hardware thread)
+     * @returns          the number of rows loaded
+     */
+    virtual size_t load(const std::string &file_path, HeapFile &file, unsigned int n_workers = 0);
+
+protected:
+    struct Chunk {
+        const char *begin;
+        const char *end;
+        size_t offset;  // of begin within the file, for error messages
+        std::deque<char *> pages;  // block_size each, filled SlottedPages waiting to be written
+        bool parsed;  // the worker is done with it (no more pages are coming)
+        size_t rows;
+    };
+
+    ColumnNames column_names;
+    ColumnAttributes column_attributes;
+    std::vector<ColumnDictionary *> dictionaries;
+    OverflowFile *overflow;
+    TxnID creator;  // stamped on every row (see mvcc.h)
+    uint block_size;  // of the file being loaded
+    bool abandoned;  // the load failed: workers stop, and the writer takes no more pages
+    std::mutex mutex;  // guards abandoned and every chunk's pages and parsed
+    std::condition_variable produced;  // a page was queued, or a chunk finished
+    std::condition_variable consumed;  // a page was taken off a queue
+
+    virtual void parse_chunk(Chunk &chunk);
+
+    virtual bool queue_page(Chunk &chunk, char *page);
+
+    virtual char *next_page(Chunk &chunk);
+
+    virtual void record_failure(std::exception_ptr &failure);
+
+    virtual uint marshal_line(const char *&p, const char *end, char *row, size_t offset);
+};
@@ -0,0 +1,115 @@
+/*
+  dictionary.cpp
+
+  Dictionary encoding for TEXT columns.
+  Codes are looked up under a mutex when rows are written, but decoded without one:
+  values live in fixed chunks that never move once allocated, and a code only becomes
+  readable after its value is in place.
+
+*/
+
+#include "dictionary.h"
+#include <cstdlib>
+#include <iostream>
+#include "transaction.h"
+
+ColumnDictionary::ColumnDictionary(Identifier table_name, Identifier column_name)
+        : dbfilename(table_name + "." + column_name + ".dict.db"), db(_DB_ENV, 0), closed(true), count(0) {
+    for (auto &chunk: chunks)
+        chunk = nullptr;
+}
+
+ColumnDictionary::~ColumnDictionary() {
+    for (auto &chunk: chunks)
+        delete[] chunk.load();
+}
+
+// Open (or create) the file and read every value in it, in code order
+void ColumnDictionary::open() {
+    std::lock_guard<std::mutex> guard(mutex);
+    if (!closed)
+        return;
+    u_int32_t flags = DB_CREATE | DB_THREAD;
+    if (Transaction::enabled())
+        flags |= DB_AUTO_COMMIT;
+    db.set_message_stream(&std::cout);
+    db.set_error_stream(&std::cerr);
+    db.open(nullptr, dbfilename.c_str(), nullptr, DB_RECNO, flags, 0);
+    closed = false;
+    for (db_recno_t recno = count + 1; count < MAX_CODES; recno++) {
+        Dbt key(&recno, sizeof(recno));
+        Dbt data;
+        data.set_flags(DB_DBT_MALLOC);
+        if (db.get(nullptr, &key, &data, 0) != 0)
+            break;
+        std::string value((const char *) data.get_data(), data.get_size());
+        free(data.get_data());
+        add(value);
+    }
+}
+
+void ColumnDictionary::close() {
+    std::lock_guard<std::mutex> guard(mutex);
+    if (closed)
+        return;
+    db.close(0);
+    closed = true;
+}
+
+// Delete the file, along with the table (in the same transaction, if there is one)
+void ColumnDictionary::drop() {
+    close();
+    int result;
+    if (Transaction::enabled()) {
+        DbTxn *txn = Transaction::current();
+        result = _DB_ENV->dbremove(txn, dbfilename.c_str(), nullptr, txn == nullptr ? DB_AUTO_COMMIT : 0);
+    } else {
+        Db db(_DB_ENV, 0);
+        result = db.remove(dbfilename.c_str(), nullptr, 0);
+    }
+    if (result != 0)
+        throw DbRelationError("failed to delete dictionary " + dbfilename);
+}
+
+// A new value is on disk (committed on its own) before any row can use its code
+u_int16_t ColumnDictionary::encode(const std::string &value) {
+    std::lock_guard<std::mutex> guard(mutex);
+    auto found = codes.find(value);
+    if (found != codes.end())
+        return found->second;
+    if (count >= MAX_CODES)
+        return ESCAPE;
+    if (closed)
+        throw DbRelationError("dictionary " + dbfilename + " is not open");
+    db_recno_t recno = count + 1;
+    Dbt key(&recno, sizeof(recno));
+    Dbt data((void *) value.data(), (u_int32_t) value.size());
+    db.put(nullptr, &key, &data, 0);
+    add(value);
+    return (u_int16_t) (recno - 1);
+}
+
+u_int16_t ColumnDictionary::find(const std::string &value) {
+    std::lock_guard<std::mutex> guard(mutex);
+    auto found = codes.find(value);
+    return found == codes.end() ? ESCAPE : found->second;
+}
+
+const std::string &ColumnDictionary::decode(u_int16_t code) const {
+    if (code >= count)
+        throw DbRelationError("dictionary code " + std::to_string(code) + " out of range in " + dbfilename);
+    return chunks[code / CHUNK_SIZE].load()[code % CHUNK_SIZE];
+}
+
+// Give value the next code (mutex held)
+void ColumnDictionary::add(const std::string &value) {
+    u_int32_t code = count;
+    std::string *chunk = chunks[code / CHUNK_SIZE];
+    if (chunk == nullptr) {
+        chunk = new std::string[CHUNK_SIZE];
+        chunks[code / CHUNK_SIZE] = chunk;
+    }
+    chunk[code % CHUNK_SIZE] = value;
+    codes[value] = (u_int16_t) code;
+    count = code + 1;
+}
@@ -0,0 +1,80 @@
+/**
+ * @file dictionary.h - Dictionary encoding for TEXT columns.
+ * ColumnDictionary
+ *
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "db_cxx.h"
+#include "storage_engine.h"
+
+/**
+ * @class ColumnDictionary - the codes standing for the distinct values of one TEXT column
+ *
+ * Values get codes 0, 1, 2, ... in order of first appearance. A code is never reused or
+ * reassigned, so a code written into a row means the same value for good. The dictionary
+ * is kept in its own Berkeley DB RecNo file (record n holds the value of code n - 1),
+ * which grows outside of any transaction: a code whose row is rolled back just goes unused.
+ *
+ * Once all codes are taken, further new values are stored in the rows themselves behind
+ * the ESCAPE code.
+ */
+class ColumnDictionary {
+public:
+    static const u_int16_t ESCAPE = 0xFFFF;  // the value follows inline, as for a plain TEXT column
+    static const u_int32_t MAX_CODES = ESCAPE;
+
+    ColumnDictionary(Identifier table_name, Identifier column_name);
+
+    virtual ~ColumnDictionary();
+
+    ColumnDictionary(const ColumnDictionary &other) = delete;
+
+    ColumnDictionary &operator=(const ColumnDictionary &other) = delete;
+
+    /**
+     * Open the dictionary's file (creating it if need be) and load its codes.
+     */
+    virtual void open();
+
+    virtual void close();
+
+    virtual void drop();
+
+    /**
+     * The code for value, adding it to the dictionary if it is new.
+     * @returns  ESCAPE if value is new and the dictionary is full
+     */
+    virtual u_int16_t encode(const std::string &value);
+
+    /**
+     * The code for value, without adding it.
+     * @returns  ESCAPE if value has no code
+     */
+    virtual u_int16_t find(const std::string &value);
+
+    /**
+     * The value of a code handed out by encode(). Never blocks, even while values are added.
+     */
+    virtual const std::string &decode(u_int16_t code) const;
+
+    virtual u_int32_t size() const { return count; }
+
+protected:
+    static const u_int32_t CHUNK_SIZE = 256;
+
+    std::string dbfilename;
+    Db db;
+    bool closed;
+    std::mutex mutex;  // guards codes, the file and adding values
+    std::unordered_map<std::string, u_int16_t> codes;
+    std::atomic<std::string *> chunks[MAX_CODES / CHUNK_SIZE + 1];  // values by code, allocated as needed
+    std::atomic<u_int32_t> count;
+
+    virtual void add(const std::string &value);
+};
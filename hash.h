@@ -0,0 +1,27 @@
+/**
+ * @file hash.h - The hash function shared by partitioning, aggregation, Bloom filters and statistics.
+ *
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#pragma once
+
+#include <cstddef>
+#include <sys/types.h>
+
+/**
+ * FNV-1a over size bytes, mixed with the first rounds of MurmurHash3's finalizer so that every
+ * bit depends on every byte. Written out rather than std::hash so that values hash the same
+ * with any compiler: partitions and Bloom filters on disk depend on it.
+ * @param seed  folded into FNV's offset basis, for independent hashes of the same bytes
+ */
+inline u_int64_t hash_bytes(const char *bytes, size_t size, u_int64_t seed = 0) {
+    u_int64_t hash = 14695981039346656037ULL ^ seed;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= (unsigned char) bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return hash;
+}
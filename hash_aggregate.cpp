@@ -0,0 +1,441 @@
+/*
+  hash_aggregate.cpp
+
+  Hash aggregation for GROUP BY queries.
+  Groups are keyed on their group-by values marshaled the same way HeapTable marshals
+  a row (INT as 4 bytes, TEXT as a 2-byte length plus the characters), so equal groups
+  have equal keys and a group key never has to be decoded until the result rows are built.
+
+*/
+
+#include "hash_aggregate.h"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <thread>
+#include "hash.h"
+#include "profile.h"
+
+typedef u_int16_t u16;
+
+
+// AggregateState
+
+AggregateState::AggregateState() : count(0), sum(0), min(INT32_MAX), max(INT32_MIN) {}
+
+// Fold one more value into the state
+void AggregateState::add(int32_t n) {
+    count++;
+    sum += n;
+    if (n < min)
+        min = n;
+    if (n > max)
+        max = n;
+}
+
+// Fold another partial state for the same group into this one
+void AggregateState::merge(const AggregateState &other) {
+    count += other.count;
+    sum += other.sum;
+    if (other.min < min)
+        min = other.min;
+    if (other.max > max)
+        max = other.max;
+}
+
+
+// GroupTable
+
+GroupTable::GroupTable(size_t n_aggregates) : n_aggregates(n_aggregates), slots(INITIAL_SLOTS, 0) {}
+
+// Mixed all the way through (see hash_bytes), so the high bits are usable for partitioning
+u_int64_t GroupTable::hash_key(const std::string &key) {
+    return hash_bytes(key.data(), key.size());
+}
+
+AggregateState *GroupTable::find_or_insert(const std::string &key, u_int64_t hash) {
+    if ((keys.size() + 1) * 10 > slots.size() * 7)  // keep the load factor under 0.7
+        grow();
+    size_t mask = slots.size() - 1;
+    size_t i = hash & mask;
+    while (slots[i] != 0) {
+        u_int32_t group = slots[i] - 1;
+        if (hashes[group] == hash && keys[group] == key)
+            return states.data() + group * n_aggregates;
+        i = (i + 1) & mask;
+    }
+    slots[i] = (u_int32_t) keys.size() + 1;
+    keys.push_back(key);
+    hashes.push_back(hash);
+    states.resize(states.size() + n_aggregates);
+    return states.data() + (keys.size() - 1) * n_aggregates;
+}
+
+// Forget every group (keeps the slot array at its current size)
+void GroupTable::clear() {
+    std::fill(slots.begin(), slots.end(), 0);
+    keys.clear();
+    hashes.clear();
+    states.clear();
+}
+
+// Double the slot array and re-place every group
+void GroupTable::grow() {
+    std::vector<u_int32_t> bigger(slots.size() * 2, 0);
+    size_t mask = bigger.size() - 1;
+    for (size_t group = 0; group < keys.size(); group++) {
+        size_t i = hashes[group] & mask;
+        while (bigger[i] != 0)
+            i = (i + 1) & mask;
+        bigger[i] = (u_int32_t) group + 1;
+    }
+    slots.swap(bigger);
+}
+
+
+// HashAggregate
+
+HashAggregate::HashAggregate(ColumnNames group_by, ColumnAttributes group_by_attributes, Aggregates aggregates,
+                             size_t spill_threshold)
+        : group_by(group_by), group_by_attributes(group_by_attributes), aggregates(aggregates),
+          spill_threshold(spill_threshold), spilled_groups(0) {}
+
+ValueDicts *HashAggregate::execute(DbRelation &relation, const ValueDict *where, unsigned int n_workers,
+                                   const BlockSample *sample) {
+    if (n_workers == 0)
+        n_workers = std::max(1U, std::thread::hardware_concurrency());
+    spilled_groups = 0;
+
+    // pre-aggregate per scan worker
+    std::vector<Worker *> workers;
+    for (unsigned int w = 0; w < n_workers; w++)
+        workers.push_back(new Worker(aggregates.size()));
+    // the scan only decodes the columns grouped by or aggregated over
+    ColumnNames needed(group_by);
+    for (auto const &aggregate: aggregates)
+        if (!aggregate.column_name.empty() && std::find(needed.begin(), needed.end(), aggregate.column_name) == needed.end())
+            needed.push_back(aggregate.column_name);
+    relation.parallel_scan(where, n_workers, [&](unsigned int w, Handle handle, const ValueDict *row) {
+        accumulate(*workers[w], row);
+    }, &needed, sample);
+
+    // merge the partial tables
+    ValueDicts *rows = new ValueDicts;
+    GroupTable groups(aggregates.size());
+    auto release_workers = [&workers]() {
+        for (auto const &worker: workers) {
+            for (auto const &file: worker->spill_files)
+                fclose(file);
+            delete worker;
+        }
+        workers.clear();
+    };
+    try {
+        bool spilled = false;
+        for (auto const &worker: workers)
+            spilled = spilled || !worker->spill_files.empty();
+        if (!spilled) {
+            for (auto const &worker: workers)
+                merge_into(groups, worker->groups, -1);
+            emit(groups, rows);
+        } else {
+            for (unsigned int partition = 0; partition < SPILL_PARTITIONS; partition++) {
+                groups.clear();
+                for (auto const &worker: workers) {
+                    merge_into(groups, worker->groups, partition);
+                    if (!worker->spill_files.empty())
+                        merge_spill_file(groups, worker->spill_files[partition]);
+                }
+                emit(groups, rows);
+            }
+        }
+
+        // with no GROUP BY there is always exactly one result row, even over no rows
+        if (group_by.empty() && rows->empty()) {
+            groups.clear();
+            groups.find_or_insert("", GroupTable::hash_key(""));
+            emit(groups, rows);
+        }
+    } catch (...) {
+        release_workers();
+        for (auto const &row: *rows)
+            delete row;
+        delete rows;
+        throw;
+    }
+    release_workers();
+    return rows;
+}
+
+// Add one row to the worker's group table
+void HashAggregate::accumulate(Worker &worker, const ValueDict *row) {
+    std::string &key = worker.key;
+    key.clear();
+    for (size_t i = 0; i < group_by.size(); i++) {
+        const Value &value = row->at(group_by[i]);
+        if (group_by_attributes[i].get_data_type() == ColumnAttribute::INT) {
+            key.append((const char *) &value.n, sizeof(int32_t));
+        } else {
+            u16 size = (u16) value.s.length();
+            key.append((const char *) &size, sizeof(u16));
+            key.append(value.s);
+        }
+    }
+    AggregateState *states = worker.groups.find_or_insert(key, GroupTable::hash_key(key));
+    for (size_t i = 0; i < aggregates.size(); i++) {
+        const Aggregate &aggregate = aggregates[i];
+        if (aggregate.column_name.empty()) {  // COUNT(*)
+            states[i].count++;
+            continue;
+        }
+        const Value &value = row->at(aggregate.column_name);
+        if (value.data_type == ColumnAttribute::INT)
+            states[i].add(value.n);
+        else if (aggregate.function == Aggregate::COUNT)
+            states[i].count++;
+        else
+            throw DbRelationError("can only aggregate INT column " + aggregate.column_name);
+    }
+    if (worker.groups.size() >= spill_threshold)
+        spill(worker);
+}
+
+// Write the worker's groups out to its per-partition spill files and empty its table
+void HashAggregate::spill(Worker &worker) {
+    if (worker.spill_files.empty()) {
+        for (unsigned int partition = 0; partition < SPILL_PARTITIONS; partition++) {
+            FILE *file = tmpfile();
+            if (file == nullptr)
+                throw DbRelationError("could not create a spill file for GROUP BY");
+            worker.spill_files.push_back(file);
+        }
+    }
+    GroupTable &groups = worker.groups;
+    for (size_t group = 0; group < groups.size(); group++) {
+        const std::string &key = groups.get_key(group);
+        u_int64_t hash = groups.get_hash(group);
+        u_int32_t size = (u_int32_t) key.size();
+        FILE *file = worker.spill_files[partition_of(hash)];
+        if (fwrite(&hash, sizeof(hash), 1, file) != 1
+            || fwrite(&size, sizeof(size), 1, file) != 1
+            || fwrite(key.data(), 1, size, file) != size
+            || fwrite(groups.get_states(group), sizeof(AggregateState), aggregates.size(), file) != aggregates.size())
+            throw DbRelationError("could not write GROUP BY spill file");
+    }
+    spilled_groups += groups.size();
+    groups.clear();
+}
+
+// Merge the groups of from that fall in the given hash partition (or all of them for partition -1)
+void HashAggregate::merge_into(GroupTable &into, GroupTable &from, int partition) {
+    for (size_t group = 0; group < from.size(); group++) {
+        u_int64_t hash = from.get_hash(group);
+        if (partition >= 0 && partition_of(hash) != (unsigned int) partition)
+            continue;
+        AggregateState *to_states = into.find_or_insert(from.get_key(group), hash);
+        AggregateState *from_states = from.get_states(group);
+        for (size_t i = 0; i < aggregates.size(); i++)
+            to_states[i].merge(from_states[i]);
+    }
+}
+
+// Read back a spill file written by spill() and merge its groups
+void HashAggregate::merge_spill_file(GroupTable &into, FILE *file) {
+    rewind(file);
+    std::vector<AggregateState> states(aggregates.size());
+    std::string key;
+    u_int64_t hash;
+    u_int32_t size;
+    while (fread(&hash, sizeof(hash), 1, file) == 1) {
+        if (fread(&size, sizeof(size), 1, file) != 1)
+            throw DbRelationError("truncated GROUP BY spill file");
+        key.resize(size);
+        if ((size > 0 && fread(&key[0], 1, size, file) != size)
+            || fread(states.data(), sizeof(AggregateState), states.size(), file) != states.size())
+            throw DbRelationError("truncated GROUP BY spill file");
+        AggregateState *to_states = into.find_or_insert(key, hash);
+        for (size_t i = 0; i < states.size(); i++)
+            to_states[i].merge(states[i]);
+    }
+}
+
+// Turn every group into a result row
+// A SUM is added up in 64 bits but has to come out as an INT, so one that doesn't fit fails
+// the query rather than wrapping around. An AVG of INTs always fits.
+void HashAggregate::emit(GroupTable &groups, ValueDicts *rows) {
+    for (size_t group = 0; group < groups.size(); group++) {
+        ValueDict *row = new ValueDict;
+        const char *bytes = groups.get_key(group).data();
+        uint offset = 0;
+        for (size_t i = 0; i < group_by.size(); i++) {
+            if (group_by_attributes[i].get_data_type() == ColumnAttribute::INT) {
+                int32_t n;
+                memcpy(&n, bytes + offset, sizeof(int32_t));
+                offset += sizeof(int32_t);
+                (*row)[group_by[i]] = Value(n);
+            } else {
+                u16 size;
+                memcpy(&size, bytes + offset, sizeof(u16));
+                offset += sizeof(u16);
+                (*row)[group_by[i]] = Value(std::string(bytes + offset, size));
+                offset += size;
+            }
+        }
+        AggregateState *states = groups.get_states(group);
+        for (size_t i = 0; i < aggregates.size(); i++) {
+            const AggregateState &state = states[i];
+            int32_t result = 0;
+            switch (aggregates[i].function) {
+                case Aggregate::COUNT:
+                    result = (int32_t) state.count;
+                    break;
+                case Aggregate::SUM:
+                    if (state.sum < INT32_MIN || state.sum > INT32_MAX) {
+                        delete row;
+                        throw DbRelationError("integer overflow in SUM(" + aggregates[i].column_name + ")");
+                    }
+                    result = (int32_t) state.sum;
+                    break;
+                case Aggregate::MIN:
+                    result = state.count ? state.min : 0;
+                    break;
+                case Aggregate::MAX:
+                    result = state.count ? state.max : 0;
+                    break;
+                case Aggregate::AVG:
+                    result = state.count ? (int32_t) (state.sum / state.count) : 0;  // INT is our only numeric type
+                    break;
+            }
+            (*row)[aggregates[i].output_name] = Value(result);
+        }
+        rows->push_back(row);
+    }
+}
+
+
+// Test function -- returns true if all tests pass
+bool test_hash_aggregate() {
+    ColumnNames column_names;
+    column_names.push_back("g");
+    column_names.push_back("t");
+    column_names.push_back("v");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    HeapTable table("_test_aggregate_cpp", column_names, column_attributes);
+    table.create_if_not_exists();
+
+    const int N_ROWS = 2000, N_GROUPS = 50;
+    for (int i = 0; i < N_ROWS; i++) {
+        ValueDict row;
+        row["g"] = Value(i % N_GROUPS);
+        row["t"] = Value("k" + std::to_string(i % 7));
+        row["v"] = Value(i);
+        table.insert(&row);
+    }
+
+    Aggregates aggregates;
+    aggregates.push_back(Aggregate(Aggregate::COUNT, "", "n"));
+    aggregates.push_back(Aggregate(Aggregate::SUM, "v", "sum"));
+    aggregates.push_back(Aggregate(Aggregate::MIN, "v", "min"));
+    aggregates.push_back(Aggregate(Aggregate::MAX, "v", "max"));
+    aggregates.push_back(Aggregate(Aggregate::AVG, "v", "avg"));
+    ColumnNames group_by(1, "g");
+    ColumnAttributes group_by_attributes(1, ColumnAttribute(ColumnAttribute::INT));
+
+    // once entirely in memory, once forced to spill almost every group
+    bool ok = true;
+    size_t thresholds[] = {HashAggregate::DEFAULT_SPILL_THRESHOLD, 8};
+    for (size_t threshold: thresholds) {
+        HashAggregate hash_aggregate(group_by, group_by_attributes, aggregates, threshold);
+        ValueDicts *rows = hash_aggregate.execute(table, nullptr, 4);
+        std::cout << "group by g: " << rows->size() << " groups, " << hash_aggregate.get_spilled_groups()
+                  << " spilled" << std::endl;
+        if (rows->size() != N_GROUPS)
+            ok = false;
+        for (auto const &row: *rows) {
+            int g = (*row)["g"].n;
+            int n = N_ROWS / N_GROUPS;
+            int sum = n * g + N_GROUPS * n * (n - 1) / 2;
+            if ((*row)["n"].n != n || (*row)["sum"].n != sum || (*row)["min"].n != g
+                || (*row)["max"].n != g + N_GROUPS * (n - 1) || (*row)["avg"].n != sum / n)
+                ok = false;
+            delete row;
+        }
+        delete rows;
+        if (threshold == 8 && hash_aggregate.get_spilled_groups() == 0)
+            ok = false;
+    }
+
+    // profiled: every worker's page reads and allocations are charged to the aggregate
+    OperatorProfile profile("HashAggregate", N_GROUPS);
+    {
+        HashAggregate hash_aggregate(group_by, group_by_attributes, aggregates);
+        Profiling profiling(&profile);
+        ValueDicts *rows = hash_aggregate.execute(table, nullptr, 4);
+        profile.rows = rows->size();
+        for (auto const &row: *rows)
+            delete row;
+        delete rows;
+    }
+    u_int64_t pages_read = profile.pages_read, bytes_allocated = profile.bytes_allocated;
+    delete table.select();  // no longer profiled
+    std::cout << "profiled: " << profile.explain(true) << std::endl;
+    if (pages_read != table.get_block_count() || bytes_allocated == 0 || profile.nanoseconds == 0
+        || profile.pages_read != pages_read || profile.bytes_allocated != bytes_allocated)
+        ok = false;
+
+    // TEXT group-by with a where clause
+    ValueDict where;
+    where["t"] = Value("k3");
+    HashAggregate by_text(ColumnNames(1, "t"), ColumnAttributes(1, ColumnAttribute(ColumnAttribute::TEXT)),
+                          Aggregates(1, Aggregate(Aggregate::COUNT, "v", "n")));
+    ValueDicts *rows = by_text.execute(table, &where);
+    if (rows->size() != 1 || (*rows->at(0))["t"].s != "k3" || (*rows->at(0))["n"].n != (N_ROWS - 3 + 6) / 7)
+        ok = false;
+    std::cout << "group by t where t = \"k3\": " << (rows->empty() ? 0 : (*rows->at(0))["n"].n) << std::endl;
+    for (auto const &row: *rows)
+        delete row;
+    delete rows;
+
+    // no GROUP BY over no rows still gives one row
+    where["t"] = Value("none");
+    HashAggregate no_groups(ColumnNames(), ColumnAttributes(), Aggregates(1, Aggregate(Aggregate::COUNT, "", "n")));
+    rows = no_groups.execute(table, &where);
+    if (rows->size() != 1 || (*rows->at(0))["n"].n != 0)
+        ok = false;
+    for (auto const &row: *rows)
+        delete row;
+    delete rows;
+
+    // a SUM past INT's range is an error, while the AVG of the same values is fine
+    where["t"] = Value("big");
+    for (int i = 0; i < 3; i++) {
+        ValueDict row;
+        row["g"] = Value(0);
+        row["t"] = Value("big");
+        row["v"] = Value(INT32_MAX - i);
+        table.insert(&row);
+    }
+    HashAggregate big_avg(ColumnNames(), ColumnAttributes(), Aggregates(1, Aggregate(Aggregate::AVG, "v", "avg")));
+    rows = big_avg.execute(table, &where);
+    if (rows->size() != 1 || (*rows->at(0))["avg"].n != INT32_MAX - 1)
+        ok = false;
+    for (auto const &row: *rows)
+        delete row;
+    delete rows;
+    HashAggregate big_sum(ColumnNames(), ColumnAttributes(), Aggregates(1, Aggregate(Aggregate::SUM, "v", "sum")));
+    try {
+        rows = big_sum.execute(table, &where);
+        for (auto const &row: *rows)
+            delete row;
+        delete rows;
+        ok = false;
+    } catch (DbRelationError &e) {
+        std::cout << "sum over INT range: " << e.what() << std::endl;
+    }
+
+    table.drop();
+    return ok;
+}
@@ -0,0 +1,167 @@
+/**
+ * @file hash_aggregate.h - GROUP BY with COUNT, SUM, MIN, MAX and AVG.
+ * Aggregate
+ * GroupTable
+ * HashAggregate
+ *
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#pragma once
+
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "heap_storage.h"
+
+/**
+ * @class Aggregate - one aggregate function in a select list, e.g. SUM(price)
+ */
+class Aggregate {
+public:
+    enum Function {
+        COUNT, SUM, MIN, MAX, AVG
+    };
+
+    /**
+     * @param function     which aggregate to compute
+     * @param column_name  column to aggregate over (empty for COUNT(*))
+     * @param output_name  name of the column holding the result
+     */
+    Aggregate(Function function, Identifier column_name, Identifier output_name)
+            : function(function), column_name(column_name), output_name(output_name) {}
+
+    Function function;
+    Identifier column_name;
+    Identifier output_name;
+};
+
+typedef std::vector<Aggregate> Aggregates;
+
+/**
+ * Running state of one aggregate for one group. Every function is computed from
+ * count/sum/min/max, so partial states from different workers or spill runs merge
+ * with merge().
+ */
+struct AggregateState {
+    int64_t count;
+    int64_t sum;
+    int32_t min;
+    int32_t max;
+
+    AggregateState();
+
+    void add(int32_t n);
+
+    void merge(const AggregateState &other);
+};
+
+/**
+ * @class GroupTable - open-addressing (linear probing) hash table from marshaled
+ * group-by bytes to the aggregate states of that group.
+ *
+ * Groups are numbered densely in insertion order; the states of group g are
+ * states()[g * n_aggregates] ... states()[(g + 1) * n_aggregates - 1].
+ */
+class GroupTable {
+public:
+    GroupTable(size_t n_aggregates);
+
+    virtual ~GroupTable() {}
+
+    /**
+     * Find a group's states, adding the group (with fresh states) if it isn't there yet.
+     * @param key   marshaled group-by values
+     * @param hash  hash_key(key)
+     * @returns     pointer to the group's n_aggregates states (valid until the next insert)
+     */
+    virtual AggregateState *find_or_insert(const std::string &key, u_int64_t hash);
+
+    virtual size_t size() const { return keys.size(); }
+
+    virtual void clear();
+
+    virtual const std::string &get_key(size_t group) const { return keys[group]; }
+
+    virtual u_int64_t get_hash(size_t group) const { return hashes[group]; }
+
+    virtual AggregateState *get_states(size_t group) { return states.data() + group * n_aggregates; }
+
+    static u_int64_t hash_key(const std::string &key);
+
+protected:
+    static const size_t INITIAL_SLOTS = 1024;  // power of two
+
+    size_t n_aggregates;
+    std::vector<u_int32_t> slots;  // group number + 1, or 0 for an empty slot
+    std::vector<std::string> keys;
+    std::vector<u_int64_t> hashes;
+    std::vector<AggregateState> states;
+
+    virtual void grow();
+};
+
+/**
+ * @class HashAggregate - Execute SELECT <group_by>, <aggregates> FROM <relation> WHERE <where> GROUP BY <group_by>.
+ *
+ * Each scan worker of DbRelation::parallel_scan pre-aggregates into its own GroupTable, so
+ * workers never share state; the partial tables are merged at the end. A worker whose table
+ * grows past spill_threshold groups writes it out to per-partition temporary files and starts
+ * over, and the final merge then goes one hash partition at a time so only a fraction of the
+ * groups are ever in memory at once.
+ */
+class HashAggregate {
+public:
+    static const size_t DEFAULT_SPILL_THRESHOLD = 1 << 16;  // groups per worker
+    static const unsigned int SPILL_PARTITIONS = 16;
+
+    HashAggregate(ColumnNames group_by, ColumnAttributes group_by_attributes, Aggregates aggregates,
+                  size_t spill_threshold = DEFAULT_SPILL_THRESHOLD);
+
+    virtual ~HashAggregate() {}
+
+    /**
+     * Run the aggregation.
+     * @param relation   table to aggregate over
+     * @param where      where-clause predicates (or nullptr)
+     * @param n_workers  scan threads to use (0 for one per hardware thread)
+     * @param sample     the blocks to aggregate over (nullptr for all of them)
+     * @returns          one row per group keyed by group-by names and aggregate output names (freed by caller)
+     */
+    virtual ValueDicts *execute(DbRelation &relation, const ValueDict *where = nullptr, unsigned int n_workers = 0,
+                                const BlockSample *sample = nullptr);
+
+    /**
+     * @returns  how many partial groups were written to disk by the last execute()
+     */
+    virtual size_t get_spilled_groups() const { return spilled_groups; }
+
+protected:
+    struct Worker {
+        Worker(size_t n_aggregates) : groups(n_aggregates) {}
+
+        GroupTable groups;
+        std::vector<FILE *> spill_files;  // one per partition, created on first spill
+        std::string key;  // scratch buffer
+    };
+
+    ColumnNames group_by;
+    ColumnAttributes group_by_attributes;
+    Aggregates aggregates;
+    size_t spill_threshold;
+    std::atomic<size_t> spilled_groups;  // added to by every scan worker
+
+    virtual void accumulate(Worker &worker, const ValueDict *row);
+
+    virtual void spill(Worker &worker);
+
+    virtual void merge_into(GroupTable &into, GroupTable &from, int partition);
+
+    virtual void merge_spill_file(GroupTable &into, FILE *file);
+
+    virtual void emit(GroupTable &groups, ValueDicts *rows);
+
+    static unsigned int partition_of(u_int64_t hash) { return (unsigned int) (hash >> 60) % SPILL_PARTITIONS; }
+};
+
+bool test_hash_aggregate();
@@ -18,7 +18,30 @@
 */
 
 #include "heap_storage.h"
+#include "cost_model.h"
+#include "csv_import.h"
+#include "io_pool.h"
+#include "mvcc.h"
+#include "page_codec.h"
+#include "profile.h"
+#include "record_format.h"
+#include "transaction.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <exception>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <set>
+#include <thread>
+#include <vector>
 
 typedef u_int16_t u16;
 
@@ -57,8 +80,21 @@ bool test_heap_storage() {
     std::cout << "put result: " << put_result << std::endl;
     std::cout << "put ok" << std::endl;
 
-    // test del
+    // test del: the slot is reused, and compact() makes the deleted record's space free again
     page.del(record_id);
+    RecordID first = page.add(&record);
+    RecordID second = page.add(&record);
+    RecordID third = page.add(&record);
+    page.del(second);
+    u_int16_t dead = page.dead_space();
+    u_int16_t reclaimed = page.compact();
+    Dbt *kept = page.get(third);
+    bool intact = strcmp((char *) kept->get_data(), rec) == 0;
+    delete[] (char *) kept->get_data();
+    delete kept;
+    if (first != record_id || dead != sizeof(rec) || reclaimed != sizeof(rec) || !intact
+        || page.add(&record) != second)
+        return false;
     std::cout << "del ok" << std::endl;
     
     // test HeapFile and HeapTable
@@ -116,21 +152,650 @@ bool test_heap_storage() {
     result = table.project((*handles)[0], &column_names);
     std::cout << "project with specific fields ok" << std::endl;
 
+    // Test import_csv: enough rows for more pages per worker than it may queue, quoted fields included
+    const int CSV_ROWS = 20000;
+    const char *csv_path = "_test_import_cpp.csv";
+    std::ofstream csv(csv_path);
+    for (int i = 0; i < CSV_ROWS; i++) {
+        if (i % 2)
+            csv << i << ",\"say \"\"hi\"\", " << i << "\"\r\n";
+        else
+            csv << i << ",plain " << i << "\n";
+    }
+    csv.close();
+    size_t imported = table.import_csv(csv_path, 4);
+    delete handles;
+    handles = table.select();
+    std::cout << "import_csv ok " << imported << " " << handles->size() << std::endl;
+    if (imported != CSV_ROWS || handles->size() != CSV_ROWS + 1)
+        return false;
+    delete result;
+    ColumnNames a_only = {"a"};
+    for (int i = 0; i < CSV_ROWS; i++) {  // in file order
+        result = table.project((*handles)[i + 1], &a_only);
+        bool in_order = (*result)["a"].n == i;
+        delete result;
+        if (!in_order)
+            return false;
+    }
+    result = table.project(handles->back());
+    if ((*result)["a"].n != CSV_ROWS - 1 || (*result)["b"].s != "say \"hi\", " + std::to_string(CSV_ROWS - 1))
+        return false;
+    delete result;
+    delete handles;
+
+    // a bad line near the end fails the load, with every worker stopped
+    csv.open(csv_path, std::ios::app);
+    csv << "x,bad\n";
+    csv.close();
+    try {
+        table.import_csv(csv_path, 4);
+        return false;
+    } catch (DbRelationError &e) {
+        std::cout << "import_csv failure ok: " << e.what() << std::endl;
+    }
+    std::remove(csv_path);
+
     table.drop();
 
+    // Test dictionary encoding: equality is tested on codes, values come back decoded
+    ColumnAttributes coded_attributes;
+    coded_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    coded_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT, true));
+    HeapTable coded("_test_dictionary_cpp", column_names, coded_attributes);
+    coded.create();
+    const char *statuses[] = {"active", "inactive", "pending"};
+    for (int i = 0; i < 300; i++) {
+        row["a"] = Value(i);
+        row["b"] = Value(statuses[i % 3]);
+        coded.insert(&row);
+    }
+    ValueDict where;
+    where["b"] = Value("pending");
+    handles = coded.select(&where);
+    result = coded.project(handles->back());
+    std::cout << "dictionary select ok " << handles->size() << std::endl;
+    if (handles->size() != 100 || (*result)["b"].s != "pending" || (*result)["a"].n != 299)
+        return false;
+    delete result;
+    delete handles;
+    where["b"] = Value("unknown");
+    handles = coded.select(&where);
+    if (!handles->empty())
+        return false;
+    delete handles;
+    coded.drop();
+
+    // Test compression: every block but the last is stored compressed and reads back the same
+    HeapTable packed("_test_compressed_cpp", column_names, column_attributes);
+    packed.set_compression(true);
+    packed.create();
+    for (int i = 0; i < 3000; i++) {
+        row["a"] = Value(i);
+        row["b"] = Value("row number " + std::to_string(i % 100));
+        packed.insert(&row);
+    }
+    where.clear();
+    where["a"] = Value(7);
+    handles = packed.select(&where);
+    if (handles->size() != 1)
+        return false;
+    ValueDict changes;
+    changes["b"] = Value("changed");
+    packed.update(handles->front(), &changes);  // rewrites a sealed block
+    delete handles;
+    packed.close();
+    HeapTable reopened("_test_compressed_cpp", column_names, column_attributes);
+    reopened.open();
+    handles = reopened.select();
+    result = reopened.project((*handles)[7]);
+    CompressionStats stats = reopened.compression_stats();
+    std::cout << "compressed select ok " << handles->size() << " ratio " << packed.compression_stats().ratio()
+              << " decoded " << stats.blocks_decoded << std::endl;
+    if (!reopened.is_compressed() || handles->size() != 3000 || (*result)["b"].s != "changed"
+        || packed.compression_stats().ratio() <= 1.0 || stats.blocks_decoded == 0)
+        return false;
+    delete result;
+    delete handles;
+    reopened.drop();
+
+    // Test big blocks and overflow pages: a wide value is only read when it is asked for
+    HeapTable wide("_test_overflow_cpp", column_names, column_attributes);
+    wide.set_block_size(DbBlock::MAX_BLOCK_SZ);
+    wide.create();
+    std::string big(100000, 'x');
+    for (int i = 0; i < 20; i++) {
+        row["a"] = Value(i);
+        row["b"] = Value(i % 2 ? big + std::to_string(i) : std::string(10000, 'y'));
+        wide.insert(&row);
+    }
+    wide.close();
+    HeapTable wide_again("_test_overflow_cpp", column_names, column_attributes);
+    wide_again.open();
+    handles = wide_again.select();
+    ColumnNames just_a(1, "a");
+    for (auto const &handle: *handles) {
+        result = wide_again.project(handle, &just_a);
+        delete result;
+    }
+    u_int64_t skipped = wide_again.get_overflow_pages_read();
+    result = wide_again.project((*handles)[19]);
+    where.clear();
+    where["b"] = Value(big + "19");
+    Handles *found = wide_again.select(&where);
+    std::cout << "overflow ok " << handles->size() << " blocks " << wide_again.get_block_size()
+              << " pages read " << skipped << " then " << wide_again.get_overflow_pages_read() << std::endl;
+    if (handles->size() != 20 || wide_again.get_block_size() != DbBlock::MAX_BLOCK_SZ || skipped != 0
+        || (*result)["b"].s != big + "19" || found->size() != 1 || found->front() != (*handles)[19])
+        return false;
+    delete found;
+    delete result;
+    delete handles;
+    wide_again.drop();
+
+    // Test Bloom filters: a lookup on a filtered column only reads the blocks that may hold the value
+    HeapTable filtered("_test_bloom_cpp", column_names, column_attributes);
+    filtered.set_bloom_filters(ColumnNames(1, "b"), 0.01);
+    filtered.create();
+    for (int i = 0; i < 3000; i++) {
+        row["a"] = Value(i);
+        row["b"] = Value("customer " + std::to_string(i * 7919 % 3000));
+        filtered.insert(&row);
+    }
+    filtered.close();
+    HeapTable filtered_again("_test_bloom_cpp", column_names, column_attributes);
+    filtered_again.open();  // the filters come back from the side file
+    where.clear();
+    where["b"] = Value("customer 1234");
+    handles = filtered_again.select(&where);
+    skipped = filtered_again.get_blocks_skipped();
+    u_int32_t blocks = filtered_again.get_block_count();
+    if (handles->size() != 1 || skipped + 4 < blocks)  // its block, the last one and maybe a false positive or two
+        return false;
+    changes.clear();
+    changes["b"] = Value("renamed");
+    filtered_again.update(handles->front(), &changes);  // a value new to a full block
+    delete handles;
+    where["b"] = Value("renamed");
+    handles = filtered_again.select(&where);
+    if (handles->size() != 1)
+        return false;
+    delete handles;
+    const int MISSES = 1000;
+    u_int64_t before = filtered_again.get_blocks_skipped();
+    for (int i = 0; i < MISSES; i++) {
+        where["b"] = Value("nobody " + std::to_string(i));
+        delete filtered_again.select(&where);
+    }
+    u_int64_t read = MISSES * (u_int64_t) (blocks - 1) - (filtered_again.get_blocks_skipped() - before);
+    std::cout << "bloom ok " << skipped << " of " << blocks << " blocks skipped, false positive rate "
+              << (double) read / (MISSES * (blocks - 1)) << std::endl;
+    if (read > MISSES * (blocks - 1) / 20)
+        return false;
+    filtered_again.drop();
+
+    // Test statistics: half the rows share a = 0, the rest have a to themselves, and b takes 40 values
+    HeapTable analyzed("_test_stats_cpp", column_names, column_attributes);
+    analyzed.create();
+    const int STATS_ROWS = 5000;
+    for (int i = 0; i < STATS_ROWS; i++) {
+        row["a"] = Value(i % 2 == 0 ? 0 : i);
+        row["b"] = Value("group " + std::to_string(i % 40));
+        analyzed.insert(&row);
+    }
+    std::shared_ptr<const TableStatistics> statistics = analyzed.analyze(TableStatistics::DEFAULT_SAMPLE_BLOCKS);
+    double distinct_a = statistics->columns[0].distinct, distinct_b = statistics->columns[1].distinct;
+    if (statistics->rows != STATS_ROWS || statistics->sampled_blocks != statistics->blocks
+        || std::abs(distinct_a - (STATS_ROWS / 2 + 1)) > STATS_ROWS / 2 * 0.05 || std::abs(distinct_b - 40) > 2)
+        return false;
+    CostModel model(statistics, column_names);
+    where.clear();
+    where["a"] = Value(0);
+    double heavy = model.selectivity(&where);
+    unsigned int heavy_workers = model.scan(&where, 8).n_workers;
+    where["a"] = Value(1);
+    double rare = model.selectivity(&where);
+    unsigned int rare_workers = model.scan(&where, 8).n_workers;
+    if (std::abs(heavy - 0.5) > 0.05 || rare > 0.001 || heavy_workers < 2 || rare_workers != 1)
+        return false;
+
+    // Test late materialization: the 2500 rows with a = 0 are projected with a read of each block,
+    // and a parallel scan only decodes the columns asked for
+    where["a"] = Value(0);
+    handles = analyzed.select(&where);
+    ColumnNames just_b(1, "b");
+    OperatorProfile batched("project", -1), one_by_one("project", -1);
+    ValueDicts *projected;
+    {
+        Profiling profiling(&batched);
+        projected = analyzed.project(handles, &just_b);
+    }
+    bool same = projected->size() == handles->size();
+    {
+        Profiling profiling(&one_by_one);
+        for (size_t i = 0; i < handles->size() && same; i++) {
+            result = analyzed.project((*handles)[i], &just_b);
+            same = result->size() == 1 && (*result)["b"].s == (*(*projected)[i])["b"].s;
+            delete result;
+        }
+    }
+    for (auto projected_row: *projected)
+        delete projected_row;
+    delete projected;
+    std::atomic<size_t> narrow(0), empty(0);
+    analyzed.parallel_scan(&where, 4, [&](unsigned int, Handle, const ValueDict *scanned) {
+        if (scanned->size() == 1 && scanned->count("b") == 1)
+            narrow++;
+    }, &just_b);
+    ColumnNames none;
+    analyzed.parallel_scan(&where, 4, [&](unsigned int, Handle, const ValueDict *scanned) {
+        if (scanned->empty())
+            empty++;
+    }, &none);
+    std::cout << "late materialization ok " << handles->size() << " rows projected from " << batched.pages_read
+              << " block reads rather than " << one_by_one.pages_read << std::endl;
+    if (!same || batched.pages_read > statistics->blocks || one_by_one.pages_read < handles->size()
+        || narrow != handles->size() || empty != handles->size())
+        return false;
+    delete handles;
+
+    // Test LIMIT: the scan stops at the block where it finds its last row
+    handles = analyzed.select(&where);
+    OperatorProfile limited("select", -1);
+    Handles *prefix;
+    {
+        Profiling profiling(&limited);
+        prefix = analyzed.select(&where, 7);
+    }
+    same = prefix->size() == 7 && std::equal(prefix->begin(), prefix->end(), handles->begin()) && limited.pages_read == 1;
+    delete prefix;
+    prefix = analyzed.select(nullptr, 0);
+    same = same && prefix->empty();
+    delete prefix;
+    std::cout << "limit ok " << limited.pages_read << " of " << statistics->blocks << " blocks read" << std::endl;
+    delete handles;
+    if (!same)
+        return false;
+
+    // Test TABLESAMPLE: a seed picks the same blocks every time, and only they are read
+    BlockSample quarter(0.25, 5300);
+    OperatorProfile sampling("sample", -1);
+    {
+        Profiling profiling(&sampling);
+        handles = analyzed.select(nullptr, SIZE_MAX, &quarter);
+    }
+    size_t in_sample = 0;
+    for (BlockID block_id = 1; block_id <= statistics->blocks; block_id++)
+        if (quarter.contains(block_id))
+            in_sample++;
+    Handles *again = analyzed.select(nullptr, SIZE_MAX, &quarter);
+    same = *again == *handles && sampling.pages_read == in_sample;
+    delete again;
+    for (auto const &handle: *handles)
+        same = same && quarter.contains(handle.first);
+    std::atomic<size_t> scanned(0);
+    analyzed.parallel_scan(nullptr, 4, [&](unsigned int, Handle, const ValueDict *) { scanned++; }, &none, &quarter);
+    BlockSample other(0.25, 5301);
+    again = analyzed.select(nullptr, SIZE_MAX, &other);
+    same = same && scanned == handles->size() && *again != *handles;
+    delete again;
+    double estimate = handles->size() / quarter.fraction;
+    std::cout << "tablesample ok " << handles->size() << " rows from " << sampling.pages_read << " of "
+              << statistics->blocks << " blocks, estimating " << (size_t) estimate << " of " << STATS_ROWS << std::endl;
+    delete handles;
+    if (!same || std::abs(estimate - STATS_ROWS) > STATS_ROWS * 0.5)
+        return false;
+
+    u_int32_t sample = statistics->blocks / 4;
+    statistics = analyzed.analyze(sample);
+    double sampled_rows = statistics->rows;
+    if (statistics->sampled_blocks != sample || std::abs(sampled_rows - STATS_ROWS) > STATS_ROWS * 0.15)
+        return false;
+    analyzed.close();
+    HeapTable analyzed_again("_test_stats_cpp", column_names, column_attributes);
+    analyzed_again.open();  // the statistics come back from their file
+    statistics = analyzed_again.get_statistics();
+    if (statistics == nullptr || statistics->rows != sampled_rows)
+        return false;
+    std::cout << "statistics ok " << STATS_ROWS << " rows, distinct " << distinct_a << " and " << distinct_b
+              << ", a = 0 selectivity " << heavy << " on " << heavy_workers << " workers, "
+              << (size_t) sampled_rows << " rows from " << sample << " of " << statistics->blocks << " blocks" << std::endl;
+    analyzed_again.drop();
+
     return true;
 }
 
+// Stress test for concurrent use of one HeapTable -- returns true if no insert was lost
+// Also reports scan throughput (rows read per second, since the table keeps growing) for
+// 1, 2, 4 and 8 readers running alongside two inserters.
+bool test_heap_concurrency() {
+    ColumnNames column_names;
+    column_names.push_back("a");
+    column_names.push_back("b");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    HeapTable table("_test_concurrency_cpp", column_names, column_attributes);
+    table.create_if_not_exists();
+
+    // inserters racing each other (and a scanner) for the last block
+    const int WRITERS = 4, ROWS = 2000;
+    std::atomic<bool> writing(true);
+    std::atomic<size_t> scanned(0);
+    std::thread scanner([&]() {
+        while (writing)
+            table.parallel_scan(nullptr, 1, [&](unsigned int, Handle, const ValueDict *) { scanned++; });
+    });
+    std::vector<std::thread> writers;
+    for (int w = 0; w < WRITERS; w++) {
+        writers.push_back(std::thread([&table, w]() {
+            ValueDict row;
+            row["b"] = Value("concurrent");
+            for (int i = 0; i < ROWS; i++) {
+                row["a"] = Value(w * ROWS + i);
+                table.insert(&row);
+            }
+        }));
+    }
+    for (auto &writer: writers)
+        writer.join();
+    writing = false;
+    scanner.join();
+
+    std::vector<char> seen(WRITERS * ROWS, 0);  // not vector<bool>: workers set neighboring entries
+    size_t rows = 0;
+    table.parallel_scan(nullptr, 4, [&](unsigned int, Handle, const ValueDict *row) {
+        int32_t a = row->at("a").n;
+        if (a >= 0 && a < WRITERS * ROWS)
+            seen[a] = 1;
+    });
+    for (auto const &found: seen)
+        rows += found;
+    std::cout << "concurrent inserts: " << rows << " of " << WRITERS * ROWS << " rows found, "
+              << scanned << " rows scanned meanwhile" << std::endl;
+    if (rows != (size_t) WRITERS * ROWS)
+        return false;
+
+    // read scaling with inserts going on
+    double single = 0;
+    for (unsigned int readers = 1; readers <= 8; readers *= 2) {
+        std::atomic<bool> running(true);
+        std::vector<std::thread> inserters;
+        for (int w = 0; w < 2; w++) {
+            inserters.push_back(std::thread([&table, &running]() {
+                ValueDict row;
+                row["a"] = Value(-1);
+                row["b"] = Value("background");
+                while (running)
+                    table.insert(&row);
+            }));
+        }
+        const int SCANS = 5;
+        std::atomic<size_t> read(0);
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> scanners;
+        for (unsigned int r = 0; r < readers; r++) {
+            scanners.push_back(std::thread([&table, &read]() {
+                size_t count = 0;
+                for (int s = 0; s < SCANS; s++)
+                    table.parallel_scan(nullptr, 1, [&count](unsigned int, Handle, const ValueDict *) { count++; });
+                read += count;
+            }));
+        }
+        for (auto &scanner: scanners)
+            scanner.join();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        running = false;
+        for (auto &inserter: inserters)
+            inserter.join();
+        double rate = read / seconds;
+        if (readers == 1)
+            single = rate;
+        std::cout << readers << " readers: " << (size_t) rate << " rows/s (" << rate / single << "x)" << std::endl;
+    }
+    table.drop();
+
+    // insert scaling: each writer should soon be filling blocks of its own
+    single = 0;
+    bool ok = true;
+    for (unsigned int n_writers = 1; n_writers <= 8; n_writers *= 2) {
+        HeapTable ingest("_test_ingest_cpp", column_names, column_attributes);
+        ingest.create();
+        const int EACH = 4000;
+        std::vector<std::vector<BlockID>> written(n_writers);
+        auto start = std::chrono::steady_clock::now();
+        writers.clear();
+        for (unsigned int w = 0; w < n_writers; w++) {
+            writers.push_back(std::thread([&ingest, &written, w]() {
+                ValueDict row;
+                row["b"] = Value("ingested");
+                for (int i = 0; i < EACH; i++) {
+                    row["a"] = Value(i);
+                    written[w].push_back(ingest.insert(&row).first);
+                }
+            }));
+        }
+        for (auto &writer: writers)
+            writer.join();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::map<BlockID, std::set<unsigned int>> writers_of;
+        for (unsigned int w = 0; w < n_writers; w++)
+            for (auto const &block_id: written[w])
+                writers_of[block_id].insert(w);
+        size_t shared_blocks = 0;
+        for (auto const &block: writers_of)
+            shared_blocks += block.second.size() > 1;
+        Handles *handles = ingest.select();
+        size_t rows = handles->size();
+        delete handles;
+        double rate = n_writers * EACH / seconds;
+        if (n_writers == 1)
+            single = rate;
+        std::cout << n_writers << " writers: " << (size_t) rate << " rows/s (" << rate / single << "x), "
+                  << shared_blocks << " of " << writers_of.size() << " blocks shared" << std::endl;
+        if (rows != n_writers * EACH || shared_blocks > n_writers)
+            ok = false;
+        ingest.drop();
+    }
+    return ok;
+}
+
+// Test function -- returns true if concurrent commits share log flushes and an aborted
+// transaction leaves neither its rows nor its new blocks behind
+bool test_group_commit() {
+    ColumnNames column_names;
+    column_names.push_back("a");
+    column_names.push_back("b");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    HeapTable table("_test_group_commit_cpp", column_names, column_attributes);
+    table.create();
+    auto count_rows = [&table]() {
+        Handles *handles = table.select();
+        size_t rows = handles->size();
+        delete handles;
+        return rows;
+    };
+
+    // committers that arrive while a flush is going on (or inside the window) share the next one
+    const int COMMITTERS = 8, EACH = 50;
+    unsigned int window = GroupCommit::get_window();
+    GroupCommit::set_window(1000);
+    size_t commits = GroupCommit::get_commits(), flushes = GroupCommit::get_flushes();
+    std::vector<std::thread> committers;
+    for (int c = 0; c < COMMITTERS; c++) {
+        committers.push_back(std::thread([&table, c]() {
+            ValueDict row;
+            row["b"] = Value("committed");
+            for (int i = 0; i < EACH; i++) {
+                Transaction transaction;
+                row["a"] = Value(c * EACH + i);
+                table.insert(&row);
+                transaction.commit();
+            }
+        }));
+    }
+    for (auto &committer: committers)
+        committer.join();
+    GroupCommit::set_window(window);
+    commits = GroupCommit::get_commits() - commits;
+    flushes = GroupCommit::get_flushes() - flushes;
+    size_t rows = count_rows();
+    std::cout << "group commit: " << commits << " commits in " << flushes << " log flushes, " << rows << " of "
+              << COMMITTERS * EACH << " rows" << std::endl;
+    if (commits != (size_t) COMMITTERS * EACH || flushes >= commits || rows != (size_t) COMMITTERS * EACH) {
+        table.drop();
+        return false;
+    }
+
+    // an aborted transaction's rows go, and so do the blocks it added to the end of the file
+    u_int32_t blocks = table.get_block_count();
+    u_int32_t grown;
+    {
+        Transaction transaction;
+        ValueDict row;
+        row["b"] = Value(std::string(DbBlock::BLOCK_SZ / 4, 'x'));
+        for (int i = 0; i < 40; i++) {
+            row["a"] = Value(-i);
+            table.insert(&row);
+        }
+        grown = table.get_block_count();
+        transaction.abort();
+    }
+    size_t after_abort = count_rows();
+    u_int32_t blocks_after_abort = table.get_block_count();
+    ValueDict row;
+    row["a"] = Value(-1);
+    row["b"] = Value("after the abort");
+    for (int i = 0; i < 100; i++)
+        table.insert(&row);
+    bool ok = grown > blocks && after_abort == rows && blocks_after_abort == blocks && count_rows() == rows + 100;
+    std::cout << "group commit abort: " << grown - blocks << " new blocks, " << blocks_after_abort - blocks
+              << " left behind, " << after_abort << " rows" << std::endl;
+    table.drop();
+    return ok;
+}
+
+// Test function -- returns true if rows keep their handles as updates make them grow
+bool test_heap_update() {
+    ColumnNames column_names;
+    column_names.push_back("a");
+    column_names.push_back("b");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    HeapTable table("_test_update_cpp", column_names, column_attributes);
+    table.create_if_not_exists();
+    std::shared_ptr<DbRelation> unowned(&table, [](DbRelation *) {});
+    VersionCollector collector([&unowned]() { return std::vector<std::shared_ptr<DbRelation>>(1, unowned); });
+
+    const int ROWS = 2000;
+    Handles handles;
+    ValueDict row;
+    row["b"] = Value("");
+    for (int i = 0; i < ROWS; i++) {
+        row["a"] = Value(i);
+        handles.push_back(table.insert(&row));
+    }
+
+    // update throughput as the rows grow (and more and more of them have to move)
+    std::string b;
+    const size_t growth[] = {0, 8, 64, 256};
+    for (auto const &grow: growth) {
+        b = std::string(grow, 'u');
+        ValueDict new_values;
+        new_values["b"] = Value(b);
+        u_int64_t moved = table.get_rows_moved();
+        auto start = std::chrono::steady_clock::now();
+        for (auto const &handle: handles)
+            table.update(handle, &new_values);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        collector.collect();
+        std::cout << "update +" << grow << " bytes: " << (size_t) (ROWS / seconds) << " rows/s, "
+                  << table.get_rows_moved() - moved << " moved" << std::endl;
+    }
+
+    // every handle still reads its row, and a scan finds each row once (at its own handle)
+    for (int i = 0; i < ROWS; i++) {
+        ValueDict *values = table.project(handles[i]);
+        bool same = (*values)["a"].n == i && (*values)["b"].s == b;
+        delete values;
+        if (!same)
+            return false;
+    }
+    Handles *found = table.select();
+    bool once = found->size() == (size_t) ROWS && std::is_permutation(found->begin(), found->end(), handles.begin());
+    delete found;
+    if (!once)
+        return false;
+
+    // deleting a moved row takes its stub with it
+    table.del(handles.front());  // the first block filled up long ago
+    collector.collect();
+    found = table.select();
+    size_t left = found->size();
+    delete found;
+    std::cout << "update ok " << table.get_rows_moved() << " moved, " << left << " left" << std::endl;
+    if (left != (size_t) ROWS - 1 || table.get_rows_moved() == 0)
+        return false;
+
+    // deletes just stamp the rows; the vacuum gives the space back once they are collected
+    u_int32_t blocks = table.get_block_count();
+    found = table.select();
+    auto start = std::chrono::steady_clock::now();
+    for (auto const &handle: *found)
+        table.del(handle);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    delete found;
+    collector.collect();
+    u_int32_t vacuumed = table.get_block_count();
+    for (int i = 0; i < ROWS; i++) {
+        row["a"] = Value(i);
+        table.insert(&row);
+    }
+    std::cout << "delete: " << (size_t) (left / seconds) << " rows/s, vacuum reclaimed "
+              << table.get_bytes_reclaimed() << " bytes, " << blocks << " blocks then " << vacuumed
+              << " then " << table.get_block_count() << " after as many inserts" << std::endl;
+    if (vacuumed != 1 || table.get_block_count() > blocks)
+        return false;
+
+    // the rows went in in order of a, so a lookup on a only reads the block holding it
+    ValueDict where;
+    where["a"] = Value(ROWS / 2 + 7);
+    u_int64_t skipped = table.get_blocks_skipped();
+    found = table.select(&where);
+    Handle middle = found->empty() ? Handle(0, 0) : found->front();
+    bool one = found->size() == 1;
+    delete found;
+    skipped = table.get_blocks_skipped() - skipped;
+    if (!one || skipped + 1 < table.get_block_count())
+        return false;
+
+    // an update out of the block's range widens its zone
+    ValueDict new_values;
+    new_values["a"] = Value(ROWS * 10);
+    table.update(middle, &new_values);
+    where["a"] = new_values["a"];
+    found = table.select(&where);
+    one = found->size() == 1 && found->front() == middle;
+    delete found;
+    std::cout << "zone map ok " << skipped << " of " << table.get_block_count() << " blocks skipped" << std::endl;
+    table.drop();
+    return one;
+}
+
 
 // SlottedPage
 
 SlottedPage::SlottedPage(Dbt &block,
                          BlockID block_id,
-                         bool is_new)
-    : DbBlock(block, block_id, is_new) {
+                         bool is_new,
+                         bool owns_data)
+    : DbBlock(block, block_id, is_new), owns_data(owns_data) {
     if (is_new) {
         this->num_records = 0;
-        this->end_free = DbBlock::BLOCK_SZ - 1;
+        this->end_free = (u16) (block.get_size() - 1);
         put_header();
     } else {
         get_header(this->num_records, this->end_free);
@@ -138,11 +803,19 @@ SlottedPage::SlottedPage(Dbt &block,
 }
 
 // Add a new record to the block. Return its id.
+// The slot of a deleted record is reused if there is one; the space deleted records leave
+// among the live ones is only reclaimed (by compacting the block) once it is needed.
 RecordID SlottedPage::add(const Dbt* data) {
-    if (!has_room(data->get_size()))
-        throw DbBlockNoRoomError("not enough room for new record");
-    u16 id = ++this->num_records;
     u16 size = (u16) data->get_size();
+    RecordID id = free_slot();
+    if (!has_room(size, id == 0) && has_room(size - std::min(size, dead_space()), id == 0)) {
+        compact();
+        id = free_slot();
+    }
+    if (!has_room(size, id == 0))
+        throw DbBlockNoRoomError("not enough room for new record");
+    if (id == 0)
+        id = ++this->num_records;
     this->end_free -= size;
     u16 loc = this->end_free + 1;
     put_header();
@@ -175,8 +848,12 @@ void SlottedPage::put(RecordID record_id, const Dbt &data){
     if (newSize > size) {
         u16 extra = newSize - size;
 
-        if (!has_room(extra)) {
-            throw DbBlockNoRoomError("Not enough space for record " + record_id);
+        if (!has_room(extra, false) && has_room(extra - std::min(extra, dead_space()), false)) {
+            compact();
+            get_header(size, loc, record_id);
+        }
+        if (!has_room(extra, false)) {
+            throw DbBlockNoRoomError("Not enough space for record " + std::to_string(record_id));
         }
         slide(loc, loc - extra);
         memcpy(address(loc - extra), data.get_data(), newSize);
@@ -192,28 +869,90 @@ void SlottedPage::put(RecordID record_id, const Dbt &data){
 
 // Delete a record from this block.
 // record_id indicates which record to delete
+// Only the record's slot is cleared: nothing else moves, so a delete costs the same however
+// full the block is. Its bytes stay where they were until compact() (or add()) needs them,
+// unless the record was the lowest in the block, in which case they simply become free space.
 void SlottedPage::del(RecordID record_id){
-    if (record_id > num_records) {
-        throw new DbRelationError("Invalid record id: " + record_id);
+    if (record_id == 0 || record_id > num_records) {
+        throw DbRelationError("Invalid record id: " + std::to_string(record_id));
     }
 
     u16 size;
     u16 loc;
     get_header(size, loc, record_id);
 
-    slide(loc, loc + size);
     put_header(record_id, 0, 0);
+    if (loc != 0 && loc == this->end_free + 1) {
+        this->end_free += size;
+        put_header();
+    }
 }
 
 // Get all the record ids in this block (excluding deleted ones).
 // returns pointer to list of record ids (freed by caller)
 RecordIDs* SlottedPage::ids(void){
     RecordIDs* ids = new RecordIDs;
-    for (RecordID i = 1; i <= num_records; i++)
-        ids->push_back(i);
+    for (RecordID i = 1; i <= num_records; i++) {
+        u16 size, loc;
+        get_header(size, loc, i);
+        if (loc != 0)
+            ids->push_back(i);
+    }
     return ids;
 }
 
+// The bytes of deleted records that are still in among the live ones
+u_int16_t SlottedPage::dead_space(void) {
+    u_int32_t used = (u_int32_t) this->block.get_size() - 1 - this->end_free;
+    RecordIDs* record_ids = ids();
+    for (auto const &record_id: *record_ids) {
+        u16 size, loc;
+        get_header(size, loc, record_id);
+        used -= size;
+    }
+    delete record_ids;
+    return (u16) used;
+}
+
+// The bytes free for new records (and their headers) without compacting the block
+u_int16_t SlottedPage::free_space(void) {
+    int available = (int) this->end_free + 1 - (this->num_records + 1) * 4;
+    return (u16) std::max(available, 0);
+}
+
+// Moves the live records together at the end of the block, so the space deleted records
+// took up becomes free space again, and drops the empty slots at the end of the header
+// Record ids stay the same. Returns the number of bytes reclaimed.
+u_int16_t SlottedPage::compact(void) {
+    u16 before = free_space();
+    std::vector<char> records((char *) this->address(0), (char *) this->address(0) + this->block.get_size());
+    u16 size, loc;
+    while (this->num_records > 0) {
+        get_header(size, loc, this->num_records);
+        if (loc != 0)
+            break;
+        this->num_records--;
+    }
+    this->end_free = (u16) (this->block.get_size() - 1);
+    for (RecordID id = 1; id <= this->num_records; id++) {
+        get_header(size, loc, id);
+        if (loc == 0)
+            continue;
+        this->end_free -= size;
+        memcpy(this->address(this->end_free + 1), records.data() + loc, size);
+        put_header(id, size, this->end_free + 1);
+    }
+    put_header();
+    return free_space() - before;
+}
+
+// Zero the free space in the middle of the block
+void SlottedPage::clear_free_space(void) {
+    u16 headers_end = (u16) (4 * (this->num_records + 1));
+    if (headers_end <= this->end_free)
+        memset(this->address(headers_end), 0, this->end_free - headers_end + 1);
+}
+
 // Get the size and offset of a record given it's id (defaults to block header)
 void SlottedPage::get_header(u_int16_t &size, u_int16_t &loc, RecordID id){
     size = get_n(4 * id);
@@ -230,9 +969,21 @@ void SlottedPage::put_header(RecordID id, u16 size, u16 loc) {
     put_n(4*id + 2, loc);
 }
 
-// Return true if there is room for param size
-bool SlottedPage::has_room(u_int16_t size){
-    return size - (this->end_free - (this->num_records + 1) * 4);
+// Return true if there is room for param size (plus the header of one more record, if new_slot)
+bool SlottedPage::has_room(u_int16_t size, bool new_slot){
+    int available = (int) this->end_free - (this->num_records + (new_slot ? 2 : 1)) * 4;
+    return (int) size <= available;
+}
+
+// The id of a deleted record's slot, free for a new record (0 if there isn't one)
+RecordID SlottedPage::free_slot(void) {
+    for (RecordID id = 1; id <= this->num_records; id++) {
+        u16 size, loc;
+        get_header(size, loc, id);
+        if (loc == 0)
+            return id;
+    }
+    return 0;
 }
 
 // Slide data to the left or right
@@ -243,13 +994,14 @@ void SlottedPage::slide(u_int16_t start, u_int16_t end){
         return;
     }
 
-    // slide data
-    memcpy((address((u16)(end_free + 1 + shift))), 
-           (address((u16)end_free + 1)),
-           (start - end_free - 1));
+    // slide data (source and destination may overlap)
+    memmove((address((u16)(end_free + 1 + shift))),
+            (address((u16)end_free + 1)),
+            (start - end_free - 1));
 
     // fix headers
-    for(auto &record_id: *ids()){
+    RecordIDs* record_ids = ids();
+    for(auto &record_id: *record_ids){
         u16 size, loc;
         get_header(size, loc, record_id);
 
@@ -258,6 +1010,7 @@ void SlottedPage::slide(u_int16_t start, u_int16_t end){
             put_header(record_id, size, loc);
         }
     }
+    delete record_ids;
 
     this->end_free += shift;
     put_header();
@@ -285,15 +1038,21 @@ void* SlottedPage::address(u16 offset) {
 void HeapFile::create(void) {
     db_open(DB_CREATE | DB_EXCL);
     SlottedPage* block = get_new();
-    put(block);
+    delete block;
 }
 
 // Deletes the database file
 void HeapFile::drop(void) {
     close();
     const char* file_name = dbfilename.c_str();
-    Db db(_DB_ENV, 0);
-    int result = db.remove(file_name, nullptr, 0);
+    int result;
+    if (Transaction::enabled()) {
+        DbTxn *txn = Transaction::current();
+        result = _DB_ENV->dbremove(txn, file_name, nullptr, txn == nullptr ? DB_AUTO_COMMIT : 0);
+    } else {
+        Db db(_DB_ENV, 0);
+        result = db.remove(file_name, nullptr, 0);
+    }
     if (result != 0)
         throw std::string("Failed to delete file: ") + file_name;
 }
@@ -305,6 +1064,7 @@ void HeapFile::open(void) {
 
 // Closes the database file
 void HeapFile::close(void) {
+    std::lock_guard<std::mutex> guard(open_mutex);
     db.close(0);
     closed = true;
 }
@@ -312,35 +1072,237 @@ void HeapFile::close(void) {
 // Allocate a new block for the database file.
 // Returns the new empty DbBlock that is managing the records in this block and its block id.
 SlottedPage* HeapFile::get_new(void) {
-    char block[DbBlock::BLOCK_SZ];
-    std::memset(block, 0, sizeof(block));
-    Dbt data(block, sizeof(block));
-
-    int block_id = ++this->last;
-    Dbt key(&block_id, sizeof(block_id));
-
-    // write out an empty block and read it back in so Berkeley DB is managing the memory
-    SlottedPage* page = new SlottedPage(data, this->last, true);
-    this->db.put(nullptr, &key, &data, 0); // write it out with initialization applied
-    this->db.get(nullptr, &key, &data, 0);
-    return page;
+    char *bytes = new char[this->block_size]();
+    Dbt data(bytes, this->block_size);
+    SlottedPage initializer(data, 0, true);
+    BlockID block_id = write_new(bytes);
+    return new SlottedPage(data, block_id, false, true);
 }
 
 // Gets a block from the database file for a given block id
 // The client code can then read or modify the block via the DbBlock interface
+// The block is a private copy, so it stays valid whatever other threads do with the file.
+// A block whose write was rolled back (or never happened) reads as an empty block.
 SlottedPage* HeapFile::get(BlockID block_id) {
+    return fetch(block_id, 0);
+}
+
+// Reads a block with the given Berkeley DB get flags (see get)
+SlottedPage* HeapFile::fetch(BlockID block_id, u_int32_t flags) {
+    char *bytes = new char[this->block_size];
     Dbt key(&block_id, sizeof(block_id));
-    Dbt data;
-    db.get(nullptr, &key, &data, 0);
-    SlottedPage* page = new SlottedPage(data, block_id);
-    return page;
+    Dbt data(bytes, this->block_size);
+    data.set_ulen(this->block_size);
+    data.set_flags(DB_DBT_USERMEM);
+    int result;
+    try {
+        result = db.get(Transaction::current(), &key, &data, flags);
+    } catch (...) {
+        delete[] bytes;
+        throw;
+    }
+    bool missing = result == DB_NOTFOUND || result == DB_KEYEMPTY;
+    if (missing) {
+        std::memset(bytes, 0, this->block_size);
+        data.set_size(this->block_size);
+    } else if (data.get_size() < this->block_size) {  // only compressed blocks are short
+        char *page = new char[this->block_size];
+        auto start = std::chrono::steady_clock::now();
+        bool ok = PageCodec::decompress(bytes, data.get_size(), page, this->block_size);
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        delete[] bytes;
+        if (!ok) {
+            delete[] page;
+            throw DbRelationError("block " + std::to_string(block_id) + " of " + dbfilename + " is corrupt");
+        }
+        this->blocks_decoded++;
+        this->decode_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+        data.set_data(page);
+        data.set_size(this->block_size);
+    }
+    return new SlottedPage(data, block_id, missing, true);
 }
 
-// Writes a block to the file
+// Gets a block for reading without blocking writers
+// The copy is taken optimistically and kept only if no writer had the block's latch
+// meanwhile; after a few lost races the reader takes the latch shared instead.
+// Nor does it wait for the Berkeley DB locks of uncommitted transactions: the block may
+// hold their writes, and record versions (see mvcc.h) sort out which ones to read.
+SlottedPage* HeapFile::read(BlockID block_id) {
+    const int OPTIMISTIC_TRIES = 4;
+    Profiling::page_read();
+    u_int32_t flags = dirty_reads ? DB_READ_UNCOMMITTED : 0;
+    PageLatch &latch = latches.get(block_id);
+    for (int i = 0; i < OPTIMISTIC_TRIES; i++) {
+        u_int64_t version;
+        if (!latch.read_begin(version))
+            continue;
+        SlottedPage *block = fetch(block_id, flags);
+        if (latch.read_validate(version))
+            return block;
+        delete block;
+    }
+    latch.lock_shared();
+    try {
+        SlottedPage *block = fetch(block_id, flags);
+        latch.unlock_shared();
+        return block;
+    } catch (...) {
+        latch.unlock_shared();
+        throw;
+    }
+}
+
+// Writes a block to the file (compressed, if it isn't the last block of a compressed file)
 void HeapFile::put(DbBlock *block) {
     BlockID block_id(block->get_block_id());
+    if (this->compressed && block_id < this->last) {
+        put_compressed(block_id, (const char *) block->get_block()->get_data());
+        return;
+    }
+    Dbt key(&block_id, sizeof(block_id));
+    db.put(Transaction::current(), &key, block->get_block(), 0);
+}
+
+// Writes an already formatted block (get_block_size() bytes) to the end of the file
+// Used by bulk loads that build whole pages in memory, and by appends that fill a new block
+// before anyone else can see it
+BlockID HeapFile::put_new(const char *block) {
+    return write_new(block);
+}
+
+// Allocates the next block id, writes the block there and then makes it visible as the last block
+// Ids come from an atomic counter, so concurrent writers never collide. Blocks are published
+// strictly in id order, so block_ids() never lists a block that hasn't been written yet.
+// If the writer's transaction aborts, the block is taken back off the end (see retract).
+BlockID HeapFile::write_new(const char *block) {
+    BlockID block_id = ++this->allocated;
     Dbt key(&block_id, sizeof(block_id));
-    db.put(nullptr, &key, block->get_block(), 0);
+    Dbt data((void *) block, this->block_size);
+    try {
+        db.put(Transaction::current(), &key, &data, 0);
+    } catch (...) {
+        publish(block_id);  // leave a hole (read as an empty block) rather than stall later writers
+        throw;
+    }
+    publish(block_id);
+    if (block_id > 1)  // the first block is written when the file is created and always stays
+        Transaction::on_abort([this, block_id]() { retract(block_id); });
+    if (this->compressed && block_id > 1)
+        seal(block_id - 1);
+    return block_id;
+}
+
+// Advance last to block_id once every earlier block has been published
+void HeapFile::publish(BlockID block_id) {
+    BlockID previous = block_id - 1;
+    while (!this->last.compare_exchange_weak(previous, block_id)) {
+        previous = block_id - 1;
+        std::this_thread::yield();
+    }
+}
+
+// Takes a block written by a transaction that has aborted back off the end of the file
+// The rollback has already removed its record. It goes only while it is still the last block
+// and no one has written to it since; otherwise it stays behind as a hole (an empty block).
+void HeapFile::retract(BlockID block_id) {
+    PagePairWriteGuard guard(latch(block_id - 1), latch(block_id));
+    SlottedPage *block = get(block_id);
+    RecordIDs *record_ids = block->ids();
+    bool empty = record_ids->empty();
+    delete record_ids;
+    delete block;
+    if (empty)
+        truncate(block_id);
+}
+
+// Removes the last block, block_id, which the caller has found empty under its latch
+// (and the latch of the block before it, which becomes the last block)
+// Gives up, returning false, if a newer block has been started meanwhile. A writer that
+// starts one just after is handed block_id again, and publishes it once last is back down.
+bool HeapFile::truncate(BlockID block_id) {
+    if (block_id <= 1 || this->last != block_id || this->allocated != block_id)
+        return false;
+    Dbt key(&block_id, sizeof(block_id));
+    db.del(Transaction::current(), &key, 0);
+    BlockID expected = block_id;
+    if (!this->allocated.compare_exchange_strong(expected, block_id - 1))
+        return false;  // the block is a hole now, which reads as an empty block
+    this->last = block_id - 1;
+    if (this->compressed) {
+        // the last block is never stored compressed (it tells the block size when opened)
+        SlottedPage *block = get(block_id - 1);
+        BlockID previous = block_id - 1;
+        Dbt previous_key(&previous, sizeof(previous));
+        try {
+            db.put(Transaction::current(), &previous_key, block->get_block(), 0);
+        } catch (...) {
+            delete block;
+            throw;
+        }
+        delete block;
+    }
+    return true;
+}
+
+// Returns the Berkeley DB pages freed by truncate() to the file system
+void HeapFile::compact(void) {
+    db.compact(Transaction::current(), nullptr, nullptr, nullptr, DB_FREE_SPACE, nullptr);
+}
+
+// Rewrites a block that is no longer the last one, compressed
+// Appends to it may still be finishing, so it is re-read under its latch.
+void HeapFile::seal(BlockID block_id) {
+    PageWriteGuard guard(latch(block_id));
+    SlottedPage *block = get(block_id);
+    try {
+        put(block);
+    } catch (...) {
+        delete block;
+        throw;
+    }
+    delete block;
+}
+
+// Writes a block compressed, or as is if it doesn't get any smaller
+void HeapFile::put_compressed(BlockID block_id, const char *block) {
+    std::vector<char> page(block, block + this->block_size);
+    Dbt page_data(page.data(), this->block_size);
+    SlottedPage(page_data, block_id).clear_free_space();
+    std::vector<char> packed(this->block_size);
+    size_t size = PageCodec::compress(page.data(), page.size(), packed.data(), packed.size() - 1);
+    Dbt key(&block_id, sizeof(block_id));
+    Dbt data(packed.data(), (u_int32_t) size);
+    db.put(Transaction::current(), &key, size > 0 ? &data : &page_data, 0);
+    if (size > 0) {
+        this->blocks_compressed++;
+        this->bytes_in += this->block_size;
+        this->bytes_out += size;
+    }
+}
+
+// A snapshot of the compression counters
+CompressionStats HeapFile::compression_stats() const {
+    CompressionStats stats;
+    stats.blocks_compressed = this->blocks_compressed;
+    stats.bytes_in = this->bytes_in;
+    stats.bytes_out = this->bytes_out;
+    stats.blocks_decoded = this->blocks_decoded;
+    stats.decode_ns = this->decode_ns;
+    stats.block_size = this->block_size;
+    return stats;
+}
+
+bool HeapFile::valid_block_size(uint block_size) {
+    bool power_of_two = (block_size & (block_size - 1)) == 0;
+    return power_of_two && block_size >= DbBlock::BLOCK_SZ && block_size <= DbBlock::MAX_BLOCK_SZ;
+}
+
+void HeapFile::set_block_size(uint block_size) {
+    if (!valid_block_size(block_size))
+        throw DbRelationError("block size must be a power of two from " + std::to_string(DbBlock::BLOCK_SZ)
+                              + " to " + std::to_string(DbBlock::MAX_BLOCK_SZ));
+    this->block_size = block_size;
 }
 
 // Iterates through all the block ids in the file
@@ -351,18 +1313,67 @@ BlockIDs* HeapFile::block_ids() {
     return ids;
 }
 
+// Check whether the database file is already on disk (in the environment's home directory)
+bool HeapFile::exists(void) {
+    return env_file_exists(name + ".db");
+}
+
 // Wrapper for Berkeley DB open
+// Existing files pick up where they left off: last is the highest block number in the file.
+// In a transactional environment the open commits on its own, so the handle outlives
+// an abort of whatever transaction happens to be current.
+// The handle is free-threaded (DB_THREAD), so several threads may use the file at once.
+// It also allows reads of uncommitted data, which read() uses to get past writers' locks.
+// A new file has fixed-length records unless it is to be compressed; an existing file
+// keeps whichever it was created with, and is compressed if its records aren't fixed.
 void HeapFile::db_open(uint flags) {
+    std::lock_guard<std::mutex> guard(open_mutex);
     if (closed) {
         db.set_message_stream(&std::cout);
         db.set_error_stream(&std::cerr);
-        db.set_re_len(DbBlock::BLOCK_SZ);
+        if ((flags & DB_CREATE) && !compressed)
+            db.set_re_len(block_size);
         dbfilename = name + ".db";
-        int result = db.open(nullptr, dbfilename.c_str(), nullptr, DB_RECNO, flags, 0);
+        uint open_flags = flags | DB_THREAD;
+        dirty_reads = Transaction::enabled();
+        if (dirty_reads)
+            open_flags |= DB_AUTO_COMMIT | DB_READ_UNCOMMITTED;
+        int result = db.open(nullptr, dbfilename.c_str(), nullptr, DB_RECNO, open_flags, 0);
         if(result != 0) {
-            close();
+            db.close(0);
         }
         closed = false;
+        u_int32_t re_len = 0;
+        db.get_re_len(&re_len);
+        compressed = re_len == 0;
+        if (!compressed)
+            block_size = re_len;
+        BlockID block_id = 0;
+        if (!flags) {
+            Dbc *cursor;
+            db.cursor(nullptr, &cursor, 0);
+            Dbt key(&block_id, sizeof(block_id));
+            key.set_ulen(sizeof(block_id));
+            key.set_flags(DB_DBT_USERMEM);
+            Dbt data;
+            data.set_flags(DB_DBT_PARTIAL | DB_DBT_USERMEM);  // just the key
+            data.set_ulen(0);
+            data.set_doff(0);
+            data.set_dlen(0);
+            if (cursor->get(&key, &data, DB_LAST) != 0)
+                block_id = 0;
+            cursor->close();
+            if (compressed && block_id != 0) {
+                Dbt last_block;
+                last_block.set_flags(DB_DBT_MALLOC);
+                if (db.get(nullptr, &key, &last_block, 0) == 0) {
+                    block_size = last_block.get_size();
+                    free(last_block.get_data());
+                }
+            }
+        }
+        last = block_id;
+        allocated = block_id;
     }
 }
 
@@ -375,13 +1386,32 @@ void HeapFile::db_open(uint flags) {
 HeapTable::HeapTable(Identifier table_name,
                      ColumnNames column_names,
                      ColumnAttributes column_attributes)
-    : DbRelation(table_name, column_names, column_attributes), file(table_name) {}
+    : DbRelation(table_name, column_names, column_attributes), file(table_name), overflow(table_name), moved_rows(0),
+      reclaimed_bytes(0), has_reusable(false),
+      zones(std::count_if(column_attributes.begin(), column_attributes.end(), [](ColumnAttribute &attribute) {
+          return attribute.get_data_type() == ColumnAttribute::INT;
+      })), skipped_blocks(0), filters(table_name), statistics_loaded(false) {
+    for (size_t i = 0; i < column_names.size(); i++) {
+        ColumnAttribute &attribute = this->column_attributes[i];
+        bool coded = attribute.get_data_type() == ColumnAttribute::TEXT && attribute.is_dictionary();
+        dictionaries.push_back(coded ? new ColumnDictionary(table_name, column_names[i]) : nullptr);
+    }
+    for (auto &target: insert_targets)
+        target.block = 0;
+}
+
+HeapTable::~HeapTable() {
+    for (auto dictionary: dictionaries)
+        delete dictionary;
+}
 
 // Sets up the DbFile and calls its create method
 // Corresponds to the SQL command CREATE TABLE
 void HeapTable::create() {
     try {
         file.create();
+        filters.create();
+        open_dictionaries();
     }
     catch (...) {
         std::cerr << "Failed to create table" << std::endl;
@@ -392,94 +1422,1091 @@ void HeapTable::create() {
 // Otherwise, sets up the DbFile and calls its create method
 // Corresponds to the SQL command CREATE TABLE IF NOT EXISTS
 void HeapTable::create_if_not_exists() {
-    try {
-        file.create();
-    } catch (...) {
+    // check first: a Berkeley DB handle can't be reused after a failed open
+    if (file.exists()) {
         file.open();
+        filters.open(file.get_last_block_id());
+    } else {
+        file.create();
+        filters.create();
     }
+    open_dictionaries();
 }
 
-// Deletes the underlying DbFile
+// Deletes the underlying DbFile and any dictionaries, overflow pages, Bloom filters and statistics
 // Corresponds to the SQL command DROP TABLE
 void HeapTable::drop() {
     file.drop();
+    for (auto &target: insert_targets)
+        target.block = 0;
+    zones.clear();
+    filters.drop();
+    TableStatistics::drop(table_name);
+    {
+        std::lock_guard<std::mutex> guard(statistics_mutex);
+        statistics.reset();
+        statistics_loaded = true;
+    }
+    overflow.drop();
+    for (auto dictionary: dictionaries)
+        if (dictionary != nullptr)
+            dictionary->drop();
 }
 
 // Opens the table for insert, update, delete, select, and project methods
 void HeapTable::open() {
     file.open();
+    filters.open(file.get_last_block_id());
+    open_dictionaries();
 }
 
 // Closes the table, temporarily disabling insert, update, delete, select, and project methods
 void HeapTable::close() {
     file.close();
+    overflow.close();
+    filters.close();
+    for (auto dictionary: dictionaries)
+        if (dictionary != nullptr)
+            dictionary->close();
+}
+
+// Picks the TEXT columns for create() to build Bloom filters over
+void HeapTable::set_bloom_filters(const ColumnNames &columns, double false_positive_rate) {
+    std::vector<size_t> indices;
+    for (auto const &column: columns) {
+        size_t i = std::find(column_names.begin(), column_names.end(), column) - column_names.begin();
+        if (i == column_names.size() || column_attributes[i].get_data_type() != ColumnAttribute::TEXT)
+            throw DbRelationError("Bloom filters need a TEXT column, not " + column);
+        indices.push_back(i);
+    }
+    filters.set_columns(indices, false_positive_rate);
 }
 
 // Takes a proposed row and adds it to the table
 // Corresponds to the SQL command INSERT INTO TABLE
 Handle HeapTable::insert(const ValueDict *row) {
-    file.open();
+    open();
 
     // Determine the block to write to, marshal the data, and write it to the block
-    return append(validate(row));
+    ValueDict *full_row = validate(row);
+    Handle handle = append(full_row);
+    delete full_row;
+    return handle;
 }
 
-// TODO: implement update
+// Writes a new version of the row, after saving the current one as a copy at the end of the
+// file for the snapshots that still read it
+// The new version replaces the current one where it is (with SlottedPage::put) if it fits.
+// If not, it is appended elsewhere and the row's handle becomes a forwarding stub to it, so
+// handles stay valid however much a row grows.
+// Fails if another transaction has changed or deleted the row since this transaction's
+// snapshot was taken (the first updater wins).
+// Corresponds to the SQL command UPDATE ... SET ... WHERE ...
 void HeapTable::update(const Handle handle, const ValueDict *new_values) {
-    throw "Not implemented";
+    open();
+    Transaction transaction;  // joins the caller's, if any
+    ValueDict *row = project(handle);
+    for (auto const& new_value: *new_values) {
+        if (row->find(new_value.first) == row->end()) {
+            delete row;
+            throw DbRelationError("unknown column " + new_value.first);
+        }
+        (*row)[new_value.first] = new_value.second;
+    }
+    Dbt *data = marshal(row);
+    delete row;
+    TxnID me = Transaction::id();
+    Handle moved(0, 0);  // where the new version went, if it had to move
+    try {
+        // save the current version
+        const Snapshot &snapshot = *ReadView::current();
+        Handle current = locate(handle);
+        SlottedPage *block = file.get(current.first);
+        Dbt *old = block->get(current.second);
+        delete block;
+        RecordVersion version;
+        bool changed = !version.read(old) || !snapshot.sees(version.xmin) || version.xmax != 0;
+        Handle copy;
+        if (!changed) {
+            RecordVersion saved = version;
+            saved.xmax = me;
+            saved.flags = RecordVersion::COPY;
+            saved.write(old->get_data());
+            try {
+                copy = append(old);
+            } catch (...) {
+                delete[] (char *) old->get_data();
+                delete old;
+                throw;
+            }
+        }
+        delete[] (char *) old->get_data();
+        delete old;
+        if (changed)
+            throw DbRelationError("could not serialize update: row was changed by a concurrent transaction");
+
+        // replace it, unless another writer got there in the meantime; if it doesn't fit,
+        // move it out (with no latch held, as appends take their own) and come back for the stub
+        RecordVersion newest(me);
+        newest.prev_block = copy.first;
+        newest.prev_record = copy.second;
+        bool done = false;
+        while (!done) {
+            {
+                PagePairWriteGuard guard(file.latch(handle.first), file.latch(current.first));
+                widen_zone(handle.first, data);  // scans reach the new version through the handle's block
+                RecordVersion now;
+                changed = locate(handle) != current || !read_version(current, now) || now.xmin != version.xmin
+                          || now.xmax != 0;
+                if (!changed && moved.first == 0) {
+                    newest.flags = current == handle ? 0 : RecordVersion::MOVED;
+                    newest.write(data->get_data());
+                    done = replace(current, data);
+                } else if (!changed) {
+                    RecordVersion stub(me);
+                    stub.flags = RecordVersion::FORWARD;
+                    stub.prev_block = moved.first;
+                    stub.prev_record = moved.second;
+                    replace(handle, stub);
+                    if (current != handle) {
+                        // the previously moved version is a copy now: leave a header leading to it
+                        RecordVersion left(me);
+                        left.xmax = me;
+                        left.prev_block = copy.first;
+                        left.prev_record = copy.second;
+                        left.flags = RecordVersion::MOVED | RecordVersion::COPY;
+                        replace(current, left);
+                    }
+                    done = true;
+                }
+            }
+            if (changed)
+                throw DbRelationError("could not serialize update: row was changed by a concurrent transaction");
+            if (!done) {
+                newest.flags = RecordVersion::MOVED;
+                newest.write(data->get_data());
+                moved = append(data);
+                this->moved_rows++;
+            }
+        }
+    } catch (...) {
+        if (moved.first != 0) {
+            // never reachable; leave just a header for collect_garbage() to remove
+            RecordVersion dead(me);
+            dead.xmax = me;
+            dead.flags = RecordVersion::MOVED | RecordVersion::COPY;
+            PageWriteGuard guard(file.latch(moved.first));
+            replace(moved, dead);
+        }
+        free_overflow(data);  // the new version's out of line values
+        delete[] (char *) data->get_data();
+        delete data;
+        throw;
+    }
+    try {
+        add_keys(handle.first, data);  // scans reach the new version through the handle's block
+    } catch (...) {
+        delete[] (char *) data->get_data();
+        delete data;
+        throw;
+    }
+    delete[] (char *) data->get_data();
+    delete data;
+    transaction.commit();
 }
 
-// TODO: implement del
+// Marks the row as deleted by this transaction; snapshots that don't see the delete still
+// read it until collect_garbage() removes it (along with its forwarding stub, if it has one)
+// Fails like update() if another transaction has changed or deleted the row meanwhile.
+// Corresponds to the SQL command DELETE FROM ... WHERE ...
 void HeapTable::del(const Handle handle) {
-    throw "Not implemented";
+    file.open();
+    Transaction transaction;  // joins the caller's, if any
+    const Snapshot &snapshot = *ReadView::current();
+    TxnID me = Transaction::id();
+    bool changed = false;
+    for (bool done = false; !done;) {
+        Handle current = locate(handle);
+        PagePairWriteGuard guard(file.latch(handle.first), file.latch(current.first));
+        if (locate(handle) != current)
+            continue;  // moved meanwhile
+        RecordVersion version;
+        changed = !read_version(current, version) || version.is_copy() || !snapshot.sees(version.xmin)
+                  || version.xmax != 0;
+        if (!changed) {
+            version.xmax = me;
+            put_version(current, version);
+            if (current != handle) {
+                RecordVersion stub;
+                read_version(handle, stub);
+                stub.xmax = me;
+                put_version(handle, stub);
+            }
+        }
+        done = true;
+    }
+    if (changed)
+        throw DbRelationError("could not serialize delete: row was changed by a concurrent transaction");
+    transaction.commit();
 }
 
-// Returns handles to the matching rows
+// Returns handles to the rows visible to the thread's snapshot (or a new one)
+// The blocks are read ahead (see ReadAhead), so the scan rarely waits for a read.
 // Corresponds to the SQL query SELECT * FROM...
 Handles* HeapTable::select() {
+    ReadView view;
     Handles* handles = new Handles();
     BlockIDs* block_ids = file.block_ids();
-    for (auto const& block_id: *block_ids) {
-        SlottedPage* block = file.get(block_id);
+    ReadAhead pages([this](BlockID block_id) { return file.read(block_id); }, *block_ids);
+    delete block_ids;
+    BlockID block_id;
+    while (SlottedPage* block = pages.next(block_id)) {
         RecordIDs* record_ids = block->ids();
-        for (auto const& record_id: *record_ids)
+        for (auto const& record_id: *record_ids) {
+            Dbt *data = visible(block, record_id, view.get());
+            if (data == nullptr)
+                continue;
             handles->push_back(Handle(block_id, record_id));
+            delete[] (char *) data->get_data();
+            delete data;
+        }
         delete record_ids;
         delete block;
     }
-    delete block_ids;
     return handles;
 }
 
-// TODO: implement select with where clause
+// Returns handles to the rows matching every column = value pair in where
+// The conditions are tested on the marshaled records, so rows that don't match are never unmarshaled.
+// Corresponds to the SQL query SELECT * FROM ... WHERE ...
 Handles* HeapTable::select(const ValueDict *where) {
-    throw "Not implemented";
+    return select(where, SIZE_MAX);
+}
+
+// Returns handles to the first limit rows matching where (all rows if where is null)
+// Blocks are read in order and the scan stops as soon as it has limit rows, so a small
+// limit only reads the first few blocks that hold matching rows.
+// Corresponds to the SQL query SELECT * FROM ... WHERE ... LIMIT ...
+Handles* HeapTable::select(const ValueDict *where, size_t limit) {
+    return select(where, limit, nullptr);
+}
+
+// Drops the blocks that aren't in the sample (if there is one)
+static void take_sample(BlockIDs &block_ids, const BlockSample *sample) {
+    if (sample == nullptr)
+        return;
+    block_ids.erase(std::remove_if(block_ids.begin(), block_ids.end(),
+                                   [sample](BlockID block_id) { return !sample->contains(block_id); }),
+                    block_ids.end());
+}
+
+// As above, but only reading the blocks in the sample (all of them if it is null)
+// Without a limit the blocks are read ahead; with one they are read one at a time, so
+// the scan doesn't read past the block where it stops.
+// Corresponds to the SQL query SELECT * FROM ... TABLESAMPLE SYSTEM (...) WHERE ... LIMIT ...
+Handles* HeapTable::select(const ValueDict *where, size_t limit, const BlockSample *sample) {
+    ReadView view;
+    Predicates predicates = compile(where);
+    WhereProgram where_program = program(predicates);
+    Handles* handles = new Handles();
+    if (limit == 0)
+        return handles;
+    BlockIDs* block_ids = file.block_ids();
+    prune(*block_ids, predicates);
+    take_sample(*block_ids, sample);
+    ReadAhead pages([this](BlockID block_id) { return file.read(block_id); }, *block_ids,
+                    limit == SIZE_MAX ? ReadAhead::DEFAULT_DEPTH : 0);
+    delete block_ids;
+    BlockID block_id;
+    while (SlottedPage* block = pages.next(block_id)) {
+        RecordIDs* record_ids = block->ids();
+        for (auto const& record_id: *record_ids) {
+            Dbt *data = visible(block, record_id, view.get());
+            if (data == nullptr)
+                continue;
+            if (matches(data, where_program))
+                handles->push_back(Handle(block_id, record_id));
+            delete[] (char *) data->get_data();
+            delete data;
+            if (handles->size() == limit)
+                break;
+        }
+        delete record_ids;
+        delete block;
+        if (handles->size() == limit)
+            break;
+    }
+    return handles;
+}
+
+// Visits every row matching where using n_workers threads.
+// Workers claim whole blocks and read them optimistically (see HeapFile::read), so they
+// neither wait for each other nor hold up concurrent inserts. The blocks are read ahead
+// of the workers, at least two per worker (see ReadAhead). All of them read through
+// the caller's snapshot, and charge their work to the operator the caller is profiling.
+// Only the columns asked for are decoded, and only from the rows that match, and only
+// the blocks in the sample are read.
+void HeapTable::parallel_scan(const ValueDict *where, unsigned int n_workers, RowVisitor visit,
+                              const ColumnNames *column_names, const BlockSample *sample) {
+    if (n_workers < 1)
+        n_workers = 1;
+    ReadView view;
+    const Snapshot *snapshot = &view.get();
+    Predicates predicates = compile(where);
+    WhereProgram where_program = program(predicates);
+    BlockIDs* block_ids = file.block_ids();
+    prune(*block_ids, predicates);
+    take_sample(*block_ids, sample);
+    ReadAhead pages([this](BlockID block_id) { return file.read(block_id); }, *block_ids,
+                    std::max((uint) ReadAhead::DEFAULT_DEPTH, 2 * n_workers));
+    delete block_ids;
+    std::mutex failure_mutex;
+    std::exception_ptr failure;
+    OperatorProfile *profile = Profiling::current();
+
+    auto worker = [&](unsigned int worker_id) {
+        ReadView worker_view(snapshot);
+        Profiling profiling(worker_id == 0 ? nullptr : profile, false);
+        try {
+            BlockID block_id;
+            while (SlottedPage *block = pages.next(block_id)) {
+                RecordIDs *record_ids = block->ids();
+                for (auto const &record_id: *record_ids) {
+                    Dbt *data = visible(block, record_id, *snapshot);
+                    if (data == nullptr)
+                        continue;
+                    if (matches(data, where_program)) {
+                        ValueDict *row = column_names != nullptr && column_names->empty() ? new ValueDict
+                                                                                          : unmarshal(data, column_names);
+                        visit(worker_id, Handle(block_id, record_id), row);
+                        delete row;
+                    }
+                    delete[] (char *) data->get_data();
+                    delete data;
+                }
+                delete record_ids;
+                delete block;
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> guard(failure_mutex);
+            if (!failure)
+                failure = std::current_exception();
+            pages.stop();  // stop the other workers early
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned int w = 1; w < n_workers; w++)
+        threads.push_back(std::thread(worker, w));
+    worker(0);
+    for (auto &thread: threads)
+        thread.join();
+    if (failure)
+        std::rethrow_exception(failure);
+}
+
+// Bulk loads a CSV file, writing full pages after the table's current last block
+// Corresponds to the SQL command IMPORT FROM CSV FILE ... INTO ...
+size_t HeapTable::import_csv(const std::string &file_path, unsigned int n_workers) {
+    open();
+    CSVImport import(column_names, column_attributes, dictionaries, &overflow);
+    BlockID before = file.get_last_block_id();
+    size_t rows = import.load(file_path, file, n_workers);
+    if (zones.is_built()) {
+        // the new blocks hold nothing but new rows
+        BlockIDs loaded;
+        for (BlockID block_id = before + 1; block_id <= file.get_last_block_id(); block_id++)
+            loaded.push_back(block_id);
+        ReadAhead pages([this](BlockID block_id) { return file.read(block_id); }, loaded);
+        BlockID block_id;
+        while (SlottedPage *block = pages.next(block_id)) {
+            RecordIDs *record_ids = block->ids();
+            for (auto const &record_id: *record_ids) {
+                Dbt *data = block->get(record_id);
+                widen_zone(block_id, data);
+                delete[] (char *) data->get_data();
+                delete data;
+            }
+            delete record_ids;
+            delete block;
+        }
+    }
+    if (filters.is_enabled()) {
+        // every block but the new last one is full (or, for the old last one, done with)
+        for (BlockID block_id = std::max(before, (BlockID) 1); block_id < file.get_last_block_id(); block_id++)
+            seal(block_id);
+    }
+    return rows;
+}
+
+// Removes the versions replaced or deleted by transactions below horizon
+// Each block is looked over with a non-blocking read first and only latched if it has any.
+// Removing a version just clears its slot (see SlottedPage::del); vacuum() later compacts
+// the blocks this leaves fragmented.
+// A moved row's newest version goes only together with its forwarding stub, under both
+// their latches: slots are reused, so the stub must never outlive the version it points at.
+size_t HeapTable::collect_garbage(TxnID horizon) {
+    file.open();
+    auto dead = [horizon](const RecordVersion &version) {
+        return version.xmax != 0 && version.xmax < horizon && (!version.is_moved() || version.is_copy());
+    };
+    auto dead_ids = [&dead](SlottedPage *block) {
+        RecordIDs dead_ids;
+        RecordIDs *record_ids = block->ids();
+        for (auto const &record_id: *record_ids) {
+            Dbt *data = block->get(record_id);
+            RecordVersion version;
+            if (version.read(data) && dead(version))
+                dead_ids.push_back(record_id);
+            delete[] (char *) data->get_data();
+            delete data;
+        }
+        delete record_ids;
+        return dead_ids;
+    };
+
+    size_t removed = 0;
+    std::vector<BlockID> collected;
+    Handles stubs;
+    BlockIDs *block_ids = file.block_ids();
+    for (auto const &block_id: *block_ids) {
+        SlottedPage *block = file.read(block_id);
+        bool garbage = !dead_ids(block).empty();
+        delete block;
+        if (!garbage)
+            continue;
+        PageWriteGuard guard(file.latch(block_id));
+        block = file.get(block_id);
+        RecordIDs found = dead_ids(block);
+        size_t cleared = 0;
+        for (auto const &record_id: found) {
+            Dbt *data = block->get(record_id);
+            RecordVersion version;
+            version.read(data);
+            if (version.is_forward()) {
+                stubs.push_back(Handle(block_id, record_id));
+            } else {
+                free_overflow(data);
+                block->del(record_id);
+                cleared++;
+            }
+            delete[] (char *) data->get_data();
+            delete data;
+        }
+        if (cleared > 0) {
+            file.put(block);
+            collected.push_back(block_id);
+        }
+        removed += cleared;
+        delete block;
+    }
+    delete block_ids;
+
+    for (auto const &stub: stubs) {
+        Handle target = locate(stub);
+        PagePairWriteGuard guard(file.latch(stub.first), file.latch(target.first));
+        RecordVersion version;
+        if (!read_version(stub, version) || !dead(version) || locate(stub) != target)
+            continue;
+        remove(target);
+        remove(stub);
+        collected.push_back(target.first);
+        collected.push_back(stub.first);
+        removed += 2;
+    }
+    std::lock_guard<std::mutex> guard(vacuum_mutex);
+    collected_blocks.insert(collected_blocks.end(), collected.begin(), collected.end());
+    return removed;
+}
+
+// Reclaims the space collect_garbage() has freed
+// The blocks it has cleared slots in since the last time are compacted if enough of them
+// is taken up by dead records, and those left at least half empty take inserts again (see
+// append()). Empty blocks at the end of the file are removed.
+// Returns the number of bytes reclaimed.
+size_t HeapTable::vacuum() {
+    file.open();
+    std::vector<BlockID> blocks;
+    {
+        std::lock_guard<std::mutex> guard(vacuum_mutex);
+        blocks.swap(collected_blocks);
+    }
+    std::sort(blocks.begin(), blocks.end());
+    blocks.erase(std::unique(blocks.begin(), blocks.end()), blocks.end());
+
+    uint block_size = file.get_block_size();
+    size_t reclaimed = 0;
+    std::vector<BlockID> reusable;
+    for (auto const &block_id: blocks) {
+        PageWriteGuard guard(file.latch(block_id));
+        if (block_id > file.get_last_block_id())
+            continue;
+        SlottedPage *block = file.get(block_id);
+        try {
+            if (block->dead_space() >= block_size / 8) {
+                reclaimed += block->compact();
+                file.put(block);
+            }
+            RecordIDs *record_ids = block->ids();
+            if (record_ids->empty()) {
+                zones.reset(block_id);  // nothing left for a scan to reach from here
+                filters.reset(block_id);
+            }
+            delete record_ids;
+            if (block_id < file.get_last_block_id() && block->free_space() >= block_size / 2)
+                reusable.push_back(block_id);
+        } catch (...) {
+            delete block;
+            throw;
+        }
+        delete block;
+    }
+
+    // empty blocks at the end of the file (the first block always stays)
+    size_t truncated = 0;
+    for (BlockID block_id = file.get_last_block_id(); block_id > 1; block_id--) {
+        PagePairWriteGuard guard(file.latch(block_id - 1), file.latch(block_id));
+        SlottedPage *block = file.get(block_id);
+        RecordIDs *record_ids = block->ids();
+        bool empty = record_ids->empty();
+        delete record_ids;
+        delete block;
+        if (!empty || !file.truncate(block_id))
+            break;
+        zones.reset(block_id);
+        filters.reset(block_id);
+        truncated++;
+    }
+    if (truncated > 0)
+        file.compact();
+    reclaimed += truncated * block_size;
+
+    {
+        std::lock_guard<std::mutex> guard(vacuum_mutex);
+        BlockID last = file.get_last_block_id();
+        for (auto const &block_id: reusable) {
+            if (std::find(reusable_blocks.begin(), reusable_blocks.end(), block_id) == reusable_blocks.end())
+                reusable_blocks.push_back(block_id);
+        }
+        reusable_blocks.erase(std::remove_if(reusable_blocks.begin(), reusable_blocks.end(),
+                                             [last](BlockID block_id) { return block_id >= last; }),
+                              reusable_blocks.end());
+        has_reusable = !reusable_blocks.empty();
+    }
+    this->reclaimed_bytes += reclaimed;
+    return reclaimed;
+}
+
+// Estimates the table's statistics from up to sample_blocks of its blocks, picked at random,
+// and keeps them (in memory and in the statistics file)
+// Only rows visible to the thread's snapshot (or a new one) count. A column whose sampled
+// values were nearly all distinct (a key, say) is taken to stay that way in the blocks not
+// sampled, so its distinct count scales with the table; any other column's values have
+// mostly shown up in the sample already, so its count is taken as it is.
+// Corresponds to the SQL command ANALYZE
+std::shared_ptr<const TableStatistics> HeapTable::analyze(size_t sample_blocks) {
+    open();
+    ReadView view;
+    BlockIDs *block_ids = file.block_ids();
+    u_int32_t n_blocks = (u_int32_t) block_ids->size();
+    if (sample_blocks < block_ids->size()) {
+        std::mt19937 random(std::random_device{}());
+        for (size_t i = 0; i < sample_blocks; i++)
+            std::swap((*block_ids)[i], (*block_ids)[i + random() % (block_ids->size() - i)]);
+        block_ids->resize(sample_blocks);
+        std::sort(block_ids->begin(), block_ids->end());
+    }
+
+    std::vector<HyperLogLog> distinct(column_names.size());
+    std::vector<std::vector<int32_t>> ints(column_names.size());
+    std::vector<double> lengths(column_names.size(), 0);
+    double sampled_rows = 0;
+    for (auto const &block_id: *block_ids) {
+        SlottedPage *block = file.read(block_id);
+        RecordIDs *record_ids = block->ids();
+        for (auto const &record_id: *record_ids) {
+            Dbt *data = visible(block, record_id, view.get());
+            if (data == nullptr)
+                continue;
+            ValueDict *row = unmarshal(data);
+            delete[] (char *) data->get_data();
+            delete data;
+            for (size_t i = 0; i < column_names.size(); i++) {
+                const Value &value = row->at(column_names[i]);
+                distinct[i].add(value);
+                if (value.data_type == ColumnAttribute::INT)
+                    ints[i].push_back(value.n);
+                else
+                    lengths[i] += value.s.length();
+            }
+            delete row;
+            sampled_rows++;
+        }
+        delete record_ids;
+        delete block;
+    }
+
+    TableStatistics *gathered = new TableStatistics();
+    gathered->blocks = n_blocks;
+    gathered->sampled_blocks = (u_int32_t) block_ids->size();
+    delete block_ids;
+    double scale = gathered->sampled_blocks == 0 ? 0 : (double) n_blocks / gathered->sampled_blocks;
+    gathered->rows = sampled_rows * scale;
+    for (size_t i = 0; i < column_names.size(); i++) {
+        ColumnStatistics column(column_attributes[i].get_data_type());
+        double seen = std::min(distinct[i].estimate(), sampled_rows);
+        column.distinct = seen >= 0.9 * sampled_rows ? std::min(seen * scale, gathered->rows) : seen;
+        if (column.data_type == ColumnAttribute::INT && !ints[i].empty()) {
+            std::vector<int32_t> &values = ints[i];
+            std::sort(values.begin(), values.end());
+            column.min = values.front();
+            column.max = values.back();
+            size_t buckets = std::min((size_t) ColumnStatistics::BUCKETS, values.size());
+            for (size_t b = 0; b <= buckets; b++)
+                column.bounds.push_back(values[(values.size() - 1) * b / buckets]);
+        } else if (sampled_rows > 0) {
+            column.average_length = lengths[i] / sampled_rows;
+        }
+        gathered->columns.push_back(column);
+    }
+    try {
+        gathered->save(table_name);
+    } catch (...) {
+        delete gathered;
+        throw;
+    }
+    std::lock_guard<std::mutex> guard(statistics_mutex);
+    statistics.reset(gathered);
+    statistics_loaded = true;
+    return statistics;
+}
+
+// The statistics of the last analyze(), read from the statistics file the first time
+std::shared_ptr<const TableStatistics> HeapTable::get_statistics() {
+    std::lock_guard<std::mutex> guard(statistics_mutex);
+    if (!statistics_loaded) {
+        statistics.reset(TableStatistics::load(table_name));
+        statistics_loaded = true;
+    }
+    return statistics;
 }
 
-// Extracts all fields from a row handle
+// Extracts all fields from a row handle, as of the thread's snapshot
 ValueDict* HeapTable::project(Handle handle) {
-    BlockID block_id = handle.first;
-    RecordID record_id = handle.second;
-    SlottedPage *block = file.get(block_id);
-    Dbt *data = block->get(record_id);
-    ValueDict *row = unmarshal(data);
-    return row;
+    return project(handle, nullptr);
 }
 
-// Extracts specific fields from a row handle
+// Extracts specific fields from a row handle (all of them if column_names is empty)
+// Only the overflow pages of the fields asked for are read.
 ValueDict* HeapTable::project(Handle handle, const ColumnNames *column_names) {
-    BlockID block_id = handle.first;
-    RecordID record_id = handle.second;
-    SlottedPage *block = file.get(block_id);
+    check_columns(column_names);
+    ReadView view;
+    SlottedPage *block = file.read(handle.first);
+    Dbt *data = visible(block, handle.second, view.get());
+    delete block;
+    if (data == nullptr)
+        throw DbRelationError("row is not visible to this transaction");
+    ValueDict *row;
+    try {
+        row = unmarshal(data, column_names);
+    } catch (...) {
+        delete[] (char *) data->get_data();
+        delete data;
+        throw;
+    }
+    delete[] (char *) data->get_data();
+    delete data;
+    return row;
+}
+
+// Extracts specific fields from many rows, as of the thread's snapshot
+// Runs of handles into the same block share one read of it, so projecting the rows a
+// select() found reads each of their blocks once rather than once per row.
+ValueDicts* HeapTable::project(const Handles *handles, const ColumnNames *column_names) {
+    check_columns(column_names);
+    ReadView view;
+    ValueDicts *rows = new ValueDicts;
+    SlottedPage *block = nullptr;
+    try {
+        for (auto const &handle: *handles) {
+            if (block == nullptr || block->get_block_id() != handle.first) {
+                delete block;
+                block = nullptr;
+                block = file.read(handle.first);
+            }
+            Dbt *data = visible(block, handle.second, view.get());
+            if (data == nullptr)
+                throw DbRelationError("row is not visible to this transaction");
+            try {
+                rows->push_back(unmarshal(data, column_names));
+            } catch (...) {
+                delete[] (char *) data->get_data();
+                delete data;
+                throw;
+            }
+            delete[] (char *) data->get_data();
+            delete data;
+        }
+    } catch (...) {
+        delete block;
+        for (auto row: *rows)
+            delete row;
+        delete rows;
+        throw;
+    }
+    delete block;
+    return rows;
+}
+
+// Throws if any of column_names isn't one of the table's
+void HeapTable::check_columns(const ColumnNames *column_names) {
+    if (column_names != nullptr)
+        for (auto const &column_name: *column_names)
+            if (std::find(this->column_names.begin(), this->column_names.end(), column_name) == this->column_names.end())
+                throw DbRelationError("unknown column " + column_name);
+}
+
+// Finds the version of the record at record_id that snapshot reads, following the row's
+// forwarding stub if it has moved and then the chain of older versions if the newest one is too new
+// Returns it (freed by caller), or nullptr if the snapshot sees no version of this row, or if
+// the slot holds an older or moved version (which only its row's handle leads to).
+Dbt* HeapTable::visible(SlottedPage *block, RecordID record_id, const Snapshot &snapshot) {
     Dbt *data = block->get(record_id);
-    ValueDict *row = unmarshal(data);
-    if (column_names->empty())
-        return row;
-    ValueDict *result = new ValueDict;
-    for (auto const& column_name : *column_names) {
-        (*result)[column_name] = (*row)[column_name];
+    RecordVersion version;
+    bool found = version.read(data) && !version.is_copy() && !version.is_moved();
+    if (found && version.is_forward()) {
+        Handle moved = version.prev();
+        delete[] (char *) data->get_data();
+        delete data;
+        SlottedPage *moved_block = file.read(moved.first);
+        data = moved_block->get(moved.second);
+        delete moved_block;
+        found = version.read(data) && version.is_moved();  // not a reused slot
     }
-    return result;
+    while (found && !snapshot.visible(version)) {
+        // deleted as far as the snapshot is concerned, or written after it with nothing older
+        found = !snapshot.sees(version.xmin) && version.has_prev();
+        if (!found)
+            break;
+        Handle prev = version.prev();
+        delete[] (char *) data->get_data();
+        delete data;
+        SlottedPage *prev_block = file.read(prev.first);
+        data = prev_block->get(prev.second);
+        delete prev_block;
+        found = version.read(data);
+    }
+    if (!found) {
+        delete[] (char *) data->get_data();
+        delete data;
+        return nullptr;
+    }
+    return data;
+}
+
+// Where the row at handle keeps its newest version: handle itself, unless the row has moved
+Handle HeapTable::locate(Handle handle) {
+    RecordVersion version;
+    if (read_version(handle, version) && version.is_forward())
+        return version.prev();
+    return handle;
+}
+
+// Reads the version header of the record at a handle; false if the slot is empty
+bool HeapTable::read_version(Handle at, RecordVersion &version) {
+    SlottedPage *block = file.get(at.first);
+    Dbt *data = block->get(at.second);
+    delete block;
+    bool found = version.read(data);
+    delete[] (char *) data->get_data();
+    delete data;
+    return found;
+}
+
+// Rewrites the version header of the record at a handle, leaving its fields as they are
+// The caller holds the block's latch.
+void HeapTable::put_version(Handle at, const RecordVersion &version) {
+    SlottedPage *block = file.get(at.first);
+    Dbt *data = block->get(at.second);
+    try {
+        version.write(data->get_data());
+        block->put(at.second, *data);  // same size, so it stays where it is
+        file.put(block);
+    } catch (...) {
+        delete[] (char *) data->get_data();
+        delete data;
+        delete block;
+        throw;
+    }
+    delete[] (char *) data->get_data();
+    delete data;
+    delete block;
+}
+
+// Replaces the record at a handle; false if the new one doesn't fit in the block
+// The caller holds the block's latch.
+bool HeapTable::replace(Handle at, const Dbt *data) {
+    SlottedPage *block = file.get(at.first);
+    try {
+        block->put(at.second, *data);
+        file.put(block);
+    } catch (DbBlockNoRoomError &e) {
+        delete block;
+        return false;
+    } catch (...) {
+        delete block;
+        throw;
+    }
+    delete block;
+    return true;
+}
+
+// Replaces the record at a handle with a bare version header (which always fits)
+void HeapTable::replace(Handle at, const RecordVersion &version) {
+    char bytes[RecordVersion::SIZE];
+    version.write(bytes);
+    Dbt data(bytes, sizeof(bytes));
+    replace(at, &data);
+}
+
+// Removes the record at a handle for good, along with its overflow pages
+// The caller holds the block's latch.
+void HeapTable::remove(Handle at) {
+    SlottedPage *block = file.get(at.first);
+    Dbt *data = block->get(at.second);
+    try {
+        free_overflow(data);
+        block->del(at.second);
+        file.put(block);
+    } catch (...) {
+        delete[] (char *) data->get_data();
+        delete data;
+        delete block;
+        throw;
+    }
+    delete[] (char *) data->get_data();
+    delete data;
+    delete block;
+}
+
+// Drops the blocks whose zones rule out the INT equality conditions among predicates, and
+// those whose Bloom filters rule out the TEXT ones
+// The zone map is built first if this is the first select that can use it.
+void HeapTable::prune(BlockIDs &block_ids, const Predicates &predicates) {
+    if (filters.is_enabled()) {
+        std::vector<u_int64_t> keys;
+        const std::vector<size_t> &filtered = filters.get_columns();
+        for (auto const &predicate: predicates)
+            if (predicate.value.data_type == ColumnAttribute::TEXT
+                && std::find(filtered.begin(), filtered.end(), predicate.column) != filtered.end())
+                keys.push_back(BloomFile::hash(predicate.column, predicate.value.s));
+        this->skipped_blocks += filters.prune(block_ids, keys);
+    }
+
+    ZoneMap::Ranges ranges;
+    size_t zone_column = 0;
+    Predicates::const_iterator predicate = predicates.begin();
+    for (size_t i = 0; i < column_attributes.size() && predicate != predicates.end(); i++) {
+        if (column_attributes[i].get_data_type() != ColumnAttribute::INT)
+            continue;
+        for (; predicate != predicates.end() && predicate->column < i; predicate++);
+        for (; predicate != predicates.end() && predicate->column == i; predicate++) {
+            if (predicate->value.data_type == ColumnAttribute::INT) {
+                ZoneMap::Range range = {zone_column, predicate->value.n, predicate->value.n};
+                ranges.push_back(range);
+            }
+        }
+        zone_column++;
+    }
+    if (ranges.empty())
+        return;
+    build_zones();
+    this->skipped_blocks += zones.prune(block_ids, ranges);
+}
+
+// Fills in the zone map with one pass over the table
+// A block's zone takes in every version reachable() from the block. Writes widen the
+// zones as they go, so the map stays complete even when they race the build.
+void HeapTable::build_zones() {
+    if (zones.is_built() || zones.get_n_columns() == 0)
+        return;
+    std::lock_guard<std::mutex> guard(zones_mutex);
+    if (zones.is_built())
+        return;
+    TxnID horizon = VersionManager::horizon();
+    BlockIDs *block_ids = file.block_ids();
+    for (auto const &block_id: *block_ids) {
+        SlottedPage *block = file.read(block_id);
+        RecordIDs *record_ids = block->ids();
+        for (auto const &record_id: *record_ids)
+            reachable(block, record_id, horizon, [this, block_id](const Dbt *data) { widen_zone(block_id, data); });
+        delete record_ids;
+        delete block;
+    }
+    delete block_ids;
+    zones.set_built();
+}
+
+// Visits every version a snapshot may reach from a block's record: the row's newest version
+// (behind its stub, if it has moved) and the older ones down the chain that some snapshot
+// newer than horizon may still read. Copies and moved versions are only reached this way.
+void HeapTable::reachable(SlottedPage *block, RecordID record_id, TxnID horizon,
+                          const std::function<void(const Dbt *)> &visit) {
+    const int MAX_CHAIN = 64;  // guards against a chain gone astray through a reused slot
+    Dbt *data = block->get(record_id);
+    RecordVersion version;
+    bool found = version.read(data) && !version.is_copy() && !version.is_moved();
+    try {
+        for (int hops = 0; found && hops < MAX_CHAIN; hops++) {
+            Handle next = version.prev();
+            if (!version.is_forward()) {
+                visit(data);
+                found = version.has_prev() && version.xmin >= horizon;  // else nobody reads further back
+            }
+            if (!found)
+                break;
+            delete[] (char *) data->get_data();
+            delete data;
+            data = nullptr;
+            SlottedPage *other = file.read(next.first);
+            data = other->get(next.second);
+            delete other;
+            found = version.read(data);
+        }
+    } catch (...) {
+        if (data != nullptr) {
+            delete[] (char *) data->get_data();
+            delete data;
+        }
+        throw;
+    }
+    delete[] (char *) data->get_data();
+    delete data;
+}
+
+// Builds the Bloom filter of a block that has filled up
+// Rows written into the block from start() on add their keys themselves (see add_keys), so
+// the block is only read after it.
+void HeapTable::seal(BlockID block_id) {
+    if (!filters.is_enabled() || block_id == 0)
+        return;
+    filters.start(block_id);
+    TxnID horizon = VersionManager::horizon();
+    std::vector<u_int64_t> keys;
+    SlottedPage *block = file.read(block_id);
+    RecordIDs *record_ids = block->ids();
+    try {
+        for (auto const &record_id: *record_ids)
+            reachable(block, record_id, horizon, [this, &keys](const Dbt *data) { filter_keys(data, keys); });
+    } catch (...) {
+        delete record_ids;
+        delete block;
+        throw;
+    }
+    delete record_ids;
+    delete block;
+    filters.finish(block_id, keys);
+}
+
+// Adds a marshaled record's keys to the Bloom filter of the block it was just written into
+// Only blocks that have (or are getting) a filter need them: any other block is read in
+// full once it is sealed, after the record is already in it.
+void HeapTable::add_keys(BlockID block_id, const Dbt *data) {
+    if (!filters.is_enabled() || !filters.wants(block_id))
+        return;
+    std::vector<u_int64_t> keys;
+    if (filter_keys(data, keys))
+        filters.add(block_id, keys);
+}
+
+// Pulls the keys of the Bloom filtered columns out of a marshaled record
+// Returns false for a record with no fields (a bare version header).
+bool HeapTable::filter_keys(const Dbt *data, std::vector<u_int64_t> &keys) {
+    if (data->get_size() <= RecordVersion::SIZE)
+        return false;
+    ColumnNames filtered;
+    for (auto const &column: filters.get_columns())
+        filtered.push_back(column_names[column]);
+    ValueDict *row = unmarshal(const_cast<Dbt *>(data), &filtered);
+    for (auto const &column: filters.get_columns())
+        keys.push_back(BloomFile::hash(column, (*row)[column_names[column]].s));
+    delete row;
+    return true;
+}
+
+// Widens a block's zone to take in a marshaled record's INT values
+void HeapTable::widen_zone(BlockID block_id, const Dbt *data) {
+    if (zones.get_n_columns() == 0)
+        return;
+    std::vector<int32_t> values;
+    if (zone_values(data, values))
+        zones.widen(block_id, values);
+}
+
+// Pulls the INT fields out of a marshaled record, in column order
+// Returns false for a record with no fields (a bare version header).
+bool HeapTable::zone_values(const Dbt *data, std::vector<int32_t> &values) {
+    const char *field = (const char *) data->get_data() + RecordVersion::SIZE;
+    const char *end = (const char *) data->get_data() + data->get_size();
+    if (field >= end)
+        return false;
+    for (size_t i = 0; i < column_attributes.size() && field < end; i++) {
+        ColumnAttribute::DataType data_type = column_attributes[i].get_data_type();
+        if (data_type == ColumnAttribute::INT)
+            values.push_back(RecordFormat::get_int(field));
+        else
+            RecordFormat::skip(field, data_type, dictionaries[i] != nullptr);
+    }
+    return values.size() == zones.get_n_columns();
+}
+
+// Opens the dictionaries of the dictionary encoded columns
+void HeapTable::open_dictionaries() {
+    for (auto dictionary: dictionaries)
+        if (dictionary != nullptr)
+            dictionary->open();
+}
+
+// Turns the column = value pairs in where (if any) into predicates ordered by column
+// A value for a dictionary encoded column is looked up once here, so rows can be
+// matched on its code. Call it after taking the snapshot the rows are read through:
+// every row the snapshot sees was written after its value got a code.
+HeapTable::Predicates HeapTable::compile(const ValueDict *where) {
+    Predicates predicates;
+    if (where == nullptr)
+        return predicates;
+    for (auto const& condition: *where) {
+        ColumnNames::const_iterator column = std::find(column_names.begin(), column_names.end(), condition.first);
+        if (column == column_names.end())
+            throw DbRelationError("unknown column " + condition.first);
+        Predicate predicate;
+        predicate.column = column - column_names.begin();
+        predicate.value = condition.second;
+        ColumnDictionary *dictionary = dictionaries[predicate.column];
+        bool coded = dictionary != nullptr && condition.second.data_type == ColumnAttribute::TEXT;
+        predicate.code = coded ? dictionary->find(condition.second.s) : ColumnDictionary::ESCAPE;
+        predicates.push_back(predicate);
+    }
+    std::sort(predicates.begin(), predicates.end(), [](const Predicate &a, const Predicate &b) {
+        return a.column < b.column;
+    });
+    return predicates;
+}
+
+// Compiles the predicates against the table's record layout (see WhereProgram)
+WhereProgram HeapTable::program(const Predicates &predicates) {
+    std::vector<bool> coded;
+    for (auto dictionary: dictionaries)
+        coded.push_back(dictionary != nullptr);
+    WhereProgram where_program;
+    where_program.compile(column_attributes, coded, predicates);
+    return where_program;
+}
+
+// Check whether a marshaled record satisfies every predicate
+// A value kept in overflow pages is only read if its length matches.
+bool HeapTable::matches(const Dbt *data, const WhereProgram &program) {
+    return program.matches((const char *) data->get_data() + RecordVersion::SIZE, overflow);
 }
 
 // Check whether a row is valid to insert into
@@ -498,45 +2525,153 @@ ValueDict* HeapTable::validate(const ValueDict *row) {
     return full_row;
 }
 
-// Appends a record to a file
+// Appends a row to the file, stamped with the current transaction's id
 Handle HeapTable::append(const ValueDict *row) {
     Dbt *data = marshal(row);
-    SlottedPage *block = file.get(file.get_last_block_id());
-    RecordID record_id;
+    Handle result;
     try {
-        record_id = block->add(data);
+        result = append(data);
+    } catch (...) {
+        free_overflow(data);
+        delete[] (char *) data->get_data();
+        delete data;
+        throw;
     }
-    catch (...) {
-        block = file.get_new();
-        record_id = block->add(data);
+    delete[] (char *) data->get_data();
+    delete data;
+    return result;
+}
+
+// Appends a marshaled record to the file
+// The record goes into a block vacuum() has found room in, if there is one, or else into
+// the calling thread's target block (the last block, until the thread has started one).
+// The block is fetched, added to and written back under its exclusive latch, so
+// concurrent appends can't overwrite each other. When it is full the record goes into a
+// new block that is filled in memory first and only then written and made visible, and
+// which becomes the thread's target. A compressed file only ever appends to its last block.
+Handle HeapTable::append(const Dbt *data) {
+    Handle result;
+    if (append_reused(data, result)) {
+        add_keys(result.first, data);
+        return result;
     }
-    file.put(block);
-    Handle result = Handle(file.get_last_block_id(), record_id);
+    bool shared = file.is_compressed();
+    std::atomic<BlockID> &target = insert_targets[insert_target()].block;
+    BlockID filled = 0;
+    while (true) {
+        BlockID claimed = shared ? 0 : target.load();
+        BlockID block_id = claimed == 0 ? file.get_last_block_id() : claimed;
+        bool full = false;
+        {
+            PageWriteGuard guard(file.latch(block_id));
+            if (block_id > file.get_last_block_id()) {
+                target.compare_exchange_strong(claimed, 0);  // vacuum() removed it meanwhile
+                continue;
+            }
+            SlottedPage *block = file.get(block_id);
+            try {
+                RecordID record_id = block->add(data);
+                widen_zone(block_id, data);
+                file.put(block);
+                result = Handle(block_id, record_id);
+            } catch (DbBlockNoRoomError &e) {
+                full = true;
+            } catch (...) {
+                delete block;
+                throw;
+            }
+            delete block;
+        }
+        if (!full)
+            break;
+        if (shared ? file.get_last_block_id() != block_id : target != claimed)
+            continue;  // another writer has already started a new block
+
+        std::vector<char> bytes(file.get_block_size());
+        Dbt page(bytes.data(), (u_int32_t) bytes.size());
+        SlottedPage block(page, 0, true);
+        RecordID record_id = block.add(data);
+        result = Handle(file.put_new(bytes.data()), record_id);
+        widen_zone(result.first, data);  // before the row's transaction commits, so before anyone can see it
+        if (!shared)
+            target.compare_exchange_strong(claimed, result.first);
+        filled = block_id;  // threads leaving the same last block may each seal it, which is harmless
+        break;
+    }
+    if (filled != 0)
+        seal(filled);
+    add_keys(result.first, data);
     return result;
 }
 
+// The insert target of the calling thread: threads take them in turn as they first insert
+uint HeapTable::insert_target() {
+    static std::atomic<uint> next_target(0);
+    static thread_local uint target = next_target++ % INSERT_TARGETS;
+    return target;
+}
+
+// Adds a marshaled record to one of the blocks vacuum() has found room in, if any is left
+// A block the record doesn't fit in is taken off the list.
+bool HeapTable::append_reused(const Dbt *data, Handle &handle) {
+    while (has_reusable) {
+        BlockID block_id;
+        {
+            std::lock_guard<std::mutex> guard(vacuum_mutex);
+            has_reusable = !reusable_blocks.empty();
+            if (!has_reusable)
+                return false;
+            block_id = reusable_blocks.back();
+        }
+        {
+            PageWriteGuard guard(file.latch(block_id));
+            if (block_id <= file.get_last_block_id()) {
+                SlottedPage *block = file.get(block_id);
+                try {
+                    RecordID record_id = block->add(data);
+                    widen_zone(block_id, data);
+                    file.put(block);
+                    handle = Handle(block_id, record_id);
+                    delete block;
+                    return true;
+                } catch (DbBlockNoRoomError &e) {
+                } catch (...) {
+                    delete block;
+                    throw;
+                }
+                delete block;
+            }
+        }
+        std::lock_guard<std::mutex> guard(vacuum_mutex);
+        reusable_blocks.erase(std::remove(reusable_blocks.begin(), reusable_blocks.end(), block_id),
+                              reusable_blocks.end());
+    }
+    return false;
+}
+
 // Serialize a row into bits to go into the file
+// TEXT values too long to keep in the row (see OverflowFile) are written to overflow pages first.
 // Caller responsible for freeing the returned Dbt and its enclosed ret->get_data().
 Dbt* HeapTable::marshal(const ValueDict* row) {
-    char *bytes = new char[DbBlock::BLOCK_SZ]; // more than we need (we insist that one row fits into DbBlock::BLOCK_SZ)
-    uint offset = 0;
+    uint block_size = file.get_block_size();
+    char *bytes = new char[block_size]; // more than we need (we insist that one row fits into a block)
+    RecordVersion(Transaction::id()).write(bytes);
+    uint offset = RecordVersion::SIZE;
     uint col_num = 0;
-    for (auto const& column_name: this->column_names) {
-        ColumnAttribute ca = this->column_attributes[col_num++];
-        ValueDict::const_iterator column = row->find(column_name);
-        Value value = column->second;
-        if (ca.get_data_type() == ColumnAttribute::DataType::INT) {
-            *(int32_t*) (bytes + offset) = value.n;
-            offset += sizeof(int32_t);
-        } else if (ca.get_data_type() == ColumnAttribute::DataType::TEXT) {
-            uint size = value.s.length();
-            *(u16*) (bytes + offset) = size;
-            offset += sizeof(u16);
-            memcpy(bytes+offset, value.s.c_str(), size); // assume ascii for now
-            offset += size;
-        } else {
-            throw DbRelationError("Only know how to marshal INT and TEXT");
+    Dbt written(bytes, 0);  // what is marshaled so far, for releasing its overflow pages on failure
+    try {
+        for (auto const& column_name: this->column_names) {
+            ColumnAttribute ca = this->column_attributes[col_num++];
+            ValueDict::const_iterator column = row->find(column_name);
+            if (!RecordFormat::put(bytes, offset, block_size, ca.get_data_type(), column->second,
+                                   dictionaries[col_num - 1], overflow))
+                throw DbRelationError("row does not fit in a block");
+            written.set_size(offset);
         }
+    } catch (...) {
+        free_overflow(&written);
+        delete[] bytes;
+        throw;
     }
     char *right_size_bytes = new char[offset];
     memcpy(right_size_bytes, bytes, offset);
@@ -547,27 +2682,59 @@ Dbt* HeapTable::marshal(const ValueDict* row) {
 
 // Deserializes the marshaled data
 ValueDict* HeapTable::unmarshal(Dbt *data) {
+    return unmarshal(data, nullptr);
+}
+
+// Deserializes the given columns of the marshaled data (all of them if column_names is empty)
+// Fields that aren't wanted are skipped over without decoding them.
+ValueDict* HeapTable::unmarshal(Dbt *data, const ColumnNames *column_names) {
     ValueDict *row = new ValueDict;
-    char *bytes = (char *)data->get_data();
+    const char *field = (const char *) data->get_data() + RecordVersion::SIZE;
     uint index = 0;
-    uint offset = 0;
-    for (auto const& column_name : column_names) {
-        ColumnAttribute attr = column_attributes[index++];
-        Value val;
-        if (attr.get_data_type() == ColumnAttribute::DataType::INT) {
-            val.n = *(int32_t *)(bytes + offset);
-            offset += sizeof(int32_t);
-        }
-        else if (attr.get_data_type() == ColumnAttribute::DataType::TEXT) {
-            u16 size = *(u16 *)(bytes + offset);
-            offset += sizeof(u16);
-            val.s = std::string(bytes + offset);
-            offset += size;
+    bool all = column_names == nullptr || column_names->empty();
+    size_t remaining = 0;  // wanted fields not decoded yet: the ones after the last of them aren't visited
+    for (auto const& column_name : this->column_names)
+        if (all || std::find(column_names->begin(), column_names->end(), column_name) != column_names->end())
+            remaining++;
+    try {
+        for (auto const& column_name : this->column_names) {
+            if (remaining == 0)
+                break;
+            ColumnAttribute::DataType data_type = column_attributes[index].get_data_type();
+            ColumnDictionary *dictionary = dictionaries[index++];
+            bool wanted = all || std::find(column_names->begin(), column_names->end(), column_name) != column_names->end();
+            if (!wanted) {
+                RecordFormat::skip(field, data_type, dictionary != nullptr);
+                continue;
+            }
+            remaining--;
+            (*row)[column_name] = RecordFormat::get(field, data_type, dictionary, overflow);
         }
-        else
-            throw DbRelationError("Marshal only supports INT and TEXT");
-
-        (*row)[column_name] = val;
+    } catch (...) {
+        delete row;
+        throw;
     }
     return row;
 }
+
+// Frees the overflow pages of a marshaled record's out of line values
+// The record may be cut short (by a marshal() that failed partway): only whole fields count.
+void HeapTable::free_overflow(const Dbt *data) {
+    const char *field = (const char *) data->get_data() + RecordVersion::SIZE;
+    const char *end = (const char *) data->get_data() + data->get_size();
+    for (size_t i = 0; i < column_attributes.size() && field < end; i++) {
+        ColumnAttribute::DataType data_type = column_attributes[i].get_data_type();
+        if (data_type == ColumnAttribute::INT) {
+            RecordFormat::skip(field, data_type, false);
+            continue;
+        }
+        if (dictionaries[i] != nullptr && RecordFormat::get_code(field) != ColumnDictionary::ESCAPE)
+            continue;
+        if (field >= end)
+            break;
+        u_int32_t length;
+        BlockID first;
+        if (RecordFormat::get_text(field, length, first) == nullptr && field <= end)
+            overflow.free(first);
+    }
+}
@@ -9,8 +9,18 @@
  */
 #pragma once
 
+#include <atomic>
+#include <mutex>
 #include "db_cxx.h"
 #include "storage_engine.h"
+#include "bloom.h"
+#include "dictionary.h"
+#include "mvcc.h"
+#include "overflow.h"
+#include "page_latch.h"
+#include "statistics.h"
+#include "where_program.h"
+#include "zone_map.h"
 
 /**
  * @class SlottedPage - heap file implementation of DbBlock.
@@ -18,7 +28,10 @@
  *      Manage a database block that contains several records.
         Modeled after slotted-page from Database Systems Concepts, 6ed, Figure 10-9.
 
+        The block is as big as the Dbt it is given, up to DbBlock::MAX_BLOCK_SZ.
         Record id are handed out sequentially starting with 1 as records are added with add().
+        Deleting a record just clears its slot, which the next add() reuses; the space left
+        among the live records is reclaimed by compact(), which never changes a record's id.
         Each record has a header which is a fixed offset from the beginning of the block:
             Bytes 0x00 - Ox01: number of records
             Bytes 0x02 - 0x03: offset to end of free space
@@ -29,11 +42,14 @@
  */
 class SlottedPage : public DbBlock {
 public:
-    SlottedPage(Dbt &block, BlockID block_id, bool is_new = false);
+    SlottedPage(Dbt &block, BlockID block_id, bool is_new = false, bool owns_data = false);
 
     // Big 5 - we only need the destructor, copy-ctor, move-ctor, and op= are unnecessary
     // but we delete them explicitly just to make sure we don't use them accidentally
-    virtual ~SlottedPage() {}
+    virtual ~SlottedPage() {
+        if (owns_data)
+            delete[] (char *) block.get_data();
+    }
 
     SlottedPage(const SlottedPage &other) = delete;
 
@@ -53,15 +69,39 @@ public:
 
     virtual RecordIDs *ids(void);
 
+    /**
+     * Zero the unused bytes between the record headers and the records (so they compress).
+     */
+    virtual void clear_free_space(void);
+
+    /**
+     * Bytes of deleted records that only compact() can make free again.
+     */
+    virtual u_int16_t dead_space(void);
+
+    /**
+     * Bytes free for new records (headers included) as the block stands.
+     */
+    virtual u_int16_t free_space(void);
+
+    /**
+     * Move the live records together, making the space of deleted ones free.
+     * @returns  the bytes reclaimed
+     */
+    virtual u_int16_t compact(void);
+
 protected:
     u_int16_t num_records;
     u_int16_t end_free;
+    bool owns_data;  // block's bytes were allocated with new[] for this page alone
 
     virtual void get_header(u_int16_t &size, u_int16_t &loc, RecordID id = 0);
 
     virtual void put_header(RecordID id = 0, u_int16_t size = 0, u_int16_t loc = 0);
 
-    virtual bool has_room(u_int16_t size);
+    virtual bool has_room(u_int16_t size, bool new_slot = true);
+
+    virtual RecordID free_slot(void);
 
     virtual void slide(u_int16_t start, u_int16_t end);
 
@@ -72,6 +112,25 @@ protected:
     virtual void *address(u_int16_t offset);
 };
 
+/**
+ * @class CompressionStats - what a HeapFile's block compression has done so far
+ */
+struct CompressionStats {
+    u_int64_t blocks_compressed;  // blocks written compressed
+    u_int64_t bytes_in;           // their size before compression
+    u_int64_t bytes_out;          // and after
+    u_int64_t blocks_decoded;     // compressed blocks read back
+    u_int64_t decode_ns;          // time spent decompressing them
+    uint block_size;
+
+    double ratio() const { return bytes_out == 0 ? 1.0 : (double) bytes_in / bytes_out; }
+
+    // decompressed megabytes per second
+    double decode_rate() const {
+        return decode_ns == 0 ? 0.0 : (double) blocks_decoded * block_size * 1000.0 / decode_ns;
+    }
+};
+
 /**
  * @class HeapFile - heap file implementation of DbFile
  *
@@ -79,10 +138,26 @@ protected:
         database blocks for each Berkeley DB record in the RecNo file. In this way we are using Berkeley DB
         for buffer management and file management.
         Uses SlottedPage for storing records within blocks.
+
+        Safe to share among threads: get() hands out private copies of blocks, new block ids
+        come from an atomic counter, and the latches() let writers make a block's
+        fetch-modify-write atomic while read() lets readers go without blocking them.
+
+        A compressed file (see set_compressed) stores each block compressed with PageCodec
+        once a newer block has been started after it: the last block, where appends go,
+        is kept as is, and the cold ones before it are decompressed on the way in by
+        get() and read(). The blocks are then variable-length records in the RecNo file,
+        so a file's compression is fixed when it is created and recognized when opened.
+
+        Blocks are DbBlock::BLOCK_SZ bytes unless set_block_size() picks another size for a
+        new file. An existing file's block size is its record length, or for a compressed
+        file the length of its (never compressed) last block.
  */
 class HeapFile : public DbFile {
 public:
-    HeapFile(std::string name) : DbFile(name), dbfilename(""), last(0), closed(true), db(_DB_ENV, 0) {}
+    HeapFile(std::string name) : DbFile(name), dbfilename(""), last(0), allocated(0), closed(true), dirty_reads(false),
+                                 compressed(false), block_size(DbBlock::BLOCK_SZ), blocks_compressed(0), bytes_in(0), bytes_out(0),
+                                 blocks_decoded(0), decode_ns(0), db(_DB_ENV, 0) {}
 
     virtual ~HeapFile() {}
 
@@ -106,30 +181,115 @@ public:
 
     virtual SlottedPage *get(BlockID block_id);
 
+    virtual SlottedPage *read(BlockID block_id);
+
     virtual void put(DbBlock *block);
 
+    virtual BlockID put_new(const char *block);
+
     virtual BlockIDs *block_ids();
 
     virtual u_int32_t get_last_block_id() { return last; }
 
+    /**
+     * Remove the last block once it is empty. The caller holds its latch and that of the
+     * block before it.
+     * @returns  false if the block wasn't removed (it is no longer the last one)
+     */
+    virtual bool truncate(BlockID block_id);
+
+    /**
+     * Give the space of removed blocks back to the file system.
+     */
+    virtual void compact(void);
+
+    virtual bool exists(void);
+
+    virtual PageLatch &latch(BlockID block_id) { return latches.get(block_id); }
+
+    /**
+     * Choose whether create() makes a compressed file. Opening a file finds out for itself.
+     */
+    virtual void set_compressed(bool compressed) { this->compressed = compressed; }
+
+    virtual bool is_compressed() const { return compressed; }
+
+    virtual CompressionStats compression_stats() const;
+
+    /**
+     * Choose the block size of the file create() makes: a power of two from
+     * DbBlock::BLOCK_SZ to DbBlock::MAX_BLOCK_SZ.
+     */
+    virtual void set_block_size(uint block_size);
+
+    virtual uint get_block_size() const { return block_size; }
+
+    static bool valid_block_size(uint block_size);
+
 protected:
     std::string dbfilename;
-    u_int32_t last;
+    std::atomic<u_int32_t> last;       // highest block written and visible to readers
+    std::atomic<u_int32_t> allocated;  // highest block id handed out
     bool closed;
+    bool dirty_reads;  // read() may see uncommitted writes
+    bool compressed;   // blocks before the last one are stored compressed
+    uint block_size;
+    std::atomic<u_int64_t> blocks_compressed, bytes_in, bytes_out, blocks_decoded, decode_ns;
+    std::mutex open_mutex;
     Db db;
+    PageLatches latches;
 
     virtual void db_open(uint flags = 0);
+
+    virtual SlottedPage *fetch(BlockID block_id, u_int32_t flags);
+
+    virtual BlockID write_new(const char *block);
+
+    virtual void publish(BlockID block_id);
+
+    virtual void retract(BlockID block_id);
+
+    virtual void seal(BlockID block_id);
+
+    virtual void put_compressed(BlockID block_id, const char *block);
 };
 
 /**
  * @class HeapTable - Heap storage engine (implementation of DbRelation)
+ *
+ * Rows are versioned (see mvcc.h): every record starts with a RecordVersion, reads go
+ * through the thread's snapshot, and an update or delete leaves the row's previous
+ * version in place for snapshots that still need it until collect_garbage() removes it.
+ * Handles always refer to the newest version of a row, which is either at the handle or,
+ * once an update has made the row too big for its block, behind a forwarding stub there.
+ *
+ * A dictionary encoded TEXT column (see dictionary.h) stores its values' codes, and
+ * equality conditions on it are tested on the codes without decoding anything.
+ *
+ * Large TEXT values are kept out of line in overflow pages (see overflow.h), which are
+ * only read for the columns a projection or condition actually asks for.
+ *
+ * A select with an equality condition on an INT column skips the blocks whose zones (see
+ * zone_map.h) can't hold the value. One on a TEXT column given Bloom filters (see bloom.h)
+ * skips the full blocks whose filters rule the value out.
+ * A sampling select or scan (see BlockSample) only reads the blocks in its sample.
+ * Scans read their blocks ahead on the shared I/O threads (see io_pool.h).
+ *
+ * Each inserting thread appends to a block of its own, started from the file's atomic block
+ * allocator once the block it was using fills up, so concurrent inserts don't all wait on
+ * the latch of the last block (except in a compressed file, where only the last block can
+ * take rows cheaply).
+ *
+ * collect_garbage() only clears the slots of dead versions. vacuum() then compacts the
+ * blocks it left fragmented, hands blocks with room to spare back to insert() and
+ * removes empty blocks from the end of the file.
  */
 
 class HeapTable : public DbRelation {
 public:
     HeapTable(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes);
 
-    virtual ~HeapTable() {}
+    virtual ~HeapTable();
 
     HeapTable(const HeapTable &other) = delete;
 
@@ -159,20 +319,168 @@ public:
 
     virtual Handles *select(const ValueDict *where);
 
+    virtual Handles *select(const ValueDict *where, size_t limit);
+
+    virtual Handles *select(const ValueDict *where, size_t limit, const BlockSample *sample);
+
     virtual ValueDict *project(Handle handle);
 
     virtual ValueDict *project(Handle handle, const ColumnNames *column_names);
 
+    virtual ValueDicts *project(const Handles *handles, const ColumnNames *column_names);
+
+    virtual void parallel_scan(const ValueDict *where, unsigned int n_workers, RowVisitor visit,
+                               const ColumnNames *column_names = nullptr, const BlockSample *sample = nullptr);
+
+    virtual size_t import_csv(const std::string &file_path, unsigned int n_workers = 0);
+
+    virtual size_t collect_garbage(TxnID horizon);
+
+    virtual size_t vacuum();
+
+    virtual std::shared_ptr<const TableStatistics> analyze(size_t sample_blocks);
+
+    virtual std::shared_ptr<const TableStatistics> get_statistics();
+
+    /**
+     * Have create() make the table's file compressed (see HeapFile).
+     */
+    virtual void set_compression(bool compressed) { file.set_compressed(compressed); }
+
+    virtual CompressionStats compression_stats() const { return file.compression_stats(); }
+
+    virtual bool is_compressed() const { return file.is_compressed(); }
+
+    /**
+     * Have create() make the table's blocks block_size bytes (see HeapFile::set_block_size).
+     */
+    virtual void set_block_size(uint block_size) { file.set_block_size(block_size); }
+
+    virtual uint get_block_size() const { return file.get_block_size(); }
+
+    /**
+     * Have create() give the table Bloom filters over the given TEXT columns (see BloomFile).
+     * @throws DbRelationError  if one of them isn't a TEXT column of the table
+     */
+    virtual void set_bloom_filters(const ColumnNames &columns, double false_positive_rate);
+
+    /**
+     * How many overflow pages have been read for this table's large TEXT values.
+     */
+    virtual u_int64_t get_overflow_pages_read() const { return overflow.get_pages_read(); }
+
+    /**
+     * How many updates have had to move their row out of its block.
+     */
+    virtual u_int64_t get_rows_moved() const { return moved_rows; }
+
+    /**
+     * How many blocks the table's file has.
+     */
+    virtual u_int32_t get_block_count() { return file.get_last_block_id(); }
+
+    /**
+     * How many blocks selects have skipped thanks to the zone map and Bloom filters.
+     */
+    virtual u_int64_t get_blocks_skipped() const { return skipped_blocks; }
+
+    /**
+     * How many bytes vacuum() has reclaimed so far.
+     */
+    virtual u_int64_t get_bytes_reclaimed() const { return reclaimed_bytes; }
+
 protected:
+    // a column = value condition, with the column's index and (for a dictionary encoded column) the value's code
+    typedef WhereProgram::Condition Predicate;
+    typedef WhereProgram::Conditions Predicates;
+
     HeapFile file;
+    std::vector<ColumnDictionary *> dictionaries;  // by column, nullptr unless dictionary encoded
+    OverflowFile overflow;
+    std::atomic<u_int64_t> moved_rows;
+    std::atomic<u_int64_t> reclaimed_bytes;
+    std::vector<BlockID> collected_blocks;  // where collect_garbage() has cleared slots since the last vacuum()
+    std::vector<BlockID> reusable_blocks;   // earlier blocks vacuum() found half empty, for appends
+    std::mutex vacuum_mutex;                // guards both lists
+    std::atomic<bool> has_reusable;         // so appends don't take the mutex while there are none
+    static const uint INSERT_TARGETS = 16;  // threads beyond this many share targets
+    struct InsertTarget {
+        std::atomic<BlockID> block;  // the block a thread appends to, 0 until it has started one
+        char padding[64 - sizeof(std::atomic<BlockID>)];  // one cache line each
+    };
+    InsertTarget insert_targets[INSERT_TARGETS];
+    ZoneMap zones;
+    std::mutex zones_mutex;  // one build at a time
+    std::atomic<u_int64_t> skipped_blocks;
+    BloomFile filters;
+    std::shared_ptr<const TableStatistics> statistics;
+    bool statistics_loaded;      // whether statistics has been read from the file yet
+    std::mutex statistics_mutex;  // guards both
+
+    virtual void open_dictionaries();
+
+    virtual Predicates compile(const ValueDict *where);
+
+    virtual WhereProgram program(const Predicates &predicates);
+
+    virtual bool matches(const Dbt *data, const WhereProgram &program);
+
+    virtual Dbt *visible(SlottedPage *block, RecordID record_id, const Snapshot &snapshot);
+
+    virtual void prune(BlockIDs &block_ids, const Predicates &predicates);
+
+    static uint insert_target();
+
+    virtual void build_zones();
+
+    virtual void widen_zone(BlockID block_id, const Dbt *data);
+
+    virtual bool zone_values(const Dbt *data, std::vector<int32_t> &values);
+
+    virtual void seal(BlockID block_id);
+
+    virtual void add_keys(BlockID block_id, const Dbt *data);
+
+    virtual bool filter_keys(const Dbt *data, std::vector<u_int64_t> &keys);
+
+    virtual void reachable(SlottedPage *block, RecordID record_id, TxnID horizon,
+                           const std::function<void(const Dbt *)> &visit);
+
+    virtual Handle locate(Handle handle);
+
+    virtual bool read_version(Handle at, RecordVersion &version);
+
+    virtual void put_version(Handle at, const RecordVersion &version);
+
+    virtual bool replace(Handle at, const Dbt *data);
+
+    virtual void replace(Handle at, const RecordVersion &version);
 
     virtual ValueDict *validate(const ValueDict *row);
 
     virtual Handle append(const ValueDict *row);
 
+    virtual Handle append(const Dbt *data);
+
+    virtual bool append_reused(const Dbt *data, Handle &handle);
+
+    virtual void remove(Handle at);
+
     virtual Dbt *marshal(const ValueDict *row);
 
     virtual ValueDict *unmarshal(Dbt *data);
+
+    virtual ValueDict *unmarshal(Dbt *data, const ColumnNames *column_names);
+
+    virtual void check_columns(const ColumnNames *column_names);
+
+    virtual void free_overflow(const Dbt *data);
 };
 
 bool test_heap_storage();
+
+bool test_heap_concurrency();
+
+bool test_group_commit();
+
+bool test_heap_update();
@@ -0,0 +1,250 @@
+/*
+  io_pool.cpp
+
+  I/O threads, and scans that keep several block reads in flight on them.
+  A read's result goes into its slot and wakes whoever is waiting for it; the threads
+  never wait for the scan, so a scan that stops early only has to let the reads it
+  already started finish.
+
+*/
+
+#include "io_pool.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+
+
+// IoPool
+
+IoPool::IoPool(uint n_threads) : stopping(false) {
+    for (uint i = 0; i < n_threads; i++)
+        threads.push_back(std::thread(&IoPool::run, this));
+}
+
+IoPool::~IoPool() {
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        stopping = true;
+    }
+    queued.notify_all();
+    for (auto &thread: threads)
+        thread.join();
+}
+
+void IoPool::submit(std::function<void()> job) {
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        jobs.push_back(job);
+    }
+    queued.notify_one();
+}
+
+IoPool &IoPool::shared() {
+    static IoPool pool;
+    return pool;
+}
+
+// Runs jobs until the pool is stopping and none are left
+// A job reports its own failures; one that throws anyway doesn't take the thread with it.
+void IoPool::run() {
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            queued.wait(lock, [this]() { return stopping || !jobs.empty(); });
+            if (jobs.empty())
+                return;
+            job = jobs.front();
+            jobs.pop_front();
+        }
+        try {
+            job();
+        } catch (...) {
+        }
+    }
+}
+
+
+// ReadAhead
+
+ReadAhead::ReadAhead(Reader read, const BlockIDs &block_ids, uint depth, IoPool &pool)
+        : read(read), block_ids(block_ids), slots(block_ids.size(), Slot{nullptr, nullptr, false}), depth(depth),
+          window(1), pool(pool), profile(Profiling::current()), taken(0), end(block_ids.size()), submitted(0),
+          in_flight(0) {}
+
+ReadAhead::~ReadAhead() {
+    std::unique_lock<std::mutex> lock(mutex);
+    end = taken;
+    arrived.wait(lock, [this]() { return in_flight == 0; });
+    for (auto &slot: slots)
+        delete slot.page;
+}
+
+SlottedPage *ReadAhead::next(BlockID &block_id) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (taken >= end)
+        return nullptr;
+    size_t i = taken++;
+    block_id = block_ids[i];
+    if (depth == 0) {
+        lock.unlock();
+        return read(block_id);
+    }
+    submit_reads();
+    window = std::min(depth, 2 * window);
+    arrived.wait(lock, [this, i]() { return slots[i].arrived; });
+    SlottedPage *page = slots[i].page;
+    slots[i].page = nullptr;
+    if (slots[i].failure) {
+        end = taken;
+        std::rethrow_exception(slots[i].failure);
+    }
+    return page;
+}
+
+void ReadAhead::stop() {
+    std::lock_guard<std::mutex> guard(mutex);
+    end = std::min(end, taken);
+}
+
+// Starts the reads of the blocks up to window past the last one handed out (mutex held)
+void ReadAhead::submit_reads() {
+    size_t until = std::min(end, taken + window);
+    for (; submitted < until; submitted++) {
+        size_t i = submitted;
+        in_flight++;
+        pool.submit([this, i]() {
+            SlottedPage *page = nullptr;
+            std::exception_ptr failure;
+            {
+                Profiling profiling(profile, false);
+                try {
+                    page = read(block_ids[i]);
+                } catch (...) {
+                    failure = std::current_exception();
+                }
+            }
+            std::lock_guard<std::mutex> guard(mutex);
+            slots[i].page = page;
+            slots[i].failure = failure;
+            slots[i].arrived = true;
+            in_flight--;
+            arrived.notify_all();
+        });
+    }
+}
+
+
+// Test function -- returns true if all tests pass
+bool test_io_pool() {
+    const BlockID BLOCKS = 200;
+    HeapFile file("_test_io_pool_cpp");
+    file.create();
+    for (BlockID b = 1; b <= BLOCKS; b++) {
+        SlottedPage *block = b == 1 ? file.get(1) : file.get_new();
+        std::string record = std::to_string(block->get_block_id());
+        Dbt data((void *) record.data(), (u_int32_t) record.size());
+        block->add(&data);
+        file.put(block);
+        delete block;
+    }
+    BlockIDs *block_ids = file.block_ids();
+    auto holds_own_id = [](SlottedPage *block, BlockID block_id) {
+        Dbt *data = block->get(1);
+        bool ok = data != nullptr && std::string((char *) data->get_data(), data->get_size()) == std::to_string(block_id);
+        if (data != nullptr) {
+            delete[] (char *) data->get_data();
+            delete data;
+        }
+        return ok;
+    };
+    ReadAhead::Reader read = [&file](BlockID block_id) { return file.read(block_id); };
+    bool ok = true;
+
+    // in order, every block once
+    {
+        ReadAhead pages(read, *block_ids);
+        BlockID expected = 1, block_id;
+        SlottedPage *block;
+        while ((block = pages.next(block_id)) != nullptr) {
+            ok = ok && block_id == expected++ && holds_own_id(block, block_id);
+            delete block;
+        }
+        ok = ok && expected == BLOCKS + 1;
+    }
+
+    // shared by several consumers, and given up on partway through
+    {
+        std::vector<char> seen(BLOCKS + 1, 0);
+        std::atomic<bool> consumers_ok(true);
+        ReadAhead pages(read, *block_ids);
+        std::vector<std::thread> consumers;
+        for (int c = 0; c < 4; c++) {
+            consumers.push_back(std::thread([&]() {
+                BlockID block_id;
+                SlottedPage *block;
+                while ((block = pages.next(block_id)) != nullptr) {
+                    if (seen[block_id]++ || !holds_own_id(block, block_id))
+                        consumers_ok = false;
+                    delete block;
+                }
+            }));
+        }
+        for (auto &consumer: consumers)
+            consumer.join();
+        ok = ok && consumers_ok && std::count(seen.begin(), seen.end(), 1) == BLOCKS;
+        ReadAhead abandoned(read, *block_ids);
+        BlockID block_id;
+        for (int i = 0; i < 5; i++)
+            delete abandoned.next(block_id);
+    }
+
+    // a failed read surfaces where the scan gets to its block
+    {
+        ReadAhead pages([&file](BlockID block_id) {
+            if (block_id == 7)
+                throw DbRelationError("block 7 is unreadable");
+            return file.read(block_id);
+        }, *block_ids);
+        BlockID block_id = 0;
+        size_t before = 0;
+        try {
+            while (SlottedPage *block = pages.next(block_id)) {
+                delete block;
+                before++;
+            }
+            ok = false;
+        } catch (DbRelationError &e) {
+            ok = ok && before == 6 && block_id == 7 && pages.next(block_id) == nullptr;
+        }
+    }
+
+    // with 1 ms of device latency per read, a scan that waits for each read in turn against
+    // one that keeps up to DEFAULT_DEPTH of them in flight
+    ReadAhead::Reader slow = [&file](BlockID block_id) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        return file.read(block_id);
+    };
+    double seconds[2];
+    uint depths[2] = {0, ReadAhead::DEFAULT_DEPTH};
+    for (int d = 0; d < 2; d++) {
+        auto start = std::chrono::steady_clock::now();
+        ReadAhead pages(slow, *block_ids, depths[d]);
+        BlockID block_id;
+        size_t found = 0;
+        while (SlottedPage *block = pages.next(block_id)) {
+            found += holds_own_id(block, block_id);
+            delete block;
+        }
+        seconds[d] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        ok = ok && found == BLOCKS;
+    }
+    std::cout << "read-ahead: " << BLOCKS << " blocks at 1 ms each in " << seconds[0] * 1000 << " ms one at a time, "
+              << seconds[1] * 1000 << " ms with up to " << ReadAhead::DEFAULT_DEPTH << " in flight on "
+              << IoPool::shared().get_threads() << " I/O threads (" << seconds[0] / seconds[1] << "x)" << std::endl;
+
+    delete block_ids;
+    file.drop();
+    return ok;
+}
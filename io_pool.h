@@ -0,0 +1,131 @@
+/**
+ * @file io_pool.h - Asynchronous block reads on a pool of I/O threads.
+ * IoPool
+ * ReadAhead
+ *
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "heap_storage.h"
+#include "profile.h"
+
+/**
+ * @class IoPool - threads that run submitted I/O jobs, first come first served
+ *
+ * A job is a callback that does its I/O and then hands the result on by itself (see
+ * ReadAhead), so the thread that submitted it is free to work on something else until
+ * the result arrives. Jobs must not wait for other jobs. Every scan shares the one
+ * shared() pool, whose threads start on first use.
+ */
+class IoPool {
+public:
+    static const uint DEFAULT_THREADS = 8;
+
+    explicit IoPool(uint n_threads = DEFAULT_THREADS);
+
+    /**
+     * Runs the jobs still queued, then stops the threads.
+     */
+    virtual ~IoPool();
+
+    IoPool(const IoPool &other) = delete;
+
+    IoPool &operator=(const IoPool &other) = delete;
+
+    /**
+     * Queue a job for the next free thread.
+     */
+    virtual void submit(std::function<void()> job);
+
+    virtual uint get_threads() const { return (uint) threads.size(); }
+
+    /**
+     * The process-wide pool.
+     */
+    static IoPool &shared();
+
+protected:
+    std::vector<std::thread> threads;
+    std::deque<std::function<void()>> jobs;
+    bool stopping;
+    std::mutex mutex;  // guards the two above
+    std::condition_variable queued;
+
+    virtual void run();
+};
+
+/**
+ * @class ReadAhead - a list of blocks read ahead of the scan that consumes them
+ *
+ * Up to depth reads are in flight on the IoPool at once, and next() hands the pages over
+ * in the list's order, only waiting for the ones that haven't arrived yet: while the scan
+ * works on one block, the reads of the next few are already under way. The window opens
+ * up gradually, from one read to depth, so a scan that stops early hardly reads anything
+ * it doesn't use. With depth 0 there is no read-ahead at all: next() reads each block
+ * itself when asked for it.
+ *
+ * Several threads may share one ReadAhead; each next() hands out a different block.
+ * Reads are charged to the operator the constructing thread was profiling (see profile.h).
+ */
+class ReadAhead {
+public:
+    typedef std::function<SlottedPage *(BlockID)> Reader;
+    static const uint DEFAULT_DEPTH = 16;
+
+    ReadAhead(Reader read, const BlockIDs &block_ids, uint depth = DEFAULT_DEPTH, IoPool &pool = IoPool::shared());
+
+    /**
+     * Waits for the reads still in flight and frees the pages no one took.
+     */
+    virtual ~ReadAhead();
+
+    ReadAhead(const ReadAhead &other) = delete;
+
+    ReadAhead &operator=(const ReadAhead &other) = delete;
+
+    /**
+     * The next block in order, once it has arrived.
+     * @param block_id  set to the block's id
+     * @returns         the block (freed by caller), or nullptr past the last one (or after stop())
+     * @throws          whatever reading the block threw
+     */
+    virtual SlottedPage *next(BlockID &block_id);
+
+    /**
+     * Hand out no more blocks (the reads in flight still finish).
+     */
+    virtual void stop();
+
+protected:
+    struct Slot {
+        SlottedPage *page;
+        std::exception_ptr failure;
+        bool arrived;
+    };
+
+    Reader read;
+    BlockIDs block_ids;
+    std::vector<Slot> slots;  // by index into block_ids
+    uint depth;
+    uint window;  // how far ahead reads go now, growing to depth
+    IoPool &pool;
+    OperatorProfile *profile;
+    size_t taken;      // blocks handed out so far
+    size_t end;        // where handing out stops (block_ids.size() until stop())
+    size_t submitted;  // reads submitted so far
+    size_t in_flight;
+    std::mutex mutex;  // guards slots and the four counts above
+    std::condition_variable arrived;
+
+    virtual void submit_reads();
+};
+
+bool test_io_pool();
@@ -0,0 +1,341 @@
+/*
+  mvcc.cpp
+
+  Multi-version concurrency control.
+  Writers stamp each record version with their transaction id; readers pick the version
+  their snapshot sees, so a scan never waits for a writer and always reads one consistent
+  state of the database. Versions nobody can see anymore are removed in the background.
+
+*/
+
+#include "mvcc.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <set>
+#include <fcntl.h>
+#include <unistd.h>
+#include "heap_storage.h"
+#include "transaction.h"
+
+
+// RecordVersion
+
+bool RecordVersion::read(const Dbt *record) {
+    if (record->get_size() < SIZE)
+        return false;
+    const char *bytes = (const char *) record->get_data();
+    memcpy(&xmin, bytes, sizeof(xmin));
+    memcpy(&xmax, bytes + 4, sizeof(xmax));
+    memcpy(&prev_block, bytes + 8, sizeof(prev_block));
+    memcpy(&prev_record, bytes + 12, sizeof(prev_record));
+    memcpy(&flags, bytes + 14, sizeof(flags));
+    return true;
+}
+
+void RecordVersion::write(void *record) const {
+    char *bytes = (char *) record;
+    memcpy(bytes, &xmin, sizeof(xmin));
+    memcpy(bytes + 4, &xmax, sizeof(xmax));
+    memcpy(bytes + 8, &prev_block, sizeof(prev_block));
+    memcpy(bytes + 12, &prev_record, sizeof(prev_record));
+    memcpy(bytes + 14, &flags, sizeof(flags));
+}
+
+
+// Snapshot
+
+Snapshot::Snapshot(TxnID own, TxnID bound, const std::vector<TxnID> &running)
+        : own(own), bound(bound), running(running) {
+    std::sort(this->running.begin(), this->running.end());
+}
+
+bool Snapshot::sees(TxnID txn) const {
+    if (txn == 0 || txn == own)
+        return true;
+    return txn < bound && !std::binary_search(running.begin(), running.end(), txn);
+}
+
+
+// VersionManager
+
+static const TxnID TXN_ID_BATCH = 1 << 16;  // ids reserved on disk at a time
+static const char *TXN_ID_FILE = "__txn_ids";
+
+static std::mutex version_mutex;
+static TxnID next_txn = 0;    // 0 until the first reservation
+static TxnID reserved = 0;    // ids below this may have been handed out already
+static std::set<TxnID> running_txns;
+static std::multiset<TxnID> snapshot_lows;
+
+// Reserve the next batch of ids, recording its end in the environment's home so a
+// restarted process starts above anything this one could have used (version_mutex held)
+static void reserve_txn_ids() {
+    std::string path;
+    if (_DB_ENV != nullptr)
+        path = env_path(TXN_ID_FILE);
+    if (next_txn == 0) {
+        next_txn = 1;
+        FILE *saved = path.empty() ? nullptr : std::fopen(path.c_str(), "r");
+        if (saved != nullptr) {
+            unsigned long value = 0;
+            if (std::fscanf(saved, "%lu", &value) == 1 && value > 0)
+                next_txn = (TxnID) value;
+            std::fclose(saved);
+        }
+    }
+    reserved = next_txn + TXN_ID_BATCH;
+    if (path.empty())
+        return;
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        throw DbRelationError("cannot save transaction ids in " + path);
+    std::string text = std::to_string(reserved) + "\n";
+    bool saved = ::write(fd, text.data(), text.size()) == (ssize_t) text.size() && ::fsync(fd) == 0;
+    ::close(fd);
+    if (!saved)
+        throw DbRelationError("cannot save transaction ids in " + path);
+}
+
+TxnID VersionManager::begin() {
+    std::lock_guard<std::mutex> guard(version_mutex);
+    if (next_txn >= reserved)
+        reserve_txn_ids();
+    TxnID txn = next_txn++;
+    running_txns.insert(txn);
+    return txn;
+}
+
+void VersionManager::end(TxnID txn) {
+    std::lock_guard<std::mutex> guard(version_mutex);
+    running_txns.erase(txn);
+}
+
+Snapshot *VersionManager::take(TxnID own) {
+    std::lock_guard<std::mutex> guard(version_mutex);
+    if (next_txn == 0)
+        reserve_txn_ids();
+    Snapshot *snapshot = new Snapshot(own, next_txn, std::vector<TxnID>(running_txns.begin(), running_txns.end()));
+    snapshot_lows.insert(snapshot->get_low());
+    return snapshot;
+}
+
+void VersionManager::release(Snapshot *snapshot) {
+    {
+        std::lock_guard<std::mutex> guard(version_mutex);
+        auto low = snapshot_lows.find(snapshot->get_low());
+        if (low != snapshot_lows.end())
+            snapshot_lows.erase(low);
+    }
+    delete snapshot;
+}
+
+TxnID VersionManager::horizon() {
+    std::lock_guard<std::mutex> guard(version_mutex);
+    TxnID horizon = next_txn;
+    if (!snapshot_lows.empty())
+        horizon = std::min(horizon, *snapshot_lows.begin());
+    if (!running_txns.empty())
+        horizon = std::min(horizon, *running_txns.begin());
+    return horizon;
+}
+
+
+// ReadView
+
+static thread_local const Snapshot *thread_snapshot = nullptr;
+
+ReadView::ReadView() : snapshot(thread_snapshot), previous(thread_snapshot), owned(nullptr) {
+    if (snapshot == nullptr) {
+        owned = VersionManager::take();
+        snapshot = thread_snapshot = owned;
+    }
+}
+
+ReadView::ReadView(TxnID own) : snapshot(nullptr), previous(thread_snapshot), owned(nullptr) {
+    owned = VersionManager::take(own);
+    snapshot = thread_snapshot = owned;
+}
+
+ReadView::ReadView(const Snapshot *snapshot) : snapshot(snapshot), previous(thread_snapshot), owned(nullptr) {
+    thread_snapshot = snapshot;
+}
+
+ReadView::~ReadView() {
+    thread_snapshot = previous;
+    if (owned != nullptr)
+        VersionManager::release(owned);
+}
+
+const Snapshot *ReadView::current() {
+    return thread_snapshot;
+}
+
+
+// VersionCollector
+
+VersionCollector::VersionCollector(RelationLister relations, unsigned int interval_ms)
+        : relations(relations), interval_ms(interval_ms), stopping(false), collected(0), reclaimed(0) {}
+
+VersionCollector::~VersionCollector() {
+    stop();
+}
+
+void VersionCollector::start() {
+    std::lock_guard<std::mutex> guard(stop_mutex);
+    if (thread.joinable())
+        return;
+    stopping = false;
+    thread = std::thread(&VersionCollector::run, this);
+}
+
+void VersionCollector::stop() {
+    {
+        std::lock_guard<std::mutex> guard(stop_mutex);
+        stopping = true;
+        stopped.notify_all();
+    }
+    if (thread.joinable())
+        thread.join();
+}
+
+// Each relation is vacuumed right after its dead versions are removed
+// A relation that fails (e.g., a deadlock with a writer) is simply tried again next pass
+size_t VersionCollector::collect() {
+    TxnID horizon = VersionManager::horizon();
+    size_t removed = 0;
+    for (auto const &relation: relations()) {
+        try {
+            removed += relation->collect_garbage(horizon);
+            reclaimed += relation->vacuum();
+        } catch (DbException &e) {
+        } catch (DbRelationError &e) {
+        }
+    }
+    collected += removed;
+    return removed;
+}
+
+// Collect every interval until stopped
+void VersionCollector::run() {
+    std::unique_lock<std::mutex> lock(stop_mutex);
+    while (!stopping) {
+        stopped.wait_for(lock, std::chrono::milliseconds(interval_ms));
+        if (stopping)
+            break;
+        lock.unlock();
+        collect();
+        lock.lock();
+    }
+}
+
+
+// Test function -- returns true if snapshots read the versions they should
+bool test_mvcc() {
+    ColumnNames column_names;
+    column_names.push_back("a");
+    column_names.push_back("b");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    HeapTable table("_test_mvcc_cpp", column_names, column_attributes);
+    table.create_if_not_exists();
+
+    ValueDict row;
+    for (int i = 1; i <= 100; i++) {
+        row["a"] = Value(i);
+        row["b"] = Value("old");
+        table.insert(&row);
+    }
+    auto contents = [&table]() {
+        std::map<int32_t, std::string> rows;
+        Handles *handles = table.select();
+        for (auto const &handle: *handles) {
+            ValueDict *values = table.project(handle);
+            rows[(*values)["a"].n] = (*values)["b"].s;
+            delete values;
+        }
+        delete handles;
+        return rows;
+    };
+    auto handle_of = [&table](int32_t a) {
+        ValueDict where;
+        where["a"] = Value(a);
+        Handles *handles = table.select(&where);
+        Handle handle = handles->empty() ? Handle(0, 0) : handles->front();
+        delete handles;
+        return handle;
+    };
+    auto is_old = [](std::map<int32_t, std::string> rows) {
+        return rows.size() == 100 && rows[1] == "old" && rows.count(2) == 1 && rows.count(101) == 0;
+    };
+    auto is_new = [](std::map<int32_t, std::string> rows) {
+        return rows.size() == 100 && rows[1] == "new" && rows.count(2) == 0 && rows.count(101) == 1;
+    };
+
+    // a snapshot taken before a transaction keeps reading what was there before it
+    Snapshot *before = VersionManager::take();
+    {
+        Transaction transaction;
+        ValueDict new_values;
+        new_values["b"] = Value("new");
+        table.update(handle_of(1), &new_values);
+        table.del(handle_of(2));
+        row["a"] = Value(101);
+        row["b"] = Value("new");
+        table.insert(&row);
+        bool own_writes = is_new(contents());
+        bool hidden;
+        {
+            ReadView view(before);
+            hidden = is_old(contents());
+        }
+        std::cout << "mvcc uncommitted: own writes " << own_writes << ", hidden " << hidden << std::endl;
+        if (!own_writes || !hidden)
+            return false;
+        transaction.commit();
+    }
+    {
+        ReadView view(before);
+        if (!is_old(contents()))
+            return false;
+    }
+    if (!is_new(contents()))
+        return false;
+    std::cout << "mvcc snapshots ok" << std::endl;
+
+    // the old versions go once the snapshot that could see them does
+    std::shared_ptr<DbRelation> unowned(&table, [](DbRelation *) {});
+    VersionCollector collector([&unowned]() { return std::vector<std::shared_ptr<DbRelation>>(1, unowned); });
+    size_t kept = collector.collect();
+    VersionManager::release(before);
+    size_t removed = collector.collect();
+    std::cout << "mvcc collected " << kept << " then " << removed << std::endl;
+    if (kept != 0 || removed != 2 || !is_new(contents()))
+        return false;
+
+    // a row changed since the snapshot can't be updated (first updater wins)
+    bool conflict = false;
+    {
+        Transaction late;
+        std::thread([&table, &handle_of]() {
+            Transaction early;
+            ValueDict new_values;
+            new_values["b"] = Value("early");
+            table.update(handle_of(3), &new_values);
+            early.commit();
+        }).join();
+        ValueDict new_values;
+        new_values["b"] = Value("late");
+        try {
+            table.update(handle_of(3), &new_values);
+        } catch (DbRelationError &e) {
+            conflict = true;
+        }
+    }
+    std::cout << "mvcc write conflict detected " << conflict << std::endl;
+    table.drop();
+    return conflict;
+}
@@ -0,0 +1,239 @@
+/**
+ * @file mvcc.h - Multi-version concurrency control: record versions, snapshots and their garbage collection.
+ * RecordVersion
+ * Snapshot
+ * VersionManager
+ * ReadView
+ * VersionCollector
+ *
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "storage_engine.h"
+
+/**
+ * @class RecordVersion - the version header at the start of every heap record
+ *
+ * xmin is the transaction that wrote this version and xmax the one that deleted or
+ * replaced it (0 while it is current). An update leaves the old version behind as a
+ * COPY appended elsewhere in the file and points the new version's prev at it, so the
+ * versions of a row form a chain from newest (at the row's handle) to oldest.
+ * A version written outside any transaction has xmin 0 and is visible to everyone.
+ *
+ * A row whose newest version outgrew its block lives elsewhere as a MOVED record, and
+ * the row's handle holds just a FORWARD header whose prev points at it.
+ */
+class RecordVersion {
+public:
+    static const u_int16_t SIZE = 16;  // bytes in front of the row's fields
+    static const u_int16_t COPY = 0x1;  // an older version, reachable only from a newer one's prev
+    static const u_int16_t MOVED = 0x2;  // a newest version, reachable only from its row's FORWARD stub
+    static const u_int16_t FORWARD = 0x4;  // no row data: the row is at prev
+
+    TxnID xmin;
+    TxnID xmax;
+    BlockID prev_block;  // 0 if there is no older version
+    RecordID prev_record;
+    u_int16_t flags;
+
+    RecordVersion(TxnID xmin = 0) : xmin(xmin), xmax(0), prev_block(0), prev_record(0), flags(0) {}
+
+    /**
+     * Decode the header at the start of a record.
+     * @returns  false if the record is too short to have one (e.g., a deleted slot)
+     */
+    bool read(const Dbt *record);
+
+    /**
+     * Encode the header into the first SIZE bytes of record.
+     */
+    void write(void *record) const;
+
+    bool is_copy() const { return (flags & COPY) != 0; }
+
+    bool is_moved() const { return (flags & MOVED) != 0; }
+
+    bool is_forward() const { return (flags & FORWARD) != 0; }
+
+    bool has_prev() const { return prev_block != 0; }
+
+    Handle prev() const { return Handle(prev_block, prev_record); }
+};
+
+/**
+ * @class Snapshot - which transactions' writes a reader sees
+ *
+ * A snapshot sees its own transaction's writes and those of every transaction that had
+ * ended before the snapshot was taken; transactions still running then, and any begun
+ * afterwards, are invisible for as long as the snapshot is used.
+ */
+class Snapshot {
+public:
+    Snapshot(TxnID own, TxnID bound, const std::vector<TxnID> &running);
+
+    virtual ~Snapshot() {}
+
+    /**
+     * Whether the snapshot sees what transaction txn wrote.
+     */
+    bool sees(TxnID txn) const;
+
+    /**
+     * Whether this version of a record is the one the snapshot reads.
+     */
+    bool visible(const RecordVersion &version) const {
+        return sees(version.xmin) && (version.xmax == 0 || !sees(version.xmax));
+    }
+
+    TxnID get_own() const { return own; }
+
+    /**
+     * Every transaction below this had ended when the snapshot was taken.
+     */
+    TxnID get_low() const { return running.empty() ? bound : running.front(); }
+
+protected:
+    TxnID own;
+    TxnID bound;                 // first id not yet handed out when the snapshot was taken
+    std::vector<TxnID> running;  // sorted
+};
+
+/**
+ * @class VersionManager - hands out transaction ids and keeps track of live snapshots
+ *
+ * Ids keep rising across restarts: they are reserved in batches from a small file in the
+ * database environment's home directory, so a version written before a crash is never
+ * mistaken for one written by a later transaction with the same id.
+ */
+class VersionManager {
+public:
+    /**
+     * Start a writer: its id counts as running until end() is called.
+     */
+    static TxnID begin();
+
+    /**
+     * A writer has committed or rolled back.
+     */
+    static void end(TxnID txn);
+
+    /**
+     * Take a snapshot of the transactions that have ended so far.
+     * @param own  the transaction reading through it (0 for a plain reader)
+     * @returns    a snapshot that counts as live until release()
+     */
+    static Snapshot *take(TxnID own = 0);
+
+    static void release(Snapshot *snapshot);
+
+    /**
+     * Versions replaced or deleted by a transaction below the horizon are invisible to
+     * every live snapshot and to all snapshots still to come, so they can be removed.
+     */
+    static TxnID horizon();
+};
+
+/**
+ * @class ReadView - the snapshot the storage engine reads through on the calling thread
+ *
+ * A statement or transaction creates one for its duration and everything it reads on
+ * this thread sees the same snapshot. A ReadView created while another one is in effect
+ * just shares its snapshot, so nested reads stay consistent with the outer ones.
+ */
+class ReadView {
+public:
+    /**
+     * Share the thread's current snapshot, or take a new one if there is none.
+     */
+    ReadView();
+
+    /**
+     * Always take a new snapshot, for writer own.
+     */
+    explicit ReadView(TxnID own);
+
+    /**
+     * Read through a snapshot owned elsewhere, e.g., another thread's.
+     */
+    explicit ReadView(const Snapshot *snapshot);
+
+    virtual ~ReadView();
+
+    ReadView(const ReadView &other) = delete;
+
+    ReadView &operator=(const ReadView &other) = delete;
+
+    const Snapshot &get() const { return *snapshot; }
+
+    /**
+     * The calling thread's snapshot, or nullptr outside any ReadView.
+     */
+    static const Snapshot *current();
+
+protected:
+    const Snapshot *snapshot;
+    const Snapshot *previous;  // the thread's snapshot before this view, put back by the destructor
+    Snapshot *owned;           // released by the destructor
+};
+
+/**
+ * Lists the relations whose dead versions should be collected. The collector holds on to
+ * them only for the pass it lists them for.
+ */
+typedef std::function<std::vector<std::shared_ptr<DbRelation>>()> RelationLister;
+
+/**
+ * @class VersionCollector - background removal of versions no snapshot can see anymore
+ *
+ * Each pass also vacuums the relations (see DbRelation::vacuum), so the space of the
+ * versions it removes is reclaimed in the background too.
+ */
+class VersionCollector {
+public:
+    VersionCollector(RelationLister relations, unsigned int interval_ms = 1000);
+
+    virtual ~VersionCollector();
+
+    VersionCollector(const VersionCollector &other) = delete;
+
+    VersionCollector &operator=(const VersionCollector &other) = delete;
+
+    virtual void start();
+
+    virtual void stop();
+
+    /**
+     * Make one pass over the relations right now.
+     * @returns  the number of versions removed
+     */
+    virtual size_t collect();
+
+    virtual size_t get_collected() const { return collected; }
+
+    /**
+     * Bytes vacuumed so far.
+     */
+    virtual size_t get_reclaimed() const { return reclaimed; }
+
+protected:
+    RelationLister relations;
+    unsigned int interval_ms;
+    std::thread thread;
+    std::mutex stop_mutex;
+    std::condition_variable stopped;
+    bool stopping;
+    std::atomic<size_t> collected;
+    std::atomic<size_t> reclaimed;
+
+    virtual void run();
+};
+
+bool test_mvcc();
@@ -0,0 +1,147 @@
+/*
+  overflow.cpp
+
+  Chains of overflow pages for large TEXT values.
+  A chain is written from its last page back to its first, so every page can be written
+  once, already knowing the page that follows it. Page numbers come from DB_APPEND, so
+  concurrent writers (the workers of a CSV import, say) never collide.
+
+*/
+
+#include "overflow.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include "profile.h"
+#include "transaction.h"
+
+OverflowFile::OverflowFile(Identifier table_name)
+        : dbfilename(table_name + ".overflow.db"), db(nullptr), pages_read(0) {}
+
+OverflowFile::~OverflowFile() {
+    close();
+}
+
+void OverflowFile::close() {
+    std::lock_guard<std::mutex> guard(open_mutex);
+    Db *handle = db.exchange(nullptr);
+    if (handle != nullptr) {
+        handle->close(0);
+        delete handle;
+    }
+}
+
+// Delete the file, if there is one (in the current transaction, if there is one)
+void OverflowFile::drop() {
+    close();
+    if (!exists())
+        return;
+    int result;
+    if (Transaction::enabled()) {
+        DbTxn *txn = Transaction::current();
+        result = _DB_ENV->dbremove(txn, dbfilename.c_str(), nullptr, txn == nullptr ? DB_AUTO_COMMIT : 0);
+    } else {
+        Db db(_DB_ENV, 0);
+        result = db.remove(dbfilename.c_str(), nullptr, 0);
+    }
+    if (result != 0)
+        throw DbRelationError("failed to delete overflow file " + dbfilename);
+}
+
+BlockID OverflowFile::write(const std::string &value, uint page_size) {
+    Db *handle = open(true);
+    uint capacity = page_size - NEXT_SIZE;
+    std::vector<char> page(page_size);
+    BlockID next = 0;
+    size_t end = value.length();
+    do {
+        size_t begin = end == 0 ? 0 : (end - 1) / capacity * capacity;
+        memcpy(page.data(), &next, NEXT_SIZE);
+        memcpy(page.data() + NEXT_SIZE, value.data() + begin, end - begin);
+        BlockID page_id = 0;
+        Dbt key(&page_id, sizeof(page_id));
+        key.set_ulen(sizeof(page_id));
+        key.set_flags(DB_DBT_USERMEM);
+        Dbt data(page.data(), (u_int32_t) (NEXT_SIZE + end - begin));
+        handle->put(Transaction::current(), &key, &data, DB_APPEND);
+        next = page_id;
+        end = begin;
+    } while (end > 0);
+    return next;
+}
+
+std::string OverflowFile::read(BlockID first, u_int32_t length) {
+    Db *handle = open(false);
+    std::string value;
+    value.reserve(length);
+    for (BlockID page_id = first; page_id != 0 && value.length() < length;) {
+        Dbt key(&page_id, sizeof(page_id));
+        Dbt data;
+        data.set_flags(DB_DBT_MALLOC);
+        int result = handle->get(Transaction::current(), &key, &data, 0);
+        if (result != 0 || data.get_size() < NEXT_SIZE) {
+            if (result == 0)
+                ::free(data.get_data());
+            throw DbRelationError("overflow page " + std::to_string(page_id) + " of " + dbfilename + " is missing");
+        }
+        const char *bytes = (const char *) data.get_data();
+        value.append(bytes + NEXT_SIZE, std::min((size_t) data.get_size() - NEXT_SIZE, length - value.length()));
+        memcpy(&page_id, bytes, NEXT_SIZE);
+        ::free(data.get_data());
+        pages_read++;
+        Profiling::page_read();
+    }
+    if (value.length() != length)
+        throw DbRelationError("overflow chain " + std::to_string(first) + " of " + dbfilename + " is too short");
+    return value;
+}
+
+void OverflowFile::free(BlockID first) {
+    Db *handle = open(false);
+    for (BlockID page_id = first; page_id != 0;) {
+        Dbt key(&page_id, sizeof(page_id));
+        BlockID next = 0;
+        Dbt data(&next, NEXT_SIZE);
+        data.set_ulen(NEXT_SIZE);
+        data.set_dlen(NEXT_SIZE);
+        data.set_doff(0);
+        data.set_flags(DB_DBT_USERMEM | DB_DBT_PARTIAL);  // just the link to the next page
+        if (handle->get(Transaction::current(), &key, &data, 0) != 0)
+            break;
+        handle->del(Transaction::current(), &key, 0);
+        page_id = next;
+    }
+}
+
+// Check whether the file is already on disk (in the environment's home directory)
+bool OverflowFile::exists() {
+    return env_file_exists(dbfilename);
+}
+
+// The open handle, opening the file first if need be (creating it only if create is set)
+// Like a dictionary, the file is opened (and created) outside of any transaction.
+Db *OverflowFile::open(bool create) {
+    Db *handle = db;
+    if (handle != nullptr)
+        return handle;
+    std::lock_guard<std::mutex> guard(open_mutex);
+    if (db != nullptr)
+        return db;
+    if (!create && !exists())
+        throw DbRelationError("overflow file " + dbfilename + " is missing");
+    u_int32_t flags = DB_CREATE | DB_THREAD;
+    if (Transaction::enabled())
+        flags |= DB_AUTO_COMMIT;
+    handle = new Db(_DB_ENV, 0);
+    handle->set_message_stream(&std::cout);
+    handle->set_error_stream(&std::cerr);
+    try {
+        handle->open(nullptr, dbfilename.c_str(), nullptr, DB_RECNO, flags, 0);
+    } catch (...) {
+        delete handle;
+        throw;
+    }
+    db = handle;
+    return handle;
+}
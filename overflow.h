@@ -0,0 +1,82 @@
+/**
+ * @file overflow.h - Out of line storage for large TEXT values.
+ * OverflowFile
+ *
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include "db_cxx.h"
+#include "storage_engine.h"
+
+/**
+ * @class OverflowFile - the TEXT values of a table too large to keep in its rows
+ *
+ * A value is stored as a chain of pages in the table's own Berkeley DB RecNo file
+ * (<table>.overflow.db): each page starts with the number of the next one (0 ends
+ * the chain) and holds as much of the value as fits in a block of the table's size.
+ * The row keeps a reference in place of the value: the MARKER where the value's
+ * length would go, then the value's length and its first page.
+ *
+ * The file is only created once a table has a value to put in it. Every chain belongs
+ * to exactly one record, and is freed when that record is removed for good.
+ */
+class OverflowFile {
+public:
+    static const u_int16_t MARKER = 0xFFFF;  // no inline TEXT value is this long
+    static const uint REFERENCE_SIZE = 2 * sizeof(u_int32_t);  // after the marker: length, first page
+
+    /**
+     * TEXT values longer than a quarter of a block go out of line, so that several rows
+     * still fit in a block however wide they get.
+     */
+    static uint threshold(uint block_size) { return block_size / 4; }
+
+    OverflowFile(Identifier table_name);
+
+    virtual ~OverflowFile();
+
+    OverflowFile(const OverflowFile &other) = delete;
+
+    OverflowFile &operator=(const OverflowFile &other) = delete;
+
+    virtual void close();
+
+    virtual void drop();
+
+    /**
+     * Store value as a new chain of pages of at most page_size bytes each.
+     * @returns  the chain's first page
+     */
+    virtual BlockID write(const std::string &value, uint page_size);
+
+    /**
+     * The value of length bytes whose chain starts at first.
+     */
+    virtual std::string read(BlockID first, u_int32_t length);
+
+    /**
+     * Delete the pages of the chain starting at first.
+     */
+    virtual void free(BlockID first);
+
+    /**
+     * How many pages read() has fetched so far.
+     */
+    virtual u_int64_t get_pages_read() const { return pages_read; }
+
+protected:
+    static const uint NEXT_SIZE = sizeof(BlockID);
+
+    std::string dbfilename;
+    std::atomic<Db *> db;  // a new handle for every open (Berkeley DB handles can't be reopened)
+    std::mutex open_mutex;
+    std::atomic<u_int64_t> pages_read;
+
+    virtual bool exists();
+
+    virtual Db *open(bool create);
+};
@@ -0,0 +1,134 @@
+/*
+  page_codec.cpp
+
+  LZ77 block compression with a single-probe hash table: each position looks up the last
+  position whose next four bytes hashed the same and takes the match if those bytes agree.
+  Greedy, so compression is a little worse than it could be, but it runs at memory speed.
+
+*/
+
+#include "page_codec.h"
+#include <cstring>
+#include <sys/types.h>
+
+static const size_t MIN_MATCH = 4;
+static const size_t MAX_DISTANCE = 0xFFFF;
+static const int HASH_BITS = 12;
+
+static u_int32_t read32(const char *p) {
+    u_int32_t n;
+    memcpy(&n, p, sizeof(n));
+    return n;
+}
+
+static u_int32_t hash32(u_int32_t n) {
+    return (n * 2654435761U) >> (32 - HASH_BITS);
+}
+
+// Append a length's continuation bytes (for a nibble that overflowed at 15)
+static bool put_length(size_t length, char *out, size_t &op, size_t capacity) {
+    for (; length >= 255; length -= 255) {
+        if (op >= capacity)
+            return false;
+        out[op++] = (char) 255;
+    }
+    if (op >= capacity)
+        return false;
+    out[op++] = (char) length;
+    return true;
+}
+
+// Append one sequence: literals, then (if length > 0) a match
+static bool put_sequence(const char *literals, size_t n_literals, size_t distance, size_t length,
+                         char *out, size_t &op, size_t capacity) {
+    if (op >= capacity)
+        return false;
+    size_t extra = length == 0 ? 0 : length - MIN_MATCH;
+    out[op++] = (char) (((n_literals < 15 ? n_literals : 15) << 4) | (extra < 15 ? extra : 15));
+    if (n_literals >= 15 && !put_length(n_literals - 15, out, op, capacity))
+        return false;
+    if (op + n_literals > capacity)
+        return false;
+    memcpy(out + op, literals, n_literals);
+    op += n_literals;
+    if (length == 0)
+        return true;
+    if (op + 2 > capacity)
+        return false;
+    out[op++] = (char) (distance & 0xFF);
+    out[op++] = (char) (distance >> 8);
+    return extra < 15 || put_length(extra - 15, out, op, capacity);
+}
+
+size_t PageCodec::compress(const char *in, size_t size, char *out, size_t capacity) {
+    u_int32_t table[1 << HASH_BITS];  // position + 1 of the last 4 bytes with each hash
+    memset(table, 0, sizeof(table));
+    size_t op = 0;
+    size_t anchor = 0;  // start of the pending literals
+    size_t i = 0;
+    while (i + MIN_MATCH <= size) {
+        u_int32_t next = read32(in + i);
+        u_int32_t h = hash32(next);
+        size_t candidate = table[h];
+        table[h] = (u_int32_t) (i + 1);
+        if (candidate == 0 || i - (candidate - 1) > MAX_DISTANCE || read32(in + candidate - 1) != next) {
+            i++;
+            continue;
+        }
+        size_t match = candidate - 1;
+        size_t length = MIN_MATCH;
+        while (i + length < size && in[match + length] == in[i + length])
+            length++;
+        if (!put_sequence(in + anchor, i - anchor, i - match, length, out, op, capacity))
+            return 0;
+        i += length;
+        anchor = i;
+    }
+    if (!put_sequence(in + anchor, size - anchor, 0, 0, out, op, capacity))
+        return 0;
+    return op;
+}
+
+// Read a length's continuation bytes
+static bool get_length(const unsigned char *in, size_t size, size_t &ip, size_t &length) {
+    unsigned char b;
+    do {
+        if (ip >= size)
+            return false;
+        b = in[ip++];
+        length += b;
+    } while (b == 255);
+    return true;
+}
+
+bool PageCodec::decompress(const char *in, size_t size, char *out, size_t expected) {
+    const unsigned char *bytes = (const unsigned char *) in;
+    size_t ip = 0;
+    size_t op = 0;
+    while (ip < size) {
+        unsigned char token = bytes[ip++];
+        size_t n_literals = token >> 4;
+        if (n_literals == 15 && !get_length(bytes, size, ip, n_literals))
+            return false;
+        if (ip + n_literals > size || op + n_literals > expected)
+            return false;
+        memcpy(out + op, in + ip, n_literals);
+        ip += n_literals;
+        op += n_literals;
+        if (ip == size)
+            break;  // the last sequence
+
+        if (ip + 2 > size)
+            return false;
+        size_t distance = bytes[ip] | (bytes[ip + 1] << 8);
+        ip += 2;
+        size_t length = (token & 0x0F) + MIN_MATCH;
+        if ((token & 0x0F) == 15 && !get_length(bytes, size, ip, length))
+            return false;
+        if (distance == 0 || distance > op || op + length > expected)
+            return false;
+        for (size_t k = 0; k < length; k++, op++)  // may overlap itself, so byte by byte
+            out[op] = out[op - distance];
+    }
+    return op == expected;
+}
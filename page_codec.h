@@ -0,0 +1,37 @@
+/**
+ * @file page_codec.h - Compression of whole database blocks.
+ * PageCodec
+ *
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#pragma once
+
+#include <cstddef>
+
+/**
+ * @class PageCodec - a small LZ77 codec for blocks of up to 64KB
+ *
+ * The output is a series of sequences, each a run of literal bytes followed by a copy
+ * of earlier output (a match). Every sequence starts with a token byte: the high four
+ * bits count the literals, the low four the match length beyond the 4-byte minimum, and
+ * a count of 15 continues in extra bytes of 255 until one is smaller. The literals
+ * follow, then the match's distance back as two little-endian bytes, then the extra
+ * length bytes. The last sequence has literals only.
+ *
+ * Slotted pages compress well: their free space is one long run, and the records of a
+ * table tend to repeat each other's headers and values.
+ */
+class PageCodec {
+public:
+    /**
+     * Compress size bytes from in.
+     * @returns  the compressed size, or 0 if it would take more than capacity bytes
+     */
+    static size_t compress(const char *in, size_t size, char *out, size_t capacity);
+
+    /**
+     * Decompress size bytes from in into exactly expected bytes at out.
+     * @returns  false if in is not a well-formed encoding of that many bytes
+     */
+    static bool decompress(const char *in, size_t size, char *out, size_t expected);
+};
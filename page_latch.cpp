@@ -0,0 +1,64 @@
+/*
+  page_latch.cpp
+
+  Spinning shared/exclusive page latches with a seqlock-style version.
+  Latches are held only across a single block fetch-modify-write, so waiters spin
+  briefly and then yield rather than going to sleep.
+
+*/
+
+#include "page_latch.h"
+#include <thread>
+
+// Spin a little, then give the CPU away
+static void backoff(unsigned int &spins) {
+    if (++spins < 64)
+        return;
+    std::this_thread::yield();
+}
+
+void PageLatch::lock_shared() {
+    unsigned int spins = 0;
+    while (true) {
+        u_int32_t current = state.load(std::memory_order_relaxed);
+        if ((current & WRITER) == 0
+            && state.compare_exchange_weak(current, current + 1, std::memory_order_acquire))
+            return;
+        backoff(spins);
+    }
+}
+
+void PageLatch::unlock_shared() {
+    state.fetch_sub(1, std::memory_order_release);
+}
+
+void PageLatch::lock() {
+    unsigned int spins = 0;
+
+    // claim the writer bit (which keeps new readers out), then wait for the readers to leave
+    while (true) {
+        u_int32_t current = state.load(std::memory_order_relaxed);
+        if ((current & WRITER) == 0
+            && state.compare_exchange_weak(current, current | WRITER, std::memory_order_acquire))
+            break;
+        backoff(spins);
+    }
+    while ((state.load(std::memory_order_acquire) & ~WRITER) != 0)
+        backoff(spins);
+    version.fetch_add(1, std::memory_order_acq_rel);  // odd: write in progress
+}
+
+void PageLatch::unlock() {
+    version.fetch_add(1, std::memory_order_release);  // even again
+    state.fetch_and(~WRITER, std::memory_order_release);
+}
+
+bool PageLatch::read_begin(u_int64_t &version) const {
+    version = this->version.load(std::memory_order_acquire);
+    return (version & 1) == 0;
+}
+
+bool PageLatch::read_validate(u_int64_t version) const {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return this->version.load(std::memory_order_relaxed) == version;
+}
@@ -0,0 +1,138 @@
+/**
+ * @file page_latch.h - Short-term latches protecting heap file blocks from concurrent threads.
+ * PageLatch
+ * PageLatches
+ *
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include "storage_engine.h"
+
+/**
+ * @class PageLatch - shared/exclusive latch with a version for optimistic readers
+ *
+ * Writers hold it exclusively for a block's whole fetch-modify-write. The version is
+ * odd while a writer holds the latch and goes up by two for every write, so a reader
+ * can skip the latch altogether: note the version, copy the block, and keep the copy
+ * only if the version is still the same (even) number.
+ *
+ * A writer waiting for the latch keeps new readers out, so a steady stream of
+ * scans can't starve inserts.
+ */
+class PageLatch {
+public:
+    PageLatch() : state(0), version(0) {}
+
+    PageLatch(const PageLatch &other) = delete;
+
+    PageLatch &operator=(const PageLatch &other) = delete;
+
+    virtual ~PageLatch() {}
+
+    virtual void lock_shared();
+
+    virtual void unlock_shared();
+
+    virtual void lock();
+
+    virtual void unlock();
+
+    /**
+     * Start an optimistic read.
+     * @param version  set to the version to validate against
+     * @returns        false if a writer holds the latch right now (don't bother reading)
+     */
+    virtual bool read_begin(u_int64_t &version) const;
+
+    /**
+     * Finish an optimistic read.
+     * @returns  true if no writer took the latch since read_begin() (the copy is consistent)
+     */
+    virtual bool read_validate(u_int64_t version) const;
+
+protected:
+    static const u_int32_t WRITER = 0x80000000;  // other bits count the readers
+
+    std::atomic<u_int32_t> state;
+    std::atomic<u_int64_t> version;
+};
+
+/**
+ * @class PageLatches - a fixed table of latches shared among all the blocks of a file
+ *
+ * Block n uses latch n % STRIPES, so memory stays constant as the file grows; two blocks
+ * that happen to share a latch just serialize their writers. Latches are padded to
+ * separate cache lines.
+ */
+class PageLatches {
+public:
+    static const size_t STRIPES = 256;
+
+    PageLatches() {}
+
+    PageLatches(const PageLatches &other) = delete;
+
+    PageLatches &operator=(const PageLatches &other) = delete;
+
+    virtual ~PageLatches() {}
+
+    virtual PageLatch &get(BlockID block_id) { return latches[block_id % STRIPES].latch; }
+
+protected:
+    struct PaddedLatch {
+        PageLatch latch;
+        char padding[64];
+    };
+
+    PaddedLatch latches[STRIPES];
+};
+
+/**
+ * @class PageWriteGuard - hold a block's latch exclusively for the life of the guard
+ */
+class PageWriteGuard {
+public:
+    explicit PageWriteGuard(PageLatch &latch) : latch(latch) { latch.lock(); }
+
+    ~PageWriteGuard() { latch.unlock(); }
+
+    PageWriteGuard(const PageWriteGuard &other) = delete;
+
+    PageWriteGuard &operator=(const PageWriteGuard &other) = delete;
+
+protected:
+    PageLatch &latch;
+};
+
+/**
+ * @class PagePairWriteGuard - hold two blocks' latches exclusively for the life of the guard
+ *
+ * The latches are always taken in address order, so threads latching the same two blocks
+ * can't deadlock, and a latch the blocks share is only taken once.
+ */
+class PagePairWriteGuard {
+public:
+    PagePairWriteGuard(PageLatch &a, PageLatch &b)
+            : first(std::less<PageLatch *>()(&a, &b) ? a : b), second(std::less<PageLatch *>()(&a, &b) ? b : a) {
+        first.lock();
+        if (&second != &first)
+            second.lock();
+    }
+
+    ~PagePairWriteGuard() {
+        if (&second != &first)
+            second.unlock();
+        first.unlock();
+    }
+
+    PagePairWriteGuard(const PagePairWriteGuard &other) = delete;
+
+    PagePairWriteGuard &operator=(const PagePairWriteGuard &other) = delete;
+
+protected:
+    PageLatch &first;
+    PageLatch &second;
+};
@@ -0,0 +1,749 @@
+/*
+  partition.cpp
+
+  Tables split by a column's values into several heap tables.
+  A partition's handles only differ from its HeapTable's in the top bits of the block id,
+  so everything but routing is passed straight through to the partitions.
+
+*/
+
+#include "partition.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <unistd.h>
+#include "hash.h"
+#include "mvcc.h"
+#include "profile.h"
+#include "statistics.h"
+#include "transaction.h"
+
+
+// PartitionScheme
+
+// The value's bytes go through hash_bytes, so rows land in the same partitions with any compiler
+u_int32_t PartitionScheme::partition_of(const Value &value) const {
+    if (kind == RANGE) {
+        if (value.data_type != ColumnAttribute::INT)
+            throw DbRelationError("range partition column " + column_name + " needs an INT");
+        return (u_int32_t) (std::upper_bound(bounds.begin(), bounds.end(), value.n) - bounds.begin());
+    }
+    const char *bytes = value.data_type == ColumnAttribute::INT ? (const char *) &value.n : value.s.data();
+    size_t size = value.data_type == ColumnAttribute::INT ? sizeof(value.n) : value.s.size();
+    return (u_int32_t) (hash_bytes(bytes, size) % partitions);
+}
+
+void PartitionScheme::check(const ColumnNames &column_names, const ColumnAttributes &column_attributes) const {
+    size_t i = std::find(column_names.begin(), column_names.end(), column_name) - column_names.begin();
+    if (i == column_names.size())
+        throw DbRelationError("unknown partition column " + column_name);
+    if (count() < 1 || count() > MAX_PARTITIONS)
+        throw DbRelationError("a table needs from 1 to " + std::to_string(MAX_PARTITIONS) + " partitions");
+    if (kind == RANGE) {
+        if (ColumnAttribute(column_attributes[i]).get_data_type() != ColumnAttribute::INT)
+            throw DbRelationError("range partitioning needs an INT column, not " + column_name);
+        for (size_t b = 1; b < bounds.size(); b++)
+            if (bounds[b - 1] >= bounds[b])
+                throw DbRelationError("range partition bounds must be ascending");
+    }
+}
+
+Identifier PartitionScheme::partition_name(const Identifier &table_name, u_int32_t partition) {
+    return table_name + ".p" + std::to_string(partition);
+}
+
+static std::string partitions_filename(const Identifier &table_name) {
+    return table_name + ".partitions.db";
+}
+
+// Unlike statistics, the scheme is part of the table's definition: it is written in the
+// current transaction (if there is one), so a CREATE TABLE that aborts leaves none behind
+void PartitionScheme::save(const Identifier &table_name) const {
+    std::string dbfilename = partitions_filename(table_name);
+    DbTxn *txn = Transaction::current();
+    u_int32_t flags = DB_CREATE | DB_THREAD;
+    if (Transaction::enabled() && txn == nullptr)
+        flags |= DB_AUTO_COMMIT;
+    Db db(_DB_ENV, 0);
+    db.set_message_stream(&std::cout);
+    db.set_error_stream(&std::cerr);
+    db.open(txn, dbfilename.c_str(), nullptr, DB_RECNO, flags, 0);
+    std::string bytes = marshal();
+    db_recno_t recno = 1;
+    Dbt key(&recno, sizeof(recno));
+    Dbt data((void *) bytes.data(), (u_int32_t) bytes.size());
+    int result = db.put(txn, &key, &data, 0);
+    db.close(0);
+    if (result != 0)
+        throw DbRelationError("failed to write partitions file " + dbfilename);
+}
+
+PartitionScheme *PartitionScheme::load(const Identifier &table_name) {
+    std::string dbfilename = partitions_filename(table_name);
+    if (!env_file_exists(dbfilename))
+        return nullptr;
+    u_int32_t flags = DB_THREAD;
+    if (Transaction::enabled())
+        flags |= DB_AUTO_COMMIT;
+    Db db(_DB_ENV, 0);
+    db.set_message_stream(&std::cout);
+    db.set_error_stream(&std::cerr);
+    db.open(nullptr, dbfilename.c_str(), nullptr, DB_RECNO, flags, 0);
+    db_recno_t recno = 1;
+    Dbt key(&recno, sizeof(recno));
+    Dbt data;
+    data.set_flags(DB_DBT_MALLOC);
+    PartitionScheme *scheme = nullptr;
+    if (db.get(nullptr, &key, &data, 0) == 0) {
+        scheme = new PartitionScheme();
+        if (!scheme->unmarshal(std::string((const char *) data.get_data(), data.get_size()))) {
+            delete scheme;
+            scheme = nullptr;
+        }
+        free(data.get_data());
+    }
+    db.close(0);
+    if (scheme == nullptr)
+        throw DbRelationError("bad partitions file " + dbfilename);
+    return scheme;
+}
+
+// Delete the file, if there is one (in the current transaction, if there is one)
+void PartitionScheme::drop(const Identifier &table_name) {
+    std::string dbfilename = partitions_filename(table_name);
+    if (!env_file_exists(dbfilename))
+        return;
+    int result;
+    if (Transaction::enabled()) {
+        DbTxn *txn = Transaction::current();
+        result = _DB_ENV->dbremove(txn, dbfilename.c_str(), nullptr, txn == nullptr ? DB_AUTO_COMMIT : 0);
+    } else {
+        Db db(_DB_ENV, 0);
+        result = db.remove(dbfilename.c_str(), nullptr, 0);
+    }
+    if (result != 0)
+        throw DbRelationError("failed to delete partitions file " + dbfilename);
+}
+
+template<typename T>
+static void put(std::string &bytes, const T &value) {
+    bytes.append((const char *) &value, sizeof(T));
+}
+
+template<typename T>
+static bool get(const std::string &bytes, size_t &offset, T &value) {
+    if (offset + sizeof(T) > bytes.size())
+        return false;
+    memcpy(&value, bytes.data() + offset, sizeof(T));
+    offset += sizeof(T);
+    return true;
+}
+
+std::string PartitionScheme::marshal() const {
+    std::string bytes;
+    put(bytes, (u_int8_t) kind);
+    put(bytes, partitions);
+    put(bytes, (u_int32_t) bounds.size());
+    for (auto const &bound: bounds)
+        put(bytes, bound);
+    put(bytes, (u_int32_t) column_name.size());
+    bytes += column_name;
+    return bytes;
+}
+
+// Returns false if bytes are cut short
+bool PartitionScheme::unmarshal(const std::string &bytes) {
+    size_t offset = 0;
+    u_int8_t which;
+    u_int32_t n_bounds, length;
+    if (!get(bytes, offset, which) || !get(bytes, offset, partitions) || !get(bytes, offset, n_bounds))
+        return false;
+    kind = (Kind) which;
+    bounds.resize(n_bounds);
+    for (auto &bound: bounds)
+        if (!get(bytes, offset, bound))
+            return false;
+    if (!get(bytes, offset, length) || offset + length > bytes.size())
+        return false;
+    column_name = bytes.substr(offset, length);
+    return true;
+}
+
+
+// PartitionedTable
+
+PartitionedTable::PartitionedTable(Identifier table_name, ColumnNames column_names,
+                                   ColumnAttributes column_attributes, const PartitionScheme &scheme)
+        : DbRelation(table_name, column_names, column_attributes), scheme(scheme), pruned_partitions(0),
+          statistics_loaded(false) {
+    scheme.check(column_names, column_attributes);
+    for (u_int32_t p = 0; p < scheme.count(); p++)
+        partitions.push_back(new HeapTable(PartitionScheme::partition_name(table_name, p), column_names,
+                                           column_attributes));
+}
+
+PartitionedTable::~PartitionedTable() {
+    for (auto partition: partitions)
+        delete partition;
+}
+
+// Corresponds to the SQL command CREATE TABLE ... PARTITION BY ...
+void PartitionedTable::create() {
+    scheme.save(table_name);
+    for (auto partition: partitions)
+        partition->create();
+}
+
+void PartitionedTable::create_if_not_exists() {
+    std::unique_ptr<PartitionScheme> saved(PartitionScheme::load(table_name));
+    if (saved == nullptr)
+        scheme.save(table_name);
+    for (auto partition: partitions)
+        partition->create_if_not_exists();
+}
+
+void PartitionedTable::drop() {
+    for (auto partition: partitions)
+        partition->drop();
+    PartitionScheme::drop(table_name);
+    TableStatistics::drop(table_name);
+    std::lock_guard<std::mutex> guard(statistics_mutex);
+    statistics.reset();
+    statistics_loaded = true;
+}
+
+void PartitionedTable::open() {
+    for (auto partition: partitions)
+        partition->open();
+}
+
+void PartitionedTable::close() {
+    for (auto partition: partitions)
+        partition->close();
+}
+
+void PartitionedTable::set_compression(bool compressed) {
+    for (auto partition: partitions)
+        partition->set_compression(compressed);
+}
+
+void PartitionedTable::set_block_size(uint block_size) {
+    for (auto partition: partitions)
+        partition->set_block_size(block_size);
+}
+
+void PartitionedTable::set_bloom_filters(const ColumnNames &columns, double false_positive_rate) {
+    for (auto partition: partitions)
+        partition->set_bloom_filters(columns, false_positive_rate);
+}
+
+Handle PartitionedTable::global_handle(u_int32_t partition, Handle handle) {
+    if (handle.first > MAX_PARTITION_BLOCK)
+        throw DbRelationError("partition has more blocks than a handle can address");
+    return Handle(partition << (32 - PARTITION_BITS) | handle.first, handle.second);
+}
+
+u_int32_t PartitionedTable::partition_of(Handle handle) {
+    return handle.first >> (32 - PARTITION_BITS);
+}
+
+Handle PartitionedTable::local_handle(Handle handle) {
+    return Handle(handle.first & MAX_PARTITION_BLOCK, handle.second);
+}
+
+// Routes the row by its partition column
+Handle PartitionedTable::insert(const ValueDict *row) {
+    ValueDict::const_iterator value = row->find(scheme.column_name);
+    if (value == row->end())
+        throw DbRelationError("row has no value for partition column " + scheme.column_name);
+    u_int32_t p = scheme.partition_of(value->second);
+    return global_handle(p, partitions[p]->insert(row));
+}
+
+void PartitionedTable::update(const Handle handle, const ValueDict *new_values) {
+    u_int32_t p = partition_of(handle);
+    if (p >= partitions.size())
+        throw DbRelationError("no such partition");
+    ValueDict::const_iterator value = new_values->find(scheme.column_name);
+    if (value != new_values->end() && scheme.partition_of(value->second) != p)
+        throw DbRelationError("can't move a row to another partition by updating " + scheme.column_name);
+    partitions[p]->update(local_handle(handle), new_values);
+}
+
+void PartitionedTable::del(const Handle handle) {
+    u_int32_t p = partition_of(handle);
+    if (p >= partitions.size())
+        throw DbRelationError("no such partition");
+    partitions[p]->del(local_handle(handle));
+}
+
+// An equality on the partition column leaves just the partition its value goes to
+std::vector<u_int32_t> PartitionedTable::partitions_for(const ValueDict *where) const {
+    std::vector<u_int32_t> chosen;
+    ValueDict::const_iterator value;
+    if (where != nullptr && (value = where->find(scheme.column_name)) != where->end()) {
+        if (scheme.kind == PartitionScheme::HASH || value->second.data_type == ColumnAttribute::INT)
+            chosen.push_back(scheme.partition_of(value->second));
+        return chosen;  // a TEXT value in an INT column: no partition
+    }
+    for (u_int32_t p = 0; p < partitions.size(); p++)
+        chosen.push_back(p);
+    return chosen;
+}
+
+Handles *PartitionedTable::select() {
+    return select(nullptr, SIZE_MAX, nullptr);
+}
+
+Handles *PartitionedTable::select(const ValueDict *where) {
+    return select(where, SIZE_MAX, nullptr);
+}
+
+Handles *PartitionedTable::select(const ValueDict *where, size_t limit) {
+    return select(where, limit, nullptr);
+}
+
+// Selects from each partition that can hold matching rows in turn, all through one snapshot
+// A limit stops it at the partition where it finds the last row it needs.
+Handles *PartitionedTable::select(const ValueDict *where, size_t limit, const BlockSample *sample) {
+    ReadView view;
+    std::vector<u_int32_t> chosen = partitions_for(where);
+    pruned_partitions += partitions.size() - chosen.size();
+    Handles *handles = new Handles;
+    try {
+        for (auto const &p: chosen) {
+            if (handles->size() >= limit)
+                break;
+            Handles *found = partitions[p]->select(where, limit - handles->size(), sample);
+            for (auto const &handle: *found)
+                handles->push_back(global_handle(p, handle));
+            delete found;
+        }
+    } catch (...) {
+        delete handles;
+        throw;
+    }
+    return handles;
+}
+
+ValueDict *PartitionedTable::project(Handle handle) {
+    return project(handle, nullptr);
+}
+
+ValueDict *PartitionedTable::project(Handle handle, const ColumnNames *column_names) {
+    u_int32_t p = partition_of(handle);
+    if (p >= partitions.size())
+        throw DbRelationError("no such partition");
+    return partitions[p]->project(local_handle(handle), column_names);
+}
+
+// Hands each run of handles from one partition to that partition's batch projection
+ValueDicts *PartitionedTable::project(const Handles *handles, const ColumnNames *column_names) {
+    ReadView view;
+    ValueDicts *rows = new ValueDicts;
+    try {
+        for (size_t i = 0; i < handles->size();) {
+            u_int32_t p = partition_of((*handles)[i]);
+            if (p >= partitions.size())
+                throw DbRelationError("no such partition");
+            Handles run;
+            for (; i < handles->size() && partition_of((*handles)[i]) == p; i++)
+                run.push_back(local_handle((*handles)[i]));
+            ValueDicts *projected = partitions[p]->project(&run, column_names);
+            rows->insert(rows->end(), projected->begin(), projected->end());
+            delete projected;
+        }
+    } catch (...) {
+        for (auto row: *rows)
+            delete row;
+        delete rows;
+        throw;
+    }
+    return rows;
+}
+
+// Scans up to n_workers partitions at once, each with n_workers / (partitions scanned at
+// once) workers of its own, all through the caller's snapshot. Partition scan t's worker w
+// is worker t * per_scan + w to visit.
+void PartitionedTable::parallel_scan(const ValueDict *where, unsigned int n_workers, RowVisitor visit,
+                                     const ColumnNames *column_names, const BlockSample *sample) {
+    if (n_workers < 1)
+        n_workers = 1;
+    ReadView view;
+    const Snapshot *snapshot = &view.get();
+    std::vector<u_int32_t> chosen = partitions_for(where);
+    pruned_partitions += partitions.size() - chosen.size();
+    if (chosen.empty())
+        return;
+    unsigned int scans = std::min(n_workers, (unsigned int) chosen.size());
+    unsigned int per_scan = n_workers / scans;
+    std::atomic<size_t> next_partition(0);
+    std::mutex failure_mutex;
+    std::exception_ptr failure;
+    OperatorProfile *profile = Profiling::current();
+
+    auto scanner = [&](unsigned int scan_id) {
+        ReadView scanner_view(snapshot);
+        Profiling profiling(scan_id == 0 ? nullptr : profile, false);
+        try {
+            size_t i;
+            while ((i = next_partition++) < chosen.size()) {
+                u_int32_t p = chosen[i];
+                partitions[p]->parallel_scan(where, per_scan, [&, p](unsigned int worker, Handle handle,
+                                                                     const ValueDict *row) {
+                    visit(scan_id * per_scan + worker, global_handle(p, handle), row);
+                }, column_names, sample);
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> guard(failure_mutex);
+            if (!failure)
+                failure = std::current_exception();
+            next_partition = chosen.size();  // stop the other scans early
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned int s = 1; s < scans; s++)
+        threads.push_back(std::thread(scanner, s));
+    scanner(0);
+    for (auto &thread: threads)
+        thread.join();
+    if (failure)
+        std::rethrow_exception(failure);
+}
+
+// The column'th field of a CSV line, unquoted, like CSVImport reads it
+// Returns false if the line has fewer fields.
+static bool csv_field(const std::string &line, size_t column, std::string &field) {
+    size_t i = 0;
+    for (size_t c = 0;; c++) {
+        field.clear();
+        if (i < line.size() && line[i] == '"') {
+            for (i++; i < line.size(); i++) {
+                if (line[i] == '"') {
+                    if (i + 1 < line.size() && line[i + 1] == '"')
+                        i++;
+                    else
+                        break;
+                }
+                field += line[i];
+            }
+            i++;
+        } else {
+            size_t comma = line.find(',', i);
+            comma = comma == std::string::npos ? line.size() : comma;
+            field = line.substr(i, comma - i);
+            i = comma;
+        }
+        if (c == column)
+            return true;
+        if (i >= line.size())
+            return false;
+        i++;  // past the comma
+    }
+}
+
+// Splits the file by partition into temporary files and bulk loads each into its partition
+// Every partition's load parses with n_workers threads, on this thread's transaction.
+size_t PartitionedTable::import_csv(const std::string &file_path, unsigned int n_workers) {
+    std::ifstream in(file_path);
+    if (!in)
+        throw DbRelationError("cannot open " + file_path + ": " + strerror(errno));
+    size_t column = std::find(column_names.begin(), column_names.end(), scheme.column_name) - column_names.begin();
+    bool is_int = ColumnAttribute(column_attributes[column]).get_data_type() == ColumnAttribute::INT;
+
+    std::vector<std::string> paths(partitions.size());
+    std::vector<FILE *> files(partitions.size(), nullptr);
+    auto remove_all = [&]() {
+        for (size_t p = 0; p < paths.size(); p++) {
+            if (files[p] != nullptr)
+                fclose(files[p]);
+            files[p] = nullptr;
+            if (!paths[p].empty())
+                unlink(paths[p].c_str());
+        }
+    };
+    size_t rows = 0;
+    try {
+        std::string line, field;
+        for (size_t number = 1; std::getline(in, line); number++) {
+            if (line.empty() || line == "\r")
+                continue;
+            std::string text = !line.empty() && line.back() == '\r' ? line.substr(0, line.size() - 1) : line;
+            if (!csv_field(text, column, field))
+                throw DbRelationError("too few fields in line " + std::to_string(number) + " of " + file_path);
+            Value value(field);
+            if (is_int) {
+                char *rest;
+                errno = 0;
+                long n = strtol(field.c_str(), &rest, 10);
+                if (field.empty() || *rest != '\0' || errno != 0 || n < INT32_MIN || n > INT32_MAX)
+                    throw DbRelationError("bad INT '" + field + "' for " + scheme.column_name + " in line "
+                                          + std::to_string(number) + " of " + file_path);
+                value = Value((int32_t) n);
+            }
+            u_int32_t p = scheme.partition_of(value);
+            if (files[p] == nullptr) {
+                std::string path = std::string(P_tmpdir) + "/" + PartitionScheme::partition_name(table_name, p)
+                                   + ".XXXXXX";
+                std::vector<char> name(path.begin(), path.end());
+                name.push_back('\0');
+                int fd = mkstemp(name.data());
+                if (fd < 0)
+                    throw DbRelationError("cannot create a file in " + std::string(P_tmpdir) + ": " + strerror(errno));
+                paths[p] = name.data();
+                files[p] = fdopen(fd, "w");
+                if (files[p] == nullptr) {
+                    ::close(fd);
+                    throw DbRelationError("cannot write " + paths[p] + ": " + strerror(errno));
+                }
+            }
+            line += '\n';
+            if (fwrite(line.data(), 1, line.size(), files[p]) != line.size())
+                throw DbRelationError("cannot write " + paths[p] + ": " + strerror(errno));
+        }
+        for (size_t p = 0; p < partitions.size(); p++) {
+            if (files[p] == nullptr)
+                continue;
+            int closed = fclose(files[p]);
+            files[p] = nullptr;
+            if (closed != 0)
+                throw DbRelationError("cannot write " + paths[p] + ": " + strerror(errno));
+            rows += partitions[p]->import_csv(paths[p], n_workers);
+        }
+    } catch (...) {
+        remove_all();
+        throw;
+    }
+    remove_all();
+    return rows;
+}
+
+size_t PartitionedTable::collect_garbage(TxnID horizon) {
+    size_t removed = 0;
+    for (auto partition: partitions)
+        removed += partition->collect_garbage(horizon);
+    return removed;
+}
+
+size_t PartitionedTable::vacuum() {
+    size_t reclaimed = 0;
+    for (auto partition: partitions)
+        reclaimed += partition->vacuum();
+    return reclaimed;
+}
+
+// Merges the partitions' equi-depth histograms: each bucket of a partition stands for its
+// share of that partition's rows, and the merged bounds are the quantiles of all of them
+static std::vector<int32_t> merge_bounds(const std::vector<std::shared_ptr<const TableStatistics>> &parts,
+                                         size_t column) {
+    std::vector<std::pair<int32_t, double>> points;  // bucket upper bound, rows in the bucket
+    int32_t low = INT32_MAX;
+    double total = 0;
+    for (auto const &part: parts) {
+        const std::vector<int32_t> &bounds = part->columns[column].bounds;
+        if (bounds.size() < 2 || part->rows <= 0)
+            continue;
+        low = std::min(low, bounds.front());
+        double rows = part->rows / (bounds.size() - 1);
+        for (size_t b = 1; b < bounds.size(); b++)
+            points.push_back(std::make_pair(bounds[b], rows));
+        total += part->rows;
+    }
+    std::vector<int32_t> merged;
+    if (points.empty())
+        return merged;
+    std::sort(points.begin(), points.end());
+    merged.push_back(low);
+    double seen = 0;
+    size_t i = 0;
+    for (uint b = 1; b <= ColumnStatistics::BUCKETS; b++) {
+        double target = total * b / ColumnStatistics::BUCKETS;
+        while (i + 1 < points.size() && seen + points[i].second < target - 1e-9)
+            seen += points[i++].second;
+        merged.push_back(points[i].first);
+    }
+    return merged;
+}
+
+// Analyzes every partition from its share of the sample, and merges their statistics into the
+// table's. Only the partition column's values can't repeat across partitions, so its distinct
+// counts add up; any other column's count is taken as the largest partition's.
+std::shared_ptr<const TableStatistics> PartitionedTable::analyze(size_t sample_blocks) {
+    std::vector<std::shared_ptr<const TableStatistics>> parts;
+    size_t share = std::max((size_t) 1, sample_blocks / partitions.size());
+    for (auto partition: partitions)
+        parts.push_back(partition->analyze(share));
+
+    size_t column = std::find(column_names.begin(), column_names.end(), scheme.column_name) - column_names.begin();
+    TableStatistics *gathered = new TableStatistics();
+    for (auto const &part: parts) {
+        gathered->rows += part->rows;
+        gathered->blocks += part->blocks;
+        gathered->sampled_blocks += part->sampled_blocks;
+    }
+    for (size_t i = 0; i < column_names.size(); i++) {
+        ColumnStatistics merged(ColumnAttribute(column_attributes[i]).get_data_type());
+        bool first = true;
+        for (auto const &part: parts) {
+            const ColumnStatistics &stats = part->columns[i];
+            merged.distinct = i == column ? merged.distinct + stats.distinct : std::max(merged.distinct, stats.distinct);
+            if (gathered->rows > 0)
+                merged.average_length += stats.average_length * part->rows / gathered->rows;
+            if (stats.bounds.empty())
+                continue;
+            merged.min = first ? stats.min : std::min(merged.min, stats.min);
+            merged.max = first ? stats.max : std::max(merged.max, stats.max);
+            first = false;
+        }
+        if (merged.data_type == ColumnAttribute::INT)
+            merged.bounds = merge_bounds(parts, i);
+        gathered->columns.push_back(merged);
+    }
+    try {
+        gathered->save(table_name);
+    } catch (...) {
+        delete gathered;
+        throw;
+    }
+    std::lock_guard<std::mutex> guard(statistics_mutex);
+    statistics.reset(gathered);
+    statistics_loaded = true;
+    return statistics;
+}
+
+// The statistics of the last analyze(), read from the statistics file the first time
+std::shared_ptr<const TableStatistics> PartitionedTable::get_statistics() {
+    std::lock_guard<std::mutex> guard(statistics_mutex);
+    if (!statistics_loaded) {
+        statistics.reset(TableStatistics::load(table_name));
+        statistics_loaded = true;
+    }
+    return statistics;
+}
+
+
+// Test function -- returns true if all tests pass
+
+bool test_partitioned_table() {
+    ColumnNames column_names = {"a", "b"};
+    ColumnAttributes column_attributes = {ColumnAttribute(ColumnAttribute::INT), ColumnAttribute(ColumnAttribute::TEXT)};
+    const int WRITERS = 4, ROWS = 2000;
+
+    // inserters into one heap table, and into four partitions
+    PartitionScheme by_hash;
+    by_hash.column_name = "a";
+    by_hash.partitions = 4;
+    HeapTable single("_test_single_cpp", column_names, column_attributes);
+    PartitionedTable hashed("_test_hashed_cpp", column_names, column_attributes, by_hash);
+    single.create();
+    hashed.create();
+    double rates[2];
+    DbRelation *relations[2] = {&single, &hashed};
+    for (int r = 0; r < 2; r++) {
+        DbRelation &relation = *relations[r];
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> writers;
+        for (int w = 0; w < WRITERS; w++) {
+            writers.push_back(std::thread([&relation, w]() {
+                ValueDict row;
+                row["b"] = Value("partitioned");
+                for (int i = 0; i < ROWS; i++) {
+                    row["a"] = Value(w * ROWS + i);
+                    relation.insert(&row);
+                }
+            }));
+        }
+        for (auto &writer: writers)
+            writer.join();
+        rates[r] = WRITERS * ROWS / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    std::cout << "partitioned inserts: " << WRITERS << " writers " << (size_t) rates[0] << " rows/s into one table, "
+              << (size_t) rates[1] << " rows/s into " << by_hash.partitions << " partitions" << std::endl;
+    single.drop();
+
+    // every row comes back once, from the partition its hash picks
+    std::vector<char> seen(WRITERS * ROWS, 0);
+    std::atomic<bool> routed(true);
+    hashed.parallel_scan(nullptr, 8, [&](unsigned int worker, Handle handle, const ValueDict *row) {
+        int32_t a = row->at("a").n;
+        if (a >= 0 && a < WRITERS * ROWS)
+            seen[a]++;
+        if (worker >= 8 || handle.first >> (32 - PartitionedTable::PARTITION_BITS) != by_hash.partition_of(Value(a)))
+            routed = false;
+    });
+    if (!routed || std::count(seen.begin(), seen.end(), 1) != WRITERS * ROWS)
+        return false;
+
+    // a where clause on the partition column reads one partition; a limit stops early
+    ValueDict where;
+    where["a"] = Value(1234);
+    size_t pruned = hashed.get_partitions_pruned();
+    Handles *handles = hashed.select(&where);
+    ValueDicts *rows = hashed.project(handles, nullptr);
+    bool ok = handles->size() == 1 && rows->front()->at("a").n == 1234 && hashed.get_partitions_pruned() == pruned + 3;
+    for (auto row: *rows)
+        delete row;
+    delete rows;
+    ValueDict changes;
+    changes["a"] = Value(1235);
+    try {
+        hashed.update(handles->front(), &changes);
+        ok = ok && by_hash.partition_of(Value(1234)) == by_hash.partition_of(Value(1235));
+    } catch (DbRelationError &e) {
+        ok = ok && by_hash.partition_of(Value(1234)) != by_hash.partition_of(Value(1235));
+    }
+    changes.clear();
+    changes["b"] = Value("updated");
+    hashed.update(handles->front(), &changes);
+    ValueDict *row = hashed.project(handles->front());
+    ok = ok && row->at("b").s == "updated";
+    delete row;
+    delete handles;
+    handles = hashed.select(nullptr, 10);
+    ok = ok && handles->size() == 10;
+    delete handles;
+    std::shared_ptr<const TableStatistics> statistics = hashed.analyze(TableStatistics::DEFAULT_SAMPLE_BLOCKS);
+    ok = ok && (size_t) statistics->rows == (size_t) WRITERS * ROWS && statistics->columns[0].distinct > WRITERS * ROWS / 2;
+    hashed.close();
+    std::unique_ptr<PartitionScheme> saved(PartitionScheme::load("_test_hashed_cpp"));
+    ok = ok && saved != nullptr && saved->kind == PartitionScheme::HASH && saved->partitions == 4 && saved->column_name == "a";
+    hashed.drop();
+    if (!ok)
+        return false;
+
+    // ranges: below 100, below 1000, the rest
+    PartitionScheme by_range;
+    by_range.kind = PartitionScheme::RANGE;
+    by_range.column_name = "a";
+    by_range.bounds = {100, 1000};
+    PartitionedTable ranged("_test_ranged_cpp", column_names, column_attributes, by_range);
+    ranged.create();
+    ValueDict values;
+    values["b"] = Value("ranged");
+    for (int a = -50; a < 1500; a += 10) {
+        values["a"] = Value(a);
+        ranged.insert(&values);
+    }
+    where["a"] = Value(500);
+    handles = ranged.select(&where);
+    ok = handles->size() == 1 && handles->front().first >> (32 - PartitionedTable::PARTITION_BITS) == 1
+         && ranged.get_partitions_pruned() == 2;
+    delete handles;
+    size_t counts[3] = {0, 0, 0};
+    handles = ranged.select();
+    for (auto const &handle: *handles)
+        counts[handle.first >> (32 - PartitionedTable::PARTITION_BITS)]++;
+    delete handles;
+    std::cout << "partitioned ok " << WRITERS * ROWS << " rows hashed into " << by_hash.partitions
+              << " partitions, " << counts[0] << "/" << counts[1] << "/" << counts[2] << " rows by range" << std::endl;
+    ranged.drop();
+    return ok && counts[0] == 15 && counts[1] == 90 && counts[2] == 50;
+}
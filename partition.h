@@ -0,0 +1,202 @@
+/**
+ * @file partition.h - Tables split by a column's values into several heap tables.
+ * PartitionScheme
+ * PartitionedTable
+ *
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "heap_storage.h"
+
+/**
+ * @class PartitionScheme - how a partitioned table's rows are routed to its partitions
+ *
+ * By HASH, a row goes to the partition given by a hash of its partition column's value,
+ * modulo the number of partitions. By RANGE (of an INT column), partition i holds the values
+ * below bounds[i] and not below bounds[i - 1], and the last partition the values from the
+ * last bound up.
+ *
+ * The scheme is kept in the table's own Berkeley DB RecNo file (<table>.partitions.db),
+ * written in the transaction that creates the table.
+ */
+class PartitionScheme {
+public:
+    enum Kind {
+        HASH, RANGE
+    };
+    static const u_int32_t MAX_PARTITIONS = 256;
+    static const u_int32_t DEFAULT_PARTITIONS = 8;  // for PARTITION BY HASH without PARTITIONS n
+
+    PartitionScheme() : kind(HASH), partitions(DEFAULT_PARTITIONS) {}
+
+    virtual ~PartitionScheme() {}
+
+    Kind kind;
+    Identifier column_name;
+    u_int32_t partitions;         // HASH only
+    std::vector<int32_t> bounds;  // RANGE only, ascending
+
+    /**
+     * How many partitions the scheme has.
+     */
+    virtual u_int32_t count() const { return kind == HASH ? partitions : (u_int32_t) bounds.size() + 1; }
+
+    /**
+     * The partition that holds rows whose partition column is value.
+     */
+    virtual u_int32_t partition_of(const Value &value) const;
+
+    /**
+     * Check that the scheme can partition a table with these columns.
+     * @throws DbRelationError  if it can't
+     */
+    virtual void check(const ColumnNames &column_names, const ColumnAttributes &column_attributes) const;
+
+    /**
+     * The name of a partition's own heap table, e.g., foo.p3.
+     */
+    static Identifier partition_name(const Identifier &table_name, u_int32_t partition);
+
+    /**
+     * Write the scheme to the table's partitions file.
+     */
+    virtual void save(const Identifier &table_name) const;
+
+    /**
+     * The scheme in the table's partitions file.
+     * @returns  nullptr if the table isn't partitioned (freed by caller)
+     */
+    static PartitionScheme *load(const Identifier &table_name);
+
+    /**
+     * Delete the table's partitions file, if there is one.
+     */
+    static void drop(const Identifier &table_name);
+
+protected:
+    virtual std::string marshal() const;
+
+    virtual bool unmarshal(const std::string &bytes);
+};
+
+/**
+ * @class PartitionedTable - a relation whose rows are spread over several HeapTables by a
+ * PartitionScheme
+ *
+ * Each partition is a HeapTable of its own, with its own file, last block, zone map, Bloom
+ * filters and dictionaries, so inserts into different partitions never contend with one
+ * another. A handle's block id keeps the partition in its top PARTITION_BITS bits and the
+ * block id within the partition in the rest.
+ *
+ * A select or scan whose where clause gives the partition column a value only reads the one
+ * partition that can hold it. parallel_scan() scans several partitions at once, one to each
+ * group of workers, and import_csv() hands each partition's rows to that partition's own
+ * parallel bulk load.
+ *
+ * A row can't be updated into another partition: it would need a new handle.
+ */
+class PartitionedTable : public DbRelation {
+public:
+    static const uint PARTITION_BITS = 8;
+    static const BlockID MAX_PARTITION_BLOCK = (1U << (32 - PARTITION_BITS)) - 1;
+
+    PartitionedTable(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes,
+                     const PartitionScheme &scheme);
+
+    virtual ~PartitionedTable();
+
+    PartitionedTable(const PartitionedTable &other) = delete;
+
+    PartitionedTable &operator=(const PartitionedTable &other) = delete;
+
+    virtual void create();
+
+    virtual void create_if_not_exists();
+
+    virtual void drop();
+
+    virtual void open();
+
+    virtual void close();
+
+    virtual Handle insert(const ValueDict *row);
+
+    virtual void update(const Handle handle, const ValueDict *new_values);
+
+    virtual void del(const Handle handle);
+
+    virtual Handles *select();
+
+    virtual Handles *select(const ValueDict *where);
+
+    virtual Handles *select(const ValueDict *where, size_t limit);
+
+    virtual Handles *select(const ValueDict *where, size_t limit, const BlockSample *sample);
+
+    virtual ValueDict *project(Handle handle);
+
+    virtual ValueDict *project(Handle handle, const ColumnNames *column_names);
+
+    virtual ValueDicts *project(const Handles *handles, const ColumnNames *column_names);
+
+    virtual void parallel_scan(const ValueDict *where, unsigned int n_workers, RowVisitor visit,
+                               const ColumnNames *column_names = nullptr, const BlockSample *sample = nullptr);
+
+    virtual size_t import_csv(const std::string &file_path, unsigned int n_workers = 0);
+
+    virtual size_t collect_garbage(TxnID horizon);
+
+    virtual size_t vacuum();
+
+    virtual std::shared_ptr<const TableStatistics> analyze(size_t sample_blocks);
+
+    virtual std::shared_ptr<const TableStatistics> get_statistics();
+
+    /**
+     * Have create() compress every partition's cold blocks (see HeapTable::set_compression).
+     */
+    virtual void set_compression(bool compressed);
+
+    /**
+     * Have create() give every partition block_size byte blocks (see HeapTable::set_block_size).
+     */
+    virtual void set_block_size(uint block_size);
+
+    /**
+     * Have create() keep Bloom filters in every partition (see HeapTable::set_bloom_filters).
+     */
+    virtual void set_bloom_filters(const ColumnNames &columns, double false_positive_rate);
+
+    virtual const PartitionScheme &get_scheme() const { return scheme; }
+
+    /**
+     * The partitions that can hold rows matching where, in order.
+     */
+    virtual std::vector<u_int32_t> partitions_for(const ValueDict *where) const;
+
+    /**
+     * How many partitions selects and scans have skipped thanks to their where clauses.
+     */
+    virtual size_t get_partitions_pruned() const { return pruned_partitions; }
+
+protected:
+    PartitionScheme scheme;
+    std::vector<HeapTable *> partitions;
+    std::atomic<size_t> pruned_partitions;
+    std::mutex statistics_mutex;  // guards the two below
+    std::shared_ptr<const TableStatistics> statistics;
+    bool statistics_loaded;
+
+    static Handle global_handle(u_int32_t partition, Handle handle);
+
+    static u_int32_t partition_of(Handle handle);
+
+    static Handle local_handle(Handle handle);
+};
+
+bool test_partitioned_table();
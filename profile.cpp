@@ -0,0 +1,104 @@
+/*
+  profile.cpp
+
+  Per-operator counters for EXPLAIN ANALYZE.
+  Allocations are counted by replacing the global operator new, which costs a
+  thread-local load and a branch when nothing is being profiled.
+
+*/
+
+#include "profile.h"
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+thread_local OperatorProfile *Profiling::profile_in_scope = nullptr;
+
+// As the standard one does, gives the installed new handler a chance to free up memory
+// each time malloc fails, and only throws once there is none
+void *operator new(std::size_t size) {
+    Profiling::allocated(size);
+    void *memory;
+    while ((memory = std::malloc(size == 0 ? 1 : size)) == nullptr) {
+        std::new_handler handler = std::get_new_handler();
+        if (handler == nullptr)
+            throw std::bad_alloc();
+        handler();
+    }
+    return memory;
+}
+
+void operator delete(void *memory) noexcept {
+    std::free(memory);
+}
+
+// Sized deallocation (which C++14 compilers call when they know the size) must free
+// what the replacement operator new allocated too
+void operator delete(void *memory, std::size_t) noexcept {
+    std::free(memory);
+}
+
+
+// OperatorProfile
+
+OperatorProfile::OperatorProfile(std::string description, double estimated_rows)
+        : description(description), estimated_rows(estimated_rows), rows(0), nanoseconds(0), pages_read(0),
+          bytes_allocated(0) {}
+
+OperatorProfile::~OperatorProfile() {
+    for (auto child: children)
+        delete child;
+}
+
+OperatorProfile *OperatorProfile::add(std::string description, double estimated_rows) {
+    children.push_back(new OperatorProfile(description, estimated_rows));
+    return children.back();
+}
+
+std::string OperatorProfile::explain(bool analyzed) const {
+    std::string text;
+    explain(analyzed, 0, text);
+    return text;
+}
+
+// e.g.  -> Scan foo  (estimated rows=10)  (actual rows=12 time=0.213 ms pages=3 allocated=2048 bytes)
+void OperatorProfile::explain(bool analyzed, size_t depth, std::string &text) const {
+    if (depth > 0)
+        text += std::string(4 * depth - 4, ' ') + "  -> ";
+    text += description;
+    if (estimated_rows >= 0)
+        text += "  (estimated rows=" + std::to_string((u_int64_t) (estimated_rows + 0.5)) + ")";
+    else
+        text += "  (no statistics)";
+    if (analyzed) {
+        char milliseconds[32];
+        snprintf(milliseconds, sizeof(milliseconds), "%.3f", nanoseconds / 1e6);
+        text += "  (actual rows=" + std::to_string(rows) + " time=" + milliseconds + " ms pages="
+                + std::to_string(pages_read) + " allocated=" + std::to_string(bytes_allocated) + " bytes)";
+    }
+    for (auto const &child: children) {
+        text += "\n";
+        child->explain(analyzed, depth + 1, text);
+    }
+}
+
+
+// Profiling
+
+Profiling::Profiling(OperatorProfile *profile, bool timed) : profile(profile), previous(nullptr), timed(timed) {
+    if (profile == nullptr)
+        return;
+    previous = profile_in_scope;
+    profile_in_scope = profile;
+    if (timed)
+        start = std::chrono::steady_clock::now();
+}
+
+Profiling::~Profiling() {
+    if (profile == nullptr)
+        return;
+    if (timed)
+        profile->nanoseconds += (u_int64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count();
+    profile_in_scope = previous;
+}
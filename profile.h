@@ -0,0 +1,118 @@
+/**
+ * @file profile.h - Per-operator counters for EXPLAIN ANALYZE.
+ * OperatorProfile
+ * Profiling
+ *
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "storage_engine.h"
+
+/**
+ * @class OperatorProfile - one operator of a query plan: what it was expected to return
+ * and, once it has run, what it returned and what that took
+ *
+ * Wall time includes the operator's children; pages read and bytes allocated are only
+ * the operator's own. The counters are atomic since parallel scan workers add to them.
+ */
+class OperatorProfile {
+public:
+    /**
+     * @param description     what the operator does, e.g. "Scan foo"
+     * @param estimated_rows  rows it is expected to return (negative if there is no estimate)
+     */
+    OperatorProfile(std::string description, double estimated_rows);
+
+    virtual ~OperatorProfile();
+
+    OperatorProfile(const OperatorProfile &other) = delete;
+
+    OperatorProfile &operator=(const OperatorProfile &other) = delete;
+
+    std::string description;
+    double estimated_rows;
+    std::atomic<u_int64_t> rows;
+    std::atomic<u_int64_t> nanoseconds;
+    std::atomic<u_int64_t> pages_read;
+    std::atomic<u_int64_t> bytes_allocated;
+
+    /**
+     * Add an operator that feeds this one.
+     * @returns  the new operator (freed with this one)
+     */
+    virtual OperatorProfile *add(std::string description, double estimated_rows);
+
+    virtual const std::vector<OperatorProfile *> &get_children() const { return children; }
+
+    /**
+     * The plan from this operator down, one operator per line.
+     * @param analyzed  whether to show what running it took
+     */
+    virtual std::string explain(bool analyzed) const;
+
+protected:
+    std::vector<OperatorProfile *> children;
+
+    virtual void explain(bool analyzed, size_t depth, std::string &text) const;
+};
+
+/**
+ * @class Profiling - charges the calling thread's page reads and allocations to an operator
+ * while in scope, and adds the time spent in scope to the operator's wall time
+ *
+ * Profiling(nullptr) does nothing, and neither do the hooks while no operator is being
+ * profiled on the thread beyond loading a thread-local pointer, so a query that isn't
+ * being explained pays nothing measurable for them. Scopes nest: an inner one charges
+ * its operator instead until it ends.
+ */
+class Profiling {
+public:
+    /**
+     * @param profile  the operator to charge (nullptr for none)
+     * @param timed    whether to add the time in scope to it (worker threads don't,
+     *                 since the operator that started them is timed already)
+     */
+    explicit Profiling(OperatorProfile *profile, bool timed = true);
+
+    virtual ~Profiling();
+
+    Profiling(const Profiling &other) = delete;
+
+    Profiling &operator=(const Profiling &other) = delete;
+
+    /**
+     * The operator the calling thread is working for, if it is being profiled.
+     */
+    static OperatorProfile *current() { return profile_in_scope; }
+
+    /**
+     * Hook: a page was read from disk (or the buffer pool).
+     */
+    static void page_read() {
+        OperatorProfile *profile = profile_in_scope;
+        if (profile != nullptr)
+            profile->pages_read++;
+    }
+
+    /**
+     * Hook: size bytes were allocated (called from operator new).
+     */
+    static void allocated(size_t size) {
+        OperatorProfile *profile = profile_in_scope;
+        if (profile != nullptr)
+            profile->bytes_allocated += size;
+    }
+
+protected:
+    static thread_local OperatorProfile *profile_in_scope;
+
+    OperatorProfile *profile;
+    OperatorProfile *previous;
+    bool timed;
+    std::chrono::steady_clock::time_point start;
+};
@@ -0,0 +1,63 @@
+/*
+  record_format.cpp
+
+  Marshaling and unmarshaling of single record fields (see record_format.h for the layout).
+
+*/
+
+#include "record_format.h"
+#include <cstring>
+
+typedef u_int16_t u16;
+
+
+bool RecordFormat::put(char *bytes, uint &offset, uint block_size, ColumnAttribute::DataType data_type,
+                       const Value &value, ColumnDictionary *dictionary, OverflowFile &overflow) {
+    if (data_type == ColumnAttribute::INT) {
+        if (offset + INT_SIZE > block_size)
+            return false;
+        *(int32_t *) (bytes + offset) = value.n;
+        offset += INT_SIZE;
+        return true;
+    }
+    if (dictionary != nullptr) {
+        if (offset + sizeof(u16) > block_size)
+            return false;
+        u16 code = dictionary->encode(value.s);
+        *(u16 *) (bytes + offset) = code;
+        offset += sizeof(u16);
+        if (code != ColumnDictionary::ESCAPE)
+            return true;
+    }
+    uint size = (uint) value.s.length();
+    bool out_of_line = size > OverflowFile::threshold(block_size);
+    if (offset + sizeof(u16) + (out_of_line ? OverflowFile::REFERENCE_SIZE : size) > block_size)
+        return false;
+    if (out_of_line) {
+        *(u16 *) (bytes + offset) = OverflowFile::MARKER;
+        *(u_int32_t *) (bytes + offset + sizeof(u16)) = size;
+        *(BlockID *) (bytes + offset + sizeof(u16) + sizeof(u_int32_t)) = overflow.write(value.s, block_size);
+        offset += sizeof(u16) + OverflowFile::REFERENCE_SIZE;
+        return true;
+    }
+    *(u16 *) (bytes + offset) = (u16) size;
+    offset += sizeof(u16);
+    memcpy(bytes + offset, value.s.data(), size);  // assume ascii for now
+    offset += size;
+    return true;
+}
+
+Value RecordFormat::get(const char *&field, ColumnAttribute::DataType data_type, ColumnDictionary *dictionary,
+                        OverflowFile &overflow) {
+    if (data_type == ColumnAttribute::INT)
+        return Value(get_int(field));
+    if (dictionary != nullptr) {
+        u16 code = get_code(field);
+        if (code != ColumnDictionary::ESCAPE)
+            return Value(dictionary->decode(code));
+    }
+    u_int32_t length;
+    BlockID first;
+    const char *text = get_text(field, length, first);
+    return Value(text != nullptr ? std::string(text, length) : overflow.read(first, length));
+}
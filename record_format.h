@@ -0,0 +1,100 @@
+/**
+ * @file record_format.h - How a row's fields are laid out in a marshaled record.
+ * RecordFormat
+ *
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#pragma once
+
+#include <string>
+#include "dictionary.h"
+#include "overflow.h"
+#include "storage_engine.h"
+
+/**
+ * @class RecordFormat - marshal, unmarshal and skip one field of a record
+ *
+ * A record's fields follow its version header (see mvcc.h) in column order, with no padding:
+ *     INT                    the value, INT_SIZE bytes
+ *     TEXT                   a 2-byte length and then the bytes, or OverflowFile::MARKER and a
+ *                            reference to the value's overflow pages (its length and first page)
+ *     dictionary coded TEXT  a 2-byte code, followed by a TEXT field only if the code is
+ *                            ColumnDictionary::ESCAPE
+ * Everything that reads or writes records field by field goes through here: HeapTable's
+ * marshal and unmarshal, the CSV importer, zone maps and compiled WHERE programs.
+ */
+class RecordFormat {
+public:
+    static const uint INT_SIZE = sizeof(int32_t);
+
+    /**
+     * Marshal a value into the field at bytes + offset, advancing offset past it.
+     * A TEXT value longer than OverflowFile::threshold(block_size) is written to overflow pages.
+     * @param data_type   the column's type
+     * @param dictionary  the column's dictionary if it is dictionary encoded (else nullptr)
+     * @returns           false if the field doesn't fit in the block_size bytes at bytes
+     *                    (before anything goes to overflow pages)
+     */
+    static bool put(char *bytes, uint &offset, uint block_size, ColumnAttribute::DataType data_type, const Value &value,
+                    ColumnDictionary *dictionary, OverflowFile &overflow);
+
+    /**
+     * Unmarshal the field at field (reading its overflow pages if it has any), and move field past it.
+     */
+    static Value get(const char *&field, ColumnAttribute::DataType data_type, ColumnDictionary *dictionary,
+                     OverflowFile &overflow);
+
+    /**
+     * Move field past a field without decoding it.
+     * @param coded  whether the column is dictionary encoded
+     */
+    static void skip(const char *&field, ColumnAttribute::DataType data_type, bool coded) {
+        if (data_type == ColumnAttribute::INT) {
+            field += INT_SIZE;
+            return;
+        }
+        if (coded && get_code(field) != ColumnDictionary::ESCAPE)
+            return;
+        u_int32_t length;
+        BlockID first;
+        get_text(field, length, first);
+    }
+
+    /**
+     * An INT field's value; moves field past it.
+     */
+    static int32_t get_int(const char *&field) {
+        int32_t n = *(const int32_t *) field;
+        field += INT_SIZE;
+        return n;
+    }
+
+    /**
+     * A dictionary coded field's code; moves field past it (a TEXT field follows if it is ESCAPE).
+     */
+    static u_int16_t get_code(const char *&field) {
+        u_int16_t code = *(const u_int16_t *) field;
+        field += sizeof(u_int16_t);
+        return code;
+    }
+
+    /**
+     * Where a TEXT field's value is; moves field past the field.
+     * @param length  set to the value's length
+     * @param first   set to its first overflow page, if it is out of line
+     * @returns       the value's bytes if they are in the record, else nullptr
+     */
+    static const char *get_text(const char *&field, u_int32_t &length, BlockID &first) {
+        u_int16_t size = *(const u_int16_t *) field;
+        field += sizeof(u_int16_t);
+        if (size == OverflowFile::MARKER) {
+            length = *(const u_int32_t *) field;
+            first = *(const BlockID *) (field + sizeof(u_int32_t));
+            field += OverflowFile::REFERENCE_SIZE;
+            return nullptr;
+        }
+        length = size;
+        field += size;
+        return field - size;
+    }
+};
@@ -0,0 +1,237 @@
+/*
+  schema_tables.cpp
+
+  Catalog of table schemas.
+  The catalog is stored in the storage engine it describes: _tables lists the user
+  tables and _columns lists their columns in order. Both are ordinary HeapTables
+  whose own schemas are fixed here.
+
+*/
+
+#include "schema_tables.h"
+#include "partition.h"
+
+// Make sure both schema tables exist in the database environment
+void initialize_schema_tables() {
+    Tables tables;
+    tables.create_if_not_exists();
+    Columns columns;
+    columns.create_if_not_exists();
+}
+
+// Translate a catalog data_type string into a ColumnAttribute
+static ColumnAttribute data_type_attribute(const std::string &data_type) {
+    if (data_type == "INT")
+        return ColumnAttribute(ColumnAttribute::INT);
+    if (data_type == "TEXT")
+        return ColumnAttribute(ColumnAttribute::TEXT);
+    if (data_type == "TEXT DICTIONARY")
+        return ColumnAttribute(ColumnAttribute::TEXT, true);
+    throw DbRelationError("unknown data type in catalog: " + data_type);
+}
+
+
+// Columns
+
+const Identifier Columns::TABLE_NAME = "_columns";
+
+ColumnNames &Columns::COLUMN_NAMES() {
+    static ColumnNames column_names;
+    if (column_names.empty()) {
+        column_names.push_back("table_name");
+        column_names.push_back("column_name");
+        column_names.push_back("data_type");
+    }
+    return column_names;
+}
+
+ColumnAttributes &Columns::COLUMN_ATTRIBUTES() {
+    static ColumnAttributes column_attributes;
+    if (column_attributes.empty()) {
+        ColumnAttribute text(ColumnAttribute::TEXT);
+        column_attributes.push_back(text);
+        column_attributes.push_back(text);
+        column_attributes.push_back(text);
+    }
+    return column_attributes;
+}
+
+Columns::Columns() : HeapTable(TABLE_NAME, COLUMN_NAMES(), COLUMN_ATTRIBUTES()) {}
+
+// Only accept rows naming a data type we know how to store
+Handle Columns::insert(const ValueDict *row) {
+    ValueDict::const_iterator data_type = row->find("data_type");
+    if (data_type == row->end())
+        throw DbRelationError("column definition is missing its data_type");
+    data_type_attribute(data_type->second.s);
+    return HeapTable::insert(row);
+}
+
+
+// Tables
+
+const Identifier Tables::TABLE_NAME = "_tables";
+
+std::map<Identifier, DbRelation *> Tables::table_cache;
+
+std::map<Identifier, std::pair<ColumnNames, ColumnAttributes>> Tables::column_cache;
+
+std::map<DbRelation *, size_t> Tables::pins;
+
+std::set<DbRelation *> Tables::forgotten;
+
+std::mutex Tables::cache_mutex;
+
+ColumnNames &Tables::COLUMN_NAMES() {
+    static ColumnNames column_names;
+    if (column_names.empty())
+        column_names.push_back("table_name");
+    return column_names;
+}
+
+ColumnAttributes &Tables::COLUMN_ATTRIBUTES() {
+    static ColumnAttributes column_attributes;
+    if (column_attributes.empty())
+        column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    return column_attributes;
+}
+
+Tables::Tables() : HeapTable(TABLE_NAME, COLUMN_NAMES(), COLUMN_ATTRIBUTES()) {}
+
+// Only accept table names that are not already in the catalog
+Handle Tables::insert(const ValueDict *row) {
+    ValueDict::const_iterator table_name = row->find("table_name");
+    if (table_name == row->end())
+        throw DbRelationError("table definition is missing its table_name");
+    if (exists(table_name->second.s))
+        throw DbRelationError(table_name->second.s + " already exists");
+    return HeapTable::insert(row);
+}
+
+// Check whether the catalog lists table_name
+bool Tables::exists(Identifier table_name) {
+    if (table_name == TABLE_NAME || table_name == Columns::TABLE_NAME)
+        return true;
+    open();
+    ValueDict where;
+    where["table_name"] = Value(table_name);
+    Handles *handles = select(&where);
+    bool found = !handles->empty();
+    delete handles;
+    return found;
+}
+
+// Look up the columns (in order) of a table
+// Schemas never change once created, so each table's columns are read from _columns only once.
+// The caches are shared by all sessions; the lock is never held while reading the catalog.
+void Tables::get_columns(Identifier table_name, ColumnNames &column_names, ColumnAttributes &column_attributes) {
+    {
+        std::lock_guard<std::mutex> guard(cache_mutex);
+        std::map<Identifier, std::pair<ColumnNames, ColumnAttributes>>::const_iterator cached = column_cache.find(table_name);
+        if (cached != column_cache.end()) {
+            column_names.insert(column_names.end(), cached->second.first.begin(), cached->second.first.end());
+            column_attributes.insert(column_attributes.end(), cached->second.second.begin(), cached->second.second.end());
+            return;
+        }
+    }
+
+    ColumnNames found_names;
+    ColumnAttributes found_attributes;
+    DbRelation &columns = get_table(Columns::TABLE_NAME);
+    ValueDict where;
+    where["table_name"] = Value(table_name);
+    Handles *handles = columns.select(&where);
+    for (auto const &handle: *handles) {
+        ValueDict *row = columns.project(handle);
+        found_names.push_back((*row)["column_name"].s);
+        found_attributes.push_back(data_type_attribute((*row)["data_type"].s));
+        delete row;
+    }
+    delete handles;
+    if (!found_names.empty()) {
+        std::lock_guard<std::mutex> guard(cache_mutex);
+        column_cache[table_name] = std::make_pair(found_names, found_attributes);
+    }
+    column_names.insert(column_names.end(), found_names.begin(), found_names.end());
+    column_attributes.insert(column_attributes.end(), found_attributes.begin(), found_attributes.end());
+}
+
+// Get the open relation for a table, building it from the catalog the first time
+DbRelation &Tables::get_table(Identifier table_name) {
+    {
+        std::lock_guard<std::mutex> guard(cache_mutex);
+        std::map<Identifier, DbRelation *>::const_iterator cached = table_cache.find(table_name);
+        if (cached != table_cache.end())
+            return *cached->second;
+    }
+
+    if (table_name == TABLE_NAME)
+        return *this;  // never a second handle on our own file
+
+    DbRelation *table;
+    if (table_name == Columns::TABLE_NAME) {
+        table = new Columns();
+    } else {
+        if (!exists(table_name))
+            throw DbRelationError(table_name + " does not exist");
+        ColumnNames column_names;
+        ColumnAttributes column_attributes;
+        get_columns(table_name, column_names, column_attributes);
+        std::unique_ptr<PartitionScheme> scheme(PartitionScheme::load(table_name));
+        if (scheme != nullptr)
+            table = new PartitionedTable(table_name, column_names, column_attributes, *scheme);
+        else
+            table = new HeapTable(table_name, column_names, column_attributes);
+    }
+    table->open();
+
+    // another session may have opened it meanwhile; keep theirs
+    std::lock_guard<std::mutex> guard(cache_mutex);
+    std::map<Identifier, DbRelation *>::const_iterator cached = table_cache.find(table_name);
+    if (cached != table_cache.end()) {
+        table->close();
+        delete table;
+        return *cached->second;
+    }
+    table_cache[table_name] = table;
+    return *table;
+}
+
+// List the cached relations, e.g., for the version collector
+// Each one is pinned until the list's reference to it is released, so that a table dropped
+// meanwhile isn't deleted from under the lister.
+std::vector<std::shared_ptr<DbRelation>> Tables::open_tables() {
+    std::lock_guard<std::mutex> guard(cache_mutex);
+    std::vector<std::shared_ptr<DbRelation>> relations;
+    for (auto const &cached: table_cache) {
+        pins[cached.second]++;
+        relations.push_back(std::shared_ptr<DbRelation>(cached.second, &Tables::unpin));
+    }
+    return relations;
+}
+
+// Release a reference from open_tables(), deleting the relation if it was the last one
+// to a forgotten relation
+void Tables::unpin(DbRelation *relation) {
+    std::lock_guard<std::mutex> guard(cache_mutex);
+    if (--pins[relation] > 0)
+        return;
+    pins.erase(relation);
+    if (forgotten.erase(relation) > 0)
+        delete relation;
+}
+
+// Drop the cached relation and columns for a table (after the table itself has been dropped)
+// The relation is deleted now, or once whoever has it from open_tables() is done with it.
+void Tables::forget(Identifier table_name) {
+    std::lock_guard<std::mutex> guard(cache_mutex);
+    column_cache.erase(table_name);
+    std::map<Identifier, DbRelation *>::iterator cached = table_cache.find(table_name);
+    if (cached != table_cache.end()) {
+        if (pins.count(cached->second) > 0)
+            forgotten.insert(cached->second);
+        else
+            delete cached->second;
+        table_cache.erase(cached);
+    }
+}
@@ -0,0 +1,90 @@
+/**
+ * @file schema_tables.h - Catalog of table schemas, kept in the heap storage engine itself.
+ * Tables: HeapTable (_tables)
+ * Columns: HeapTable (_columns)
+ *
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#pragma once
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
+#include "heap_storage.h"
+
+/**
+ * Create the schema tables if they are not already in the database environment.
+ * Call once after _DB_ENV is set up.
+ */
+void initialize_schema_tables();
+
+/**
+ * @class Columns - The catalog table listing every column of every user table.
+ *      table_name TEXT, column_name TEXT, data_type TEXT ("INT", "TEXT" or "TEXT DICTIONARY")
+ */
+class Columns : public HeapTable {
+public:
+    static const Identifier TABLE_NAME;
+
+    Columns();
+
+    virtual ~Columns() {}
+
+    virtual Handle insert(const ValueDict *row);
+
+protected:
+    static ColumnNames &COLUMN_NAMES();
+
+    static ColumnAttributes &COLUMN_ATTRIBUTES();
+};
+
+/**
+ * @class Tables - The catalog table listing every user table.
+ *      table_name TEXT
+ *
+ * Also hands out the (cached, open) DbRelation for a user table by name.
+ */
+class Tables : public HeapTable {
+public:
+    static const Identifier TABLE_NAME;
+
+    Tables();
+
+    virtual ~Tables() {}
+
+    virtual Handle insert(const ValueDict *row);
+
+    virtual bool exists(Identifier table_name);
+
+    virtual void get_columns(Identifier table_name, ColumnNames &column_names, ColumnAttributes &column_attributes);
+
+    virtual DbRelation &get_table(Identifier table_name);
+
+    virtual void forget(Identifier table_name);
+
+    /**
+     * Every relation get_table() has handed out so far (Columns included). A relation
+     * forgotten while some of these are still held isn't deleted until they are released.
+     */
+    static std::vector<std::shared_ptr<DbRelation>> open_tables();
+
+protected:
+    static ColumnNames &COLUMN_NAMES();
+
+    static ColumnAttributes &COLUMN_ATTRIBUTES();
+
+    static std::map<Identifier, DbRelation *> table_cache;
+
+    static std::map<Identifier, std::pair<ColumnNames, ColumnAttributes>> column_cache;
+
+    static std::map<DbRelation *, size_t> pins;  // references open_tables() has handed out
+                                                 // and not yet had back, by relation
+
+    static std::set<DbRelation *> forgotten;  // deleted when the last of their pins goes
+
+    static std::mutex cache_mutex;  // guards both caches (and the pins)
+
+    static void unpin(DbRelation *relation);
+};
@@ -0,0 +1,62 @@
+/*
+  socket_frame.cpp
+
+  Length-prefixed framing for the sql5300 client/server protocol.
+
+*/
+
+#include "socket_frame.h"
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+// Write all of buffer, retrying after signals and short writes
+static bool send_all(int fd, const char *buffer, size_t size) {
+    while (size > 0) {
+        ssize_t sent = send(fd, buffer, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+            return false;
+        buffer += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+// Read exactly size bytes into buffer
+static bool recv_all(int fd, char *buffer, size_t size) {
+    while (size > 0) {
+        ssize_t received = recv(fd, buffer, size, 0);
+        if (received < 0 && errno == EINTR)
+            continue;
+        if (received <= 0)
+            return false;
+        buffer += received;
+        size -= received;
+    }
+    return true;
+}
+
+bool send_frame(int fd, const std::string &message) {
+    if (message.size() > MAX_FRAME_SIZE)
+        return false;
+    unsigned char header[4];
+    u_int32_t size = (u_int32_t) message.size();
+    for (int i = 0; i < 4; i++)
+        header[i] = (unsigned char) (size >> (24 - 8 * i));
+    return send_all(fd, (const char *) header, sizeof(header)) && send_all(fd, message.data(), message.size());
+}
+
+bool recv_frame(int fd, std::string &message) {
+    unsigned char header[4];
+    if (!recv_all(fd, (char *) header, sizeof(header)))
+        return false;
+    u_int32_t size = 0;
+    for (int i = 0; i < 4; i++)
+        size = (size << 8) | header[i];
+    if (size > MAX_FRAME_SIZE)
+        return false;
+    message.resize(size);
+    return size == 0 || recv_all(fd, &message[0], size);
+}
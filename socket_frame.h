@@ -0,0 +1,33 @@
+/**
+ * @file socket_frame.h - Length-prefixed messages over a stream socket.
+ *
+ * Each message is a 4-byte big-endian length followed by that many bytes. Used both by
+ * the sql5300 server (one SQL statement per request, its printed result per response)
+ * and by clients such as sql5300_load.
+ *
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#pragma once
+
+#include <string>
+
+/**
+ * Largest message either side will accept.
+ */
+const size_t MAX_FRAME_SIZE = 16 * 1024 * 1024;
+
+/**
+ * Write one message.
+ * @param fd       connected socket
+ * @param message  the payload (at most MAX_FRAME_SIZE bytes)
+ * @returns        false if the peer has gone away or the message is too big
+ */
+bool send_frame(int fd, const std::string &message);
+
+/**
+ * Read one message.
+ * @param fd       connected socket
+ * @param message  set to the payload
+ * @returns        false on end of stream, an error, or a length over MAX_FRAME_SIZE
+ */
+bool recv_frame(int fd, std::string &message);
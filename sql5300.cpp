@@ -9,16 +9,32 @@
 
 */
 
+#include <chrono>
+#include <csignal>
+#include <ctime>
+#include <fstream>
 #include <iostream>
+#include <sstream>
 #include <string>
+#include <thread>
+#include <unistd.h>
 #include <db_cxx.h>
 #include "SQLParser.h"
 #include "heap_storage.h"
+#include "hash_aggregate.h"
+#include "mvcc.h"
+#include "io_pool.h"
+#include "partition.h"
+#include "sql_exec.h"
+#include "sql_server.h"
+#include "statement_cache.h"
+#include "transaction.h"
 
 using namespace std;
 using namespace hsql;
 
 DbEnv *_DB_ENV;
+SQLServer* server = nullptr;
 
 string execute(const SQLStatement* parseTree);
 string parseSelect(SelectStatement* stmt);
@@ -27,30 +43,84 @@ string parseExpression(Expr* expr);
 string parseOperator(Expr* expr);
 string parseTableRef(TableRef* table);
 string columnDefToString(ColumnDefinition* col);
+void runStatement(const string& input, StatementCache& statementCache, ostream& out);
+int runBatch(istream& script, StatementCache& statementCache);
+int runServer(const char* socketPath, unsigned int threads);
+void reportCompression();
+void reportVacuum();
 
 
 // User input loop program
 // Takes user input and prints the converted parse tree
 // The user must supply the BerkelyDB environment path as a parameter
+// With -f script (or when stdin is not a terminal) runs the script in batch mode instead
+// -w sets the group commit window in microseconds
+// With -s socket runs as a server for many clients instead (-t sets its thread count)
 int main(int argc, char* argv[]) {
 	
 	// Invalid usage
-    if (argc != 2) {        
-        cerr << "Usage: ./sql5300 env_path" << endl;
+    const char* scriptFile = nullptr;
+    const char* socketPath = nullptr;
+    long threads = thread::hardware_concurrency();
+    long commitWindow = 0;
+    bool badUsage = argc < 2 || argc % 2 != 0;
+    for (int i = 2; !badUsage && i < argc; i += 2) {
+        string option = argv[i];
+        if (option == "-f")
+            scriptFile = argv[i + 1];
+        else if (option == "-w")
+            commitWindow = atol(argv[i + 1]);
+        else if (option == "-s")
+            socketPath = argv[i + 1];
+        else if (option == "-t")
+            threads = atol(argv[i + 1]);
+        else
+            badUsage = true;
+    }
+    if (badUsage || commitWindow < 0 || threads < 1) {        
+        cerr << "Usage: ./sql5300 env_path [-f script.sql | -s socket_path [-t threads]] [-w commit_window_usec]" << endl;
         exit(-1);
     }
     
-	// Create the DB environment
+	// Create the DB environment (transactional, recovering from the log if the last run crashed)
     DbEnv env(0U);
 	env.set_message_stream(&cout);
 	env.set_error_stream(&cerr);
 	try {
-		env.open(argv[1], (DB_CREATE | DB_INIT_MPOOL), 0);
+		env.set_lk_detect(DB_LOCK_DEFAULT);
+		env.set_timeout(1000000, DB_SET_LOCK_TIMEOUT);  // a writer stuck behind another's row locks holds a page latch
+		env.open(argv[1], DB_ENV_TRANSACTIONAL, 0);
 	}
 	catch (...) {
 		cerr << "Exception when opening database environment" << endl;
 		exit(-1);
 	}
+	_DB_ENV = &env;
+	GroupCommit::set_window((unsigned int) commitWindow);
+	initialize_schema_tables();
+
+	// Old row versions are removed in the background once no snapshot can see them
+	VersionCollector collector([]() { return Tables::open_tables(); });
+	collector.start();
+
+	// Server mode
+	if (socketPath != nullptr)
+		return runServer(socketPath, (unsigned int) threads);
+
+	// Parse trees are reused across statements that differ only in their literals
+	StatementCache statement_cache;
+
+	// Batch mode
+	if (scriptFile) {
+		ifstream script(scriptFile);
+		if (!script) {
+			cerr << "Cannot open script " << scriptFile << endl;
+			exit(-1);
+		}
+		return runBatch(script, statement_cache);
+	}
+	if (!isatty(fileno(stdin)))
+		return runBatch(cin, statement_cache);
 
     // Begin the user input loop
     while (true) 
@@ -70,23 +140,197 @@ int main(int argc, char* argv[]) {
         // Test rudimentary storage engine
         if (input == "test") {
             cout << "test_heap_storage: " << (test_heap_storage() ? "ok" : "failed") << endl;
+            cout << "test_hash_aggregate: " << (test_hash_aggregate() ? "ok" : "failed") << endl;
+            cout << "test_heap_concurrency: " << (test_heap_concurrency() ? "ok" : "failed") << endl;
+            cout << "test_group_commit: " << (test_group_commit() ? "ok" : "failed") << endl;
+            cout << "test_heap_update: " << (test_heap_update() ? "ok" : "failed") << endl;
+            cout << "test_mvcc: " << (test_mvcc() ? "ok" : "failed") << endl;
+            cout << "test_where_program: " << (test_where_program() ? "ok" : "failed") << endl;
+            cout << "test_partitioned_table: " << (test_partitioned_table() ? "ok" : "failed") << endl;
+            cout << "test_io_pool: " << (test_io_pool() ? "ok" : "failed") << endl;
+            cout << "test_statement_cache: " << (test_statement_cache() ? "ok" : "failed") << endl;
             continue;
         }
 
-        // Parse the response with SQLParser's ParseSQLString function
-        SQLParserResult *result = SQLParser::parseSQLString(input);
+        runStatement(input, statement_cache, cout);
+    }
+
+	return 0;
+}
+
+
+// Parses and executes one line of SQL, printing the parse tree and the result to out
+void runStatement(const string& input, StatementCache& statementCache, ostream& out) {
+
+    // Get the parse tree from the statement cache (PREPARE/EXECUTE go through it too),
+    // leaving out the clauses that only SQLExec knows
+    SQLExtensions extensions;
+    string sql = SQLExtensions::strip(input, extensions);
+    if (extensions.analyze) {
+        try {
+            QueryResult *query_result = SQLExec::analyze(extensions);
+            out << *query_result << endl;
+            delete query_result;
+        }
+        catch (SQLExecError &e) {
+            out << "Error: " << e.what() << endl;
+        }
+        return;
+    }
+    CachedStatement *cached;
+    string error;
+    if (!statementCache.prepared(sql, cached, error))
+        cached = statementCache.get(sql, error);
+    if (!error.empty()) {
+        out << error << endl;
+        return;
+    }
+    if (cached == nullptr) {
+        out << "prepared" << endl;
+        return;
+    }
 
-        // If valid, parse the statement
-		if (!result->isValid())
-			cout << "Invalid SQL: " << input << endl;
-		else {
-			for (long unsigned int i = 0; i < result->size(); i++) {	
-				cout << execute(result->getStatement(i)) << endl;
-			}
+    // Print and execute each statement
+	SQLParserResult *result = cached->get_result();
+	for (long unsigned int i = 0; i < result->size(); i++) {	
+		const SQLStatement *statement = result->getStatement(i);
+		if (extensions.explain)
+			out << (extensions.explain_analyze ? "EXPLAIN ANALYZE " : "EXPLAIN ");
+		out << execute(statement) << endl;
+		try {
+			QueryResult *query_result = SQLExec::execute(statement, &extensions);
+			out << *query_result << endl;
+			delete query_result;
 		}
+		catch (SQLExecError &e) {
+			out << "Error: " << e.what() << endl;
+		}
+	}
+}
+
+// Runs a script of semicolon-separated statements without prompting
+// Output is buffered and written in large chunks; per-statement and total
+// wall clock and CPU times are reported on stderr so stdout stays replayable
+int runBatch(istream& script, StatementCache& statementCache) {
+    const size_t FLUSH_SIZE = 1 << 16;
+    ostringstream out;
+    string statement;
+    char quote = 0;
+    int count = 0;
+    double totalWall = 0, totalCpu = 0;
+    bool more = true;
+
+    while (more) {
+        // Read up to the next semicolon that is not inside quotes (skipping -- comments)
+        int c = script.get();
+        more = c != EOF;
+        if (more && quote == 0 && c == '-' && script.peek() == '-') {
+            string comment;
+            getline(script, comment);
+            continue;
+        }
+        if (more && quote != 0) {
+            if (c == quote)
+                quote = 0;
+            statement += (char) c;
+            continue;
+        }
+        if (more && (c == '\'' || c == '"')) {
+            quote = (char) c;
+            statement += (char) c;
+            continue;
+        }
+        if (more && c != ';') {
+            statement += (isspace(c) ? ' ' : (char) c);
+            continue;
+        }
+
+        // Run it
+        size_t start = statement.find_first_not_of(' ');
+        if (start != string::npos) {
+            size_t end = statement.find_last_not_of(' ');
+            string input = statement.substr(start, end - start + 1);
+            auto wallStart = chrono::steady_clock::now();
+            clock_t cpuStart = clock();
+            runStatement(input, statementCache, out);
+            double cpu = 1000.0 * (clock() - cpuStart) / CLOCKS_PER_SEC;
+            double wall = chrono::duration<double, milli>(chrono::steady_clock::now() - wallStart).count();
+            totalWall += wall;
+            totalCpu += cpu;
+            count++;
+            cerr << "[" << count << "] " << wall << " ms wall, " << cpu << " ms cpu: "
+                 << input.substr(0, 60) << (input.length() > 60 ? "..." : "") << endl;
+            if (out.tellp() >= (streampos) FLUSH_SIZE) {
+                cout << out.str();
+                out.str("");
+            }
+        }
+        statement.clear();
     }
+    cout << out.str() << flush;
+    cerr << count << " statements, " << totalWall << " ms wall, " << totalCpu << " ms cpu, "
+         << GroupCommit::get_commits() << " commits in " << GroupCommit::get_flushes() << " log flushes" << endl;
+    reportCompression();
+    reportVacuum();
+    return 0;
+}
 
-	return 0;
+
+// Prints how well each open compressed table's blocks compressed, and how fast they decoded
+void reportCompression() {
+    for (auto const& relation : Tables::open_tables()) {
+        HeapTable* table = dynamic_cast<HeapTable*>(relation.get());
+        if (table == nullptr || !table->is_compressed())
+            continue;
+        CompressionStats stats = table->compression_stats();
+        cerr << table->get_table_name() << ": " << stats.blocks_compressed << " blocks compressed "
+             << stats.ratio() << ":1, " << stats.blocks_decoded << " decoded at " << stats.decode_rate() << " MB/s" << endl;
+    }
+}
+
+
+// Prints how many bytes the background vacuum has reclaimed in each open table
+void reportVacuum() {
+    for (auto const& relation : Tables::open_tables()) {
+        HeapTable* table = dynamic_cast<HeapTable*>(relation.get());
+        if (table == nullptr || table->get_bytes_reclaimed() == 0)
+            continue;
+        cerr << table->get_table_name() << ": " << table->get_bytes_reclaimed() << " bytes reclaimed by vacuum" << endl;
+    }
+}
+
+
+// Stops the server on SIGINT or SIGTERM
+void stopServer(int signal) {
+    if (server != nullptr)
+        server->stop();
+}
+
+// Serves sessions on a Unix domain socket until interrupted
+// Every session gets its own statement cache; all of them share the database environment
+int runServer(const char* socketPath, unsigned int threads) {
+    SQLServer sqlServer(socketPath, threads, [](const string& request, StatementCache& statementCache) {
+        ostringstream out;
+        runStatement(request, statementCache, out);
+        return out.str();
+    });
+    server = &sqlServer;
+    signal(SIGINT, stopServer);
+    signal(SIGTERM, stopServer);
+    cerr << "listening on " << socketPath << " with " << threads << " threads" << endl;
+    try {
+        sqlServer.run();
+    }
+    catch (exception& e) {
+        cerr << e.what() << endl;
+        return -1;
+    }
+    server = nullptr;
+    cerr << sqlServer.get_sessions() << " sessions, " << sqlServer.get_requests() << " requests, "
+         << GroupCommit::get_commits() << " commits in " << GroupCommit::get_flushes() << " log flushes" << endl;
+    reportCompression();
+    reportVacuum();
+    return 0;
 }
 
 
@@ -134,6 +378,16 @@ string parseSelect(SelectStatement* stmt) {
         result += " WHERE ";
         result += parseExpression(stmt->whereClause);
     }
+
+    // Parse the group by columns
+    if (stmt->groupBy != NULL) {
+        result += " GROUP BY ";
+        for (long unsigned int i = 0; i < stmt->groupBy->columns->size(); i++) {
+            result += parseExpression(stmt->groupBy->columns->at(i));
+            if (i < (stmt->groupBy->columns->size() - 1))
+                result += ", ";
+        }
+    }
     
     return result;
 }
@@ -189,7 +443,9 @@ string parseExpression(Expr* expr) {
             break;
         case kExprFunctionRef:
             result += string(expr->name);
-            result += string(expr->expr->name);
+            result += "(";
+            result += parseExpression(expr->expr);
+            result += ")";
             break;
         case kExprOperator:
             if(expr == nullptr) {
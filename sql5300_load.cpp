@@ -0,0 +1,161 @@
+/*
+  sql5300_load.cpp
+
+  Load generator for the sql5300 server (sql5300 env_path -s socket_path).
+  Opens several concurrent sessions, sends each one a stream of statements and
+  reports the throughput in queries per second and the latency distribution.
+
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "socket_frame.h"
+
+using namespace std;
+
+// Connect to the server's socket, or return -1
+int connectTo(const string& socketPath) {
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socketPath.length() >= sizeof(address.sun_path))
+        return -1;
+    strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (sockaddr*) &address, sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Whether the server reported an error: a line of the response starts with one of its error prefixes
+// (a statement's result follows the echo of its parse tree, so the error may not be on the first line)
+bool isError(const string& response) {
+    for (const char* prefix: {"Error: ", "Invalid SQL: "}) {
+        size_t length = strlen(prefix);
+        size_t line = 0;
+        do {
+            if (response.compare(line, length, prefix) == 0)
+                return true;
+            line = response.find('\n', line);
+        } while (line++ != string::npos);
+    }
+    return false;
+}
+
+// Read one statement per line, skipping blank lines and -- comments
+vector<string> readScript(istream& script) {
+    vector<string> statements;
+    string line;
+    while (getline(script, line)) {
+        size_t start = line.find_first_not_of(" \t\r");
+        if (start == string::npos || line.compare(start, 2, "--") == 0)
+            continue;
+        size_t end = line.find_last_not_of(" \t\r;");
+        statements.push_back(line.substr(start, end - start + 1));
+    }
+    return statements;
+}
+
+int main(int argc, char* argv[]) {
+    string socketPath;
+    unsigned int connections = 8;
+    unsigned int requests = 1000;
+    vector<string> statements;
+    bool badUsage = argc < 2 || argc % 2 != 0;
+    if (!badUsage)
+        socketPath = argv[1];
+    for (int i = 2; !badUsage && i < argc; i += 2) {
+        string option = argv[i];
+        if (option == "-c") {
+            connections = (unsigned int) atoi(argv[i + 1]);
+        } else if (option == "-n") {
+            requests = (unsigned int) atoi(argv[i + 1]);
+        } else if (option == "-q") {
+            statements.push_back(argv[i + 1]);
+        } else if (option == "-f") {
+            ifstream script(argv[i + 1]);
+            if (!script) {
+                cerr << "Cannot open script " << argv[i + 1] << endl;
+                return 1;
+            }
+            vector<string> more = readScript(script);
+            statements.insert(statements.end(), more.begin(), more.end());
+        } else {
+            badUsage = true;
+        }
+    }
+    if (badUsage || connections < 1) {
+        cerr << "Usage: ./sql5300_load socket_path [-c connections] [-n requests_per_connection] "
+             << "[-q statement]... [-f script.sql]" << endl;
+        return 1;
+    }
+    if (statements.empty())
+        statements.push_back("SELECT * FROM _tables");
+
+    // each session cycles through the statements, starting at a different one
+    mutex resultsMutex;
+    vector<double> latencies;
+    size_t errors = 0, failedSessions = 0;
+    auto start = chrono::steady_clock::now();
+    vector<thread> sessions;
+    for (unsigned int c = 0; c < connections; c++) {
+        sessions.push_back(thread([&, c]() {
+            vector<double> mine;
+            size_t myErrors = 0;
+            int fd = connectTo(socketPath);
+            bool ok = fd >= 0;
+            string response;
+            for (unsigned int i = 0; ok && i < requests; i++) {
+                auto sent = chrono::steady_clock::now();
+                ok = send_frame(fd, statements[(c + i) % statements.size()]) && recv_frame(fd, response);
+                if (!ok)
+                    break;
+                mine.push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - sent).count());
+                if (isError(response))
+                    myErrors++;
+            }
+            if (fd >= 0) {
+                send_frame(fd, "quit");
+                close(fd);
+            }
+            lock_guard<mutex> guard(resultsMutex);
+            latencies.insert(latencies.end(), mine.begin(), mine.end());
+            errors += myErrors;
+            failedSessions += ok ? 0 : 1;
+        }));
+    }
+    for (auto& session: sessions)
+        session.join();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    sort(latencies.begin(), latencies.end());
+    auto percentile = [&latencies](double p) {
+        if (latencies.empty())
+            return 0.0;
+        size_t rank = (size_t) (p * (latencies.size() - 1) + 0.5);
+        return latencies[rank];
+    };
+    cout << connections << " connections, " << latencies.size() << " requests, " << errors << " errors";
+    if (failedSessions > 0)
+        cout << ", " << failedSessions << " sessions failed";
+    cout << endl;
+    cout << seconds << " s, " << latencies.size() / seconds << " queries/s" << endl;
+    cout << "latency ms: p50 " << percentile(0.50) << ", p90 " << percentile(0.90) << ", p99 " << percentile(0.99)
+         << ", max " << (latencies.empty() ? 0.0 : latencies.back()) << endl;
+    return failedSessions > 0 ? 1 : 0;
+}
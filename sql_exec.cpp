@@ -0,0 +1,899 @@
+/*
+  sql_exec.cpp
+
+  Execution of parsed SQL statements against the heap storage engine.
+  Table schemas come from the catalog in schema_tables.
+  Supported so far: CREATE TABLE, INSERT, IMPORT (CSV), and SELECT from a single table with an
+  optional conjunction of column = literal predicates, GROUP BY and the aggregates
+  COUNT, SUM, MIN, MAX and AVG.
+  Statements that change the database each run in their own transaction.
+
+*/
+
+#include "sql_exec.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <random>
+#include <cmath>
+#include <thread>
+#include "hash_aggregate.h"
+#include "mvcc.h"
+#include "transaction.h"
+
+using namespace std;
+using namespace hsql;
+
+// define static data
+Tables *SQLExec::tables = nullptr;
+static std::once_flag tables_created;
+
+// make query result be printable
+ostream &operator<<(ostream &out, const QueryResult &qres) {
+    if (qres.column_names != nullptr) {
+        for (auto const &column_name: *qres.column_names)
+            out << column_name << " ";
+        out << endl << "+";
+        for (unsigned int i = 0; i < qres.column_names->size(); i++)
+            out << "----------+";
+        out << endl;
+        for (auto const &row: *qres.rows) {
+            for (auto const &column_name: *qres.column_names) {
+                Value value = row->at(column_name);
+                switch (value.data_type) {
+                    case ColumnAttribute::INT:
+                        out << value.n;
+                        break;
+                    case ColumnAttribute::TEXT:
+                        out << "\"" << value.s << "\"";
+                        break;
+                    default:
+                        out << "???";
+                }
+                out << " ";
+            }
+            out << endl;
+        }
+    }
+    out << qres.message;
+    return out;
+}
+
+QueryResult::~QueryResult() {
+    delete column_names;
+    delete column_attributes;
+    if (rows != nullptr) {
+        for (auto row: *rows)
+            delete row;
+        delete rows;
+    }
+}
+
+// Take the clauses the parser doesn't know out of a statement
+// Works on words (quoted text counts as one word), matching keywords in any case.
+string SQLExtensions::strip(const string &sql, SQLExtensions &extensions) {
+    vector<pair<size_t, size_t>> words;  // [begin, end) in sql
+    for (size_t i = 0; i < sql.length();) {
+        char c = sql[i];
+        size_t end = i + 1;
+        if (c == '\'' || c == '"') {
+            end = sql.find(c, i + 1);
+            end = end == string::npos ? sql.length() : end + 1;
+        } else if (isalnum((unsigned char) c) || c == '_') {
+            while (end < sql.length() && (isalnum((unsigned char) sql[end]) || sql[end] == '_'))
+                end++;
+        } else {
+            i++;
+            continue;
+        }
+        words.push_back(make_pair(i, end));
+        i = end;
+    }
+    auto word = [&](size_t k) {
+        string text = sql.substr(words[k].first, words[k].second - words[k].first);
+        transform(text.begin(), text.end(), text.begin(), ::toupper);
+        return text;
+    };
+    if (!words.empty() && word(0) == "EXPLAIN") {
+        extensions.explain = true;
+        size_t k = 1;
+        if (k < words.size() && word(k) == "ANALYZE") {
+            extensions.explain_analyze = true;
+            k++;
+        }
+        return strip(k < words.size() ? sql.substr(words[k].first) : "", extensions);
+    }
+    if (!words.empty() && word(0) == "ANALYZE") {
+        extensions.analyze = true;
+        size_t k = 1;
+        if (k < words.size() && word(k) != "SAMPLE") {
+            extensions.analyze_table = sql.substr(words[k].first, words[k].second - words[k].first);
+            if (extensions.analyze_table.length() >= 2 && extensions.analyze_table[0] == '"')
+                extensions.analyze_table = extensions.analyze_table.substr(1, extensions.analyze_table.length() - 2);
+            k++;
+        }
+        if (k + 1 < words.size() && word(k) == "SAMPLE" && isdigit((unsigned char) sql[words[k + 1].first])
+            && word(k + 1).length() <= 9)
+            extensions.sample_blocks = (uint) stoul(word(k + 1));
+        return "";
+    }
+
+    // FROM t TABLESAMPLE SYSTEM (percent) [REPEATABLE (seed)]
+    for (size_t k = 0; k + 2 < words.size(); k++) {
+        if (word(k) != "TABLESAMPLE" || word(k + 1) != "SYSTEM" || !isdigit((unsigned char) sql[words[k + 2].first]))
+            continue;
+        char *after;
+        extensions.tablesample = true;
+        extensions.sample_percent = strtod(sql.c_str() + words[k + 2].first, &after);
+        size_t end = after - sql.c_str(), next = k + 3;
+        for (; next < words.size() && words[next].first < end; next++);
+        if (next + 1 < words.size() && word(next) == "REPEATABLE" && isdigit((unsigned char) sql[words[next + 1].first])
+            && word(next + 1).length() <= 9) {
+            extensions.repeatable = true;
+            extensions.sample_seed = (uint) stoul(word(next + 1));
+            end = words[next + 1].second;
+        }
+        size_t close = sql.find(')', end);
+        end = close == string::npos ? sql.length() : close + 1;
+        return sql.substr(0, words[k].first) + sql.substr(end);
+    }
+
+    if (words.empty() || word(0) != "CREATE")
+        return sql;
+
+    // PARTITION BY HASH (column) [PARTITIONS n], or PARTITION BY RANGE (column) VALUES (bound, ...)
+    for (size_t k = 0; k + 3 < words.size(); k++) {
+        if (word(k) != "PARTITION" || word(k + 1) != "BY" || (word(k + 2) != "HASH" && word(k + 2) != "RANGE"))
+            continue;
+        PartitionScheme &scheme = extensions.partitioning;
+        extensions.partitioned = true;
+        scheme.kind = word(k + 2) == "HASH" ? PartitionScheme::HASH : PartitionScheme::RANGE;
+        scheme.column_name = sql.substr(words[k + 3].first, words[k + 3].second - words[k + 3].first);
+        if (scheme.column_name.length() >= 2 && scheme.column_name[0] == '"')
+            scheme.column_name = scheme.column_name.substr(1, scheme.column_name.length() - 2);
+        size_t end = sql.find(')', words[k + 3].second);
+        end = end == string::npos ? sql.length() : end + 1;
+        size_t next = k + 4;
+        for (; next < words.size() && words[next].first < end; next++);
+        if (scheme.kind == PartitionScheme::HASH && next + 1 < words.size() && word(next) == "PARTITIONS"
+            && isdigit((unsigned char) sql[words[next + 1].first]) && word(next + 1).length() <= 9) {
+            scheme.partitions = (u_int32_t) stoul(word(next + 1));
+            end = words[next + 1].second;
+        } else if (scheme.kind == PartitionScheme::RANGE && next < words.size() && word(next) == "VALUES") {
+            size_t open = sql.find('(', words[next].second);
+            size_t close = open == string::npos ? string::npos : sql.find(')', open);
+            if (close != string::npos) {
+                const char *bound = sql.c_str() + open + 1;
+                while (bound < sql.c_str() + close) {
+                    char *after;
+                    long value = strtol(bound, &after, 10);
+                    if (after == bound) {
+                        bound++;  // a comma or a space
+                        continue;
+                    }
+                    scheme.bounds.push_back((int32_t) value);
+                    bound = after;
+                }
+                end = close + 1;
+            }
+        }
+        return strip(sql.substr(0, words[k].first) + sql.substr(end), extensions);
+    }
+
+    // table options after the closing parenthesis: COMPRESSED, BLOCK_SIZE n[K], BLOOM_FPR rate
+    string stripped = sql;
+    size_t close = sql.rfind(')');
+    size_t options = words.size();
+    while (options > 0 && close != string::npos && words[options - 1].first > close)
+        options--;
+    size_t end = options;
+    while (end < words.size()) {
+        if (word(end) == "COMPRESSED") {
+            extensions.compressed = true;
+            end++;
+        } else if (word(end) == "BLOCK_SIZE" && end + 1 < words.size() && isdigit((unsigned char) sql[words[end + 1].first])
+                   && word(end + 1).length() <= 6) {
+            string size = word(end + 1);
+            extensions.block_size = (uint) stoul(size) * (size.back() == 'K' ? 1024 : 1);
+            end += 2;
+        } else if (word(end) == "BLOOM_FPR" && end + 1 < words.size() && isdigit((unsigned char) sql[words[end + 1].first])) {
+            char *after;
+            extensions.bloom_false_positive_rate = strtod(sql.c_str() + words[end + 1].first, &after);
+            for (end++; end < words.size() && words[end].first < (size_t) (after - sql.c_str()); end++);
+        } else {
+            break;
+        }
+    }
+    if (end == words.size() && options < end)
+        stripped.erase(words[options].first);
+
+    // column TEXT [DICTIONARY] [BLOOM]
+    for (size_t k = words.size() - 1; k >= 2; k--) {
+        size_t type = k - 1;
+        if (word(k) == "BLOOM" && word(type) == "DICTIONARY")
+            type--;
+        if ((word(k) != "DICTIONARY" && word(k) != "BLOOM") || type == 0 || word(type) != "TEXT")
+            continue;
+        string column = sql.substr(words[type - 1].first, words[type - 1].second - words[type - 1].first);
+        if (column.length() >= 2 && column[0] == '"')
+            column = column.substr(1, column.length() - 2);
+        (word(k) == "BLOOM" ? extensions.bloom_columns : extensions.dictionary_columns).push_back(column);
+        stripped.erase(words[k - 1].second, words[k].second - words[k - 1].second);
+    }
+    return stripped;
+}
+
+// Execute the given statement
+// May be called from several sessions' threads at once.
+QueryResult *SQLExec::execute(const SQLStatement *statement, const SQLExtensions *extensions) {
+    std::call_once(tables_created, []() { tables = new Tables(); });
+
+    try {
+        if (extensions != nullptr && extensions->explain && statement->type() != kStmtSelect)
+            throw SQLExecError("only SELECT can be explained");
+        switch (statement->type()) {
+            case kStmtSelect:
+                if (extensions != nullptr && extensions->explain)
+                    return explain((const SelectStatement *) statement, *extensions);
+                return select((const SelectStatement *) statement, extensions);
+            case kStmtCreate:
+            case kStmtInsert:
+            case kStmtImport:
+                return transact(statement, extensions);
+            default:
+                return new QueryResult("not implemented");
+        }
+    } catch (DbRelationError &e) {
+        throw SQLExecError(string("DbRelationError: ") + e.what());
+    } catch (DbException &e) {
+        throw SQLExecError(string("DbException: ") + e.what());
+    }
+}
+
+// Run a statement that changes the database in a transaction of its own
+// Returns once the commit is durable; any error rolls the whole statement back.
+QueryResult *SQLExec::transact(const SQLStatement *statement, const SQLExtensions *extensions) {
+    Transaction transaction;
+    QueryResult *result;
+    switch (statement->type()) {
+        case kStmtCreate:
+            result = create((const CreateStatement *) statement, extensions);
+            break;
+        case kStmtInsert:
+            result = insert((const InsertStatement *) statement);
+            break;
+        case kStmtImport:
+            result = import((const ImportStatement *) statement);
+            break;
+        default:
+            return new QueryResult("not implemented");
+    }
+    try {
+        transaction.commit();
+    } catch (...) {
+        delete result;
+        throw;
+    }
+    return result;
+}
+
+// Pull out the name and type of a column definition
+void SQLExec::column_definition(const ColumnDefinition *col, Identifier &column_name,
+                                ColumnAttribute &column_attribute) {
+    column_name = col->name;
+    switch (col->type) {
+        case ColumnDefinition::INT:
+            column_attribute.set_data_type(ColumnAttribute::INT);
+            break;
+        case ColumnDefinition::TEXT:
+            column_attribute.set_data_type(ColumnAttribute::TEXT);
+            break;
+        default:
+            throw SQLExecError("unrecognized data type for column " + column_name);
+    }
+}
+
+// Apply the CREATE TABLE options to a new HeapTable or PartitionedTable, and create its files
+template<typename Table>
+static void create_table(Table &table, const SQLExtensions *extensions, uint block_size,
+                         const ColumnNames &bloom_columns, double false_positive_rate) {
+    if (extensions != nullptr && extensions->compressed)
+        table.set_compression(true);
+    table.set_block_size(block_size);
+    table.set_bloom_filters(bloom_columns, false_positive_rate);
+    table.create();
+}
+
+// Execute: CREATE TABLE <table_name> ( <columns> ) [PARTITION BY ...]
+// Records the table in the catalog and then creates its file (or one per partition).
+QueryResult *SQLExec::create(const CreateStatement *statement, const SQLExtensions *extensions) {
+    if (statement->type != CreateStatement::kTable)
+        return new QueryResult("only CREATE TABLE is implemented");
+
+    Identifier table_name = statement->tableName;
+    if (tables->exists(table_name)) {
+        if (statement->ifNotExists)
+            return new QueryResult("table " + table_name + " already exists");
+        throw SQLExecError("table " + table_name + " already exists");
+    }
+    uint block_size = extensions == nullptr || extensions->block_size == 0 ? DbBlock::BLOCK_SZ : extensions->block_size;
+    if (!HeapFile::valid_block_size(block_size))
+        throw SQLExecError("block size must be a power of two from " + to_string(DbBlock::BLOCK_SZ) + " to "
+                           + to_string(DbBlock::MAX_BLOCK_SZ));
+    double false_positive_rate = extensions == nullptr || extensions->bloom_false_positive_rate == 0
+                                 ? BloomFile::default_false_positive_rate() : extensions->bloom_false_positive_rate;
+    if (false_positive_rate <= 0 || false_positive_rate >= 1)
+        throw SQLExecError("Bloom filter false positive rate must be between 0 and 1");
+    ColumnNames bloom_columns;
+    if (extensions != nullptr)
+        bloom_columns = extensions->bloom_columns;
+    for (auto const &column_name: bloom_columns) {
+        bool text = false;
+        for (ColumnDefinition *col: *statement->columns)
+            text = text || (column_name == col->name && col->type == ColumnDefinition::TEXT);
+        if (!text)
+            throw SQLExecError("Bloom filters need a TEXT column, not " + column_name);
+    }
+    if (extensions != nullptr && extensions->partitioned) {
+        ColumnNames names;
+        ColumnAttributes attributes;
+        for (ColumnDefinition *col: *statement->columns) {
+            Identifier column_name;
+            ColumnAttribute column_attribute(ColumnAttribute::INT);
+            column_definition(col, column_name, column_attribute);
+            names.push_back(column_name);
+            attributes.push_back(column_attribute);
+        }
+        try {
+            extensions->partitioning.check(names, attributes);
+        } catch (DbRelationError &e) {
+            throw SQLExecError(e.what());
+        }
+    }
+
+    ValueDict row;
+    row["table_name"] = Value(table_name);
+    tables->insert(&row);
+    DbRelation &columns = tables->get_table(Columns::TABLE_NAME);
+    ColumnNames column_names;
+    ColumnAttributes column_attributes;
+    for (ColumnDefinition *col: *statement->columns) {
+        Identifier column_name;
+        ColumnAttribute column_attribute(ColumnAttribute::INT);
+        column_definition(col, column_name, column_attribute);
+        if (extensions != nullptr && find(extensions->dictionary_columns.begin(), extensions->dictionary_columns.end(),
+                                          column_name) != extensions->dictionary_columns.end())
+            column_attribute.set_dictionary(true);
+        row["column_name"] = Value(column_name);
+        if (column_attribute.get_data_type() == ColumnAttribute::INT)
+            row["data_type"] = Value("INT");
+        else
+            row["data_type"] = Value(column_attribute.is_dictionary() ? "TEXT DICTIONARY" : "TEXT");
+        columns.insert(&row);
+        column_names.push_back(column_name);
+        column_attributes.push_back(column_attribute);
+    }
+    if (extensions != nullptr && extensions->partitioned) {
+        PartitionedTable table(table_name, column_names, column_attributes, extensions->partitioning);
+        create_table(table, extensions, block_size, bloom_columns, false_positive_rate);
+    } else {
+        HeapTable table(table_name, column_names, column_attributes);
+        create_table(table, extensions, block_size, bloom_columns, false_positive_rate);
+    }
+    return new QueryResult("created " + table_name);
+}
+
+// Turn a literal into a Value
+Value SQLExec::literal_value(const Expr *expr) {
+    switch (expr->type) {
+        case kExprLiteralInt:
+            return Value((int32_t) expr->ival);
+        case kExprLiteralString:
+            return Value(string(expr->name));
+        default:
+            throw SQLExecError("only INT and TEXT literals are supported");
+    }
+}
+
+// Execute: INSERT INTO <table_name> [( <columns> )] VALUES ( <values> )
+QueryResult *SQLExec::insert(const InsertStatement *statement) {
+    if (statement->type != InsertStatement::kInsertValues)
+        throw SQLExecError("only INSERT ... VALUES is supported");
+
+    Identifier table_name = statement->tableName;
+    ColumnNames column_names;
+    ColumnAttributes column_attributes;
+    tables->get_columns(table_name, column_names, column_attributes);
+    if (statement->columns != nullptr) {
+        column_names.clear();
+        for (char *column_name: *statement->columns)
+            column_names.push_back(column_name);
+    }
+    if (column_names.size() != statement->values->size())
+        throw SQLExecError("INSERT has " + to_string(statement->values->size()) + " values for "
+                           + to_string(column_names.size()) + " columns");
+
+    ValueDict row;
+    for (size_t i = 0; i < column_names.size(); i++)
+        row[column_names[i]] = literal_value(statement->values->at(i));
+    tables->get_table(table_name).insert(&row);
+    return new QueryResult("successfully inserted 1 row into " + table_name);
+}
+
+// Execute: IMPORT FROM CSV FILE '<path>' INTO <table_name>
+QueryResult *SQLExec::import(const ImportStatement *statement) {
+    if (statement->type != ImportStatement::kImportCSV)
+        throw SQLExecError("only IMPORT FROM CSV FILE is supported");
+
+    Identifier table_name = statement->tableName;
+    if (!tables->exists(table_name))
+        throw SQLExecError("table " + table_name + " does not exist");
+    size_t rows = tables->get_table(table_name).import_csv(statement->filePath);
+    return new QueryResult("successfully imported " + to_string(rows) + " rows into " + table_name);
+}
+
+// Pull the column = literal pairs out of a where clause (joined by AND)
+// A column set equal to two different values can't match any row. It is given a value of
+// the other type from its column's, which the scan folds into rejecting every row (see
+// WhereProgram), so the select still goes through its usual plan and returns nothing.
+ValueDict *SQLExec::get_where_conjunction(const Expr *expr, const Identifier &table_name) {
+    ValueDict where;
+    vector<Identifier> conflicting;
+    vector<const Expr *> pending(1, expr);
+    while (!pending.empty()) {
+        const Expr *e = pending.back();
+        pending.pop_back();
+        if (e->type == kExprOperator && e->opType == Expr::AND) {
+            pending.push_back(e->expr);
+            pending.push_back(e->expr2);
+        } else if (e->type == kExprOperator && e->opType == Expr::SIMPLE_OP && e->opChar == '='
+                   && e->expr->type == kExprColumnRef) {
+            Value value = literal_value(e->expr2);
+            ValueDict::const_iterator earlier = where.find(e->expr->name);
+            if (earlier == where.end())
+                where[e->expr->name] = value;
+            else if (earlier->second.data_type != value.data_type || earlier->second.n != value.n
+                     || earlier->second.s != value.s)
+                conflicting.push_back(e->expr->name);
+        } else {
+            throw SQLExecError("only column = literal predicates joined by AND are supported");
+        }
+    }
+    if (!conflicting.empty()) {
+        ColumnNames column_names;
+        ColumnAttributes column_attributes;
+        tables->get_columns(table_name, column_names, column_attributes);
+        for (auto const &column_name: conflicting) {
+            ColumnNames::iterator found = find(column_names.begin(), column_names.end(), column_name);
+            if (found == column_names.end())
+                continue;  // the scan reports it
+            if (column_attributes[found - column_names.begin()].get_data_type() == ColumnAttribute::INT)
+                where[column_name] = Value(string());
+            else
+                where[column_name] = Value();
+        }
+    }
+    return new ValueDict(where);
+}
+
+// Execute: EXPLAIN [ANALYZE] SELECT ...
+// Plain EXPLAIN only plans the select; EXPLAIN ANALYZE also runs it, and shows what that
+// took in place of the rows.
+QueryResult *SQLExec::explain(const SelectStatement *statement, const SQLExtensions &extensions) {
+    bool analyze = extensions.explain_analyze;
+    OperatorProfile plan("Result", -1);
+    QueryResult *result;
+    {
+        Profiling profiling(analyze ? &plan : nullptr);
+        result = select(statement, &extensions, &plan, analyze);
+    }
+    if (!plan.get_children().empty())
+        plan.estimated_rows = plan.get_children().front()->estimated_rows;
+    if (result != nullptr) {
+        plan.rows = result->get_rows()->size();
+        delete result;
+    }
+    return new QueryResult(plan.explain(analyze));
+}
+
+// The LIMIT and OFFSET of a select (SIZE_MAX and 0 if it has none)
+static void get_limit(const SelectStatement *statement, size_t &limit, size_t &offset) {
+    limit = SIZE_MAX;
+    offset = 0;
+    if (statement->limit == nullptr)
+        return;
+    if (statement->limit->limit >= 0)
+        limit = (size_t) statement->limit->limit;
+    if (statement->limit->offset > 0)
+        offset = (size_t) statement->limit->offset;
+}
+
+// e.g. " OFFSET 20 LIMIT 10"
+static string limit_description(size_t limit, size_t offset) {
+    return (offset > 0 ? " OFFSET " + to_string(offset) : "") + (limit != SIZE_MAX ? " LIMIT " + to_string(limit) : "");
+}
+
+// e.g. Scan foo WHERE a = 1 LIMIT 30 (4 workers, matches estimated in 12 blocks)
+static string scan_description(DbRelation &table, const BlockSample *sample, const ValueDict *where,
+                               const ScanPlan &plan, size_t stop_after) {
+    string description = "Scan " + table.get_table_name();
+    if (sample != nullptr) {
+        char percent[32];
+        snprintf(percent, sizeof(percent), "%g", sample->fraction * 100);
+        description += string(" TABLESAMPLE SYSTEM (") + percent + ") REPEATABLE (" + to_string(sample->seed) + ")";
+    }
+    if (where != nullptr) {
+        string conjunction;
+        for (auto const &condition: *where)
+            conjunction += (conjunction.empty() ? "" : " AND ") + condition.first + " = "
+                           + (condition.second.data_type == ColumnAttribute::INT ? to_string(condition.second.n)
+                                                                                 : "\"" + condition.second.s + "\"");
+        description += " WHERE " + conjunction;
+    }
+    description += limit_description(stop_after, 0);
+    description += plan.n_workers > 1 ? " (" + to_string(plan.n_workers) + " workers" : " (serial";
+    const PartitionedTable *partitioned = dynamic_cast<const PartitionedTable *>(&table);
+    if (partitioned != nullptr)
+        description += ", " + to_string(partitioned->partitions_for(where).size()) + " of "
+                       + to_string(partitioned->get_scheme().count()) + " partitions";
+    if (plan.blocks >= 0)
+        description += ", matches estimated in " + to_string(llround(plan.blocks)) + " blocks";
+    return description + ")";
+}
+
+// The blocks a TABLESAMPLE reads (nullptr if the select has none)
+// Without REPEATABLE each select draws a seed of its own.
+static BlockSample *get_sample(const SQLExtensions *extensions) {
+    if (extensions == nullptr || !extensions->tablesample)
+        return nullptr;
+    if (!(extensions->sample_percent >= 0 && extensions->sample_percent <= 100))
+        throw SQLExecError("TABLESAMPLE percentage must be between 0 and 100");
+    u_int32_t seed = extensions->repeatable ? extensions->sample_seed : (u_int32_t) random_device()();
+    return new BlockSample(extensions->sample_percent / 100, seed);
+}
+
+// Execute: SELECT <columns> FROM <table_name> [TABLESAMPLE SYSTEM (<percent>)] [WHERE <conjunction>]
+//          [GROUP BY <columns>]
+// Everything is read through one snapshot, so the result is consistent even with writers busy.
+QueryResult *SQLExec::select(const SelectStatement *statement, const SQLExtensions *extensions,
+                             OperatorProfile *plan, bool analyze) {
+    ReadView view;
+    if (statement->fromTable == nullptr || statement->fromTable->type != kTableName)
+        throw SQLExecError("only SELECT from a single table is supported");
+    Identifier table_name = statement->fromTable->name;
+    DbRelation &table = tables->get_table(table_name);
+    unique_ptr<BlockSample> sample(get_sample(extensions));
+
+    bool aggregating = statement->groupBy != nullptr;
+    for (Expr *expr: *statement->selectList)
+        aggregating = aggregating || expr->type == kExprFunctionRef;
+    if (aggregating) {
+        ValueDict *where = statement->whereClause == nullptr ? nullptr : get_where_conjunction(statement->whereClause, table_name);
+        QueryResult *result;
+        try {
+            result = aggregate(statement, table, where, sample.get(), plan, analyze);
+        } catch (...) {
+            delete where;
+            throw;
+        }
+        delete where;
+        return result;
+    }
+
+    ColumnNames column_names;
+    ColumnAttributes column_attributes;
+    ColumnNames all_names;
+    ColumnAttributes all_attributes;
+    tables->get_columns(table_name, all_names, all_attributes);
+    for (Expr *expr: *statement->selectList) {
+        if (expr->type == kExprStar) {
+            column_names.insert(column_names.end(), all_names.begin(), all_names.end());
+            column_attributes.insert(column_attributes.end(), all_attributes.begin(), all_attributes.end());
+        } else if (expr->type == kExprColumnRef) {
+            ColumnNames::iterator found = find(all_names.begin(), all_names.end(), string(expr->name));
+            if (found == all_names.end())
+                throw SQLExecError("unknown column " + string(expr->name));
+            column_names.push_back(*found);
+            column_attributes.push_back(all_attributes[found - all_names.begin()]);
+        } else {
+            throw SQLExecError("only columns and aggregates are supported in a select list");
+        }
+    }
+
+    // the scan stops once it has found the rows up to the end of the LIMIT; those before
+    // the OFFSET are dropped as handles, without being projected
+    size_t limit, offset;
+    get_limit(statement, limit, offset);
+    size_t stop_after = limit == SIZE_MAX ? SIZE_MAX : offset + limit;
+
+    ValueDict *where = statement->whereClause == nullptr ? nullptr : get_where_conjunction(statement->whereClause, table_name);
+    ValueDicts *rows = new ValueDicts;
+    try {
+        ScanPlan scan_plan = plan_scan(table, where, sample.get());
+        if (stop_after != SIZE_MAX) {
+            // only a serial scan goes through the table in order, and so can stop early
+            scan_plan.n_workers = 1;
+            if (scan_plan.rows > stop_after) {
+                scan_plan.blocks = ceil(scan_plan.blocks * stop_after / scan_plan.rows);
+                scan_plan.rows = stop_after;
+            }
+        }
+        OperatorProfile *project = nullptr, *scan = nullptr;
+        if (plan != nullptr) {
+            string projection;
+            for (auto const &column_name: column_names)
+                projection += (projection.empty() ? " " : ", ") + column_name;
+            double projected = scan_plan.rows < 0 ? -1 : max(scan_plan.rows - offset, 0.0);
+            project = plan->add("Project" + projection + limit_description(SIZE_MAX, offset), projected);
+            scan = project->add(scan_description(table, sample.get(), where, scan_plan, stop_after),
+                                scan_plan.rows);
+            if (!analyze) {
+                delete where;
+                delete rows;
+                return nullptr;
+            }
+        }
+        Profiling projecting(project);
+        if (scan_plan.n_workers > 1) {
+            // each worker projects the rows it finds; put them back in table order
+            vector<vector<pair<Handle, ValueDict *>>> found(scan_plan.n_workers);
+            try {
+                Profiling scanning(scan);
+                table.parallel_scan(where, scan_plan.n_workers, [&](unsigned int worker, Handle handle, const ValueDict *row) {
+                    found[worker].push_back(make_pair(handle, new ValueDict(*row)));
+                }, &column_names, sample.get());
+            } catch (...) {
+                for (auto const &rows_found: found)
+                    for (auto const &row: rows_found)
+                        delete row.second;
+                throw;
+            }
+            vector<pair<Handle, ValueDict *>> all;
+            for (auto const &rows_found: found)
+                all.insert(all.end(), rows_found.begin(), rows_found.end());
+            if (scan != nullptr)
+                scan->rows = all.size();
+            sort(all.begin(), all.end(), [](const pair<Handle, ValueDict *> &a, const pair<Handle, ValueDict *> &b) {
+                return a.first < b.first;
+            });
+            for (size_t i = 0; i < all.size(); i++) {
+                if (i < offset)
+                    delete all[i].second;
+                else
+                    rows->push_back(all[i].second);
+            }
+        } else {
+            Handles *handles;
+            {
+                Profiling scanning(scan);
+                handles = table.select(where, stop_after, sample.get());
+            }
+            if (scan != nullptr)
+                scan->rows = handles->size();
+            handles->erase(handles->begin(), handles->begin() + min(offset, handles->size()));
+            // only the rows that made it through the where clause get decoded, and only their selected columns
+            ValueDicts *projected;
+            try {
+                projected = table.project(handles, &column_names);
+            } catch (...) {
+                delete handles;
+                throw;
+            }
+            delete handles;
+            rows->swap(*projected);
+            delete projected;
+        }
+        if (project != nullptr)
+            project->rows = rows->size();
+    } catch (...) {
+        delete where;
+        for (auto row: *rows)
+            delete row;
+        delete rows;
+        throw;
+    }
+    delete where;
+    size_t n = rows->size();
+    return new QueryResult(new ColumnNames(column_names), new ColumnAttributes(column_attributes), rows,
+                           "successfully returned " + to_string(n) + " rows");
+}
+
+// Execute a SELECT whose select list has aggregates and/or which has a GROUP BY, using HashAggregate
+QueryResult *SQLExec::aggregate(const SelectStatement *statement, DbRelation &table, ValueDict *where,
+                                const BlockSample *sample, OperatorProfile *plan, bool analyze) {
+    if (statement->groupBy != nullptr && statement->groupBy->having != nullptr)
+        throw SQLExecError("HAVING is not supported");
+
+    ColumnNames all_names;
+    ColumnAttributes all_attributes;
+    tables->get_columns(statement->fromTable->name, all_names, all_attributes);
+
+    ColumnNames group_by;
+    ColumnAttributes group_by_attributes;
+    if (statement->groupBy != nullptr) {
+        for (Expr *expr: *statement->groupBy->columns) {
+            if (expr->type != kExprColumnRef)
+                throw SQLExecError("only columns are supported in GROUP BY");
+            ColumnNames::iterator found = find(all_names.begin(), all_names.end(), string(expr->name));
+            if (found == all_names.end())
+                throw SQLExecError("unknown column " + string(expr->name));
+            group_by.push_back(*found);
+            group_by_attributes.push_back(all_attributes[found - all_names.begin()]);
+        }
+    }
+
+    Aggregates aggregates;
+    ColumnNames column_names;
+    ColumnAttributes column_attributes;
+    for (Expr *expr: *statement->selectList) {
+        if (expr->type == kExprColumnRef) {
+            ColumnNames::iterator found = find(group_by.begin(), group_by.end(), string(expr->name));
+            if (found == group_by.end())
+                throw SQLExecError(string(expr->name) + " must appear in GROUP BY or be aggregated");
+            column_names.push_back(*found);
+            column_attributes.push_back(group_by_attributes[found - group_by.begin()]);
+        } else if (expr->type == kExprFunctionRef) {
+            string function(expr->name);
+            transform(function.begin(), function.end(), function.begin(), ::toupper);
+            Aggregate::Function which;
+            if (function == "COUNT")
+                which = Aggregate::COUNT;
+            else if (function == "SUM")
+                which = Aggregate::SUM;
+            else if (function == "MIN")
+                which = Aggregate::MIN;
+            else if (function == "MAX")
+                which = Aggregate::MAX;
+            else if (function == "AVG")
+                which = Aggregate::AVG;
+            else
+                throw SQLExecError("unknown aggregate function " + function);
+
+            Identifier column_name;
+            if (expr->expr != nullptr && expr->expr->type == kExprStar) {
+                if (which != Aggregate::COUNT)
+                    throw SQLExecError(function + "(*) is not supported");
+            } else if (expr->expr != nullptr && expr->expr->type == kExprColumnRef) {
+                column_name = expr->expr->name;
+                if (find(all_names.begin(), all_names.end(), column_name) == all_names.end())
+                    throw SQLExecError("unknown column " + column_name);
+            } else {
+                throw SQLExecError("aggregates take a column or *");
+            }
+            Identifier output_name = expr->alias != nullptr ? string(expr->alias)
+                                                            : function + "(" + (column_name.empty() ? "*" : column_name) + ")";
+            aggregates.push_back(Aggregate(which, column_name, output_name));
+            column_names.push_back(output_name);
+            column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+        } else {
+            throw SQLExecError("only columns and aggregates are supported in a select list");
+        }
+    }
+
+    HashAggregate hash_aggregate(group_by, group_by_attributes, aggregates);
+    size_t limit, offset;
+    get_limit(statement, limit, offset);
+    ScanPlan scan_plan = plan_scan(table, where, sample);
+    if (scan_plan.cost < 0)
+        scan_plan.n_workers = max(thread::hardware_concurrency(), 1u);  // without statistics, as before
+    OperatorProfile *profile = nullptr;
+    if (plan != nullptr) {
+        // the scan runs in the aggregate's own workers, so it has no counters of its own
+        shared_ptr<CostModel> model = cost_model(table);
+        string grouping;
+        for (auto const &column_name: group_by)
+            grouping += (grouping.empty() ? " GROUP BY " : ", ") + column_name;
+        profile = plan->add("HashAggregate" + grouping + limit_description(limit, offset) + " of "
+                            + scan_description(table, sample, where, scan_plan, SIZE_MAX),
+                            model == nullptr ? -1 : model->groups(group_by, where));
+        if (!analyze)
+            return nullptr;
+    }
+    Profiling profiling(profile);
+    ValueDicts *rows = hash_aggregate.execute(table, where, scan_plan.n_workers, sample);
+    // every group needs every row, so LIMIT and OFFSET only apply to the groups
+    size_t end = limit == SIZE_MAX ? rows->size() : min(offset + limit, rows->size());
+    size_t begin = min(offset, end);
+    for (size_t i = 0; i < rows->size(); i++)
+        if (i < begin || i >= end)
+            delete (*rows)[i];
+    rows->erase(rows->begin() + end, rows->end());
+    rows->erase(rows->begin(), rows->begin() + begin);
+    if (profile != nullptr)
+        profile->rows = rows->size();
+    return new QueryResult(new ColumnNames(column_names), new ColumnAttributes(column_attributes), rows,
+                           "successfully returned " + to_string(rows->size()) + " rows");
+}
+
+// Choose how to read the rows of a table (or of its sample) that match where, going by the table's statistics
+// Without any (before the table's first ANALYZE) the plan is a serial one with a negative cost.
+ScanPlan SQLExec::plan_scan(DbRelation &table, const ValueDict *where, const BlockSample *sample) {
+    shared_ptr<CostModel> model = cost_model(table);
+    if (model == nullptr) {
+        ScanPlan plan = {1, -1, -1, -1};
+        return plan;
+    }
+    return model->scan(where, max(thread::hardware_concurrency(), 1u), sample == nullptr ? 1 : sample->fraction);
+}
+
+// The table's cost model, or nullptr if it has no statistics
+shared_ptr<CostModel> SQLExec::cost_model(DbRelation &table) {
+    shared_ptr<const TableStatistics> statistics = table.get_statistics();
+    if (statistics == nullptr)
+        return nullptr;
+    ColumnNames column_names;
+    ColumnAttributes column_attributes;
+    tables->get_columns(table.get_table_name(), column_names, column_attributes);
+    return make_shared<CostModel>(statistics, column_names);
+}
+
+// Execute: ANALYZE [<table_name>] [SAMPLE <n>]
+// Tables are analyzed one at a time, each through a snapshot of its own.
+QueryResult *SQLExec::analyze(const SQLExtensions &extensions) {
+    std::call_once(tables_created, []() { tables = new Tables(); });
+
+    ColumnNames *column_names = new ColumnNames{"table_name", "column_name", "distinct", "avg_length", "min", "max"};
+    ColumnAttributes *column_attributes = new ColumnAttributes{
+            ColumnAttribute(ColumnAttribute::TEXT), ColumnAttribute(ColumnAttribute::TEXT),
+            ColumnAttribute(ColumnAttribute::INT), ColumnAttribute(ColumnAttribute::INT),
+            ColumnAttribute(ColumnAttribute::INT), ColumnAttribute(ColumnAttribute::INT)};
+    ValueDicts *rows = new ValueDicts;
+    string message;
+    try {
+        ColumnNames table_names;
+        if (!extensions.analyze_table.empty()) {
+            if (!tables->exists(extensions.analyze_table))
+                throw SQLExecError("table " + extensions.analyze_table + " does not exist");
+            table_names.push_back(extensions.analyze_table);
+        } else {
+            Handles *handles = tables->select();
+            for (auto const &handle: *handles) {
+                ValueDict *row = tables->project(handle);
+                Identifier table_name = row->at("table_name").s;
+                delete row;
+                if (table_name != Tables::TABLE_NAME && table_name != Columns::TABLE_NAME)
+                    table_names.push_back(table_name);
+            }
+            delete handles;
+        }
+        size_t sample_blocks = extensions.sample_blocks == 0 ? TableStatistics::DEFAULT_SAMPLE_BLOCKS
+                                                             : extensions.sample_blocks;
+        for (auto const &table_name: table_names) {
+            ColumnNames names;
+            ColumnAttributes attributes;
+            tables->get_columns(table_name, names, attributes);
+            shared_ptr<const TableStatistics> statistics = tables->get_table(table_name).analyze(sample_blocks);
+            for (size_t i = 0; i < names.size() && i < statistics->columns.size(); i++) {
+                const ColumnStatistics &column = statistics->columns[i];
+                ValueDict *row = new ValueDict;
+                (*row)["table_name"] = Value(table_name);
+                (*row)["column_name"] = Value(names[i]);
+                (*row)["distinct"] = Value((int32_t) std::llround(column.distinct));
+                (*row)["avg_length"] = Value((int32_t) std::llround(column.average_length));
+                (*row)["min"] = Value(column.min);
+                (*row)["max"] = Value(column.max);
+                rows->push_back(row);
+            }
+            message += (message.empty() ? "" : "\n") + string("analyzed ") + table_name + ": "
+                       + to_string(std::llround(statistics->rows)) + " rows, " + to_string(statistics->sampled_blocks)
+                       + " of " + to_string(statistics->blocks) + " blocks sampled";
+        }
+    } catch (...) {
+        delete column_names;
+        delete column_attributes;
+        for (auto row: *rows)
+            delete row;
+        delete rows;
+        try {
+            throw;
+        } catch (DbRelationError &e) {
+            throw SQLExecError(string("DbRelationError: ") + e.what());
+        } catch (DbException &e) {
+            throw SQLExecError(string("DbException: ") + e.what());
+        }
+    }
+    return new QueryResult(column_names, column_attributes, rows, message);
+}
@@ -0,0 +1,167 @@
+/**
+ * @file sql_exec.h - SQL statement execution.
+ * SQLExecError
+ * QueryResult
+ * SQLExtensions
+ * SQLExec
+ *
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#pragma once
+
+#include <exception>
+#include <string>
+#include "SQLParser.h"
+#include "cost_model.h"
+#include "partition.h"
+#include "profile.h"
+#include "schema_tables.h"
+
+/**
+ * @class SQLExecError - exception for SQLExec methods
+ */
+class SQLExecError : public std::runtime_error {
+public:
+    explicit SQLExecError(std::string s) : runtime_error(s) {}
+};
+
+
+/**
+ * @class QueryResult - data structure to hold all the returned data for a query execution
+ */
+class QueryResult {
+public:
+    QueryResult() : column_names(nullptr), column_attributes(nullptr), rows(nullptr), message("") {}
+
+    QueryResult(std::string message) : column_names(nullptr), column_attributes(nullptr), rows(nullptr),
+                                       message(message) {}
+
+    QueryResult(ColumnNames *column_names, ColumnAttributes *column_attributes, ValueDicts *rows,
+                std::string message)
+            : column_names(column_names), column_attributes(column_attributes), rows(rows), message(message) {}
+
+    virtual ~QueryResult();
+
+    ColumnNames *get_column_names() const { return column_names; }
+
+    ColumnAttributes *get_column_attributes() const { return column_attributes; }
+
+    ValueDicts *get_rows() const { return rows; }
+
+    const std::string &get_message() const { return message; }
+
+    friend std::ostream &operator<<(std::ostream &stream, const QueryResult &qres);
+
+protected:
+    ColumnNames *column_names;
+    ColumnAttributes *column_attributes;
+    ValueDicts *rows;
+    std::string message;
+};
+
+
+/**
+ * @class SQLExtensions - the parts of sql5300's SQL that the SQL parser doesn't know
+ *
+ * strip() takes them out of a statement's text before it is parsed and records them
+ * here, for SQLExec::execute() to apply to the parsed statement:
+ *     CREATE TABLE t (... c TEXT DICTIONARY ...)   -- dictionary encode column c
+ *     CREATE TABLE t (...) COMPRESSED              -- compress t's cold blocks
+ *     CREATE TABLE t (...) BLOCK_SIZE 16K          -- give t 16kB blocks (or 16384)
+ *     CREATE TABLE t (... c TEXT BLOOM ...)        -- keep a Bloom filter of c's values per block
+ *     CREATE TABLE t (...) BLOOM_FPR 0.001         -- at this false positive rate (1% by default)
+ *     CREATE TABLE t (...) PARTITION BY HASH (c) [PARTITIONS n]
+ *                                                  -- spread t's rows over n heap tables by c (8 by default)
+ *     CREATE TABLE t (...) PARTITION BY RANGE (c) VALUES (b1, b2, ...)
+ *                                                  -- or by which of the ranges the bounds make c is in
+ *     ANALYZE [t] [SAMPLE n]                       -- gather statistics on t (or every table) from n blocks
+ *     EXPLAIN [ANALYZE] SELECT ...                 -- show the select's plan (and what running it took)
+ *     SELECT ... FROM t TABLESAMPLE SYSTEM (p)     -- only read a random p percent of t's blocks
+ *         [REPEATABLE (seed)]                      -- the same ones every time for the same seed
+ *
+ * ANALYZE is taken out whole, leaving nothing to parse; run it with SQLExec::analyze().
+ */
+class SQLExtensions {
+public:
+    ColumnNames dictionary_columns;
+    ColumnNames bloom_columns;
+    bool compressed;
+    uint block_size;  // 0 for the default
+    double bloom_false_positive_rate;  // 0 for the default
+    bool analyze;
+    Identifier analyze_table;  // empty for every table
+    uint sample_blocks;        // 0 for the default
+    bool explain;
+    bool explain_analyze;
+    bool tablesample;
+    double sample_percent;
+    bool repeatable;
+    uint sample_seed;
+    bool partitioned;
+    PartitionScheme partitioning;
+
+    SQLExtensions() : compressed(false), block_size(0), bloom_false_positive_rate(0), analyze(false), sample_blocks(0),
+                      explain(false), explain_analyze(false), tablesample(false), sample_percent(100),
+                      repeatable(false), sample_seed(0), partitioned(false) {}
+
+    /**
+     * @param sql         the statement's text
+     * @param extensions  set to the extensions found in it
+     * @returns           the text without them
+     */
+    static std::string strip(const std::string &sql, SQLExtensions &extensions);
+};
+
+/**
+ * @class SQLExec - execution engine
+ */
+class SQLExec {
+public:
+    /**
+     * Execute the given SQL statement.
+     * @param statement   the Hyrise AST of the SQL statement to execute
+     * @param extensions  what SQLExtensions::strip() took out of its text, if anything
+     * @returns           the query result (freed by caller)
+     */
+    static QueryResult *execute(const hsql::SQLStatement *statement, const SQLExtensions *extensions = nullptr);
+
+    /**
+     * Execute: ANALYZE [<table_name>] [SAMPLE <n>]
+     * @param extensions  what SQLExtensions::strip() found in the statement
+     * @returns           the statistics gathered, one row per column (freed by caller)
+     */
+    static QueryResult *analyze(const SQLExtensions &extensions);
+
+protected:
+    // the one place in the system that holds the _tables table
+    static Tables *tables;
+
+    // recursive descent into the AST
+    static QueryResult *transact(const hsql::SQLStatement *statement, const SQLExtensions *extensions);
+
+    static QueryResult *create(const hsql::CreateStatement *statement, const SQLExtensions *extensions);
+
+    static QueryResult *insert(const hsql::InsertStatement *statement);
+
+    static QueryResult *import(const hsql::ImportStatement *statement);
+
+    static QueryResult *explain(const hsql::SelectStatement *statement, const SQLExtensions &extensions);
+
+    // with a plan, the select's operators are added to it, and the select only runs if analyze
+    static QueryResult *select(const hsql::SelectStatement *statement, const SQLExtensions *extensions = nullptr,
+                               OperatorProfile *plan = nullptr, bool analyze = true);
+
+    static QueryResult *aggregate(const hsql::SelectStatement *statement, DbRelation &table, ValueDict *where,
+                                  const BlockSample *sample, OperatorProfile *plan, bool analyze);
+
+    static std::shared_ptr<CostModel> cost_model(DbRelation &table);
+
+    static ScanPlan plan_scan(DbRelation &table, const ValueDict *where, const BlockSample *sample);
+
+    static ValueDict *get_where_conjunction(const hsql::Expr *expr, const Identifier &table_name);
+
+    static Value literal_value(const hsql::Expr *expr);
+
+    static void column_definition(const hsql::ColumnDefinition *col, Identifier &column_name,
+                                  ColumnAttribute &column_attribute);
+};
@@ -0,0 +1,123 @@
+/*
+  sql_server.cpp
+
+  Unix domain socket server for sql5300.
+  The accepting thread only queues connections; a fixed pool of threads takes them
+  off the queue and runs their sessions against the shared database environment.
+
+*/
+
+#include "sql_server.h"
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "socket_frame.h"
+
+SQLServer::SQLServer(const std::string &socket_path, unsigned int n_threads, SessionHandler handler)
+        : socket_path(socket_path), n_threads(n_threads < 1 ? 1 : n_threads), handler(handler), listen_fd(-1),
+          stopping(false), sessions(0), requests(0) {}
+
+SQLServer::~SQLServer() {
+    if (listen_fd >= 0)
+        close(listen_fd);
+}
+
+void SQLServer::run() {
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socket_path.length() >= sizeof(address.sun_path))
+        throw std::runtime_error("socket path too long: " + socket_path);
+    strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0)
+        throw std::runtime_error(std::string("cannot create socket: ") + strerror(errno));
+    unlink(socket_path.c_str());  // left over from a server that didn't shut down cleanly
+    if (bind(listen_fd, (sockaddr *) &address, sizeof(address)) != 0 || listen(listen_fd, SOMAXCONN) != 0) {
+        std::string error = strerror(errno);
+        close(listen_fd);
+        listen_fd = -1;
+        throw std::runtime_error("cannot listen on " + socket_path + ": " + error);
+    }
+
+    std::vector<std::thread> threads;
+    for (unsigned int i = 0; i < n_threads; i++)
+        threads.push_back(std::thread(&SQLServer::worker, this));
+
+    // accept until stopped, waking up now and then to check
+    while (!stopping) {
+        pollfd ready;
+        ready.fd = listen_fd;
+        ready.events = POLLIN;
+        ready.revents = 0;
+        if (poll(&ready, 1, 200) <= 0)
+            continue;
+        int fd = accept(listen_fd, nullptr, nullptr);
+        if (fd < 0)
+            continue;
+        std::lock_guard<std::mutex> guard(queue_mutex);
+        waiting.push_back(fd);
+        queue_ready.notify_one();
+    }
+
+    // stop listening, drop queued connections and cut off the sessions in progress
+    close(listen_fd);
+    listen_fd = -1;
+    unlink(socket_path.c_str());
+    {
+        std::lock_guard<std::mutex> guard(queue_mutex);
+        for (int fd: waiting)
+            close(fd);
+        waiting.clear();
+        for (int fd: active)
+            shutdown(fd, SHUT_RDWR);
+        queue_ready.notify_all();
+    }
+    for (auto &thread: threads)
+        thread.join();
+}
+
+// Pool thread: serve queued sessions one after another
+void SQLServer::worker() {
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    while (true) {
+        queue_ready.wait(lock, [this]() { return stopping || !waiting.empty(); });
+        if (stopping)
+            return;
+        int fd = waiting.front();
+        waiting.pop_front();
+        active.insert(fd);
+        lock.unlock();
+        serve(fd);
+        lock.lock();
+        active.erase(fd);
+        close(fd);
+    }
+}
+
+// Run one session's requests until it ends
+void SQLServer::serve(int fd) {
+    sessions++;
+    StatementCache cache;  // per session: parse trees are bound in place, so they can't be shared
+    std::string request;
+    while (!stopping && recv_frame(fd, request)) {
+        if (request == "quit")
+            break;
+        requests++;
+        std::string response;
+        try {
+            response = handler(request, cache);
+        } catch (std::exception &e) {
+            response = std::string("Error: ") + e.what() + "\n";
+        } catch (...) {
+            response = "Error: unexpected failure\n";
+        }
+        if (!send_frame(fd, response))
+            break;
+    }
+}
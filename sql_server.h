@@ -0,0 +1,80 @@
+/**
+ * @file sql_server.h - Multi-client sql5300 server on a Unix domain socket.
+ * SQLServer
+ *
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include "statement_cache.h"
+
+/**
+ * Runs one request of a session and returns the text to send back.
+ * The cache belongs to the session, so it needs no locking.
+ */
+typedef std::function<std::string(const std::string &request, StatementCache &cache)> SessionHandler;
+
+/**
+ * @class SQLServer - serve sql5300 sessions from a fixed pool of threads
+ *
+ * Clients connect to a Unix domain socket and exchange length-prefixed frames
+ * (see socket_frame.h): one SQL statement per request, its printed result per response.
+ * A session ends when the client closes the connection or sends "quit".
+ *
+ * Accepted connections wait in a queue until one of the pool's threads is free; each
+ * thread then serves one whole session at a time. All sessions share the process's
+ * database environment.
+ */
+class SQLServer {
+public:
+    SQLServer(const std::string &socket_path, unsigned int n_threads, SessionHandler handler);
+
+    virtual ~SQLServer();
+
+    SQLServer(const SQLServer &other) = delete;
+
+    SQLServer &operator=(const SQLServer &other) = delete;
+
+    /**
+     * Listen and serve until stop() is called.
+     * @throws std::runtime_error  if the socket can't be set up
+     */
+    virtual void run();
+
+    /**
+     * Ask run() to return: no new connections are accepted and open sessions are cut off.
+     * Only sets a flag, so it is safe to call from a signal handler.
+     */
+    virtual void stop() { stopping = true; }
+
+    virtual size_t get_sessions() const { return sessions; }
+
+    virtual size_t get_requests() const { return requests; }
+
+protected:
+    std::string socket_path;
+    unsigned int n_threads;
+    SessionHandler handler;
+    int listen_fd;
+    std::atomic<bool> stopping;
+    std::atomic<size_t> sessions;
+    std::atomic<size_t> requests;
+
+    std::mutex queue_mutex;
+    std::condition_variable queue_ready;
+    std::deque<int> waiting;  // accepted connections not yet picked up by a thread
+    std::set<int> active;     // connections being served, so stop() can cut them off
+
+    virtual void worker();
+
+    virtual void serve(int fd);
+};
@@ -0,0 +1,475 @@
+/*
+  statement_cache.cpp
+
+  Parse tree cache for repeated SQL statements.
+  A statement's literals are lifted out of its text and replaced by '?' placeholders,
+  the placeholder form is parsed once, and on every later use the literals are
+  written straight into the placeholder nodes of the cached tree.
+
+*/
+
+#include "statement_cache.h"
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+using namespace std;
+using namespace hsql;
+
+
+// Placeholder discovery (in the order the placeholders appear in the statement text)
+
+static void collect_placeholders(Expr *expr, vector<Expr *> &found);
+
+static void collect_placeholders(SelectStatement *statement, vector<Expr *> &found);
+
+static void collect_placeholders(TableRef *table, vector<Expr *> &found) {
+    if (table == nullptr)
+        return;
+    switch (table->type) {
+        case kTableSelect:
+            collect_placeholders(table->select, found);
+            break;
+        case kTableJoin:
+            collect_placeholders(table->join->left, found);
+            collect_placeholders(table->join->right, found);
+            collect_placeholders(table->join->condition, found);
+            break;
+        case kTableCrossProduct:
+            for (TableRef *t: *table->list)
+                collect_placeholders(t, found);
+            break;
+        default:
+            break;
+    }
+}
+
+static void collect_placeholders(Expr *expr, vector<Expr *> &found) {
+    if (expr == nullptr)
+        return;
+    if (expr->type == kExprPlaceholder) {
+        found.push_back(expr);
+        return;
+    }
+    collect_placeholders(expr->expr, found);
+    collect_placeholders(expr->expr2, found);
+    if (expr->exprList != nullptr)
+        for (Expr *e: *expr->exprList)
+            collect_placeholders(e, found);
+    collect_placeholders(expr->select, found);
+}
+
+static void collect_placeholders(SelectStatement *statement, vector<Expr *> &found) {
+    if (statement == nullptr)
+        return;
+    for (Expr *expr: *statement->selectList)
+        collect_placeholders(expr, found);
+    collect_placeholders(statement->fromTable, found);
+    collect_placeholders(statement->whereClause, found);
+    if (statement->groupBy != nullptr) {
+        for (Expr *expr: *statement->groupBy->columns)
+            collect_placeholders(expr, found);
+        collect_placeholders(statement->groupBy->having, found);
+    }
+    if (statement->order != nullptr)
+        for (OrderDescription *order: *statement->order)
+            collect_placeholders(order->expr, found);
+    collect_placeholders(statement->unionSelect, found);
+}
+
+static void collect_placeholders(SQLStatement *statement, vector<Expr *> &found) {
+    switch (statement->type()) {
+        case kStmtSelect:
+            collect_placeholders((SelectStatement *) statement, found);
+            break;
+        case kStmtInsert: {
+            InsertStatement *insert = (InsertStatement *) statement;
+            if (insert->values != nullptr)
+                for (Expr *expr: *insert->values)
+                    collect_placeholders(expr, found);
+            collect_placeholders(insert->select, found);
+            break;
+        }
+        case kStmtUpdate: {
+            UpdateStatement *update = (UpdateStatement *) statement;
+            for (UpdateClause *clause: *update->updates)
+                collect_placeholders(clause->value, found);
+            collect_placeholders(update->where, found);
+            break;
+        }
+        case kStmtDelete:
+            collect_placeholders(((DeleteStatement *) statement)->expr, found);
+            break;
+        default:
+            break;
+    }
+}
+
+
+// CachedStatement
+
+CachedStatement::CachedStatement(SQLParserResult *result, bool parameterized)
+        : result(result), parameterized(parameterized) {
+    if (result != nullptr)
+        for (size_t i = 0; i < result->size(); i++)
+            collect_placeholders(result->getMutableStatement(i), placeholders);
+}
+
+CachedStatement::~CachedStatement() {
+    delete result;
+}
+
+void CachedStatement::bind(const SQLLiterals &literals) {
+    if (literals.size() != placeholders.size())
+        throw invalid_argument("statement takes " + to_string(placeholders.size()) + " parameters, got "
+                               + to_string(literals.size()));
+    for (size_t i = 0; i < literals.size(); i++) {
+        Expr *expr = placeholders[i];
+        free(expr->name);  // the parser allocates names with strdup
+        expr->name = nullptr;
+        expr->ival = 0;  // a placeholder's number, until the first bind
+        expr->fval = 0;
+        switch (literals[i].type) {
+            case SQLLiteral::INT:
+                expr->type = kExprLiteralInt;
+                expr->ival = strtoll(literals[i].text.c_str(), nullptr, 10);
+                break;
+            case SQLLiteral::FLOAT:
+                expr->type = kExprLiteralFloat;
+                expr->fval = strtof(literals[i].text.c_str(), nullptr);
+                break;
+            case SQLLiteral::STRING:
+                expr->type = kExprLiteralString;
+                expr->name = strdup(literals[i].text.c_str());
+                break;
+        }
+    }
+}
+
+
+// StatementCache
+
+StatementCache::~StatementCache() {
+    for (auto const &entry: entries)
+        delete entry.second;
+    for (auto const &prepared: prepared_statements)
+        delete prepared.second;
+}
+
+void StatementCache::normalize(const string &sql, string &normalized, SQLLiterals &literals) {
+    normalized.clear();
+    literals.clear();
+    bool space = false;
+    size_t i = 0;
+    while (i < sql.length()) {
+        char c = sql[i];
+        if (isspace((unsigned char) c)) {
+            space = true;
+            i++;
+            continue;
+        }
+        char previous = normalized.empty() ? '(' : normalized.back();
+        if (space && !normalized.empty())
+            normalized += ' ';
+        space = false;
+
+        if (c == '\'') {  // string literal, '' stands for a quote
+            string text;
+            for (i++; i < sql.length(); i++) {
+                if (sql[i] == '\'') {
+                    if (i + 1 < sql.length() && sql[i + 1] == '\'') {
+                        text += '\'';
+                        i++;
+                    } else {
+                        break;
+                    }
+                } else {
+                    text += sql[i];
+                }
+            }
+            i++;
+            literals.push_back(SQLLiteral(SQLLiteral::STRING, text));
+            normalized += '?';
+        } else if (c == '"') {  // quoted identifier, copied through
+            size_t end = sql.find('"', i + 1);
+            end = end == string::npos ? sql.length() : end + 1;
+            normalized.append(sql, i, end - i);
+            i = end;
+        } else if (isdigit((unsigned char) c) || (c == '.' && i + 1 < sql.length() && isdigit((unsigned char) sql[i + 1]))
+                   || (c == '-' && i + 1 < sql.length() && isdigit((unsigned char) sql[i + 1])
+                       && strchr("(,=<>+-*/", previous) != nullptr)) {
+            size_t start = i++;
+            bool is_float = c == '.';
+            while (i < sql.length() && (isdigit((unsigned char) sql[i]) || sql[i] == '.')) {
+                is_float = is_float || sql[i] == '.';
+                i++;
+            }
+            literals.push_back(SQLLiteral(is_float ? SQLLiteral::FLOAT : SQLLiteral::INT, sql.substr(start, i - start)));
+            normalized += '?';
+        } else if (isalnum((unsigned char) c) || c == '_') {  // keyword or identifier (digits in it aren't literals)
+            while (i < sql.length() && (isalnum((unsigned char) sql[i]) || sql[i] == '_'))
+                normalized += sql[i++];
+        } else {
+            normalized += c;
+            i++;
+        }
+    }
+}
+
+CachedStatement *StatementCache::get(const string &sql, string &error) {
+    string normalized;
+    SQLLiterals literals;
+    normalize(sql, normalized, literals);
+
+    // a cached parameterized tree, or a marker saying this shape must be cached by exact text
+    CachedStatement *statement = lookup(normalized);
+    if (statement != nullptr && statement->is_parameterized()) {
+        hits++;
+        statement->bind(literals);
+        return statement;
+    }
+    bool by_exact_text = statement != nullptr;
+    string exact_key = "=" + sql;
+    if (by_exact_text) {
+        statement = lookup(exact_key);
+        if (statement != nullptr) {
+            hits++;
+            return statement;
+        }
+    }
+    misses++;
+
+    if (!by_exact_text) {
+        SQLParserResult *result = SQLParser::parseSQLString(normalized);
+        if (result->isValid()) {
+            statement = new CachedStatement(result, true);
+            if (statement->get_parameter_count() == literals.size()) {
+                remember(normalized, statement);
+                statement->bind(literals);
+                return statement;
+            }
+            delete statement;
+        } else {
+            delete result;
+        }
+        remember(normalized, new CachedStatement(nullptr, false));
+    }
+
+    SQLParserResult *result = SQLParser::parseSQLString(sql);
+    if (!result->isValid()) {
+        delete result;
+        error = "Invalid SQL: " + sql;
+        return nullptr;
+    }
+    statement = new CachedStatement(result, false);
+    remember(exact_key, statement);
+    return statement;
+}
+
+bool StatementCache::prepared(const string &sql, CachedStatement *&statement, string &error) {
+    statement = nullptr;
+    size_t start = sql.find_first_not_of(" \t");
+    if (start == string::npos)
+        return false;
+    size_t end = sql.find_first_of(" \t(", start);
+    string command = sql.substr(start, end == string::npos ? string::npos : end - start);
+    for (auto &c: command)
+        c = (char) toupper((unsigned char) c);
+    if (command != "PREPARE" && command != "EXECUTE")
+        return false;
+
+    // statement name
+    size_t name_start = end == string::npos ? string::npos : sql.find_first_not_of(" \t", end);
+    if (name_start == string::npos) {
+        error = command + " needs a statement name";
+        return true;
+    }
+    size_t name_end = sql.find_first_of(" \t(;", name_start);
+    string name = sql.substr(name_start, name_end == string::npos ? string::npos : name_end - name_start);
+    string rest = name_end == string::npos ? "" : sql.substr(name_end);
+
+    if (command == "PREPARE") {
+        size_t as = rest.find_first_not_of(" \t");
+        if (as == string::npos || rest.length() < as + 3 || toupper((unsigned char) rest[as]) != 'A'
+            || toupper((unsigned char) rest[as + 1]) != 'S' || !isspace((unsigned char) rest[as + 2])) {
+            error = "usage: PREPARE <name> AS <statement>";
+            return true;
+        }
+        SQLParserResult *result = SQLParser::parseSQLString(rest.substr(as + 3));
+        if (!result->isValid()) {
+            delete result;
+            error = "Invalid SQL: " + rest.substr(as + 3);
+            return true;
+        }
+        delete prepared_statements[name];
+        prepared_statements[name] = new CachedStatement(result, true);
+        return true;
+    }
+
+    unordered_map<string, CachedStatement *>::const_iterator found = prepared_statements.find(name);
+    if (found == prepared_statements.end()) {
+        error = "no prepared statement named " + name;
+        return true;
+    }
+    string normalized;
+    SQLLiterals literals;
+    normalize(rest, normalized, literals);
+    try {
+        found->second->bind(literals);
+    } catch (invalid_argument &e) {
+        error = string("EXECUTE ") + name + ": " + e.what();
+        return true;
+    }
+    statement = found->second;
+    return true;
+}
+
+// Find a cached entry and mark it most recently used
+CachedStatement *StatementCache::lookup(const string &key) {
+    unordered_map<string, Entries::iterator>::iterator found = index.find(key);
+    if (found == index.end())
+        return nullptr;
+    entries.splice(entries.begin(), entries, found->second);
+    return found->second->second;
+}
+
+// Add an entry, evicting the least recently used one if the cache is full
+void StatementCache::remember(const string &key, CachedStatement *statement) {
+    if (entries.size() >= capacity && !entries.empty()) {
+        index.erase(entries.back().first);
+        delete entries.back().second;
+        entries.pop_back();
+    }
+    entries.push_front(make_pair(key, statement));
+    index[key] = entries.begin();
+}
+
+
+// Test function -- returns true if all tests pass
+
+// Whether two expressions are the same tree
+static bool same_tree(const Expr *a, const Expr *b) {
+    if (a == nullptr || b == nullptr)
+        return a == b;
+    if (a->type != b->type || a->ival != b->ival || a->fval != b->fval || a->opType != b->opType
+        || a->opChar != b->opChar || (a->name == nullptr) != (b->name == nullptr)
+        || (a->name != nullptr && strcmp(a->name, b->name) != 0)
+        || (a->exprList == nullptr) != (b->exprList == nullptr))
+        return false;
+    if (a->exprList != nullptr) {
+        if (a->exprList->size() != b->exprList->size())
+            return false;
+        for (size_t i = 0; i < a->exprList->size(); i++)
+            if (!same_tree(a->exprList->at(i), b->exprList->at(i)))
+                return false;
+    }
+    return same_tree(a->expr, b->expr) && same_tree(a->expr2, b->expr2);
+}
+
+static bool same_trees(const vector<Expr *> *a, const vector<Expr *> *b) {
+    if (a == nullptr || b == nullptr)
+        return a == b;
+    if (a->size() != b->size())
+        return false;
+    for (size_t i = 0; i < a->size(); i++)
+        if (!same_tree(a->at(i), b->at(i)))
+            return false;
+    return true;
+}
+
+// Whether a statement from the cache is the tree a fresh parse of sql gives (for SELECT and INSERT)
+static bool same_as_parsed(CachedStatement *statement, const string &sql) {
+    if (statement == nullptr || statement->get_result()->size() != 1)
+        return false;
+    SQLParserResult *parsed = SQLParser::parseSQLString(sql);
+    bool same = parsed->isValid() && parsed->size() == 1;
+    if (same) {
+        const SQLStatement *a = statement->get_result()->getStatement(0), *b = parsed->getStatement(0);
+        same = a->type() == b->type();
+        if (same && a->type() == kStmtSelect) {
+            const SelectStatement *select_a = (const SelectStatement *) a, *select_b = (const SelectStatement *) b;
+            same = same_trees(select_a->selectList, select_b->selectList)
+                   && same_tree(select_a->whereClause, select_b->whereClause)
+                   && (select_a->limit == nullptr) == (select_b->limit == nullptr)
+                   && (select_a->limit == nullptr || (select_a->limit->limit == select_b->limit->limit
+                                                      && select_a->limit->offset == select_b->limit->offset));
+        } else if (same && a->type() == kStmtInsert) {
+            const InsertStatement *insert_a = (const InsertStatement *) a, *insert_b = (const InsertStatement *) b;
+            same = strcmp(insert_a->tableName, insert_b->tableName) == 0
+                   && same_trees(insert_a->values, insert_b->values);
+        } else {
+            same = false;
+        }
+    }
+    delete parsed;
+    return same;
+}
+
+bool test_statement_cache() {
+    bool ok = true;
+
+    // literals come out in order, and only where a value can stand
+    string normalized;
+    SQLLiterals literals;
+    StatementCache::normalize("SELECT  a2 FROM t1\n WHERE a2 = -12 AND b = 'it''s' AND c = 1.5", normalized, literals);
+    ok = ok && normalized == "SELECT a2 FROM t1 WHERE a2 = ? AND b = ? AND c = ?" && literals.size() == 3
+         && literals[0].type == SQLLiteral::INT && literals[0].text == "-12"
+         && literals[1].type == SQLLiteral::STRING && literals[1].text == "it's"
+         && literals[2].type == SQLLiteral::FLOAT && literals[2].text == "1.5";
+
+    // a statement of the same shape gets the cached tree, bound to look just like a fresh parse
+    StatementCache cache;
+    string error;
+    const char *selects[] = {"SELECT a, b FROM t WHERE a = 1 AND b = 'one'",
+                             "SELECT a, b FROM t WHERE a = 2 AND b = 'two'",
+                             "select a,  b from t where a = 3 and b = 'three'",
+                             "SELECT a, b FROM t WHERE a = 4 AND b = 'four'"};
+    for (auto const &sql: selects)
+        ok = ok && same_as_parsed(cache.get(sql, error), sql);
+    ok = ok && cache.get_misses() == 2 && cache.get_hits() == 2;  // one miss per spelling of the keywords
+    ok = ok && same_as_parsed(cache.get("INSERT INTO t VALUES (5, 'five', 5.5)", error), "INSERT INTO t VALUES (5, 'five', 5.5)")
+         && same_as_parsed(cache.get("INSERT INTO t VALUES (6, 'six', 6.5)", error), "INSERT INTO t VALUES (6, 'six', 6.5)");
+
+    // binding takes exactly as many literals as there are placeholders
+    CachedStatement *statement = cache.get(selects[0], error);
+    try {
+        statement->bind(SQLLiterals(1, SQLLiteral(SQLLiteral::INT, "7")));
+        ok = false;
+    } catch (invalid_argument &e) {
+    }
+
+    // a LIMIT must be a number, so a statement with one is cached under its exact text
+    size_t misses = cache.get_misses();
+    statement = cache.get("SELECT a FROM t WHERE a = 1 LIMIT 5", error);
+    ok = ok && statement != nullptr && !statement->is_parameterized()
+         && same_as_parsed(statement, "SELECT a FROM t WHERE a = 1 LIMIT 5");
+    ok = ok && same_as_parsed(cache.get("SELECT a FROM t WHERE a = 2 LIMIT 10", error), "SELECT a FROM t WHERE a = 2 LIMIT 10")
+         && same_as_parsed(cache.get("SELECT a FROM t WHERE a = 1 LIMIT 5", error), "SELECT a FROM t WHERE a = 1 LIMIT 5")
+         && cache.get_misses() == misses + 2;
+    ok = ok && cache.get("SELECT FROM WHERE", error) == nullptr && !error.empty();
+
+    // the least recently used shape goes first
+    StatementCache small(2);
+    small.get("SELECT a FROM t WHERE a = 1", error);
+    small.get("SELECT b FROM t WHERE b = 1", error);
+    small.get("SELECT a FROM t WHERE a = 2", error);  // a hit, so b is now the oldest
+    small.get("SELECT c FROM t WHERE c = 1", error);  // evicts b
+    ok = ok && small.get_misses() == 3 && small.get_hits() == 1;
+    small.get("SELECT a FROM t WHERE a = 3", error);
+    ok = ok && small.get_hits() == 2;
+    small.get("SELECT b FROM t WHERE b = 2", error);
+    ok = ok && small.get_misses() == 4;
+
+    // PREPARE and EXECUTE
+    error.clear();
+    ok = ok && cache.prepared("PREPARE by_a AS SELECT a, b FROM t WHERE a = ? AND b = ?", statement, error)
+         && statement == nullptr && error.empty();
+    ok = ok && cache.prepared("EXECUTE by_a (8, 'eight')", statement, error) && error.empty()
+         && same_as_parsed(statement, "SELECT a, b FROM t WHERE a = 8 AND b = 'eight'");
+    ok = ok && cache.prepared("EXECUTE by_a (9)", statement, error) && statement == nullptr && !error.empty();
+    error.clear();
+    ok = ok && cache.prepared("EXECUTE by_b (9, 'nine')", statement, error) && statement == nullptr && !error.empty();
+    ok = ok && !cache.prepared("SELECT a FROM t", statement, error);
+    return ok;
+}
@@ -0,0 +1,137 @@
+/**
+ * @file statement_cache.h - Reuse of parse trees for repeated SQL statements.
+ * SQLLiteral
+ * CachedStatement
+ * StatementCache
+ *
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#pragma once
+
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "SQLParser.h"
+
+/**
+ * @class SQLLiteral - a literal lifted out of a SQL statement's text
+ */
+class SQLLiteral {
+public:
+    enum Type {
+        INT, FLOAT, STRING
+    };
+
+    SQLLiteral(Type type, std::string text) : type(type), text(text) {}
+
+    Type type;
+    std::string text;  // without quotes for STRING
+};
+
+typedef std::vector<SQLLiteral> SQLLiterals;
+
+/**
+ * @class CachedStatement - a parse tree with its literals replaced by placeholders
+ *
+ * bind() writes a set of literals into the placeholder nodes, after which the tree
+ * looks just as if the statement had been parsed with those literals in place.
+ */
+class CachedStatement {
+public:
+    CachedStatement(hsql::SQLParserResult *result, bool parameterized);
+
+    virtual ~CachedStatement();
+
+    CachedStatement(const CachedStatement &other) = delete;
+
+    CachedStatement &operator=(const CachedStatement &other) = delete;
+
+    /**
+     * Write literals into the placeholders, in the order they appear in the text.
+     * @throws std::invalid_argument  if there are not exactly as many literals as placeholders
+     */
+    virtual void bind(const SQLLiterals &literals);
+
+    virtual hsql::SQLParserResult *get_result() { return result; }
+
+    virtual size_t get_parameter_count() const { return placeholders.size(); }
+
+    virtual bool is_parameterized() const { return parameterized; }
+
+protected:
+    hsql::SQLParserResult *result;
+    bool parameterized;
+    std::vector<hsql::Expr *> placeholders;
+};
+
+/**
+ * @class StatementCache - parse each distinct statement shape only once
+ *
+ * Statements are keyed by their normalized text: literals become '?' and runs of
+ * whitespace collapse to one space, so "SELECT * FROM t WHERE a = 1" and
+ * "SELECT *  FROM t WHERE a = 2" share one parse tree. Statements
+ * whose parameterized form the parser rejects (e.g. a LIMIT needs a real number)
+ * are cached under their exact text instead.
+ *
+ * Also provides PREPARE/EXECUTE:
+ *     PREPARE <name> AS <statement with ? placeholders>
+ *     EXECUTE <name> [( <literal>, ... )]
+ */
+class StatementCache {
+public:
+    static const size_t DEFAULT_CAPACITY = 256;
+
+    StatementCache(size_t capacity = DEFAULT_CAPACITY) : capacity(capacity), hits(0), misses(0) {}
+
+    virtual ~StatementCache();
+
+    StatementCache(const StatementCache &other) = delete;
+
+    StatementCache &operator=(const StatementCache &other) = delete;
+
+    /**
+     * Get the parse tree for sql with its literals bound, parsing it only on a cache miss.
+     * @param sql  the statement text
+     * @returns    the bound statement (owned by the cache; valid until the next call),
+     *             or nullptr with error set if sql doesn't parse
+     */
+    virtual CachedStatement *get(const std::string &sql, std::string &error);
+
+    /**
+     * Handle a PREPARE or EXECUTE command.
+     * @param sql        the command text
+     * @param statement  set to the bound statement to run for EXECUTE, nullptr for PREPARE
+     * @param error      set if the command is malformed
+     * @returns          false if sql is neither PREPARE nor EXECUTE (and should go through get())
+     */
+    virtual bool prepared(const std::string &sql, CachedStatement *&statement, std::string &error);
+
+    virtual size_t get_hits() const { return hits; }
+
+    virtual size_t get_misses() const { return misses; }
+
+    /**
+     * Split literals out of a statement.
+     * @param sql         the statement text
+     * @param normalized  set to the text with each literal replaced by '?' and whitespace collapsed
+     * @param literals    set to the literals in order of appearance
+     */
+    static void normalize(const std::string &sql, std::string &normalized, SQLLiterals &literals);
+
+protected:
+    typedef std::list<std::pair<std::string, CachedStatement *>> Entries;
+
+    size_t capacity;
+    size_t hits;
+    size_t misses;
+    Entries entries;  // most recently used first
+    std::unordered_map<std::string, Entries::iterator> index;
+    std::unordered_map<std::string, CachedStatement *> prepared_statements;
+
+    virtual CachedStatement *lookup(const std::string &key);
+
+    virtual void remember(const std::string &key, CachedStatement *statement);
+};
+
+bool test_statement_cache();
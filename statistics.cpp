@@ -0,0 +1,203 @@
+/*
+  statistics.cpp
+
+  Table and column statistics.
+  The statistics file holds a single record: the table's numbers, then each column's,
+  all in native byte order.
+
+*/
+
+#include "statistics.h"
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include "hash.h"
+#include "transaction.h"
+
+
+// HyperLogLog
+
+HyperLogLog::HyperLogLog() : registers(1 << PRECISION, 0) {}
+
+// hash_bytes over the value's bytes, finished with the last round of MurmurHash3's finalizer:
+// the estimate relies on the register index and the run of zeros after it being uniform
+void HyperLogLog::add(const Value &value) {
+    const char *bytes = value.data_type == ColumnAttribute::INT ? (const char *) &value.n : value.s.data();
+    size_t size = value.data_type == ColumnAttribute::INT ? sizeof(value.n) : value.s.size();
+    u_int64_t hash = hash_bytes(bytes, size);
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+
+    u_int64_t rest = hash << PRECISION;
+    u_int8_t run = 1;
+    while (run <= 64 - PRECISION && !(rest & (1ULL << 63))) {
+        rest <<= 1;
+        run++;
+    }
+    u_int8_t &reg = registers[hash >> (64 - PRECISION)];
+    if (run > reg)
+        reg = run;
+}
+
+// The harmonic mean of the registers, or linear counting while many are still empty
+double HyperLogLog::estimate() const {
+    double m = (double) registers.size();
+    double sum = 0;
+    size_t empty = 0;
+    for (auto const &reg: registers) {
+        sum += std::ldexp(1.0, -reg);
+        if (reg == 0)
+            empty++;
+    }
+    double estimate = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+    if (estimate <= 2.5 * m && empty > 0)
+        estimate = m * std::log(m / empty);
+    return estimate;
+}
+
+
+// ColumnStatistics
+
+double ColumnStatistics::equal_selectivity(const Value &value) const {
+    if (distinct < 1)
+        return 0;
+    if (data_type != ColumnAttribute::INT || value.data_type != ColumnAttribute::INT || bounds.size() < 2)
+        return 1 / distinct;
+    if (value.n < min || value.n > max)
+        return 0;
+    size_t filled = 0;
+    for (size_t i = 0; i + 1 < bounds.size(); i++)
+        if (bounds[i] == value.n && bounds[i + 1] == value.n)
+            filled++;
+    return filled > 0 ? (double) filled / (bounds.size() - 1) : 1 / distinct;
+}
+
+
+// TableStatistics
+
+static std::string stats_filename(const Identifier &table_name) {
+    return table_name + ".stats.db";
+}
+
+// Like a dictionary, the file is written outside of any transaction
+void TableStatistics::save(const Identifier &table_name) const {
+    std::string dbfilename = stats_filename(table_name);
+    u_int32_t flags = DB_CREATE | DB_THREAD;
+    if (Transaction::enabled())
+        flags |= DB_AUTO_COMMIT;
+    Db db(_DB_ENV, 0);
+    db.set_message_stream(&std::cout);
+    db.set_error_stream(&std::cerr);
+    db.open(nullptr, dbfilename.c_str(), nullptr, DB_RECNO, flags, 0);
+    std::string bytes = marshal();
+    db_recno_t recno = 1;
+    Dbt key(&recno, sizeof(recno));
+    Dbt data((void *) bytes.data(), (u_int32_t) bytes.size());
+    int result = db.put(nullptr, &key, &data, 0);
+    db.close(0);
+    if (result != 0)
+        throw DbRelationError("failed to write statistics file " + dbfilename);
+}
+
+TableStatistics *TableStatistics::load(const Identifier &table_name) {
+    std::string dbfilename = stats_filename(table_name);
+    if (!env_file_exists(dbfilename))
+        return nullptr;
+    u_int32_t flags = DB_THREAD;
+    if (Transaction::enabled())
+        flags |= DB_AUTO_COMMIT;
+    Db db(_DB_ENV, 0);
+    db.set_message_stream(&std::cout);
+    db.set_error_stream(&std::cerr);
+    db.open(nullptr, dbfilename.c_str(), nullptr, DB_RECNO, flags, 0);
+    db_recno_t recno = 1;
+    Dbt key(&recno, sizeof(recno));
+    Dbt data;
+    data.set_flags(DB_DBT_MALLOC);
+    TableStatistics *statistics = nullptr;
+    if (db.get(nullptr, &key, &data, 0) == 0) {
+        statistics = new TableStatistics();
+        if (!statistics->unmarshal(std::string((const char *) data.get_data(), data.get_size()))) {
+            delete statistics;
+            statistics = nullptr;
+        }
+        free(data.get_data());
+    }
+    db.close(0);
+    return statistics;
+}
+
+// Delete the file, if there is one (in the current transaction, if there is one)
+void TableStatistics::drop(const Identifier &table_name) {
+    std::string dbfilename = stats_filename(table_name);
+    if (!env_file_exists(dbfilename))
+        return;
+    int result;
+    if (Transaction::enabled()) {
+        DbTxn *txn = Transaction::current();
+        result = _DB_ENV->dbremove(txn, dbfilename.c_str(), nullptr, txn == nullptr ? DB_AUTO_COMMIT : 0);
+    } else {
+        Db db(_DB_ENV, 0);
+        result = db.remove(dbfilename.c_str(), nullptr, 0);
+    }
+    if (result != 0)
+        throw DbRelationError("failed to delete statistics file " + dbfilename);
+}
+
+template<typename T>
+static void put(std::string &bytes, const T &value) {
+    bytes.append((const char *) &value, sizeof(T));
+}
+
+template<typename T>
+static bool get(const std::string &bytes, size_t &offset, T &value) {
+    if (offset + sizeof(T) > bytes.size())
+        return false;
+    memcpy(&value, bytes.data() + offset, sizeof(T));
+    offset += sizeof(T);
+    return true;
+}
+
+std::string TableStatistics::marshal() const {
+    std::string bytes;
+    put(bytes, rows);
+    put(bytes, blocks);
+    put(bytes, sampled_blocks);
+    put(bytes, (u_int32_t) columns.size());
+    for (auto const &column: columns) {
+        put(bytes, (u_int8_t) column.data_type);
+        put(bytes, column.distinct);
+        put(bytes, column.average_length);
+        put(bytes, column.min);
+        put(bytes, column.max);
+        put(bytes, (u_int32_t) column.bounds.size());
+        for (auto const &bound: column.bounds)
+            put(bytes, bound);
+    }
+    return bytes;
+}
+
+// Returns false if bytes are cut short
+bool TableStatistics::unmarshal(const std::string &bytes) {
+    size_t offset = 0;
+    u_int32_t n_columns;
+    if (!get(bytes, offset, rows) || !get(bytes, offset, blocks) || !get(bytes, offset, sampled_blocks)
+        || !get(bytes, offset, n_columns))
+        return false;
+    for (u_int32_t i = 0; i < n_columns; i++) {
+        ColumnStatistics column;
+        u_int8_t data_type;
+        u_int32_t n_bounds;
+        if (!get(bytes, offset, data_type) || !get(bytes, offset, column.distinct)
+            || !get(bytes, offset, column.average_length) || !get(bytes, offset, column.min)
+            || !get(bytes, offset, column.max) || !get(bytes, offset, n_bounds))
+            return false;
+        column.data_type = (ColumnAttribute::DataType) data_type;
+        column.bounds.resize(n_bounds);
+        for (auto &bound: column.bounds)
+            if (!get(bytes, offset, bound))
+                return false;
+        columns.push_back(column);
+    }
+    return true;
+}
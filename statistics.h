@@ -0,0 +1,106 @@
+/**
+ * @file statistics.h - What ANALYZE learns about a table's contents, for estimating how many rows a query reads.
+ * HyperLogLog
+ * ColumnStatistics
+ * TableStatistics
+ *
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#pragma once
+
+#include <string>
+#include <vector>
+#include "storage_engine.h"
+
+/**
+ * @class HyperLogLog - an estimate of the number of distinct values seen, in a fixed 4kB
+ *
+ * Each value's hash picks one of 2^PRECISION registers, which keeps the longest run of
+ * leading zeros seen among the rest of the hashes that picked it. The estimate is within
+ * about 1.6% of the true count (1.04 / sqrt(2^PRECISION)).
+ */
+class HyperLogLog {
+public:
+    static const uint PRECISION = 12;
+
+    HyperLogLog();
+
+    virtual ~HyperLogLog() {}
+
+    virtual void add(const Value &value);
+
+    virtual double estimate() const;
+
+protected:
+    std::vector<u_int8_t> registers;
+};
+
+/**
+ * @class ColumnStatistics - the estimated distribution of one column's values
+ *
+ * An INT column also gets its smallest and largest value and an equi-depth histogram: the
+ * bounds of BUCKETS ranges that each hold about as many of the rows sampled. A value that
+ * fills whole buckets on its own is a frequent one, and its share of the rows is taken
+ * from the histogram rather than from the number of distinct values.
+ */
+class ColumnStatistics {
+public:
+    static const uint BUCKETS = 32;
+
+    ColumnStatistics(ColumnAttribute::DataType data_type = ColumnAttribute::INT)
+            : data_type(data_type), distinct(0), average_length(0), min(0), max(0) {}
+
+    ColumnAttribute::DataType data_type;
+    double distinct;                // estimated number of distinct values
+    double average_length;          // TEXT only: average length in bytes
+    int32_t min;                    // INT only
+    int32_t max;                    // INT only
+    std::vector<int32_t> bounds;    // INT only: BUCKETS + 1 bounds (fewer for a tiny sample)
+
+    /**
+     * The estimated fraction of rows whose value is value.
+     */
+    virtual double equal_selectivity(const Value &value) const;
+};
+
+/**
+ * @class TableStatistics - row count and column statistics of a table, as of its last ANALYZE
+ *
+ * They are estimated from a sample of the table's blocks and kept in the table's own
+ * Berkeley DB RecNo file (<table>.stats.db), so they outlive the process that gathered
+ * them. Nothing keeps them up to date in between: they describe the table as it was.
+ */
+class TableStatistics {
+public:
+    static const u_int32_t DEFAULT_SAMPLE_BLOCKS = 256;  // what ANALYZE reads unless told otherwise
+
+    TableStatistics() : rows(0), blocks(0), sampled_blocks(0) {}
+
+    virtual ~TableStatistics() {}
+
+    double rows;                    // estimated number of rows
+    u_int32_t blocks;               // blocks in the table
+    u_int32_t sampled_blocks;       // blocks read to gather the statistics
+    std::vector<ColumnStatistics> columns;  // in column order
+
+    /**
+     * Write the statistics to the table's statistics file.
+     */
+    virtual void save(const Identifier &table_name) const;
+
+    /**
+     * The statistics in the table's statistics file.
+     * @returns  nullptr if the table has never been analyzed (freed by caller)
+     */
+    static TableStatistics *load(const Identifier &table_name);
+
+    /**
+     * Delete the table's statistics file, if there is one.
+     */
+    static void drop(const Identifier &table_name);
+
+protected:
+    virtual std::string marshal() const;
+
+    virtual bool unmarshal(const std::string &bytes);
+};
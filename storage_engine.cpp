@@ -0,0 +1,24 @@
+/*
+  storage_engine.cpp
+
+  Where the files of the database live. Berkeley DB opens its files relative to the
+  environment's home directory; the engine looks for them there too, and keeps the file it
+  writes itself (the transaction id file) next to them.
+
+*/
+
+#include "storage_engine.h"
+#include <sys/stat.h>
+
+
+std::string env_path(const std::string &filename) {
+    const char *home = nullptr;
+    if (_DB_ENV != nullptr && _DB_ENV->get_home(&home) == 0 && home != nullptr)
+        return std::string(home) + "/" + filename;
+    return filename;
+}
+
+bool env_file_exists(const std::string &filename) {
+    struct stat info;
+    return ::stat(env_path(filename).c_str(), &info) == 0;
+}
@@ -9,8 +9,12 @@
  */
 #pragma once
 
+#include <cstdint>
 #include <exception>
+#include <functional>
 #include <map>
+#include <memory>
+#include <string>
 #include <utility>
 #include <vector>
 #include "db_cxx.h"
@@ -20,11 +24,23 @@
  */
 extern DbEnv *_DB_ENV;
 
+/**
+ * Where a file of the database goes: filename in _DB_ENV's home directory, or filename
+ * itself if there is no environment (or it has no home).
+ */
+std::string env_path(const std::string &filename);
+
+/**
+ * Whether a file of the database is already on disk (see env_path).
+ */
+bool env_file_exists(const std::string &filename);
+
 /*
  * Convenient aliases for types
  */
 typedef u_int16_t RecordID;
 typedef u_int32_t BlockID;
+typedef u_int32_t TxnID;  // see mvcc.h
 typedef std::vector<RecordID> RecordIDs;
 typedef std::length_error DbBlockNoRoomError;
 
@@ -47,10 +63,15 @@ typedef std::length_error DbBlockNoRoomError;
 class DbBlock {
 public:
     /**
-     * our blocks are 4kB
+     * our blocks are 4kB, unless a table asks for bigger ones (see HeapFile::set_block_size)
      */
     static const uint BLOCK_SZ = 4096;
 
+    /**
+     * and never more than 64kB, so offsets within a block fit in 16 bits
+     */
+    static const uint MAX_BLOCK_SZ = 65536;
+
     /**
      * ctor/dtor (subclasses should handle the big-5)
      */
@@ -196,6 +217,9 @@ protected:
 
 /**
  * @class ColumnAttribute - holds datatype and other info for a column
+ *
+ * A TEXT column may be dictionary encoded: rows then store a small integer code
+ * per value instead of the value itself (see dictionary.h).
  */
 class ColumnAttribute {
 public:
@@ -203,7 +227,7 @@ public:
         INT, TEXT
     };
 
-    ColumnAttribute(DataType data_type) : data_type(data_type) {}
+    ColumnAttribute(DataType data_type, bool dictionary = false) : data_type(data_type), dictionary(dictionary) {}
 
     virtual ~ColumnAttribute() {}
 
@@ -211,8 +235,13 @@ public:
 
     virtual void set_data_type(DataType data_type) { this->data_type = data_type; }
 
+    virtual bool is_dictionary() { return dictionary; }
+
+    virtual void set_dictionary(bool dictionary) { this->dictionary = dictionary; }
+
 protected:
     DataType data_type;
+    bool dictionary;
 };
 
 
@@ -239,6 +268,47 @@ typedef std::vector<ColumnAttribute> ColumnAttributes;
 typedef std::pair<BlockID, RecordID> Handle;
 typedef std::vector<Handle> Handles;  // FIXME: will need to turn this into an iterator at some point
 typedef std::map<Identifier, Value> ValueDict;
+typedef std::vector<ValueDict *> ValueDicts;
+
+/**
+ * Callback for DbRelation::parallel_scan. May be called concurrently from several workers;
+ * worker is a dense index in [0, n_workers) so callers can keep per-worker state.
+ */
+typedef std::function<void(unsigned int worker, Handle handle, const ValueDict *row)> RowVisitor;
+
+/**
+ * @class BlockSample - the blocks a sampling scan reads (TABLESAMPLE SYSTEM)
+ *
+ * Each block is in the sample with probability fraction, decided independently by a hash
+ * of the seed and the block's id: the same seed picks the same blocks on every scan (and
+ * keeps picking them as the table grows), and the scan never has to list the blocks first.
+ */
+class BlockSample {
+public:
+    BlockSample(double fraction, u_int32_t seed) : fraction(fraction), seed(seed) {}
+
+    virtual ~BlockSample() {}
+
+    double fraction;
+    u_int32_t seed;
+
+    /**
+     * Whether the sample reads the block.
+     */
+    virtual bool contains(BlockID block_id) const {
+        if (fraction >= 1)
+            return true;
+        // splitmix64 finalizer over (seed, block_id), compared against fraction of 2^64
+        u_int64_t x = ((u_int64_t) seed << 32 | block_id) + 0x9e3779b97f4a7c15ULL;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        x ^= x >> 31;
+        return (double) (x >> 11) < fraction * (double) (1ULL << 53);
+    }
+};
+
+
+class TableStatistics;  // see statistics.h
 
 
 /**
@@ -266,8 +336,10 @@ public:
  *	del(handle)
  *	select()
  *	select(where)
+ *	select(where, limit, sample)
  *	project(handle)
  *	project(handle, column_names)
+ *	parallel_scan(where, n_workers, visit)
  */
 class DbRelation {
 public:
@@ -343,6 +415,35 @@ public:
      */
     virtual Handles *select(const ValueDict *where) = 0;
 
+    /**
+     * Conceptually, execute: SELECT <handle> FROM <table_name> WHERE <where> LIMIT <limit>
+     * This default finds every qualifying row and drops the ones past limit; storage
+     * engines that can stop scanning once they have found enough override it.
+     * @param where  where-clause predicates (or nullptr)
+     * @param limit  the most handles to return, from the start of the table
+     * @returns      a pointer to a list of handles for qualifying rows (freed by caller)
+     */
+    virtual Handles *select(const ValueDict *where, size_t limit) {
+        Handles *handles = where == nullptr ? select() : select(where);
+        if (handles->size() > limit)
+            handles->resize(limit);
+        return handles;
+    }
+
+    /**
+     * Conceptually, execute: SELECT <handle> FROM <table_name> TABLESAMPLE SYSTEM (<sample>)
+     *                        WHERE <where> LIMIT <limit>
+     * @param where   where-clause predicates (or nullptr)
+     * @param limit   the most handles to return, from the start of the table
+     * @param sample  the blocks to read (nullptr for all of them)
+     * @returns       a pointer to a list of handles for qualifying rows (freed by caller)
+     */
+    virtual Handles *select(const ValueDict *where, size_t limit, const BlockSample *sample) {
+        if (sample != nullptr)
+            throw DbRelationError("sampling not supported by this storage engine");
+        return select(where, limit);
+    }
+
     /**
      * Return a sequence of all values for handle (SELECT *).
      * @param handle  row to get values from
@@ -359,6 +460,96 @@ public:
      */
     virtual ValueDict *project(Handle handle, const ColumnNames *column_names) = 0;
 
+    /**
+     * Return the values given by column_names of many rows at once (SELECT <column_names>).
+     * This default projects one row at a time; storage engines that can share work
+     * between rows override it.
+     * @param handles       rows to get values from
+     * @param column_names  list of column names to project (all of them if nullptr or empty)
+     * @returns             one dictionary per handle, in the same order (freed by caller)
+     */
+    virtual ValueDicts *project(const Handles *handles, const ColumnNames *column_names) {
+        ValueDicts *rows = new ValueDicts;
+        try {
+            for (auto const &handle: *handles)
+                rows->push_back(project(handle, column_names));
+        } catch (...) {
+            for (auto row: *rows)
+                delete row;
+            delete rows;
+            throw;
+        }
+        return rows;
+    }
+
+    /**
+     * Visit every row matching where (all rows if where is null), possibly from several threads.
+     * This default visits serially on worker 0; storage engines that can do better override it.
+     * @param where         where-clause predicates (or nullptr)
+     * @param n_workers     how many worker threads the caller is prepared to handle
+     * @param visit         called once per qualifying row (row is freed after the call)
+     * @param column_names  the columns visit needs from each row (nullptr for all of them,
+     *                      empty for none)
+     * @param sample        the blocks to read (nullptr for all of them)
+     */
+    virtual void parallel_scan(const ValueDict *where, unsigned int n_workers, RowVisitor visit,
+                               const ColumnNames *column_names = nullptr, const BlockSample *sample = nullptr) {
+        Handles *handles = select(where, SIZE_MAX, sample);
+        for (auto const &handle: *handles) {
+            ValueDict *row = column_names != nullptr && column_names->empty() ? new ValueDict
+                                                                               : project(handle, column_names);
+            visit(0, handle, row);
+            delete row;
+        }
+        delete handles;
+    }
+
+    /**
+     * Bulk load a CSV file (one row per line, fields in column order) into the relation.
+     * @param file_path  the CSV file
+     * @param n_workers  parsing threads (0 for one per hardware thread)
+     * @returns          the number of rows loaded
+     */
+    virtual size_t import_csv(const std::string &file_path, unsigned int n_workers = 0) {
+        throw DbRelationError("bulk import not supported by this storage engine");
+    }
+
+    /**
+     * Remove record versions that no transaction can see anymore (see mvcc.h).
+     * @param horizon  versions replaced or deleted by transactions below this are dead
+     * @returns        the number of versions removed
+     */
+    virtual size_t collect_garbage(TxnID horizon) {
+        return 0;
+    }
+
+    /**
+     * Reclaim the space collect_garbage() has freed, e.g., by compacting blocks.
+     * @returns  the number of bytes reclaimed
+     */
+    virtual size_t vacuum() {
+        return 0;
+    }
+
+    /**
+     * Execute: ANALYZE <table_name>
+     * Estimate statistics about the relation's contents from a sample of it, and keep them.
+     * @param sample_blocks  the most blocks to read
+     * @returns              the new statistics
+     */
+    virtual std::shared_ptr<const TableStatistics> analyze(size_t sample_blocks) {
+        throw DbRelationError("statistics not supported by this storage engine");
+    }
+
+    /**
+     * The statistics the last analyze() kept, or nullptr if there are none.
+     */
+    virtual std::shared_ptr<const TableStatistics> get_statistics() {
+        return nullptr;
+    }
+
+    virtual Identifier get_table_name() const { return table_name; }
+
 protected:
     Identifier table_name;
     ColumnNames column_names;
@@ -0,0 +1,188 @@
+/*
+  transaction.cpp
+
+  Per-thread Berkeley DB transactions and group commit.
+  Commits are written with DB_TXN_NOSYNC so they only reach the in-memory log buffer;
+  GroupCommit then makes them durable with one DbEnv::log_flush() per batch instead of
+  one fsync per commit.
+
+*/
+
+#include "transaction.h"
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "mvcc.h"
+#include "storage_engine.h"
+
+// the calling thread's transaction, its snapshot and the undo actions registered against it
+struct ThreadTransaction {
+    DbTxn *txn;
+    TxnID id;  // 0 outside a transaction
+    ReadView *view;
+    std::vector<std::function<void()>> undo;
+};
+
+static thread_local ThreadTransaction thread_transaction = {nullptr, 0, nullptr, std::vector<std::function<void()>>()};
+
+// The transaction's id stops counting as running only once its outcome is final
+static void end_versions() {
+    delete thread_transaction.view;
+    thread_transaction.view = nullptr;
+    VersionManager::end(thread_transaction.id);
+    thread_transaction.id = 0;
+}
+
+
+// GroupCommit
+
+static std::mutex group_mutex;
+static std::condition_variable group_flushed;
+static unsigned int group_window = 0;
+static size_t group_requested = 0;  // commits handed to wait_durable(), numbered from 1
+static size_t group_durable = 0;    // commits known to be on disk
+static bool group_flushing = false;
+static size_t group_flushes = 0;
+
+void GroupCommit::set_window(unsigned int microseconds) {
+    std::lock_guard<std::mutex> guard(group_mutex);
+    group_window = microseconds;
+}
+
+unsigned int GroupCommit::get_window() {
+    std::lock_guard<std::mutex> guard(group_mutex);
+    return group_window;
+}
+
+size_t GroupCommit::get_commits() {
+    std::lock_guard<std::mutex> guard(group_mutex);
+    return group_requested;
+}
+
+size_t GroupCommit::get_flushes() {
+    std::lock_guard<std::mutex> guard(group_mutex);
+    return group_flushes;
+}
+
+void GroupCommit::wait_durable() {
+    std::unique_lock<std::mutex> lock(group_mutex);
+    size_t ticket = ++group_requested;
+    while (group_durable < ticket) {
+        if (group_flushing) {
+            group_flushed.wait(lock);
+            continue;
+        }
+
+        // lead the next flush
+        group_flushing = true;
+        unsigned int window = group_window;
+        lock.unlock();
+        if (window > 0)
+            std::this_thread::sleep_for(std::chrono::microseconds(window));
+        lock.lock();
+        size_t covered = group_requested;  // everyone with a ticket has already written their commit record
+        lock.unlock();
+        int result = 0;
+        try {
+            result = _DB_ENV->log_flush(nullptr);
+        } catch (DbException &e) {
+            result = -1;
+        }
+        lock.lock();
+        group_flushing = false;
+        group_flushes++;
+        if (result == 0)
+            group_durable = covered;
+        group_flushed.notify_all();
+        if (result != 0)
+            throw DbRelationError("failed to flush the write-ahead log");
+    }
+}
+
+
+// Transaction
+
+Transaction::Transaction() : owner(false), done(false) {
+    if (thread_transaction.id != 0)
+        return;
+    DbTxn *txn = nullptr;
+    if (enabled()) {
+        try {
+            _DB_ENV->txn_begin(nullptr, &txn, 0);
+        } catch (DbException &e) {
+            throw DbRelationError(std::string("cannot begin transaction: ") + e.what());
+        }
+    }
+    thread_transaction.txn = txn;
+    thread_transaction.undo.clear();
+    thread_transaction.id = VersionManager::begin();
+    thread_transaction.view = new ReadView(thread_transaction.id);
+    owner = true;
+}
+
+Transaction::~Transaction() {
+    if (owner && !done)
+        abort();
+}
+
+// Commit without syncing, then wait for a group flush to cover it
+void Transaction::commit() {
+    if (!owner || done)
+        return;
+    DbTxn *txn = thread_transaction.txn;
+    thread_transaction.txn = nullptr;
+    thread_transaction.undo.clear();
+    done = true;
+    if (txn == nullptr) {
+        end_versions();
+        return;
+    }
+    try {
+        txn->commit(DB_TXN_NOSYNC);  // frees txn even if it fails
+    } catch (DbException &e) {
+        end_versions();
+        throw DbRelationError(std::string("commit failed: ") + e.what());
+    }
+    end_versions();
+    GroupCommit::wait_durable();
+}
+
+// Roll back the writes, then the in-memory state that went with them
+void Transaction::abort() {
+    if (!owner || done)
+        return;
+    DbTxn *txn = thread_transaction.txn;
+    std::vector<std::function<void()>> undo;
+    undo.swap(thread_transaction.undo);
+    thread_transaction.txn = nullptr;
+    done = true;
+    try {
+        if (txn != nullptr)
+            txn->abort();
+    } catch (DbException &e) {
+        // the handle is gone either way; nothing more to do
+    }
+    end_versions();
+    for (auto action = undo.rbegin(); action != undo.rend(); action++)
+        (*action)();
+}
+
+DbTxn *Transaction::current() {
+    return thread_transaction.txn;
+}
+
+TxnID Transaction::id() {
+    return thread_transaction.id;
+}
+
+bool Transaction::enabled() {
+    u_int32_t flags = 0;
+    return _DB_ENV != nullptr && _DB_ENV->get_open_flags(&flags) == 0 && (flags & DB_INIT_TXN) != 0;
+}
+
+void Transaction::on_abort(std::function<void()> undo) {
+    if (thread_transaction.id != 0)
+        thread_transaction.undo.push_back(undo);
+}
@@ -0,0 +1,105 @@
+/**
+ * @file transaction.h - Transactions on the Berkeley DB environment, made durable by group commit.
+ * GroupCommit
+ * Transaction
+ *
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#pragma once
+
+#include <functional>
+#include "db_cxx.h"
+#include "storage_engine.h"
+
+/**
+ * Flags for opening a transactional environment: write-ahead log, locking, and
+ * recovery of whatever the log holds that didn't make it into the files.
+ * Handles are free-threaded, since one HeapFile may be used by many threads at once.
+ */
+const u_int32_t DB_ENV_TRANSACTIONAL = DB_CREATE | DB_INIT_MPOOL | DB_INIT_LOCK | DB_INIT_LOG | DB_INIT_TXN | DB_RECOVER
+                                       | DB_THREAD;
+
+/**
+ * @class GroupCommit - share one log flush among every transaction that commits near the same time
+ *
+ * Transactions commit without syncing the log and then call wait_durable(). The first
+ * caller becomes the leader: it waits out the commit window so more commits can pile up,
+ * flushes the log once, and wakes everyone whose commit that flush covered. Callers that
+ * arrive while a flush is under way queue up for the next one, so concurrent committers
+ * share flushes even with a window of zero.
+ */
+class GroupCommit {
+public:
+    /**
+     * How long a leader waits for company before flushing.
+     * @param microseconds  0 (the default) flushes as soon as the previous flush is done
+     */
+    static void set_window(unsigned int microseconds);
+
+    static unsigned int get_window();
+
+    /**
+     * Block until the log is on disk up to (at least) everything committed before the call.
+     */
+    static void wait_durable();
+
+    static size_t get_commits();
+
+    static size_t get_flushes();
+};
+
+/**
+ * @class Transaction - the calling thread's current Berkeley DB transaction
+ *
+ * Begins a transaction that the storage engine picks up (through current()) for every
+ * read and write on this thread until it is committed or aborted; destroying it
+ * without committing aborts it. A Transaction begun while the thread already has one
+ * just joins the outer one, whose commit or abort decides for both.
+ *
+ * Every transaction also gets an id() to stamp its record versions with and a snapshot
+ * (see mvcc.h) that all of its reads go through. When the environment was not opened
+ * with DB_INIT_TXN that is all it does: there is no log, so an abort can't undo writes.
+ */
+class Transaction {
+public:
+    Transaction();
+
+    virtual ~Transaction();
+
+    Transaction(const Transaction &other) = delete;
+
+    Transaction &operator=(const Transaction &other) = delete;
+
+    /**
+     * Commit, returning once the commit is durable.
+     * @throws DbRelationError  if Berkeley DB refuses the commit (the transaction is then aborted)
+     */
+    virtual void commit();
+
+    virtual void abort();
+
+    /**
+     * The calling thread's transaction, or nullptr if there is none.
+     */
+    static DbTxn *current();
+
+    /**
+     * The calling thread's transaction id, or 0 if there is no transaction.
+     */
+    static TxnID id();
+
+    /**
+     * Whether _DB_ENV supports transactions.
+     */
+    static bool enabled();
+
+    /**
+     * Register an action that puts in-memory state back if the current transaction aborts.
+     * Actions run newest first. Ignored when there is no current transaction.
+     */
+    static void on_abort(std::function<void()> undo);
+
+protected:
+    bool owner;  // false if this joined an outer transaction
+    bool done;
+};
@@ -0,0 +1,293 @@
+/*
+  where_program.cpp
+
+  WHERE conditions compiled against a table's record layout (see record_format.h).
+
+*/
+
+#include "where_program.h"
+#include "record_format.h"
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <random>
+#include "dictionary.h"
+
+typedef u_int16_t u16;
+
+
+// Turns the conditions into instructions, folding away the ones that can't hold
+void WhereProgram::compile(const ColumnAttributes &column_attributes, const std::vector<bool> &coded,
+                           const Conditions &conditions) {
+    instructions.clear();
+    rejects_all = false;
+    u_int32_t skip = 0;  // bytes of INT fields to jump before the next instruction
+    Conditions::const_iterator condition = conditions.begin();
+    for (size_t i = 0; i < column_attributes.size() && condition != conditions.end(); i++) {
+        ColumnAttribute::DataType data_type = ColumnAttribute(column_attributes[i]).get_data_type();
+        const Condition *first = nullptr;
+        for (; condition != conditions.end() && condition->column == i; condition++) {
+            const Value &value = condition->value;
+            if (value.data_type != data_type || (first != nullptr && (value.n != first->value.n || value.s != first->value.s))) {
+                instructions.clear();
+                rejects_all = true;
+                return;
+            }
+            if (first == nullptr)
+                first = &*condition;
+        }
+        if (first == nullptr && data_type == ColumnAttribute::INT) {
+            skip += RecordFormat::INT_SIZE;
+            continue;
+        }
+        if (skip > 0) {
+            Instruction jump = {SKIP, skip, 0, 0, ""};
+            instructions.push_back(jump);
+            skip = 0;
+        }
+        Instruction instruction = {SKIP_TEXT, 0, 0, ColumnDictionary::ESCAPE, ""};
+        if (data_type == ColumnAttribute::INT) {
+            instruction.op = INT_EQUAL;
+            instruction.n = first->value.n;
+        } else if (first == nullptr) {
+            instruction.op = coded[i] ? SKIP_CODED : SKIP_TEXT;
+        } else {
+            instruction.op = coded[i] ? CODED_EQUAL : TEXT_EQUAL;
+            instruction.code = first->code;
+            instruction.text = first->value.s;
+        }
+        instructions.push_back(instruction);
+    }
+}
+
+// Runs the instructions, stopping at the first condition the record fails
+bool WhereProgram::matches(const char *fields, OverflowFile &overflow) const {
+    if (rejects_all)
+        return false;
+    const char *field = fields;
+    for (auto const &instruction: instructions) {
+        switch (instruction.op) {
+            case SKIP:
+                field += instruction.size;
+                break;
+            case SKIP_TEXT:
+                RecordFormat::skip(field, ColumnAttribute::TEXT, false);
+                break;
+            case SKIP_CODED:
+                RecordFormat::skip(field, ColumnAttribute::TEXT, true);
+                break;
+            case INT_EQUAL:
+                if (RecordFormat::get_int(field) != instruction.n)
+                    return false;
+                break;
+            case TEXT_EQUAL:
+                if (!text_equal(field, instruction.text, overflow))
+                    return false;
+                break;
+            case CODED_EQUAL: {
+                u16 code = RecordFormat::get_code(field);
+                if (code != ColumnDictionary::ESCAPE) {
+                    if (code != instruction.code)
+                        return false;
+                } else if (!text_equal(field, instruction.text, overflow)) {
+                    return false;
+                }
+                break;
+            }
+        }
+    }
+    return true;
+}
+
+std::string WhereProgram::to_string() const {
+    if (rejects_all)
+        return "reject\n";
+    std::string text;
+    for (auto const &instruction: instructions) {
+        switch (instruction.op) {
+            case SKIP:
+                text += "skip " + std::to_string(instruction.size);
+                break;
+            case SKIP_TEXT:
+                text += "skip text";
+                break;
+            case SKIP_CODED:
+                text += "skip coded";
+                break;
+            case INT_EQUAL:
+                text += "int = " + std::to_string(instruction.n);
+                break;
+            case TEXT_EQUAL:
+                text += "text = \"" + instruction.text + "\"";
+                break;
+            case CODED_EQUAL:
+                text += "code = " + std::to_string(instruction.code) + " or text = \"" + instruction.text + "\"";
+                break;
+        }
+        text += "\n";
+    }
+    return text;
+}
+
+// Compares the TEXT field at field (in place, or in its overflow pages if its length matches)
+// and moves field past it
+bool WhereProgram::text_equal(const char *&field, const std::string &text, OverflowFile &overflow) {
+    u_int32_t length;
+    BlockID first;
+    const char *bytes = RecordFormat::get_text(field, length, first);
+    if (length != text.length())
+        return false;
+    return bytes != nullptr ? memcmp(bytes, text.data(), length) == 0 : overflow.read(first, length) == text;
+}
+
+
+// Test function -- returns true if all tests pass
+
+// The baseline: an expression tree walked for every row over the unmarshaled row, the way
+// a naive evaluator of the parser's Expr would do it
+class Node {
+public:
+    virtual ~Node() {}
+
+    virtual Value eval(const ValueDict &row) const = 0;
+};
+
+class ColumnNode : public Node {
+public:
+    ColumnNode(Identifier name) : name(name) {}
+
+    Value eval(const ValueDict &row) const { return row.at(name); }
+
+    Identifier name;
+};
+
+class LiteralNode : public Node {
+public:
+    LiteralNode(Value value) : value(value) {}
+
+    Value eval(const ValueDict &) const { return value; }
+
+    Value value;
+};
+
+class OperatorNode : public Node {
+public:
+    OperatorNode(std::string op, Node *left, Node *right) : op(op), left(left), right(right) {}
+
+    Value eval(const ValueDict &row) const {
+        Value a = left->eval(row);
+        if (op == "AND" && a.n == 0)
+            return Value(0);
+        Value b = right->eval(row);
+        if (op == "AND")
+            return Value(b.n != 0);
+        return Value(a.data_type == b.data_type && (a.data_type == ColumnAttribute::INT ? a.n == b.n : a.s == b.s));
+    }
+
+    std::string op;
+    std::unique_ptr<Node> left;
+    std::unique_ptr<Node> right;
+};
+
+static ValueDict unmarshal_fields(const std::string &record, const ColumnNames &column_names,
+                                  const ColumnAttributes &column_attributes, const std::vector<bool> &coded,
+                                  const std::vector<std::string> &codes) {
+    ValueDict row;
+    const char *field = record.data();
+    for (size_t i = 0; i < column_names.size(); i++) {
+        if (ColumnAttribute(column_attributes[i]).get_data_type() == ColumnAttribute::INT) {
+            row[column_names[i]] = Value(RecordFormat::get_int(field));
+            continue;
+        }
+        if (coded[i]) {
+            u16 code = RecordFormat::get_code(field);
+            if (code != ColumnDictionary::ESCAPE) {
+                row[column_names[i]] = Value(codes[code]);
+                continue;
+            }
+        }
+        u_int32_t length;
+        BlockID first;
+        const char *text = RecordFormat::get_text(field, length, first);
+        row[column_names[i]] = Value(std::string(text, length));
+    }
+    return row;
+}
+
+bool test_where_program() {
+    // a INT, b TEXT, c INT, d INT, e TEXT DICTIONARY (whose last value is escaped)
+    ColumnNames column_names = {"a", "b", "c", "d", "e"};
+    ColumnAttributes column_attributes = {ColumnAttribute(ColumnAttribute::INT), ColumnAttribute(ColumnAttribute::TEXT),
+                                          ColumnAttribute(ColumnAttribute::INT), ColumnAttribute(ColumnAttribute::INT),
+                                          ColumnAttribute(ColumnAttribute::TEXT)};
+    std::vector<bool> coded = {false, false, false, false, true};
+    std::vector<std::string> codes = {"red", "green", "blue"};
+    const int ROWS = 200000;
+    std::mt19937 random(5300);
+    std::vector<std::string> records;
+    for (int r = 0; r < ROWS; r++) {
+        int32_t a = random() % 100, c = random() % 10, d = r;
+        std::string b = "name " + std::to_string(random() % 1000);
+        u16 code = (u16) (random() % 4), size = (u16) b.length();
+        std::string record((const char *) &a, sizeof(a));
+        record.append((const char *) &size, sizeof(size)).append(b);
+        record.append((const char *) &c, sizeof(c)).append((const char *) &d, sizeof(d));
+        if (code == 3)
+            code = ColumnDictionary::ESCAPE;
+        record.append((const char *) &code, sizeof(code));
+        if (code == ColumnDictionary::ESCAPE) {
+            std::string e = "violet";
+            size = (u16) e.length();
+            record.append((const char *) &size, sizeof(size)).append(e);
+        }
+        records.push_back(record);
+    }
+    OverflowFile overflow("_test_where_cpp");  // never opened: no value here overflows
+
+    struct Case {
+        const char *where;
+        WhereProgram::Conditions conditions;
+    };
+    std::vector<Case> cases = {
+            {"a = 42", {{0, Value(42), 0}}},
+            {"c = 7 AND e = 'red'", {{2, Value(7), 0}, {4, Value("red"), 0}}},
+            {"b = 'name 17' AND e = 'blue'", {{1, Value("name 17"), 0}, {4, Value("blue"), 2}}},
+            {"e = 'violet'", {{4, Value("violet"), ColumnDictionary::ESCAPE}}},
+            {"a = 42 AND c = '7'", {{0, Value(42), 0}, {2, Value("7"), 0}}},
+            {"nothing", {}}};
+    bool ok = true;
+    for (auto const &test: cases) {
+        WhereProgram program;
+        program.compile(column_attributes, coded, test.conditions);
+        Node *tree = nullptr;
+        for (auto const &condition: test.conditions) {
+            Node *equal = new OperatorNode("=", new ColumnNode(column_names[condition.column]),
+                                           new LiteralNode(condition.value));
+            tree = tree == nullptr ? equal : new OperatorNode("AND", tree, equal);
+        }
+        if (tree == nullptr)
+            tree = new LiteralNode(Value(1));
+
+        auto start = std::chrono::steady_clock::now();
+        size_t compiled = 0;
+        for (auto const &record: records)
+            if (program.matches(record.data(), overflow))
+                compiled++;
+        double compiled_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        start = std::chrono::steady_clock::now();
+        size_t walked = 0;
+        for (auto const &record: records)
+            if (tree->eval(unmarshal_fields(record, column_names, column_attributes, coded, codes)).n != 0)
+                walked++;
+        double walked_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        delete tree;
+
+        std::cout << "where " << test.where << ": " << compiled << " rows, compiled "
+                  << (size_t) (ROWS / compiled_seconds) << " rows/s, tree-walking " << (size_t) (ROWS / walked_seconds)
+                  << " rows/s (" << walked_seconds / compiled_seconds << "x)" << std::endl;
+        if (compiled != walked || program.is_false() != (compiled == 0))
+            ok = false;
+    }
+    return ok;
+}
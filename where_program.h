@@ -0,0 +1,95 @@
+/**
+ * @file where_program.h - WHERE conditions compiled against a table's record layout.
+ * WhereProgram
+ *
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#pragma once
+
+#include <string>
+#include <vector>
+#include "overflow.h"
+#include "storage_engine.h"
+
+/**
+ * @class WhereProgram - a conjunction of column = value conditions, compiled once per statement
+ * into a flat list of instructions over a marshaled record's fields
+ *
+ * compile() resolves each condition's column to its place in the record and its type, so
+ * testing a record is one pass through a few instructions with no lookups by name and no
+ * per-field type checks: skip a field (a run of INT fields becomes a single jump) or
+ * compare it in place. Fields after the last condition's column are never looked at, and
+ * conditions that no row can meet (a value of the wrong type) fold into a program that
+ * rejects every record without reading it.
+ */
+class WhereProgram {
+public:
+    /**
+     * A column = value condition.
+     */
+    struct Condition {
+        size_t column;
+        Value value;
+        u_int16_t code;  // value's code, for a dictionary encoded column (ColumnDictionary::ESCAPE if it has none)
+    };
+    typedef std::vector<Condition> Conditions;
+
+    WhereProgram() : rejects_all(false) {}
+
+    virtual ~WhereProgram() {}
+
+    /**
+     * @param column_attributes  the table's columns, in record order
+     * @param coded              by column: whether it is dictionary encoded
+     * @param conditions         ordered by column
+     */
+    virtual void compile(const ColumnAttributes &column_attributes, const std::vector<bool> &coded,
+                         const Conditions &conditions);
+
+    /**
+     * Check whether a record's fields meet every condition.
+     * @param fields    the record's first field
+     * @param overflow  where TEXT values too long for the record are kept
+     */
+    virtual bool matches(const char *fields, OverflowFile &overflow) const;
+
+    /**
+     * Whether every record matches (there are no conditions).
+     */
+    virtual bool is_empty() const { return instructions.empty() && !rejects_all; }
+
+    /**
+     * Whether no record can match.
+     */
+    virtual bool is_false() const { return rejects_all; }
+
+    /**
+     * The instructions, one per line, for debugging.
+     */
+    virtual std::string to_string() const;
+
+protected:
+    enum OpCode {
+        SKIP,          // past size bytes
+        SKIP_TEXT,     // past a TEXT field
+        SKIP_CODED,    // past a dictionary code, and the TEXT field after it if the code is ESCAPE
+        INT_EQUAL,     // the INT field is n
+        TEXT_EQUAL,    // the TEXT field is text
+        CODED_EQUAL    // the code is code, or it is ESCAPE and the TEXT field after it is text
+    };
+
+    struct Instruction {
+        OpCode op;
+        u_int32_t size;
+        int32_t n;
+        u_int16_t code;
+        std::string text;
+    };
+
+    std::vector<Instruction> instructions;
+    bool rejects_all;
+
+    static bool text_equal(const char *&field, const std::string &text, OverflowFile &overflow);
+};
+
+bool test_where_program();
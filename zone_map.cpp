@@ -0,0 +1,68 @@
+/*
+  zone_map.cpp
+
+  Per-block ranges of INT column values.
+  An empty zone has its low above its high, so no value falls inside it.
+
+*/
+
+#include "zone_map.h"
+#include <algorithm>
+
+ZoneMap::ZoneMap(size_t n_columns) : n_columns(n_columns), built(false) {}
+
+void ZoneMap::widen(BlockID block_id, const std::vector<int32_t> &values) {
+    if (n_columns == 0 || block_id == 0)
+        return;
+    std::lock_guard<std::mutex> guard(mutex);
+    size_t begin = (size_t) (block_id - 1) * n_columns * 2;
+    if (bounds.size() < begin + n_columns * 2) {
+        bounds.reserve(std::max(begin + n_columns * 2, bounds.size() * 2));
+        while (bounds.size() < begin + n_columns * 2) {
+            bounds.push_back(INT_MAX);
+            bounds.push_back(INT_MIN);
+        }
+    }
+    for (size_t column = 0; column < n_columns && column < values.size(); column++) {
+        int32_t &low = bounds[begin + 2 * column];
+        int32_t &high = bounds[begin + 2 * column + 1];
+        low = std::min(low, values[column]);
+        high = std::max(high, values[column]);
+    }
+}
+
+void ZoneMap::reset(BlockID block_id) {
+    std::lock_guard<std::mutex> guard(mutex);
+    size_t begin = (size_t) (block_id - 1) * n_columns * 2;
+    for (size_t i = begin; i < begin + n_columns * 2 && i < bounds.size(); i += 2) {
+        bounds[i] = INT_MAX;
+        bounds[i + 1] = INT_MIN;
+    }
+}
+
+void ZoneMap::clear() {
+    std::lock_guard<std::mutex> guard(mutex);
+    bounds.clear();
+    built = false;
+}
+
+// A block the map has never heard of has held no rows, so it is pruned too.
+size_t ZoneMap::prune(BlockIDs &block_ids, const Ranges &ranges) {
+    if (ranges.empty())
+        return 0;
+    std::lock_guard<std::mutex> guard(mutex);
+    size_t before = block_ids.size();
+    block_ids.erase(std::remove_if(block_ids.begin(), block_ids.end(), [this, &ranges](BlockID block_id) {
+        size_t begin = (size_t) (block_id - 1) * n_columns * 2;
+        if (begin + n_columns * 2 > bounds.size())
+            return true;
+        for (auto const &range: ranges) {
+            int32_t low = bounds[begin + 2 * range.column];
+            int32_t high = bounds[begin + 2 * range.column + 1];
+            if (range.high < low || range.low > high)
+                return true;
+        }
+        return false;
+    }), block_ids.end());
+    return before - block_ids.size();
+}
@@ -0,0 +1,82 @@
+/**
+ * @file zone_map.h - Per-block ranges of INT column values, for skipping blocks in scans.
+ * ZoneMap
+ *
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#pragma once
+
+#include <atomic>
+#include <climits>
+#include <mutex>
+#include <vector>
+#include "storage_engine.h"
+
+/**
+ * @class ZoneMap - the smallest and largest value of each INT column in each block of a table
+ *
+ * A block's zone only ever widens as rows are written into it, so it always covers every
+ * value the block has held since it was last reset(). A scan for a value outside a block's
+ * zone can skip the block without reading it.
+ *
+ * The map doesn't know about record versions: the table decides which values a block's
+ * zone must cover (those of every version a snapshot may still reach from the block).
+ * It lives in memory only, next to the table's HeapFile: a table fills it in with one
+ * scan the first time a select needs it, and keeps it up to date from then on.
+ */
+class ZoneMap {
+public:
+    /**
+     * A condition on one column: low <= value <= high.
+     */
+    struct Range {
+        size_t column;
+        int32_t low;
+        int32_t high;
+    };
+    typedef std::vector<Range> Ranges;
+
+    /**
+     * @param n_columns  how many INT columns each zone covers
+     */
+    ZoneMap(size_t n_columns);
+
+    virtual ~ZoneMap() {}
+
+    ZoneMap(const ZoneMap &other) = delete;
+
+    ZoneMap &operator=(const ZoneMap &other) = delete;
+
+    /**
+     * Widen a block's zone to take in a row's values (one per INT column, in column order).
+     */
+    virtual void widen(BlockID block_id, const std::vector<int32_t> &values);
+
+    /**
+     * Empty a block's zone, once the block holds nothing anymore.
+     */
+    virtual void reset(BlockID block_id);
+
+    /**
+     * Empty every zone and mark the map as no longer filled in.
+     */
+    virtual void clear();
+
+    /**
+     * Remove the blocks whose zones rule out a row matching every range.
+     * @returns  the number of blocks removed
+     */
+    virtual size_t prune(BlockIDs &block_ids, const Ranges &ranges);
+
+    virtual bool is_built() const { return built; }
+
+    virtual void set_built() { built = true; }
+
+    virtual size_t get_n_columns() const { return n_columns; }
+
+protected:
+    size_t n_columns;
+    std::vector<int32_t> bounds;  // low, high of each column of block 1, then of block 2, ...
+    std::atomic<bool> built;      // read without the mutex by the table's double-checked build
+    std::mutex mutex;  // guards bounds
+};